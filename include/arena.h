@@ -0,0 +1,53 @@
+/*
+ * Description:
+ *   Provide support data structures to sub-projects, specifically a region
+ *   (arena) allocator. Allocations are carved out of large chunks by bumping a
+ *   pointer and are never freed one by one; instead the whole arena is reset
+ *   (keeping its chunks for reuse) or destroyed. An arena is not thread safe,
+ *   use thread_arena() to get an arena private to the calling thread.
+ *
+ *   List, ChunkList and Hash can be created inside an arena (new_list_in,
+ *   new_chunk_list_in, new_hash_in); destroying such a container does not free
+ *   anything the arena handed out, resetting the arena does.
+ *
+ * Arena* new_arena(size_t chunk_size)
+ * 	creates a new arena that allocates memory from the system chunk_size bytes
+ * 	at a time (ARENA_CHUNK_SIZE if 0 is given).
+ *
+ * void* arena_alloc(Arena* arena, size_t size)
+ * 	returns size bytes (aligned to ARENA_ALIGN) from the arena, or NULL if no
+ * 	memory is available. Requests larger than the chunk size get a chunk of
+ * 	their own.
+ *
+ * void* arena_alloc_aligned(Arena* arena, size_t size, size_t align)
+ * 	like arena_alloc, for a power of two alignment of up to ARENA_MAX_ALIGN.
+ *
+ * void reset_arena(Arena* arena)
+ * 	releases every allocation made from the arena at once. The chunks are kept
+ * 	and reused by the following allocations.
+ *
+ * int arena_chunks(Arena* arena)
+ * 	returns the number of chunks the arena has allocated from the system.
+ *
+ * void destroy_arena(Arena* arena)
+ * 	frees the arena and all memory allocated from it.
+ *
+ * Arena* thread_arena()
+ * 	returns an arena private to the calling thread, created on first use and
+ * 	destroyed when the thread exits.
+ */
+
+#define ARENA_CHUNK_SIZE  (64*1024)
+#define ARENA_ALIGN       16
+#define ARENA_MAX_ALIGN   64
+
+typedef struct Arena Arena;
+
+Arena* new_arena(size_t chunk_size);
+void* arena_alloc(Arena* arena, size_t size);
+void* arena_alloc_aligned(Arena* arena, size_t size, size_t align);
+void reset_arena(Arena* arena);
+int arena_chunks(Arena* arena);
+void destroy_arena(Arena* arena);
+
+Arena* thread_arena();
@@ -0,0 +1,60 @@
+/*
+ * Description:
+ *   Provide a ring of change records that lives inside a (shared memory)
+ *   region. A single producer appends records and never waits for readers: once
+ *   the ring is full the oldest records are overwritten. Readers keep their own
+ *   cursor (the sequence number of the next record they want), read without
+ *   taking any lock and are told how many records they missed when the producer
+ *   has lapped them. Like the point index, everything is addressed relative to
+ *   the ring, so it works at any mapping address.
+ *
+ * size_t change_ring_size(uint32_t capacity)
+ * 	returns the number of bytes needed for a ring of capacity records (capacity
+ * 	must be a power of two).
+ *
+ * void change_ring_init(ChangeRing* ring, uint32_t capacity)
+ * 	prepares the (zero filled) region for use. A ring that is already set up
+ * 	with the same capacity is left as is, so its sequence numbers continue.
+ * 	Only the producer should call this.
+ *
+ * void change_ring_append(ChangeRing* ring, int index, int op, float x, float y)
+ * 	appends a record stamped with the next sequence number and the current
+ * 	(CLOCK_REALTIME) time. Only the producer may call this.
+ *
+ * uint64_t change_ring_head(ChangeRing* ring)
+ * 	returns the sequence number the next appended record will get. A reader that
+ * 	starts its cursor here only sees changes made from now on.
+ *
+ * int change_ring_read(ChangeRing* ring, uint64_t* cursor, ChangeRecord* records, int max, uint64_t* missed)
+ * 	copies up to max records, starting at *cursor, into records and advances
+ * 	the cursor past them. The number of records copied is returned, and the
+ * 	number of records that were overwritten before they could be read is added
+ * 	to *missed.
+ */
+
+enum {CHANGE_INSTALL = 1, CHANGE_INVALIDATE, CHANGE_CLEAR};
+
+/* 32 bytes, copied as 4 words so that readers never see a half written word */
+typedef struct ChangeRecord {
+	uint64_t seq;
+	uint64_t timestamp_ns;
+	int32_t index;
+	int32_t op;
+	float x;
+	float y;
+} ChangeRecord;
+
+typedef struct ChangeRing {
+	/* zero until initialized, written last */
+	uint32_t capacity;
+	uint32_t unused;
+	/* sequence number of the next record, the records before it are published */
+	uint64_t head __attribute__((aligned(64)));
+	ChangeRecord records[] __attribute__((aligned(64)));
+} ChangeRing;
+
+size_t change_ring_size(uint32_t capacity);
+void change_ring_init(ChangeRing* ring, uint32_t capacity);
+void change_ring_append(ChangeRing* ring, int index, int op, float x, float y);
+uint64_t change_ring_head(ChangeRing* ring);
+int change_ring_read(ChangeRing* ring, uint64_t* cursor, ChangeRecord* records, int max, uint64_t* missed);
@@ -0,0 +1,58 @@
+/*
+ * Description:
+ *   Provide support data structures to sub-projects, specifically a
+ *   concurrent hash table with integer keys and pointer values. Readers
+ *   (get/iterate/search) never take a lock and finish in a bounded number of
+ *   steps, writers (insert/delete) serialize on one of a set of lock stripes
+ *   chosen by the key, so writers of different keys rarely contend. A NULL
+ *   value is used to mark a missing key, so NULL cannot be stored.
+ *
+ *   The map does not own the values: a value removed (or overwritten) while
+ *   another thread may still be reading it must not be freed by the caller
+ *   unless it knows that no readers remain.
+ *
+ * CMap* new_cmap(int size)
+ * 	allocates a new (empty) concurrent hash table. The given size is only a
+ * 	hint for the number of entries expected, the table will grow as needed.
+ *
+ * void* get_cmap_item(CMap* map, int key)
+ * 	returns the value stored for the key, or NULL if the key is not in the map.
+ *
+ * bool insert_cmap_item(CMap* map, int key, void* value)
+ * 	inserts (or overwrites) the key with the given (non-NULL) value. Returns
+ * 	false if the value could not be stored.
+ *
+ * bool delete_cmap_item(CMap* map, int key)
+ * 	attempts to delete the key/value pair from the given map. An indication of
+ * 	success is returned as a boolean.
+ *
+ * int cmap_count(CMap* map)
+ * 	returns the number of key/value pairs currently stored in the map.
+ *
+ * void iterate_cmap(CMap *map, void (*processor)(void *))
+ * 	invokes the given function with each value in the map. Entries inserted or
+ * 	deleted during the iteration may or may not be visited.
+ *
+ * void* search_cmap(CMap *map, bool (*match)(void *value, void *arg), void *arg)
+ * 	returns the first value for which match(value, arg) returns true, or NULL
+ * 	if there is no such value.
+ *
+ * void destroy_cmap(CMap* map)
+ * 	frees the map, no other thread may be using it. This does not attempt to
+ * 	free the values contained within the map.
+ */
+
+
+typedef struct CMap CMap;
+
+CMap* new_cmap(int size);
+
+void* get_cmap_item(CMap* map, int key);
+bool insert_cmap_item(CMap* map, int key, void* value);
+bool delete_cmap_item(CMap* map, int key);
+int cmap_count(CMap* map);
+
+void iterate_cmap(CMap *map, void (*processor)(void *));
+void* search_cmap(CMap *map, bool (*match)(void *value, void *arg), void *arg);
+
+void destroy_cmap(CMap* map);
@@ -2,15 +2,25 @@
  * Description:
  *   Provide support data structures to sub-projects, specifically
  *   a simple hash table implementation. This supports only integer keys but
- *   any type/size value.
+ *   any type/size value. The table is the int -> HashNode instantiation of the
+ *   generic map from map_gen.h (Robin Hood probing, entries stored inline), so
+ *   it grows and shrinks as needed. Prefer a typed MAP_DEFINE for new code.
  *
  * Hash* new_hash(int size)
- * 	allocates a new hash table up to the given number of nodes (size)
+ * 	allocates a new hash table, the size is a hint of the number of nodes
+ * 	expected.
+ *
+ * Hash* new_hash_in(int size, Arena* arena)
+ * 	like new_hash, but the Hash object is allocated from the given arena (see
+ * 	arena.h). The nodes live in a table that is allocated once for the size
+ * 	hint (and again only if it has to grow); destroy_hash must still be called
+ * 	to release the table, but never frees the Hash object itself.
  *
  * HashNode *get_hash_item(Hash* hash, int key)
  * 	given a hash and potential key, this function returns a HashNode object
  * 	that contains the key and value. If this key is not in the hash then NULL
- * 	is returned.
+ * 	is returned. The returned node is only valid until the next insert or
+ * 	delete on the hash.
  *
  * void insert_hash_item(Hash* hash, int key, void* value, int size)
  * 	inserts a new HashNode object with the given key and value into the given hash.
@@ -19,10 +29,13 @@
  * 	attempts to delete the key/value pair from the given hash. An indication of
  * 	success is returned as a boolean.
  *
+ * int hash_count(Hash* hash)
+ * 	returns the number of key/value pairs currently stored in the hash.
+ *
  * void iterate_hash(Hash *hash, void (*processor)(void *))
  * 	iterates across the given hash and invokes the given function. This function
  * 	is expected to only take one argument of a type void* which should be cast
- * 	to the value stored in the HashNode->value.
+ * 	to the HashNode. The processor must not insert or delete items.
  *
  * void show_hash(void* hash_node)
  * 	dump a representation of the given hash node to the log
@@ -33,22 +46,29 @@
  */
 
 
+#include "map_gen.h"
+
 typedef struct HashNode {
 	int key;
 	int size;
 	void* value;
 } HashNode;
 
+MAP_DEFINE(HashNodeMap, int, HashNode, map_hash_int, map_eq_int)
+
 typedef struct Hash {
-	int size;
-	HashNode* hash_array[];
+	HashNodeMap map;
+	/* NULL unless the hash was created with new_hash_in() */
+	struct Arena *arena;
 } Hash;
 
 Hash* new_hash(int size);
+Hash* new_hash_in(int size, struct Arena* arena);
 
 HashNode *get_hash_item(Hash* hash, int key) ;
 void insert_hash_item(Hash* hash, int key, void* value, int size);
 bool delete_hash_item(Hash* hash, int key);
+int hash_count(Hash* hash);
 
 void iterate_hash(Hash *hash, void (*processor)(void *));
 void show_hash(void* hash_node);
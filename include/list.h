@@ -1,14 +1,27 @@
 /*
  * Description:
  *   Provide support data structures to sub-projects, specifically a
- *   linked-list implementation.
+ *   linked-list implementation and two variants of it:
+ *
+ *   - ChunkList: an unrolled list that copies fixed size values inline into
+ *     cache line aligned blocks, so a push only allocates once per block and
+ *     iteration walks mostly contiguous memory.
+ *   - DList: an intrusive doubly-linked list. The caller embeds a DListLink in
+ *     its own struct, the list never allocates and any linked item can be
+ *     unlinked in O(1) given its link (use DLIST_ITEM to get back to the item).
  *
  * List* new_list()
  * 	create a new list object and return a reference to it. The stored values
  * 	are of any type/size.
  *
+ * List* new_list_in(Arena* arena)
+ * 	like new_list, but the list and its nodes are allocated from the given
+ * 	arena (see arena.h). Removing items or destroying the list frees nothing,
+ * 	the memory is returned when the arena is reset.
+ *
  * void push_list_item(List* list, void *value, size_t value_size)
  * 	add a new node with the given value (of size value_size) to the given list.
+ * 	The node stores the value pointer, the value itself is not copied.
  *
  * bool remove_list_item(List* list, void* value)
  * 	attempts to remove the given value from the linked list. An indication of
@@ -22,6 +35,41 @@
  * void destroy_list(List* list)
  * 	attempt to free the list object and surrounding objects. This does not attempt
  * 	to free the ListNode values contained within the list.
+ *
+ * ChunkList* new_chunk_list(unsigned int value_size)
+ * 	create a new (empty) unrolled list for values of value_size bytes.
+ *
+ * ChunkList* new_chunk_list_in(unsigned int value_size, Arena* arena)
+ * 	like new_chunk_list, but the list and its blocks are allocated from the
+ * 	given arena. Destroying the list frees nothing, the arena owns the memory.
+ *
+ * void* push_chunk_list_item(ChunkList* list, void *value)
+ * 	copies the value to the end of the list and returns the address of the copy.
+ * 	Copies never move, the address is valid until the list is cleared. NULL is
+ * 	returned if no memory is available.
+ *
+ * void iterate_chunk_list(ChunkList *list, void (*processor)(void *))
+ * 	invokes the given function with the address of each value in the list, in
+ * 	the order they were pushed.
+ *
+ * void clear_chunk_list(ChunkList* list)
+ * 	removes all values from the list (the blocks are kept for reuse).
+ *
+ * void destroy_chunk_list(ChunkList* list)
+ * 	frees the list and all of the values copied into it.
+ *
+ * void init_dlist(DList* list)
+ * 	prepares the (caller allocated) list for use.
+ *
+ * void push_dlist_item(DList* list, DListLink* link)
+ * 	appends the given (unlinked) link to the end of the list.
+ *
+ * void unlink_dlist_item(DList* list, DListLink* link)
+ * 	removes the given link from the list in constant time.
+ *
+ * void iterate_dlist(DList *list, void (*processor)(DListLink *))
+ * 	invokes the given function with each link in the list. The processor may
+ * 	unlink the link it is given.
  */
 
 
@@ -32,13 +80,60 @@ typedef struct ListNode {
 
 typedef struct List {
 	int size;
+	/* NULL unless the list was created with new_list_in() */
+	struct Arena *arena;
 	ListNode *head;
 	ListNode *tail;
 } List;
 
+typedef struct ChunkBlock {
+	struct ChunkBlock *next;
+	unsigned int count;
+	/* pads the header to 16 bytes so values keep their natural alignment */
+	unsigned int unused;
+	char values[];
+} ChunkBlock;
+
+typedef struct ChunkList {
+	int size;
+	unsigned int value_size;
+	unsigned int per_block;
+	struct Arena *arena;
+	ChunkBlock *head;
+	ChunkBlock *tail;
+} ChunkList;
+
+typedef struct DListLink {
+	struct DListLink *prev;
+	struct DListLink *next;
+} DListLink;
+
+/* the list head is a sentinel link, an empty list points at itself */
+typedef struct DList {
+	int size;
+	DListLink head;
+} DList;
+
+/* given a link, return the struct of the given type it is embedded in as member */
+#define DLIST_ITEM(link, type, member) \
+	((type *) ((char *) (link) - __builtin_offsetof(type, member)))
+
 
 List* new_list();
+List* new_list_in(struct Arena* arena);
 void push_list_item(List* list, void *value, unsigned int value_size);
 bool remove_list_item(List* list, void* value);
 void iterate_list(List *list, void (*processor)(void *));
 void destroy_list(List* list);
+
+ChunkList* new_chunk_list(unsigned int value_size);
+ChunkList* new_chunk_list_in(unsigned int value_size, struct Arena* arena);
+void* push_chunk_list_item(ChunkList* list, void *value);
+void iterate_chunk_list(ChunkList *list, void (*processor)(void *));
+void clear_chunk_list(ChunkList* list);
+void destroy_chunk_list(ChunkList* list);
+
+void init_dlist(DList* list);
+void push_dlist_item(DList* list, DListLink* link);
+void unlink_dlist_item(DList* list, DListLink* link);
+void iterate_dlist(DList *list, void (*processor)(DListLink *));
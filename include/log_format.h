@@ -0,0 +1,127 @@
+/*
+* Description:
+*   Provide the layout of the binary log records written by log_mgr when
+*   use_binary_log(true) is in effect, and the functions that turn them back
+*   into the text lines log_event would have written (used by the log writer
+*   thread to print records and by the log_decode tool).
+*
+*  A binary log is a sequence of records, each starting with a LogRecord
+*  header. A LOG_RECORD_FORMAT record defines a format string (its bytes,
+*  NUL terminated, follow the header) and the id the events use to refer to
+*  it. The id is a hash of the format string, so the same format gets the same
+*  id in every process logging to the file. A process defines each format
+*  before its first event using it (and again after switching files). A
+*  LOG_RECORD_EVENT record holds the time, the level, the format id and the
+*  raw arguments in the order of the conversions of the format:
+*
+*   - an int (or a '*' width or precision, or a char) as 4 bytes
+*   - a long, long long, size_t, intmax_t, ptrdiff_t or a pointer as 8 bytes
+*   - a double as 8 bytes, a long double as 16 bytes
+*   - a string as a 4 byte length followed by its bytes (no NUL), a length of
+*     LOG_NULL_STRING stands for a NULL pointer. A string with a precision
+*     (%.10s, %.*s) is cut to it, it need not be NUL terminated after that
+*
+*  Every record starts with the LOG_BINARY_MARK byte, which no text line of
+*  the log starts with, so text lines and binary records can be told apart in
+*  a file written by processes in different modes.
+*
+*   - int log_format_spec (const char *spec, LogFormatSpec *parsed)
+*    spec : points at the '%' of a conversion in a format string
+*
+*  Parses the conversion and returns its length (up to and including the
+*  conversion character), with the type of its argument, the number of '*'
+*  ints it takes before it and its precision (LOG_NO_PRECISION if it has
+*  none, LOG_STAR_PRECISION if it is the last '*' int) in parsed. Returns 0 if the conversion is not
+*  supported in binary records (%n, or a malformed one).
+*
+*
+*   - int log_render_line (const LogRecord *record, const char *fmt, char *line, size_t size)
+*
+*  Writes the text line (time prefix, level, message and newline) of the
+*  event record, formatted with fmt, into line (at most size bytes, NUL
+*  terminated). Returns the length of the full line, like snprintf, or -1 if
+*  the arguments in the record do not match the format.
+*
+*
+*   - bool log_reserve (char **buffer, size_t *size, size_t needed)
+*
+*  Makes sure the buffer of *size bytes, allocated with malloc (NULL and 0 to
+*  start with), holds at least needed bytes, growing it with realloc if not.
+*  Returns false, leaving the buffer as it was, if it could not be grown.
+*
+*
+*   - int log_render_grow (const LogRecord *record, const char *fmt, char **line, size_t *size)
+*
+*  Same as log_render_line, into a buffer grown with log_reserve whenever the
+*  line does not fit, so the whole line always ends up in *line. Returns the
+*  length of the line, -1 if the arguments in the record do not match the
+*  format, or LOG_RENDER_NO_MEMORY if the buffer could not be grown.
+*
+*
+*   - int log_format_int (char *out, int64_t value)
+*   - int log_format_uint (char *out, uint64_t value)
+*
+*  Write the decimal digits of the value, as %d (or %u) would, to out (which
+*  has room for LOG_INT_SIZE bytes, no NUL is written) and return their number.
+*
+*
+*   - int log_format_fixed (char *out, size_t size, double value, int width, int precision)
+*
+*  Writes the value as "%<width>.<precision>f" would (with the rounding of
+*  glibc: the exact value of the double, ties to even) into out (at most size
+*  bytes, NUL terminated) and returns the length of the full text, like
+*  snprintf. The digits are worked out with integer arithmetic instead of the
+*  general conversion of printf, for a precision of up to 9, a width of 0 to
+*  32 and a magnitude below 2^53 (anything else, a negative width to left
+*  justify, infinities and NaN included, is left to snprintf).
+*/
+
+#define LOG_BINARY_MARK      0xB1
+#define LOG_NULL_STRING      0xFFFFFFFFu
+/* the most arguments (counting '*' ones) a format may take in a binary record */
+#define LOG_MAX_ARGS         32
+/* the precision of a LogFormatSpec without one, or taken from a '*' int */
+#define LOG_NO_PRECISION     -1
+#define LOG_STAR_PRECISION   -2
+/* the most digits (and sign) log_format_int writes */
+#define LOG_INT_SIZE         20
+/* room for the text of log_format_fixed when it works it out itself */
+#define LOG_FIXED_SIZE       64
+/* what log_render_grow returns when the line cannot be made room for */
+#define LOG_RENDER_NO_MEMORY -2
+
+enum {LOG_RECORD_FORMAT = 1, LOG_RECORD_EVENT = 2};
+/* the type of the argument of a conversion, by its length modifier */
+enum {LOG_ARG_NONE, LOG_ARG_INT, LOG_ARG_LONG, LOG_ARG_LONG_LONG, LOG_ARG_SIZE, LOG_ARG_INTMAX, LOG_ARG_PTRDIFF,
+      LOG_ARG_DOUBLE, LOG_ARG_LONG_DOUBLE, LOG_ARG_STRING, LOG_ARG_POINTER};
+
+/* 24 bytes, followed by the format string or the arguments */
+typedef struct LogRecord {
+	uint8_t mark;
+	uint8_t type;
+	uint8_t level;
+	uint8_t unused;
+	/* bytes in the whole record, this header included */
+	uint32_t length;
+	uint32_t format_id;
+	uint32_t unused2;
+	/* CLOCK_REALTIME of the event, 0 for a format */
+	uint64_t timestamp_ns;
+} LogRecord;
+
+typedef struct LogFormatSpec {
+	int type;
+	int stars;
+	int precision;
+} LogFormatSpec;
+
+/* the names of the Levels of log_mgr.h */
+extern const char *LOG_LEVEL_STRING[];
+
+int log_format_spec (const char *spec, LogFormatSpec *parsed);
+int log_render_line (const LogRecord *record, const char *fmt, char *line, size_t size);
+bool log_reserve (char **buffer, size_t *size, size_t needed);
+int log_render_grow (const LogRecord *record, const char *fmt, char **line, size_t *size);
+int log_format_int (char *out, int64_t value);
+int log_format_uint (char *out, uint64_t value);
+int log_format_fixed (char *out, size_t size, double value, int width, int precision);
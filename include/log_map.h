@@ -0,0 +1,48 @@
+/*
+* Description:
+*   Provide the memory-mapped log file behind map_logfile (see log_mgr.h).
+*
+*  The file is mapped whole (up to its rotation size) and grown in chunks of
+*  LOG_MAP_CHUNK bytes with fallocate, a chunk ahead of the lines. A line
+*  reserves its bytes by moving the offset of the file with an atomic add and
+*  is then copied in with memcpy, so threads append concurrently without a
+*  lock or a system call (bar one fallocate per chunk). The line that would
+*  run past the rotation size moves the file to <name>.1 (the older ones to
+*  <name>.2 and so on, the oldest kept being <name>.<keep>) and maps a new
+*  file. The old file is cut to its length and unmapped once the lines still
+*  being copied into it are in, and fsynced by a thread of its own. If the new
+*  file cannot be mapped, the lines are appended to the old one with write
+*  (past the rotation size) and the rotation is tried again every second.
+*
+*   - int log_map_open (const char *logfile_name, uint64_t file_size, unsigned int keep, LogMapPreamble preamble)
+*    file_size : the size a file is rotated at
+*    keep : how many rotated files to keep (0 removes the file instead)
+*    preamble : if not NULL, writes what every new file starts with (at most
+*           room bytes at at) and returns its length
+*
+*  Maps the file (closing the one mapped before, if any), appending to what
+*  it holds already. Returns LOG_OK, or LOG_ERROR if the file cannot be
+*  opened or mapped.
+*
+*
+*   - int log_map_write (const struct iovec *iov, int count)
+*
+*  Appends the bytes of the vector as one piece, rotating the file when it is
+*  full. Returns LOG_ERROR if no file is mapped, if the piece is larger than a
+*  whole file or if the file cannot grow (the disk is full).
+*
+*
+*   - void log_map_close (void)
+*
+*  Waits for the lines being copied, cuts the file to its length and unmaps
+*  it. Lines appended from then on are refused.
+*/
+
+/* how much the file grows at a time, ahead of the lines */
+#define LOG_MAP_CHUNK        (1024*1024)
+
+typedef size_t (*LogMapPreamble)(char *at, size_t room);
+
+int log_map_open (const char *logfile_name, uint64_t file_size, unsigned int keep, LogMapPreamble preamble);
+int log_map_write (const struct iovec *iov, int count);
+void log_map_close (void);
@@ -14,6 +14,11 @@
 *  the log library, no logStrs should be lost upon successful execution
 *  of the log_event( ) function.
 *
+*  The line is formatted in a buffer of the calling thread, with the time
+*  of day only worked out once a second, so log_event does not allocate
+*  (unless a line is longer than 2 KB). It must not be called from a signal
+*  handler that may interrupt a log_event of the same thread.
+*
 *  The date & time field shall contain, at a minimum, the month (Jan-Dec),
 *  the day of the month, and the time in HH:MM:SS (hours, minutes and seconds).
 *  Day of the week, the year, and the timezone is optional.
@@ -21,6 +26,61 @@
 *  The function log_event( ) should return OK (0) upon successful return
 *  and ERROR (-1) otherwise.
 *
+*  log_event is a macro: a line below the level set for the module of the
+*  caller (see set_log_level), and below the level of the flight recorder if
+*  it is on, is skipped with a single load, before any of the arguments are
+*  evaluated, and counts as logged. The module is the LOG_MODULE defined
+*  before this file is included (LOG_MAIN by default), the macro passes it to
+*  log_module_event.
+*  Lines below LOG_MIN_LEVEL (DEBUG by default, build with, say,
+*  -DLOG_MIN_LEVEL=WARNING for a near-silent build) are compiled out.
+*
+*
+*   - int log_module_event (LogModule module, Levels l, const char *fmt, ...)
+*
+*  The log_event of the given module, which is what the log_event macro
+*  calls.
+*
+*
+*   - void log_line_start (LogLine *line)
+*   - void log_append_string (LogLine *line, const char *string)
+*   - void log_append_int (LogLine *line, int64_t value)
+*   - void log_append_uint (LogLine *line, uint64_t value)
+*   - void log_append_fixed (LogLine *line, double value, int width, int precision)
+*   - int log_line (Levels l, LogLine *line)
+*
+*  Build the message of a line piece by piece and log it, for the lines logged
+*  in bulk (one per point, say). A value is appended as %s, %d, %u or
+*  "%<width>.<precision>f" would write it, byte for byte (see log_format.h),
+*  but without going through vsnprintf, which is several times slower for
+*  floating point values. What does not fit in the LOG_LINE_SIZE bytes of the
+*  line is cut. log_line is a macro like log_event (it calls log_module_line
+*  with the module; check log_enabled before building the line), and the line
+*  is logged as log_event(l, "%s", text) would log it, only copied instead of
+*  formatted.
+*
+*
+*   - bool log_enabled (Levels l)
+*
+*  True if a line of the level would be logged by the module of the caller
+*  (to the log file or the flight recorder), for work that is only done to
+*  log something.
+*
+*
+*   - void set_log_level (LogModule module, Levels l)
+*
+*  Sets the least level of the lines logged by the module (by every module
+*  for LOG_MODULES). INFO is the default for every module.
+*
+*
+*   - int set_log_levels (const char *spec)
+*
+*  Sets the levels from a list such as "WARNING,libshm=DEBUG,store=INFO": a
+*  level alone applies to every module, module=level to one of main, libshm,
+*  thdlib and store (in any case). Returns LOG_ERROR, having set nothing, if
+*  the list does not parse. The list in the LOG_LEVEL environment variable is
+*  applied when the program starts.
+*
 *
 *   - int set_logfile (const char *logfile_name)
 *    logfile_name : name of the new log file. If not an absolute pathname,
@@ -41,6 +101,19 @@
 *  successfully; ERROR (-1) otherwise.
 *
 *
+*   - int map_logfile (const char *logfile_name, unsigned int file_kb, unsigned int keep)
+*    file_kb : the size the file is rotated at (0 for the default of 16 MB)
+*    keep : how many rotated files are kept (logfile_name.1 being the newest)
+*
+*  Like set_logfile, but the file is mapped into memory and grown ahead of
+*  the lines (see log_map.h): a line is appended with a memcpy rather than a
+*  write(), and the disk space taken stays below (keep + 1) * file_kb. Once
+*  the file is full it is moved to logfile_name.1 and a new one is started,
+*  the old one is fsynced in the background. After a crash the end of the
+*  file may be padded with NUL bytes (which log_decode skips). A line longer
+*  than a whole file is not logged.
+*
+*
 *   - void close_logfile (void)
 *
 *  This function shall be called whenever a logfile is to be closed.
@@ -52,6 +125,92 @@
 *
 *  Enables/disabled printing log entires to stdout (in addition to writing to
 *  the log).
+*
+*
+*   - void use_binary_log (bool)
+*
+*  Enables/disables binary logging: instead of a line of text, log_event
+*  appends a record holding the time, the level, an id for the format and the
+*  raw arguments (see log_format.h), which the log_decode tool turns back into
+*  the text lines. Nothing is formatted on the way, which makes log_event much
+*  cheaper and the log much smaller. The format has to be a string literal (it
+*  is recognized by its address). Lines whose format binary records cannot
+*  carry (a %n, more than LOG_MAX_ARGS arguments, or arguments longer than
+*  2 KB) are still written as text. Printed lines (see also_print_log) are
+*  formatted as usual, by the writer thread in async mode.
+*
+*
+*   - void dedupe_log (bool)
+*
+*  Enables/disables the deduplication of repeated lines: a line that is the
+*  same (same format and same arguments) as the one its call site logged last
+*  in the thread is not logged, only counted. The count is logged as
+*  'Line "<format>" repeated N more times' when the call site logs a
+*  different line, every 10 seconds while the line keeps repeating, and when
+*  the thread exits. The counts of the thread closing the log file (or calling
+*  exit) are logged then too, but those of the other threads that are still
+*  running are not: they go to whatever file is open when the thread logs the
+*  line again or exits. Lines of other call sites in between do not end a run
+*  of repeats.
+*
+*
+*   - void log_limited (unsigned per_second, unsigned burst, Levels l, const char *fmt, ...)
+*
+*  Like log_event, but the lines of the call site go through a token bucket
+*  of burst lines, refilled with per_second lines a second: a line finding the
+*  bucket empty is left out. The number of lines left out is logged before the
+*  next line that gets through (if any does). For lines that may come in
+*  floods, such as one per bad entry of an input.
+*
+*
+*   - int start_flight_recorder (int key, unsigned int size_kb, Levels l)
+*    key : the key of the shared memory segment the records are kept in
+*    size_kb : the size of the segment when it is created (0 for the default
+*           of 1 MB, about 8000 records)
+*    l : the least level recorded, whatever the levels of the log file
+*
+*  Starts recording the lines, as binary records (see log_format.h), in a
+*  ring in a shared memory segment (see log_recorder.h) which holds the last
+*  ones. A record only costs a memcpy, so the recorder can take DEBUG lines
+*  while the log file stays at WARNING. The segment outlives the process
+*  (a crashed one included), the log_dump tool prints the records in it and
+*  can also read the recorder of a running process. A segment left by an
+*  earlier run is recorded into after its last record. Lines whose format
+*  binary records cannot carry are not recorded. Returns OK (0), or ERROR
+*  (-1) if the segment cannot be attached.
+*
+*
+*   - void stop_flight_recorder (void)
+*
+*  Stops recording and detaches the segment, which is left for log_dump.
+*
+*
+*   - int start_async_log (unsigned int ring_kb, LogOverflow overflow)
+*    ring_kb : size of the ring the lines are queued in (0 for the default of
+*           1 MB)
+*    overflow : what log_event does when the ring is full, LOG_BLOCK waits
+*           for room and LOG_DROP drops the line (and returns ERROR)
+*
+*  Switches the process to asynchronous logging: log_event only formats the
+*  line and copies it into a lock-free ring, and a writer thread writes the
+*  lines (and prints them, see also_print_log) in batches with a single
+*  writev. The number of dropped lines is logged once there is room again. A
+*  line larger than the ring is written straight away. The ring is flushed by
+*  close_logfile, set_logfile, stop_async_log and at exit (but not when the
+*  process is killed by a signal). Returns OK (0) if the writer thread was
+*  started; ERROR (-1) otherwise, or if async logging is already on.
+*
+*
+*   - void flush_log (void)
+*
+*  Waits until every line queued before the call has been written. Does
+*  nothing unless async logging is on.
+*
+*
+*   - void stop_async_log (void)
+*
+*  Flushes the ring, stops the writer thread and goes back to writing each
+*  line from the thread logging it.
 */
 
 #define DEFAULT_LOG_FMT  "%s:%s:%s"
@@ -60,9 +219,75 @@
 #define LOG_OK           0
 #define LOG_ERROR        -1
 
-typedef enum {INFO, WARNING, FATAL} Levels;
+typedef enum {DEBUG, INFO, WARNING, FATAL} Levels;
+typedef enum {LOG_BLOCK, LOG_DROP} LogOverflow;
+/* the subsystems with a log level of their own */
+typedef enum {LOG_MAIN, LOG_LIBSHM, LOG_THDLIB, LOG_STORE, LOG_MODULES} LogModule;
+
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL    DEBUG
+#endif
+#ifndef LOG_MODULE
+#define LOG_MODULE       LOG_MAIN
+#endif
+
+/* the least level logged by each module (to the log file or the flight
+recorder), only to be read by log_enabled */
+extern Levels LogLevels[LOG_MODULES];
+
+/* a message built with the log_append functions */
+#define LOG_LINE_SIZE    512
+typedef struct LogLine {
+	size_t length;
+	char text[LOG_LINE_SIZE];
+} LogLine;
+
+/* the token bucket of a log_limited call site: the time (CLOCK_MONOTONIC, in
+ns) every token is back at, what a token is worth and the lines left out */
+typedef struct LogLimit {
+	uint64_t full_at;
+	uint64_t interval_ns;
+	uint64_t burst_ns;
+	uint64_t skipped;
+} LogLimit;
+#define LOG_LIMIT(per_second, burst) \
+	{0, 1000000000ull / (per_second), (burst) * (1000000000ull / (per_second)), 0}
 
 int log_event (Levels l, const char *fmt, ...);
+int log_module_event (LogModule module, Levels l, const char *fmt, ...);
+void log_append_string (LogLine *line, const char *string);
+void log_append_int (LogLine *line, int64_t value);
+void log_append_uint (LogLine *line, uint64_t value);
+void log_append_fixed (LogLine *line, double value, int width, int precision);
+int log_module_line (LogModule module, Levels l, LogLine *line);
+void set_log_level (LogModule module, Levels l);
+int set_log_levels (const char *spec);
 int set_logfile (const char *logfile_name);
+int map_logfile (const char *logfile_name, unsigned int file_kb, unsigned int keep);
 void close_logfile (void);
 void also_print_log(bool);
+void use_binary_log(bool);
+void dedupe_log(bool);
+int start_flight_recorder (int key, unsigned int size_kb, Levels l);
+void stop_flight_recorder (void);
+long long log_limit (LogLimit *limit);
+int start_async_log (unsigned int ring_kb, LogOverflow overflow);
+void flush_log (void);
+void stop_async_log (void);
+
+/* after the prototype, which it would otherwise expand */
+#define log_enabled(l)   ((l) >= LOG_MIN_LEVEL && (l) >= __atomic_load_n(&LogLevels[LOG_MODULE], __ATOMIC_RELAXED))
+#define log_event(l, ...) (log_enabled(l) ? log_module_event(LOG_MODULE, l, __VA_ARGS__) : LOG_OK)
+#define log_line_start(line) ((line)->length = 0)
+#define log_line(l, line) (log_enabled(l) ? log_module_line(LOG_MODULE, l, line) : LOG_OK)
+#define log_limited(per_second, burst, l, ...) \
+	do { \
+		static LogLimit log_limit_ = LOG_LIMIT(per_second, burst); \
+		long long log_skipped_; \
+		if (log_enabled(l) && (log_skipped_ = log_limit(&log_limit_)) >= 0) { \
+			if (log_skipped_ > 0) { \
+				log_event(l, " [LOGMGR] %lld lines left out by the rate limit", log_skipped_); \
+			} \
+			log_event(l, __VA_ARGS__); \
+		} \
+	} while (0)
@@ -0,0 +1,85 @@
+/*
+* Description:
+*   Provide the flight recorder behind start_flight_recorder (see log_mgr.h): a
+*   ring of the last binary log records (see log_format.h) in a shared memory
+*   segment, which outlives the process and is read by the log_dump tool.
+*
+*  The segment starts with a LogRecorder header, followed by the format table
+*  (formats_size bytes of LOG_RECORD_FORMAT records, each at an 8 byte
+*  boundary) and the ring (capacity slots of LOG_RECORDER_SLOT bytes). A
+*  format is added to the table the first time a process records an event
+*  using it, unless the table has it already. A record takes as many
+*  consecutive slots as it needs (its bytes run on through the bytes of the
+*  slots after the first), wrapping around the end of the ring. Writers
+*  reserve slots by moving the tail with an atomic add, copy the record in
+*  and publish it by storing the ready word of its first slot last, so the
+*  records go in at memcpy cost and from any number of threads (or processes).
+*
+*  Positions only ever grow, so a reader knows a record is whole if the ready
+*  word of its first slot is its position + 1, and that it was not overwritten
+*  while being read if the tail is still within capacity slots of its
+*  position afterwards. A record that was being copied when the process died
+*  is never published, and is skipped.
+*
+*   - int log_recorder_open (int key, uint64_t size)
+*    size : the size of the segment, used when it does not exist yet
+*
+*  Attaches the segment (with shmget and shmat, so that log_mgr does not
+*  depend on shmlib, which logs through it), creating it if needed. A segment
+*  that was set up already, by this process or one before it, is kept as it
+*  is and recorded into after its last record. Returns LOG_OK, or LOG_ERROR
+*  if the segment cannot be attached or is too small.
+*
+*
+*   - bool log_recorder_define (uint32_t id, const char *fmt)
+*
+*  Makes sure the format table has the format. Returns false if the table is
+*  full (events using the format are dumped as of an unknown format).
+*
+*
+*   - void log_recorder_write (const char *record, size_t length)
+*
+*  Puts the record in the ring, overwriting the oldest records. Does nothing
+*  if no segment is attached.
+*
+*
+*   - void log_recorder_close (void)
+*
+*  Detaches the segment, which is left in place for log_dump.
+*/
+
+#define LOG_RECORDER_MAGIC   0x464C5452u
+#define LOG_RECORDER_SLOT    128
+#define LOG_RECORDER_BYTES   (LOG_RECORDER_SLOT - 16)
+/* the size of the format table, whatever the size of the segment */
+#define LOG_RECORDER_FORMATS (64*1024)
+
+typedef struct LogRecorderSlot {
+	/* position + 1 once the record starting at this position is in */
+	uint64_t ready;
+	uint32_t length;
+	uint32_t slots;
+	char bytes[LOG_RECORDER_BYTES];
+} LogRecorderSlot;
+
+/* the start of the segment */
+typedef struct LogRecorder {
+	uint32_t magic;
+	uint32_t slot_size;
+	/* slots in the ring, a power of two */
+	uint64_t capacity;
+	uint64_t formats_size;
+	/* the bytes of the format table taken so far (may run past its size) */
+	uint64_t formats_used __attribute__((aligned(64)));
+	/* the positions handed out so far */
+	uint64_t tail __attribute__((aligned(64)));
+} __attribute__((aligned(64))) LogRecorder;
+
+#define LOG_RECORDER_TABLE(recorder)  ((char *) (recorder) + sizeof(LogRecorder))
+#define LOG_RECORDER_RING(recorder) \
+	((LogRecorderSlot *) (LOG_RECORDER_TABLE(recorder) + (recorder)->formats_size))
+
+int log_recorder_open (int key, uint64_t size);
+bool log_recorder_define (uint32_t id, const char *fmt);
+void log_recorder_write (const char *record, size_t length);
+void log_recorder_close (void);
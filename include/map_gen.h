@@ -0,0 +1,300 @@
+/*
+ * Description:
+ *   Provide a type-generic hash map to sub-projects. Each map type is
+ *   generated at compile time for a given key type, value type, hash function
+ *   and equality function, so lookups are inlined with no function pointers or
+ *   void* boxing. This is the same table used by Hash: entries are stored
+ *   inline in a dense array, slots use Robin Hood probing with backward shift
+ *   deletion, and the table grows and shrinks with the number of entries.
+ *
+ * MAP_DEFINE(name, key_t, value_t, hash_fn, eq_fn)
+ * 	generates the map type 'name', the entry type 'name_entry' (holding key and
+ * 	value) and the static inline functions below. hash_fn(key) must return a
+ * 	uint32_t and eq_fn(a, b) must return true when two keys are equal. Keys and
+ * 	values are copied into the map, so for pointer keys (i.e. strings) the
+ * 	caller owns the pointed to memory and it must outlive the entry.
+ *
+ * bool name_init(name* map, uint32_t size_hint)
+ * 	initializes an empty map, the size hint is the number of entries expected.
+ * 	Returns false if the table could not be allocated, or if the hint is more
+ * 	than the largest table holds (MAP_MAX_LOAD(MAP_MAX_SLOTS) entries).
+ *
+ * value_t* name_get(name* map, key_t key)
+ * 	returns a pointer to the value stored for the key, NULL otherwise. The
+ * 	pointer is only valid until the next put or del on the map.
+ *
+ * value_t* name_put(name* map, key_t key, value_t value)
+ * 	inserts (or overwrites) the value for the key and returns a pointer to the
+ * 	stored value (NULL if the table could not grow, the map is left as it was).
+ *
+ * bool name_del(name* map, key_t key)
+ * 	removes the key, an indication of success is returned.
+ *
+ * uint32_t name_count(name* map)
+ * name_entry* name_at(name* map, uint32_t idx)
+ * 	the entries are dense, so iteration is simply:
+ * 		for (idx = 0; idx < name_count(map); idx++) { name_at(map, idx)->value ... }
+ * 	The map must not be modified during the iteration.
+ *
+ * void name_destroy(name* map)
+ * 	frees the table (but not anything the keys or values point to).
+ *
+ * Hash/equality functions are provided for int, 64-bit and string keys:
+ * 	map_hash_int/map_eq_int, map_hash_u64/map_eq_u64, map_hash_str/map_eq_str
+ *
+ * Example, a map from 64-bit point ids to array indices:
+ * 	MAP_DEFINE(PointIdMap, uint64_t, int, map_hash_u64, map_eq_u64)
+ */
+
+#ifndef MAP_GEN_H
+#define MAP_GEN_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define MAP_MIN_SLOTS   8
+/* slots and entries are referenced by uint32_t, MAP_EMPTY included */
+#define MAP_MAX_SLOTS   0x80000000u
+#define MAP_EMPTY       0xFFFFFFFFu
+
+/* the table is grown once it is more than 7/8 full and shrunk once it is less
+than 1/4 full (this leaves room so that a grow is not followed by a shrink) */
+#define MAP_MAX_LOAD(slots) (((slots) / 8) * 7)
+#define MAP_MIN_LOAD(slots) ((slots) / 4)
+
+/* the slots only hold the (cached) hash and a reference into the dense entry
+array, this keeps the probed memory small and iteration independent of the
+number of slots */
+typedef struct MapSlot {
+	uint32_t hash;
+	uint32_t entry;
+} MapSlot;
+
+static inline uint32_t map_hash_int(int key) {
+	/* finalizer from murmur3, spreads sequential keys across the table */
+	uint32_t h = (uint32_t) key;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+static inline uint32_t map_hash_u64(uint64_t key) {
+	/* finalizer from murmur3 (64-bit variant) */
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return (uint32_t) key;
+}
+
+static inline uint32_t map_hash_str(const char* key) {
+	/* FNV-1a */
+	uint32_t h = 2166136261u;
+	while (*key) {
+		h ^= (unsigned char) *key++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static inline bool map_eq_int(int a, int b) { return a == b; }
+static inline bool map_eq_u64(uint64_t a, uint64_t b) { return a == b; }
+static inline bool map_eq_str(const char* a, const char* b) { return strcmp(a, b) == 0; }
+
+static inline uint32_t map_probe_distance(uint32_t mask, uint32_t hash, uint32_t slot) {
+	return (slot - (hash & mask)) & mask;
+}
+
+static inline void map_place_slot(MapSlot* slots, uint32_t mask, MapSlot item) {
+	uint32_t slot = item.hash & mask;
+	uint32_t dist = 0;
+	uint32_t existing_dist;
+	MapSlot tmp;
+
+	while (slots[slot].entry != MAP_EMPTY) {
+		/* take from the rich (closer to home) and give to the poor */
+		existing_dist = map_probe_distance(mask, slots[slot].hash, slot);
+		if (existing_dist < dist) {
+			tmp = slots[slot];
+			slots[slot] = item;
+			item = tmp;
+			dist = existing_dist;
+		}
+		slot = (slot + 1) & mask;
+		dist++;
+	}
+	slots[slot] = item;
+}
+
+/* backward shift: pull the following entries of the probe chain one slot
+closer to home so that no tombstone is needed */
+static inline void map_remove_slot(MapSlot* slots, uint32_t mask, uint32_t slot) {
+	uint32_t next = (slot + 1) & mask;
+	while (slots[next].entry != MAP_EMPTY &&
+				 map_probe_distance(mask, slots[next].hash, next) > 0) {
+		slots[slot] = slots[next];
+		slot = next;
+		next = (next + 1) & mask;
+	}
+	slots[slot].entry = MAP_EMPTY;
+}
+
+
+#define MAP_DEFINE(name, key_t, value_t, hash_fn, eq_fn)                       \
+                                                                               \
+typedef struct name##_entry {                                                  \
+	key_t key;                                                                   \
+	value_t value;                                                               \
+} name##_entry;                                                                \
+                                                                               \
+typedef struct name {                                                          \
+	uint32_t mask;                                                               \
+	uint32_t count;                                                              \
+	MapSlot *slots;                                                              \
+	name##_entry *entries;                                                       \
+} name;                                                                        \
+                                                                               \
+static inline bool name##_resize(name* map, uint32_t num_slots) {              \
+	uint32_t i;                                                                  \
+	MapSlot item;                                                                \
+	MapSlot *slots;                                                              \
+	name##_entry *entries;                                                       \
+	if (num_slots < MAP_MIN_SLOTS || num_slots > MAP_MAX_SLOTS) {                \
+		return false;                                                              \
+	}                                                                            \
+	/* the realloc goes last: once it succeeded nothing can fail, before that    \
+	the map is untouched (realloc leaves the old entries alone on failure) */    \
+	slots = (MapSlot*) malloc((size_t) num_slots*sizeof(MapSlot));               \
+	if (slots == NULL) {                                                         \
+		return false;                                                              \
+	}                                                                            \
+	entries = (name##_entry*) realloc(map->entries,                              \
+	                          (size_t) MAP_MAX_LOAD(num_slots)*sizeof(name##_entry)); \
+	if (entries == NULL) {                                                       \
+		free(slots);                                                               \
+		return false;                                                              \
+	}                                                                            \
+	for (i = 0; i<num_slots; i++) {                                              \
+		slots[i].entry = MAP_EMPTY;                                                \
+	}                                                                            \
+	free(map->slots);                                                            \
+	map->slots = slots;                                                          \
+	map->entries = entries;                                                      \
+	map->mask = num_slots - 1;                                                   \
+	for (i = 0; i<map->count; i++) {                                             \
+		item.hash = hash_fn(entries[i].key);                                       \
+		item.entry = i;                                                            \
+		map_place_slot(map->slots, map->mask, item);                               \
+	}                                                                            \
+	return true;                                                                 \
+}                                                                              \
+                                                                               \
+static inline bool name##_init(name* map, uint32_t size_hint) {                \
+	uint32_t num_slots = MAP_MIN_SLOTS;                                          \
+	map->mask = 0;                                                               \
+	map->count = 0;                                                              \
+	map->slots = NULL;                                                           \
+	map->entries = NULL;                                                         \
+	if (size_hint > MAP_MAX_LOAD(MAP_MAX_SLOTS)) {                               \
+		return false;                                                              \
+	}                                                                            \
+	while (MAP_MAX_LOAD(num_slots) < size_hint) {                                \
+		num_slots <<= 1;                                                           \
+	}                                                                            \
+	return name##_resize(map, num_slots);                                        \
+}                                                                              \
+                                                                               \
+static inline int64_t name##_find_slot(name* map, key_t key, uint32_t hash) {  \
+	uint32_t slot = hash & map->mask;                                            \
+	uint32_t dist = 0;                                                           \
+	while (map->slots[slot].entry != MAP_EMPTY) {                                \
+		/* an entry for this key would have displaced anything closer to home */   \
+		if (dist > map_probe_distance(map->mask, map->slots[slot].hash, slot)) {   \
+			return -1;                                                               \
+		}                                                                          \
+		if (map->slots[slot].hash == hash &&                                       \
+				eq_fn(map->entries[map->slots[slot].entry].key, key)) {                \
+			return slot;                                                             \
+		}                                                                          \
+		slot = (slot + 1) & map->mask;                                             \
+		dist++;                                                                    \
+	}                                                                            \
+	return -1;                                                                   \
+}                                                                              \
+                                                                               \
+static inline value_t* name##_get(name* map, key_t key) {                      \
+	int64_t slot = name##_find_slot(map, key, hash_fn(key));                     \
+	if (slot < 0) {                                                              \
+		return NULL;                                                               \
+	}                                                                            \
+	return &map->entries[map->slots[slot].entry].value;                          \
+}                                                                              \
+                                                                               \
+static inline value_t* name##_put(name* map, key_t key, value_t value) {       \
+	MapSlot item;                                                                \
+	uint32_t hash = hash_fn(key);                                                \
+	int64_t slot = name##_find_slot(map, key, hash);                             \
+	/* allow for overwrites */                                                   \
+	if (slot >= 0) {                                                             \
+		map->entries[map->slots[slot].entry].value = value;                        \
+		return &map->entries[map->slots[slot].entry].value;                        \
+	}                                                                            \
+	if (map->count + 1 > MAP_MAX_LOAD(map->mask + 1) &&                          \
+			(map->mask + 1 == MAP_MAX_SLOTS || !name##_resize(map, (map->mask + 1) << 1))) { \
+		return NULL;                                                               \
+	}                                                                            \
+	map->entries[map->count].key = key;                                          \
+	map->entries[map->count].value = value;                                      \
+	item.hash = hash;                                                            \
+	item.entry = map->count;                                                     \
+	map_place_slot(map->slots, map->mask, item);                                 \
+	return &map->entries[map->count++].value;                                    \
+}                                                                              \
+                                                                               \
+static inline bool name##_del(name* map, key_t key) {                          \
+	uint32_t entry, last;                                                        \
+	int64_t slot = name##_find_slot(map, key, hash_fn(key));                     \
+	if (slot < 0) {                                                              \
+		return false;                                                              \
+	}                                                                            \
+	entry = map->slots[slot].entry;                                              \
+	map_remove_slot(map->slots, map->mask, slot);                                \
+	/* keep the entries dense by moving the last one into the hole */            \
+	last = map->count - 1;                                                       \
+	if (entry != last) {                                                         \
+		slot = name##_find_slot(map, map->entries[last].key,                       \
+		                        hash_fn(map->entries[last].key));                  \
+		map->entries[entry] = map->entries[last];                                  \
+		map->slots[slot].entry = entry;                                            \
+	}                                                                            \
+	map->count--;                                                                \
+	if (map->mask + 1 > MAP_MIN_SLOTS && map->count < MAP_MIN_LOAD(map->mask + 1)) { \
+		/* failing to shrink is harmless, the table is simply left as is */        \
+		name##_resize(map, (map->mask + 1) >> 1);                                  \
+	}                                                                            \
+	return true;                                                                 \
+}                                                                              \
+                                                                               \
+static inline uint32_t name##_count(name* map) {                               \
+	return map->count;                                                           \
+}                                                                              \
+                                                                               \
+static inline name##_entry* name##_at(name* map, uint32_t idx) {               \
+	return &map->entries[idx];                                                   \
+}                                                                              \
+                                                                               \
+static inline void name##_destroy(name* map) {                                 \
+	free(map->slots);                                                            \
+	free(map->entries);                                                          \
+	map->slots = NULL;                                                           \
+	map->entries = NULL;                                                         \
+	map->count = 0;                                                              \
+}
+
+#endif
@@ -0,0 +1,40 @@
+/*
+ * Description:
+ *   Provide support data structures to sub-projects, specifically a bounded
+ *   multi-producer single-consumer queue of fixed size elements. Any number of
+ *   threads may enqueue concurrently without taking a lock; exactly one thread
+ *   at a time may dequeue. Elements are copied into and out of the queue, the
+ *   producer and consumer positions live on separate cache lines.
+ *
+ * MPSCQueue* new_mpsc_queue(unsigned int capacity, unsigned int elem_size)
+ * 	allocates an empty queue for at least capacity elements (rounded up to a
+ * 	power of two) of elem_size bytes each. Returns NULL on failure.
+ *
+ * bool mpsc_enqueue(MPSCQueue* queue, const void* elem)
+ * 	copies the element into the queue. Returns false (without waiting) if the
+ * 	queue is full.
+ *
+ * bool mpsc_dequeue(MPSCQueue* queue, void* elem)
+ * 	copies the oldest element into elem and removes it from the queue. Returns
+ * 	false if the queue is empty. Only the consumer thread may call this.
+ *
+ * unsigned int mpsc_dequeue_batch(MPSCQueue* queue, void* elems, unsigned int max)
+ * 	dequeues up to max elements into the elems array (max*elem_size bytes) and
+ * 	returns the number dequeued. Only the consumer thread may call this.
+ *
+ * unsigned int mpsc_queue_count(MPSCQueue* queue)
+ * 	returns the number of elements waiting in the queue. This is only a
+ * 	snapshot while producers or the consumer are active.
+ *
+ * void destroy_mpsc_queue(MPSCQueue* queue)
+ * 	frees the queue, no other thread may be using it.
+ */
+
+typedef struct MPSCQueue MPSCQueue;
+
+MPSCQueue* new_mpsc_queue(unsigned int capacity, unsigned int elem_size);
+bool mpsc_enqueue(MPSCQueue* queue, const void* elem);
+bool mpsc_dequeue(MPSCQueue* queue, void* elem);
+unsigned int mpsc_dequeue_batch(MPSCQueue* queue, void* elems, unsigned int max);
+unsigned int mpsc_queue_count(MPSCQueue* queue);
+void destroy_mpsc_queue(MPSCQueue* queue);
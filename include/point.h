@@ -2,23 +2,213 @@
  * Description:
  *   Provide support data structures to sub-projects
  *
+ *   The points are grouped in blocks of POINT_SEQ_BLOCK, each with a sequence
+ *   counter used as a seqlock: install_point, invalidate_point and clear_points
+ *   make it odd while they change the block and even again afterwards. Readers
+ *   (get_point and show_points) copy a block and retry if the counter was odd or
+ *   moved meanwhile, so they never see a torn point and never store anything to
+ *   the segment. They do not need shm_lock, only concurrent writers do. They
+ *   wait for a busy writer as long as it takes, and only give up on a counter
+ *   that stayed odd (at the same value) for seconds, which a writer that died in
+ *   the middle of an update leaves behind: the call then reports that it could
+ *   not read the points (and logs it) rather than hand out what it copied. The
+ *   next writer to set the segment up makes the counters even again.
+ *
+ *   The header also carries running aggregates over the valid points (count, sum
+ *   of x and sum of y) that the writer keeps up to date on every change, using
+ *   compensated (Neumaier) summation so the float error does not build up.
+ *   Readers get the averages in constant time, whatever the capacity.
+ *
+ *   Every change (a single call below, or a whole batch) also moves the segment
+ *   to a new generation, and the points it touched are stamped with it (see
+ *   point_dirty.h). A reader that remembers the generation it last looked at
+ *   can tell with a single load whether anything changed since, and find the
+ *   points that did without going over all of them.
+ *
+ * size_t point_segment_size(uint64_t capacity, uint32_t history_depth)
+ * 	returns the number of bytes needed for a shared memory segment holding
+ * 	capacity points: the segment header, the change ring, the point id index
+ * 	(see point_index.h), the points themselves (room is reserved for either
+ * 	layout), their sequence counters and per block counts of valid points,
+ * 	the spatial grid, the change stamps and a history of history_depth
+ * 	entries per ring (0 for none, see point_history.h).
+ *
+ * bool point_segment_init(void* shmaddr, uint64_t capacity, int layout, float cell_size,
+ *                         uint32_t history_depth)
+ * 	sets up the segment header for capacity points stored in the given layout,
+ * 	along with the id index, the change ring, a spatial grid of cells cell_size
+ * 	wide and the history. POINT_LAYOUT_AOS is the array of Point structs,
+ * 	POINT_LAYOUT_SOA a validity bitmap with separate x and y arrays (see
+ * 	point_columns.h) that show_points can scan with SIMD. A segment that already
+ * 	has the same capacity and layout is kept as is; changing the layout clears
+ * 	the points and changing the capacity also drops the ids. The history is kept
+ * 	unless the capacity or its depth change. The running aggregates and the grid
+ * 	are rebuilt from the points in any case. When the points are cleared, the
+ * 	segment moves to a new generation in which every point changed. The
+ * 	segment must be at least point_segment_size(capacity, history_depth)
+ * 	bytes. Returns false if capacity is 0 or above POINT_MAX_CAPACITY, or
+ * 	history_depth is above POINT_HISTORY_MAX_DEPTH. Only the writer should
+ * 	call this.
+ *
+ * uint64_t point_segment_capacity(void* shmaddr)
+ * 	returns the number of points the segment holds according to its header, or
+ * 	0 if the segment has not been set up (or was set up for a different Point).
+ *
+ * int point_segment_layout(void* shmaddr)
+ * 	returns the layout the points in the segment are stored in.
+ *
+ * bool point_segment_stats(void* shmaddr, PointSums* sums)
+ * 	copies the running count and sums out of the header. Returns false (with
+ * 	all zeros) if the segment has not been set up, or cannot be read.
+ *
+ * bool point_segment_rescan(void* shmaddr, PointSums* sums)
+ * 	computes the count and sums from scratch by scanning every point. Returns
+ * 	false (with all zeros) if a block of points cannot be read.
+ *
+ * int verify_point_stats(void* shmaddr)
+ * 	cross-checks the running aggregates against a full rescan and logs the
+ * 	outcome. Returns POINT_STATS_OK, POINT_STATS_DRIFT if they disagree, or
+ * 	POINT_STATS_BUSY if the writer changed the points during the rescan (the
+ * 	check is inconclusive then, try again later), or POINT_STATS_STUCK if the
+ * 	aggregates or the points cannot be read.
+ *
+ * bool point_segment_summary(void* shmaddr, int what, int threads, PointSummary* summary)
+ * 	computes the statistics in what (POINT_SUMMARY_* or'ed together, see
+ * 	point_summary.h) over the valid points in a single pass, so a caller only
+ * 	pays for what it asks for. For a histogram the caller sets up the bins and
+ * 	the box in summary first. Large segments are split between up to threads
+ * 	threads (0 for one per processor), each block of points is copied under its
+ * 	sequence counter before it is looked at. Returns false (with an empty
+ * 	summary) if the segment has not been set up, or a block cannot be read.
+ *
+ * PointGrid* point_segment_grid(void* shmaddr)
+ * 	returns the spatial grid over the valid points (see point_grid.h), which
+ * 	answers box and nearest neighbour queries without a scan. Returns NULL if
+ * 	the segment has not been set up.
+ *
+ * PointHistory* point_segment_history(void* shmaddr)
+ * 	returns the history of the slots (see point_history.h): every install and
+ * 	invalidation done through the calls below, with per second and per minute
+ * 	summaries, which readers can fetch by time range without copying. Returns
+ * 	NULL if the segment has not been set up.
+ *
+ * uint64_t point_segment_generation(void* shmaddr)
+ * 	returns the generation of the last change made to the points, a single
+ * 	load. It only grows, unless the segment is set up again from scratch.
+ *
+ * int point_segment_changed(void* shmaddr, uint64_t since, uint64_t* position, int* indices, int max)
+ * 	copies into indices (up to max of) the indices of the points changed after
+ * 	generation since, in increasing order, starting at index *position (0 for
+ * 	the first call) and moving *position past the points looked at. Returns
+ * 	the number of indices copied, fewer than max once every point has been
+ * 	looked at. The cost is in the number of changed points (and a load per
+ * 	16K points), not the capacity. Load the generation first and use it as
+ * 	since next time: every change up to it is found.
+ *
+ * PointIndex* point_segment_index(void* shmaddr)
+ * 	returns the id index found in the segment attached at the given address.
+ *
+ * ChangeRing* point_segment_changes(void* shmaddr)
+ * 	returns the ring of point changes found in the segment attached at the given
+ * 	address (see change_ring.h). Every install, invalidate and clear of the
+ * 	points is appended to it.
+ *
  * void install_point(void* addr, int index, Point* point)
  * 	attempts to install a copy of the given point at the memory address given.
+ * 	The index has to be below the capacity of the segment.
  *
  * void invalidate_point(void* addr, int index)
  * 	attempts to set the is_valid flag at the pointer-arithmatic index offset from
  * 	the given address.
  *
+ * bool install_points_batch(void* addr, int* indices, Point* points, int count)
+ * 	installs points[i] at indices[i] for each of the count entries, in order.
+ * 	Every index is checked before anything is written: if one is out of range
+ * 	nothing is installed and false is returned. The running aggregates are
+ * 	updated once for the whole batch. The caller takes shm_lock once around the
+ * 	batch (if it has to lock at all).
+ *
+ * bool invalidate_points_batch(void* addr, int* indices, int count)
+ * 	same as install_points_batch, for invalidating the points at the indices.
+ *
+ * void clear_points(void* addr)
+ * 	clears (not just invalidates) all of the points in the segment. The points
+ * 	that were valid count as changed, and only they get an entry in the history.
+ *
+ * bool get_point(void* addr, int index, Point* point)
+ * 	copies the point at the given index out of the segment (whatever its
+ * 	layout) and returns whether it is valid. An index outside of the segment,
+ * 	or one that cannot be read, reads as an invalid point (all zeros).
+ *
+ * void show_change(ChangeRecord* change)
+ * 	dump a representation of the given change record to the log
+ *
  * void show_task(void *task)
  * 	given a task struct, dump a representation to the log
  *
  * void show_points(void* shmaddr, int max)
- * 	given a pointer to an array of point structs, dump a representation of all
- * 	found points to the log. This is restricted up to (shmaddr + max) address
- * 	(note: in pointer arithmatic, not bytes).
+ * 	given the address of the segment, dump the statistics over all of its points
+ * 	(taken from the running aggregates) to the log, followed by (at most) the
+ * 	first max valid points. Blocks without any valid point are skipped, so a
+ * 	sparse segment is not read through to find them.
+ *
+ * uint64_t show_changed_points(void* shmaddr, uint64_t since, int max)
+ * 	same as show_points, but lists (at most max of) the points changed after
+ * 	generation since instead, valid or not. Returns the generation they were
+ * 	collected at, to be passed as since the next time.
  */
 
-#define MAX_NUM_POINTS 20
+/* the capacity used when none is asked for, and the number of points listed by
+show_points */
+#define DEFAULT_NUM_POINTS 20
+/* slots are ints, and every slot may be bound to an id */
+#define POINT_MAX_CAPACITY POINT_INDEX_MAX_CAPACITY
+enum {POINT_LAYOUT_AOS, POINT_LAYOUT_SOA};
+/* number of changes kept in the segment for readers that fall behind */
+#define POINT_CHANGE_RING_SIZE 1024
+/* number of consecutive points sharing a sequence counter (a multiple of 64) */
+#define POINT_SEQ_BLOCK 256
+
+enum {POINT_STATS_OK, POINT_STATS_DRIFT, POINT_STATS_BUSY, POINT_STATS_STUCK};
+
+/* running aggregates over the valid points, the sums are kept as a Neumaier
+pair (the value is sum + compensation) */
+typedef struct PointStats {
+	/* seqlock, odd while the writer updates the aggregates */
+	uint32_t seq;
+	uint32_t unused;
+	uint64_t count;
+	double sum_x;
+	double comp_x;
+	double sum_y;
+	double comp_y;
+} PointStats;
+
+/* the first cache lines of the segment describe the rest of it, the next one
+holds the running aggregates and the last one the generation, which readers poll */
+typedef struct PointSegment {
+	/* POINT_SEGMENT_MAGIC once set up, written last */
+	uint32_t magic;
+	uint32_t layout;
+	/* sizeof(Point) of the writer, readers built differently ignore the segment */
+	uint32_t elem_size;
+	uint32_t unused;
+	uint64_t capacity;
+	/* byte offsets (from the start of the segment) of the points, of their
+	sequence counters, of the spatial grid, of the change stamps and of the
+	history, and the size of the segment as set up */
+	uint64_t points_offset;
+	uint64_t seqs_offset;
+	uint64_t grid_offset;
+	uint64_t dirty_offset;
+	uint64_t history_offset;
+	uint64_t size;
+	PointStats stats __attribute__((aligned(64)));
+	/* generation of the last change published to readers */
+	uint64_t generation __attribute__((aligned(64)));
+} __attribute__((aligned(64))) PointSegment;
+
+#define POINT_SEGMENT_MAGIC 0x50544d37
 
 typedef struct Point {
 	int is_valid;
@@ -26,14 +216,41 @@ typedef struct Point {
 	float y;
 } Point;
 
+/* a point id of 0 means the task is not bound to an id */
+#define POINT_NO_ID 0
+
 typedef struct PointTask {
+	uint64_t id;
 	int index;
 	int delay;
 	Point point;
 } PointTask;
 
+size_t point_segment_size(uint64_t capacity, uint32_t history_depth);
+bool point_segment_init(void* shmaddr, uint64_t capacity, int layout, float cell_size,
+                        uint32_t history_depth);
+uint64_t point_segment_capacity(void* shmaddr);
+int point_segment_layout(void* shmaddr);
+bool point_segment_stats(void* shmaddr, PointSums* sums);
+bool point_segment_rescan(void* shmaddr, PointSums* sums);
+int verify_point_stats(void* shmaddr);
+PointIndex* point_segment_index(void* shmaddr);
+ChangeRing* point_segment_changes(void* shmaddr);
+bool point_segment_summary(void* shmaddr, int what, int threads, PointSummary* summary);
+PointGrid* point_segment_grid(void* shmaddr);
+PointHistory* point_segment_history(void* shmaddr);
+uint64_t point_segment_generation(void* shmaddr);
+int point_segment_changed(void* shmaddr, uint64_t since, uint64_t* position, int* indices, int max);
+
 void install_point(void* addr, int index, Point* point);
 void invalidate_point(void* addr, int index);
+bool install_points_batch(void* addr, int* indices, Point* points, int count);
+bool invalidate_points_batch(void* addr, int* indices, int count);
+void clear_points(void* addr);
+bool get_point(void* addr, int index, Point* point);
+
+void show_change(ChangeRecord* change);
 
 void show_task(void *task);
 void show_points(void* shmaddr, int max);
+uint64_t show_changed_points(void* shmaddr, uint64_t since, int max);
@@ -0,0 +1,79 @@
+/*
+ * Description:
+ *   Provide a structure-of-arrays store for points that lives inside a (shared
+ *   memory) region: a validity bitmap followed by contiguous x[] and y[] float
+ *   arrays (each cache line aligned), all addressed by offsets relative to the
+ *   PointColumns. Statistics over the valid points are computed by kernels that
+ *   stream the arrays with SSE2 or AVX2 when the CPU supports it (chosen once at
+ *   run time), with a portable scalar fallback.
+ *
+ * size_t point_columns_size(uint64_t capacity)
+ * 	returns the number of bytes needed to hold capacity points.
+ *
+ * void point_columns_init(PointColumns* columns, uint64_t capacity)
+ * 	prepares the region for capacity points, all invalid.
+ *
+ * void point_columns_set(PointColumns* columns, uint64_t index, float x, float y)
+ * 	stores the point at the given index and marks it valid.
+ *
+ * void point_columns_invalidate(PointColumns* columns, uint64_t index)
+ * 	marks the point at the given index invalid (x and y are kept).
+ *
+ * bool point_columns_get(PointColumns* columns, uint64_t index, float* x, float* y)
+ * 	copies the point at the given index out and returns whether it is valid.
+ *
+ * void point_columns_sums(PointColumns* columns, uint64_t max, PointSums* sums)
+ * 	counts the valid points among the first max and sums their x and y values
+ * 	(in double precision) using the selected kernel.
+ *
+ * void point_columns_sums_range(PointColumns* columns, uint64_t first, uint64_t count, PointSums* sums)
+ * 	same as point_columns_sums, but over count points starting at first (which
+ * 	is rounded down to a multiple of 64).
+ *
+ * void point_columns_copy(PointColumns* columns, uint64_t first, uint64_t count, uint64_t* bitmap, float* x, float* y)
+ * 	copies the bitmap words and the x and y values of count points starting at
+ * 	first (a multiple of 64) out, as they are. The bitmap gets whole words, x
+ * 	and y are padded up to the next multiple of 64 points.
+ *
+ * void point_columns_gather(const int* valid, const float* x, const float* y, size_t stride, uint64_t count, uint64_t* bitmap, float* out_x, float* out_y)
+ * 	converts count points stored as an array of structs (stride bytes apart,
+ * 	valid when the valid field is 1) into the same bitmap and arrays as
+ * 	point_columns_copy.
+ *
+ * bool point_columns_use_kernel(int kernel)
+ * 	selects the kernel used by point_columns_sums (POINT_KERNEL_*). Returns
+ * 	false, leaving the selection alone, if the CPU does not support it.
+ *
+ * const char* point_columns_kernel_name()
+ * 	returns the name of the kernel in use.
+ */
+
+enum {POINT_KERNEL_SCALAR, POINT_KERNEL_SSE2, POINT_KERNEL_AVX2};
+
+typedef struct PointSums {
+	uint64_t count;
+	double sum_x;
+	double sum_y;
+} PointSums;
+
+typedef struct PointColumns {
+	uint64_t capacity;
+	/* byte offsets (from the start of this struct) of the arrays */
+	uint64_t bitmap_offset;
+	uint64_t x_offset;
+	uint64_t y_offset;
+} PointColumns;
+
+size_t point_columns_size(uint64_t capacity);
+void point_columns_init(PointColumns* columns, uint64_t capacity);
+void point_columns_set(PointColumns* columns, uint64_t index, float x, float y);
+void point_columns_invalidate(PointColumns* columns, uint64_t index);
+bool point_columns_get(PointColumns* columns, uint64_t index, float* x, float* y);
+void point_columns_sums(PointColumns* columns, uint64_t max, PointSums* sums);
+void point_columns_sums_range(PointColumns* columns, uint64_t first, uint64_t count, PointSums* sums);
+void point_columns_copy(PointColumns* columns, uint64_t first, uint64_t count, uint64_t* bitmap, float* x, float* y);
+void point_columns_gather(const int* valid, const float* x, const float* y, size_t stride, uint64_t count,
+                          uint64_t* bitmap, float* out_x, float* out_y);
+
+bool point_columns_use_kernel(int kernel);
+const char* point_columns_kernel_name();
@@ -0,0 +1,58 @@
+/*
+ * Description:
+ *   Provide a record of which slots changed since a given generation, so that
+ *   readers can look at just those instead of every slot. The writer numbers
+ *   its changes with a generation counter (kept by the caller) and stamps each
+ *   slot it changes with the generation of the change, along with the block of
+ *   POINT_DIRTY_BLOCK slots and the group of POINT_DIRTY_GROUP blocks holding
+ *   it. A reader skips every group and block stamped at or before the
+ *   generation it already saw, so a scan costs one load per group plus the
+ *   blocks of the groups that changed, and the slots of the blocks that
+ *   changed.
+ *
+ *   The stamps only ever grow and readers store nothing, so any number of
+ *   readers can each keep their own generation. Like the point index,
+ *   everything is addressed relative to the PointDirty, so it works at any
+ *   mapping address.
+ *
+ * size_t point_dirty_size(uint64_t capacity)
+ * 	returns the number of bytes needed to track capacity slots.
+ *
+ * void point_dirty_init(PointDirty* dirty, uint64_t capacity, uint64_t generation)
+ * 	prepares the region with every slot stamped with generation, i.e. as if
+ * 	all of them changed then. Only the writer should call this.
+ *
+ * void point_dirty_mark(PointDirty* dirty, uint64_t slot, uint64_t generation)
+ * 	stamps the slot as changed in the given generation, which must not be
+ * 	older than any generation marked before. The writer makes the stamps
+ * 	visible by publishing the generation (with a release store) once the
+ * 	change is complete. Only the writer may call this.
+ *
+ * int point_dirty_scan(PointDirty* dirty, uint64_t since, uint64_t* position, int* slots, int max)
+ * 	copies into slots (up to max of) the slots stamped after generation since,
+ * 	in increasing order, starting the search at *position and moving it past
+ * 	the slots looked at. Returns the number of slots copied: the scan is
+ * 	complete once *position reaches the capacity. The reader loads the
+ * 	published generation (with an acquire load) before its first call, every
+ * 	change up to that generation is then found. Changes the writer is still
+ * 	making may or may not be.
+ */
+
+/* slots per block, and blocks per group */
+#define POINT_DIRTY_BLOCK  256
+#define POINT_DIRTY_GROUP  64
+
+typedef struct PointDirty {
+	/* zero until initialized, written last */
+	uint64_t capacity;
+	/* byte offsets (from the start of this struct) of the stamps of the groups,
+	of the blocks and of the slots */
+	uint64_t groups_offset;
+	uint64_t blocks_offset;
+	uint64_t slots_offset;
+} PointDirty;
+
+size_t point_dirty_size(uint64_t capacity);
+void point_dirty_init(PointDirty* dirty, uint64_t capacity, uint64_t generation);
+void point_dirty_mark(PointDirty* dirty, uint64_t slot, uint64_t generation);
+int point_dirty_scan(PointDirty* dirty, uint64_t since, uint64_t* position, int* slots, int max);
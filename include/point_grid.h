@@ -0,0 +1,97 @@
+/*
+ * Description:
+ *   Provide a spatial index over the valid points of the segment: a uniform grid
+ *   of square cells (cell_size wide) whose cells are hashed into a fixed number
+ *   of buckets, so the grid has no bounds and its size only depends on the
+ *   number of points. Each bucket holds a chain of the points (slot, x and y)
+ *   that fall in its cells. Like the point index, the grid lives entirely inside
+ *   a (shared memory) region and is addressed by offsets relative to the
+ *   PointGrid.
+ *
+ *   One process (the writer) keeps the grid up to date while any number of
+ *   processes query it without locking: every bucket has a sequence counter
+ *   that the writer makes odd while it changes the chain, and a reader that saw
+ *   the counter move while it walked the chain walks it again.
+ *
+ * size_t point_grid_size(uint32_t capacity)
+ * 	returns the number of bytes needed for a grid over capacity slots.
+ *
+ * void point_grid_init(PointGrid* grid, uint32_t capacity, float cell_size)
+ * 	prepares the region as an empty grid. Only the writer should call this.
+ *
+ * void point_grid_insert(PointGrid* grid, int slot, float x, float y)
+ * 	adds the point held in the slot (or moves it if the slot is already in the
+ * 	grid). Only the writer may call this.
+ *
+ * void point_grid_remove(PointGrid* grid, int slot)
+ * 	removes the point held in the slot, if it is in the grid.
+ *
+ * void point_grid_clear(PointGrid* grid)
+ * 	removes every point.
+ *
+ * int point_grid_range(PointGrid* grid, float min_x, float min_y, float max_x, float max_y, PointGridHit* hits, int max_hits)
+ * 	finds the points inside the box (bounds included) and returns how many
+ * 	there are. Only the first max_hits of them are copied into hits (in no
+ * 	particular order).
+ *
+ * int point_grid_nearest(PointGrid* grid, float x, float y, int k, PointGridHit* hits)
+ * 	finds the (at most) k points nearest to (x, y), copies them into hits
+ * 	nearest first and returns how many were found. The search looks at the
+ * 	rings of cells around (x, y) until no closer point can be left.
+ *
+ * uint32_t point_grid_count(PointGrid* grid)
+ * 	returns the number of points in the grid.
+ *
+ * Queries on a grid that has not been initialized find nothing. A query made
+ * while the writer is busy sees every bucket as it was either before or after
+ * each change, not the grid as a whole at one instant. A query waits for a busy
+ * writer for as long as it takes, but returns -1 (and no hits) if the counter
+ * of a bucket stayed odd for seconds, which a writer that died in the middle
+ * of a change leaves behind.
+ */
+
+#define POINT_GRID_CELL_SIZE  1.0f
+
+typedef struct PointGridHit {
+	int32_t slot;
+	float x;
+	float y;
+	/* squared distance to the query point (point_grid_nearest only) */
+	float distance2;
+} PointGridHit;
+
+typedef struct PointGridEntry {
+	float x;
+	float y;
+	/* next entry of the chain (slot + 1), 0 ends the chain */
+	uint32_t next;
+	/* bucket holding the entry (bucket + 1), 0 when the slot is not in the grid */
+	uint32_t bucket;
+} PointGridEntry;
+
+typedef struct PointGridBucket {
+	/* first entry of the chain (slot + 1), 0 if empty */
+	uint32_t head;
+	/* seqlock, odd while the writer changes the chain */
+	uint32_t seq;
+} PointGridBucket;
+
+typedef struct PointGrid {
+	/* zero until initialized, written last */
+	uint32_t num_buckets;
+	uint32_t capacity;
+	uint32_t count;
+	float cell_size;
+	/* byte offsets (from the start of this struct) of the bucket and entry arrays */
+	uint64_t buckets_offset;
+	uint64_t entries_offset;
+} PointGrid;
+
+size_t point_grid_size(uint32_t capacity);
+void point_grid_init(PointGrid* grid, uint32_t capacity, float cell_size);
+void point_grid_insert(PointGrid* grid, int slot, float x, float y);
+void point_grid_remove(PointGrid* grid, int slot);
+void point_grid_clear(PointGrid* grid);
+int point_grid_range(PointGrid* grid, float min_x, float min_y, float max_x, float max_y, PointGridHit* hits, int max_hits);
+int point_grid_nearest(PointGrid* grid, float x, float y, int k, PointGridHit* hits);
+uint32_t point_grid_count(PointGrid* grid);
@@ -0,0 +1,132 @@
+/*
+ * Description:
+ *   Provide an optional history of every point slot inside a (shared memory)
+ *   region. Each slot has three rings of depth entries: the raw samples (every
+ *   install and invalidation, stamped with the CLOCK_REALTIME time) and two
+ *   downsampled tiers holding the count, min, max and mean of x and y of the
+ *   valid samples per second and per minute. The tiers are maintained as the
+ *   samples are recorded, so nothing has to scan the raw samples later. Like the
+ *   point index, the history is addressed relative to the PointHistory.
+ *
+ *   One process (the writer) records samples while any number of processes
+ *   read the rings in place, without copying and without locking: a reader gets
+ *   a view of the entries in a time range and checks, once it is done with
+ *   them, that the writer has not overwritten any of them in the meantime.
+ *
+ * size_t point_history_size(uint64_t capacity, uint32_t depth)
+ * 	returns the number of bytes needed for the history of capacity slots with
+ * 	depth entries per ring. A depth of 0 (no history) only takes the header.
+ *
+ * void point_history_init(PointHistory* hist, uint64_t capacity, uint32_t depth)
+ * 	prepares the region. A history that is already set up for the same capacity
+ * 	and depth is left as is, so it survives a restart of the writer. Only the
+ * 	writer should call this.
+ *
+ * uint32_t point_history_depth(PointHistory* hist)
+ * 	returns the number of entries kept per ring, 0 if there is no history.
+ *
+ * void point_history_record(PointHistory* hist, int slot, uint64_t timestamp_ns, bool is_valid, float x, float y)
+ * 	appends a sample to the history of the slot. A valid sample is also added
+ * 	to the second and the minute it falls in; a bucket is published to its tier
+ * 	once a sample of a later interval arrives or the point is invalidated. An
+ * 	invalidation of a slot whose last sample is not valid records nothing. The
+ * 	timestamps of a slot never go back, a sample older than the previous one
+ * 	takes its time. Only the writer may call this.
+ *
+ * int point_history_range(PointHistory* hist, int slot, int tier, uint64_t from_ns, uint64_t to_ns, PointHistoryView* view)
+ * 	sets up the view on the entries of the tier (POINT_HISTORY_RAW,
+ * 	POINT_HISTORY_SECONDS or POINT_HISTORY_MINUTES) of the slot that are stamped
+ * 	from_ns to to_ns (both included), oldest first, and returns how many there
+ * 	are. Buckets are stamped with the start of their interval. The entries are
+ * 	not copied: the view points into the rings (in two runs when the range wraps
+ * 	around the end of a ring).
+ *
+ * bool point_history_check(PointHistoryView* view)
+ * 	returns whether the entries of the view were left alone by the writer since
+ * 	point_history_range. A reader should call this after it used the entries and
+ * 	discard what it got (or ask again) if it returns false. The entries are
+ * 	read with plain loads while the writer may be overwriting them, the same
+ * 	race a seqlock reader runs: what was read may be torn, and only means
+ * 	something once this returned true.
+ */
+
+enum {POINT_HISTORY_RAW, POINT_HISTORY_SECONDS, POINT_HISTORY_MINUTES, POINT_HISTORY_TIERS};
+
+/* the largest number of entries per ring */
+#define POINT_HISTORY_MAX_DEPTH 65536
+
+typedef struct PointHistorySample {
+	uint64_t timestamp_ns;
+	float x;
+	float y;
+	int32_t is_valid;
+	uint32_t unused;
+} PointHistorySample;
+
+typedef struct PointHistoryBucket {
+	/* start of the interval */
+	uint64_t start_ns;
+	/* number of valid samples in the interval */
+	uint32_t count;
+	float min_x;
+	float max_x;
+	float min_y;
+	float max_y;
+	float mean_x;
+	float mean_y;
+	uint32_t unused;
+} PointHistoryBucket;
+
+/* a bucket the writer is still filling */
+typedef struct PointHistoryOpen {
+	uint64_t start_ns;
+	uint32_t count;
+	float min_x;
+	float max_x;
+	float min_y;
+	float max_y;
+	uint32_t unused;
+	double sum_x;
+	double sum_y;
+} PointHistoryOpen;
+
+typedef struct PointHistoryTrack {
+	/* position of the next entry of each ring, the entries before it are
+	published */
+	uint64_t head[POINT_HISTORY_TIERS];
+	/* time of the last sample */
+	uint64_t last_ns;
+	PointHistoryOpen open[POINT_HISTORY_TIERS - 1];
+} PointHistoryTrack;
+
+typedef struct PointHistory {
+	/* zero until initialized (or without history), written last */
+	uint32_t depth;
+	uint32_t unused;
+	uint64_t capacity;
+	/* byte offsets (from the start of this struct) of the tracks (one per slot),
+	the raw samples and the buckets of both tiers */
+	uint64_t tracks_offset;
+	uint64_t samples_offset;
+	uint64_t buckets_offset;
+} PointHistory;
+
+typedef struct PointHistoryView {
+	/* samples for POINT_HISTORY_RAW, buckets for the other tiers */
+	union {
+		const PointHistorySample* samples;
+		const PointHistoryBucket* buckets;
+	} runs[2];
+	uint32_t counts[2];
+	/* what point_history_check needs */
+	const uint64_t* head;
+	uint64_t first;
+	uint64_t depth;
+} PointHistoryView;
+
+size_t point_history_size(uint64_t capacity, uint32_t depth);
+void point_history_init(PointHistory* hist, uint64_t capacity, uint32_t depth);
+uint32_t point_history_depth(PointHistory* hist);
+void point_history_record(PointHistory* hist, int slot, uint64_t timestamp_ns, bool is_valid, float x, float y);
+int point_history_range(PointHistory* hist, int slot, int tier, uint64_t from_ns, uint64_t to_ns, PointHistoryView* view);
+bool point_history_check(PointHistoryView* view);
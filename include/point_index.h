@@ -0,0 +1,72 @@
+/*
+ * Description:
+ *   Provide a hash index from sparse 64-bit point ids to slots of the point
+ *   array. The index lives entirely inside a (shared memory) region: buckets and
+ *   entries are referenced by offsets relative to the PointIndex, never by
+ *   pointers, so every process attached to the segment can use it in place no
+ *   matter where the segment is mapped. One process (the writer) may insert
+ *   while any number of processes look up ids concurrently without locking.
+ *   Slots are numbered from 0 to capacity - 1 and hold at most one id each: the
+ *   index keeps the entry bound to every slot, so binding a slot to an id drops
+ *   the id it was bound to before. The entry of a removed (or dropped) id is
+ *   unlinked from its bucket and reused for the next new id, so the index holds
+ *   up to 'capacity' ids at a time however many come and go.
+ *
+ * size_t point_index_size(uint32_t capacity)
+ * 	returns the number of bytes needed for an index of up to capacity ids
+ * 	(at most POINT_INDEX_MAX_CAPACITY).
+ *
+ * void point_index_init(PointIndex* index, uint32_t capacity)
+ * 	prepares the (zero filled) region for use. If the region already holds an
+ * 	index of the same capacity it is left untouched, so ids survive a restart
+ * 	of the writer. Only the writer should call this.
+ *
+ * bool point_index_insert(PointIndex* index, uint64_t id, int slot)
+ * 	binds (or re-binds) the id to the given slot. The id the slot was bound to
+ * 	before (if another) is removed, and so is the binding of the id to its
+ * 	previous slot. Returns false if the slot is out of range or if the index is
+ * 	full. Only the writer may call this.
+ *
+ * bool point_index_remove(PointIndex* index, uint64_t id)
+ * 	removes the id from the index (lookups return POINT_INDEX_NO_SLOT) and
+ * 	frees its entry. Returns false if the id was not bound. Only the writer may
+ * 	call this.
+ *
+ * int point_index_lookup(PointIndex* index, uint64_t id)
+ * 	returns the slot bound to the id, or POINT_INDEX_NO_SLOT if there is none
+ * 	(or if the index has not been initialized yet).
+ */
+
+#define POINT_INDEX_NO_SLOT  -1
+/* the bucket count (twice the capacity) has to fit in 32 bits */
+#define POINT_INDEX_MAX_CAPACITY  (1u << 30)
+
+typedef struct PointIndexEntry {
+	uint64_t id;
+	int32_t slot;
+	/* offset of the next entry of the bucket (entry number + 1), 0 ends the chain */
+	uint32_t next;
+} PointIndexEntry;
+
+typedef struct PointIndex {
+	/* zero until initialized, written last */
+	uint32_t num_buckets;
+	uint32_t capacity;
+	uint32_t count;
+	/* the first of the removed entries (linked through next) */
+	uint32_t free_entries;
+	/* odd while the writer unlinks or reuses an entry, lookups that missed
+	meanwhile walk their chain again */
+	uint32_t moves;
+	/* byte offsets (from the start of this struct) of the bucket and entry
+	arrays, and of the entry bound to each slot (only the writer uses those) */
+	uint32_t buckets_offset;
+	uint64_t entries_offset;
+	uint64_t slots_offset;
+} PointIndex;
+
+size_t point_index_size(uint32_t capacity);
+void point_index_init(PointIndex* index, uint32_t capacity);
+bool point_index_insert(PointIndex* index, uint64_t id, int slot);
+bool point_index_remove(PointIndex* index, uint64_t id);
+int point_index_lookup(PointIndex* index, uint64_t id);
@@ -0,0 +1,96 @@
+/*
+ * Description:
+ *   Provide descriptive statistics over a set of points given as a validity
+ *   bitmap with separate x and y arrays (the PointColumns layout): the count,
+ *   the centroid (mean), the variance and standard deviation, the bounding box
+ *   (min and max) and a fixed-bin 2D histogram, all in a single pass. Only the
+ *   statistics asked for are computed. A summary can be built in pieces (say
+ *   one per thread, over separate chunks of the points) and merged.
+ *
+ *   The sums behind the mean and the variance are taken relative to a shift
+ *   (ideally close to the mean, see point_summary_init), in double precision,
+ *   so the variance does not lose its digits when the points are far from the
+ *   origin. The kernel streams the arrays with AVX2 when the CPU supports it
+ *   (chosen once at run time), the histogram is always filled point by point.
+ *
+ * void point_summary_init(PointSummary* summary, int what, double shift_x, double shift_y)
+ * 	prepares an empty summary of the statistics in what (POINT_SUMMARY_* or'ed
+ * 	together, the count is always there). The histogram settings (bins_x,
+ * 	bins_y, the box and bins) are left alone, the caller sets them up when
+ * 	it asks for POINT_SUMMARY_HISTOGRAM; the bins are cleared.
+ *
+ * void point_summary_split(PointSummary* part, PointSummary* summary, uint64_t* bins)
+ * 	prepares part as an empty summary of the same statistics as summary, with
+ * 	its own (bins_x*bins_y) histogram bins, to be merged back later.
+ *
+ * void point_summary_add(PointSummary* summary, const uint64_t* bitmap, const float* x, const float* y, uint64_t count)
+ * 	adds the valid points among the first count ones. x and y have to be 32
+ * 	byte aligned and padded to a multiple of 64 points.
+ *
+ * void point_summary_merge(PointSummary* summary, PointSummary* part)
+ * 	adds what part collected to summary (both set up for the same statistics).
+ *
+ * void point_summary_finish(PointSummary* summary)
+ * 	works out the mean, variance and standard deviation from the sums. The
+ * 	values asked for are 0 (and the box empty) when there is no valid point.
+ *
+ * bool point_summary_use_kernel(int kernel)
+ * 	selects the kernel used by point_summary_add (POINT_KERNEL_SCALAR or
+ * 	POINT_KERNEL_AVX2). Returns false, leaving the selection alone, if the CPU
+ * 	does not support it.
+ */
+
+enum {
+	POINT_SUMMARY_MEAN = 1,
+	/* implies the mean */
+	POINT_SUMMARY_VARIANCE = 2,
+	POINT_SUMMARY_BOUNDS = 4,
+	POINT_SUMMARY_HISTOGRAM = 8,
+	POINT_SUMMARY_ALL = 15
+};
+
+typedef struct PointSummary {
+	int what;
+
+	/* the histogram: bins_x*bins_y counters (row after row of bins_x, from
+	hist_min_y up) splitting the box evenly, both bounds included. Points
+	outside the box are only counted as outside. */
+	uint32_t bins_x;
+	uint32_t bins_y;
+	float hist_min_x;
+	float hist_max_x;
+	float hist_min_y;
+	float hist_max_y;
+	uint64_t* bins;
+	uint64_t outside;
+
+	uint64_t count;
+	/* the centroid */
+	double mean_x;
+	double mean_y;
+	/* population variance */
+	double var_x;
+	double var_y;
+	double stddev_x;
+	double stddev_y;
+	/* the bounding box */
+	float min_x;
+	float max_x;
+	float min_y;
+	float max_y;
+
+	/* sums of (value - shift) and of its square */
+	double shift_x;
+	double shift_y;
+	double sum_x;
+	double sum_y;
+	double sum2_x;
+	double sum2_y;
+} PointSummary;
+
+void point_summary_init(PointSummary* summary, int what, double shift_x, double shift_y);
+void point_summary_split(PointSummary* part, PointSummary* summary, uint64_t* bins);
+void point_summary_add(PointSummary* summary, const uint64_t* bitmap, const float* x, const float* y, uint64_t count);
+void point_summary_merge(PointSummary* summary, PointSummary* part);
+void point_summary_finish(PointSummary* summary);
+bool point_summary_use_kernel(int kernel);
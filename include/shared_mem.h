@@ -2,13 +2,19 @@
 * Description:
 *   Provide the function prototypes for managing shared memory
 *
-* void* connect_shm(int key, int size)
+* void* connect_shm(int key, size_t size)
 * 	- REQ_conn_1: This function has two arguments:
 * 	  - The first argument serves as the key for the shared memory segment.
 * 	  - The second argument contains the size (in bytes) of the shared memory segment to be allocated.
 * 	- REQ_conn_2: The return value for this function is a pointer to the shared memory area which has been attached (and possibly created) by this function.
 * 	- REQ_conn_3: If, for some reason, this function cannot connect to the shared memory area as requested, it shall return a NULL pointer.
 * 	- REQ_conn_4: A program using this library function must be able to use it to attach the maximum number of shared memory segments to the calling process. (Note that Solaris 11 does not have a limit to the number of attachments, so you can use the limit that Linux supports).
+* 	- The size is 64-bit, segments may be larger than 2 GiB (as far as SHMMAX allows). An existing segment can be attached with any size up to its own, the whole segment is always attached.
+*
+* size_t shm_size(int key)
+*		returns the size (in bytes) of the existing shared memory segment for the
+*		given key, or 0 if there is none. This lets a process attach to a segment
+*		whose size was chosen by another process.
 *
 * int detach_shm(void *addr)
 * 	- REQ_detach_1: This function detaches the shared memory segment attached to the process via the argument addr.
@@ -63,11 +69,12 @@ typedef struct SegmentNode {
 	int key;
 	int shm_id;
 	int lock_id;
-	int size;
+	size_t size;
 	List* attachments;
 } SegmentNode;
 
-void* connect_shm(int key, int size);
+void* connect_shm(int key, size_t size);
+size_t shm_size(int key);
 int detach_shm(void* addr);
 int destroy_shm(int key);
 void show_segments();
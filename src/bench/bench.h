@@ -0,0 +1,18 @@
+/*
+* Description:
+*
+* What the benchmarks have in common:
+*
+*   - double now_ns()
+*
+*  Returns the time of the monotonic clock in nanoseconds, as a double so that
+*  differences can be divided into rates right away.
+*/
+
+#include <time.h>
+
+static double now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1.0e9 + ts.tv_nsec;
+}
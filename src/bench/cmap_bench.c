@@ -0,0 +1,175 @@
+/*
+* Description:
+*
+* Multi-threaded stress benchmark for CMap, the concurrent map used for the
+* shmlib and thread_mgr registries. Each thread performs a mix of lookups and
+* updates (insert/delete) over a shared key range for a fixed duration. The
+* same workload is run against a Hash guarded by a single pthread rwlock to
+* show how throughput scales with the number of threads.
+*
+*     ./cmap_bench [max_threads] [update_percent] [num_keys]
+*
+* A lookup that returns a value stored under another key is counted, and any
+* such lookup is reported as an ERROR at the end of the run.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "hash_table.h"
+#include "cmap.h"
+#include "bench.h"
+
+#define DEFAULT_UPDATE_PERCENT  5
+#define DEFAULT_KEYS            1024
+#define RUN_MS                  300
+
+typedef struct Worker {
+	pthread_t pthread;
+	unsigned int seed;
+	long ops;
+	long errors;
+} Worker;
+
+static CMap* Map;
+static Hash* LockedHash;
+static pthread_rwlock_t HashLock = PTHREAD_RWLOCK_INITIALIZER;
+static bool UseCMap;
+static int UpdatePercent = DEFAULT_UPDATE_PERCENT;
+static int NumKeys = DEFAULT_KEYS;
+static bool Running;
+
+/* every key maps to a value that can be verified, ((key << 1) | 1) is never NULL */
+#define VALUE_FOR(key) ((void*) (intptr_t) (((key) << 1) | 1))
+
+static unsigned int next_rand(unsigned int *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+static void* run_worker(void *args) {
+	Worker *worker = args;
+	unsigned int r;
+	int key;
+	void* value;
+	HashNode* node;
+
+	while (__atomic_load_n(&Running, __ATOMIC_RELAXED)) {
+		r = next_rand(&worker->seed);
+		key = (r >> 8) % NumKeys;
+
+		if (r % 100 < UpdatePercent) {
+			if (UseCMap) {
+				if (r & 0x80) {
+					insert_cmap_item(Map, key, VALUE_FOR(key));
+				} else {
+					delete_cmap_item(Map, key);
+				}
+			} else {
+				pthread_rwlock_wrlock(&HashLock);
+				if (r & 0x80) {
+					insert_hash_item(LockedHash, key, VALUE_FOR(key), sizeof(void*));
+				} else {
+					delete_hash_item(LockedHash, key);
+				}
+				pthread_rwlock_unlock(&HashLock);
+			}
+		} else {
+			if (UseCMap) {
+				value = get_cmap_item(Map, key);
+			} else {
+				pthread_rwlock_rdlock(&HashLock);
+				node = get_hash_item(LockedHash, key);
+				value = node == NULL ? NULL : node->value;
+				pthread_rwlock_unlock(&HashLock);
+			}
+			if (value != NULL && value != VALUE_FOR(key)) {
+				worker->errors++;
+			}
+		}
+		worker->ops++;
+	}
+	return NULL;
+}
+
+static double run(int num_threads, long *errors) {
+	int idx, key;
+	long ops = 0;
+	double start, elapsed;
+	Worker *workers = calloc(num_threads, sizeof(Worker));
+
+	Map = new_cmap(NumKeys);
+	LockedHash = new_hash(NumKeys);
+	/* start half full so lookups see a mix of hits and misses */
+	for (key = 0; key < NumKeys; key += 2) {
+		insert_cmap_item(Map, key, VALUE_FOR(key));
+		insert_hash_item(LockedHash, key, VALUE_FOR(key), sizeof(void*));
+	}
+
+	__atomic_store_n(&Running, true, __ATOMIC_RELAXED);
+	start = now_ns();
+	for (idx = 0; idx < num_threads; idx++) {
+		workers[idx].seed = 2463534242u + idx*7919;
+		pthread_create(&workers[idx].pthread, NULL, run_worker, &workers[idx]);
+	}
+	usleep(RUN_MS*1000);
+	__atomic_store_n(&Running, false, __ATOMIC_RELAXED);
+	for (idx = 0; idx < num_threads; idx++) {
+		pthread_join(workers[idx].pthread, NULL);
+		ops += workers[idx].ops;
+		*errors += workers[idx].errors;
+	}
+	elapsed = now_ns() - start;
+
+	destroy_cmap(Map);
+	destroy_hash(LockedHash);
+	free(workers);
+	return ops / (elapsed / 1.0e9);
+}
+
+int main(int argc, char *argv[]) {
+	int num_threads;
+	long errors = 0;
+	double cmap_ops, hash_ops, cmap_base = 0, hash_base = 0;
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (argc > 1) {
+		max_threads = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		UpdatePercent = atoi(argv[2]);
+	}
+	if (argc > 3) {
+		NumKeys = atoi(argv[3]);
+	}
+	if (max_threads < 1 || UpdatePercent < 0 || UpdatePercent > 100 || NumKeys < 2) {
+		printf("usage: %s [max_threads] [update_percent] [num_keys]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%d keys, %d%% updates, %d ms per run\n", NumKeys, UpdatePercent, RUN_MS);
+	printf("  threads %16s %8s %16s %8s\n", "CMap ops/sec", "scale", "Hash+rwlock", "scale");
+	for (num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+		UseCMap = true;
+		cmap_ops = run(num_threads, &errors);
+		UseCMap = false;
+		hash_ops = run(num_threads, &errors);
+		if (num_threads == 1) {
+			cmap_base = cmap_ops;
+			hash_base = hash_ops;
+		}
+		printf("  %7d %16.0f %7.2fx %16.0f %7.2fx\n", num_threads,
+					 cmap_ops, cmap_ops / cmap_base, hash_ops, hash_ops / hash_base);
+	}
+
+	if (errors != 0) {
+		printf("ERROR: %ld lookups returned a value for the wrong key\n", errors);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,152 @@
+/*
+* Description:
+*
+* Benchmark for point_segment_changed: the time a reader takes to find the points
+* changed since the generation it last saw, against a scan of every point (what
+* show_points did each second), in a segment of num_points points with 0, 1, 16,
+* 1024 and 65536 random points changed between two looks.
+*
+*     ./dirty_bench [num_points] [rounds]
+*
+* Every scan has to find exactly the indices that were changed, a scan that
+* finds more or fewer is reported as an ERROR.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "point_index.h"
+#include "change_ring.h"
+#include "point_columns.h"
+#include "point_grid.h"
+#include "point_history.h"
+#include "point_summary.h"
+#include "point.h"
+#include "bench.h"
+
+#define DEFAULT_POINTS   (4*1024*1024)
+#define DEFAULT_ROUNDS   10
+#define MAX_CHANGES      65536
+#define SCAN_BATCH       256
+
+static int compare_ints(const void* a, const void* b) {
+	return *(const int*) a - *(const int*) b;
+}
+
+/* changes count random points (each at most once) in a batch and sorts their indices */
+static int change_points(void* segment, long num_points, int count, unsigned int* state, int* changed) {
+	int idx, distinct = 0;
+	static Point points[MAX_CHANGES];
+
+	for (idx = 0; idx < count; idx++) {
+		*state ^= *state << 13;
+		*state ^= *state >> 17;
+		*state ^= *state << 5;
+		changed[idx] = *state % num_points;
+	}
+	qsort(changed, count, sizeof(int), compare_ints);
+	for (idx = 0; idx < count; idx++) {
+		if (idx == 0 || changed[idx] != changed[idx - 1]) {
+			changed[distinct++] = changed[idx];
+		}
+	}
+	for (idx = 0; idx < distinct; idx++) {
+		points[idx].is_valid = 1;
+		points[idx].x = (float) idx;
+		points[idx].y = (float) changed[idx];
+	}
+	if (distinct > 0) {
+		install_points_batch(segment, changed, points, distinct);
+	}
+	return distinct;
+}
+
+/* what a reader does each second: one load, and a scan if anything changed */
+static int find_changes(void* segment, uint64_t* generation, int* found) {
+	int count, total = 0;
+	uint64_t position = 0;
+	uint64_t now = point_segment_generation(segment);
+
+	if (now == *generation) {
+		return 0;
+	}
+	do {
+		count = point_segment_changed(segment, *generation, &position, found + total, SCAN_BATCH);
+		total += count;
+	} while (count == SCAN_BATCH && total + SCAN_BATCH <= MAX_CHANGES);
+	*generation = now;
+	return total;
+}
+
+/* the full scan the changed points replace */
+static long scan_all(void* segment, long num_points) {
+	long idx, valid = 0;
+	Point point;
+
+	for (idx = 0; idx < num_points; idx++) {
+		valid += get_point(segment, idx, &point);
+	}
+	return valid;
+}
+
+int main(int argc, char *argv[]) {
+	int set, round, count, found_count, errors = 0;
+	int counts[] = {0, 1, 16, 1024, MAX_CHANGES};
+	unsigned int state = 2463534242u;
+	long num_points = DEFAULT_POINTS;
+	int rounds = DEFAULT_ROUNDS;
+	int *changed, *found;
+	uint64_t generation;
+	double start, scan_time = 0, full_time;
+	void *segment;
+
+	if (argc > 1) {
+		num_points = atol(argv[1]);
+	}
+	if (argc > 2) {
+		rounds = atoi(argv[2]);
+	}
+	if (num_points < 1 || num_points > POINT_MAX_CAPACITY || rounds < 1) {
+		printf("usage: %s [num_points] [rounds]\n", argv[0]);
+		return 1;
+	}
+
+	changed = malloc(MAX_CHANGES*sizeof(int));
+	found = malloc(MAX_CHANGES*sizeof(int));
+	if (posix_memalign(&segment, 64, point_segment_size(num_points, 0)) || changed == NULL || found == NULL) {
+		printf("unable to allocate %ld points\n", num_points);
+		return 1;
+	}
+	memset(segment, 0, point_segment_size(num_points, 0));
+	point_segment_init(segment, num_points, POINT_LAYOUT_AOS, POINT_GRID_CELL_SIZE, 0);
+	generation = point_segment_generation(segment);
+
+	start = now_ns();
+	scan_all(segment, num_points);
+	full_time = now_ns() - start;
+	printf("%ld points, full scan %10.3f ms\n", num_points, full_time / 1.0e6);
+
+	for (set = 0; set < 5; set++) {
+		scan_time = 0;
+		for (round = 0; round < rounds; round++) {
+			count = change_points(segment, num_points, counts[set], &state, changed);
+			start = now_ns();
+			found_count = find_changes(segment, &generation, found);
+			scan_time += now_ns() - start;
+
+			if (found_count != count || memcmp(found, changed, count*sizeof(int))) {
+				printf("ERROR: %d points changed, %d found\n", count, found_count);
+				errors++;
+			}
+		}
+		printf("  %6d changed   %10.3f ms/look   %8.1fx faster than a full scan\n", counts[set],
+		       scan_time / rounds / 1.0e6, full_time / (scan_time / rounds));
+	}
+
+	free(changed);
+	free(found);
+	free(segment);
+	return errors != 0;
+}
@@ -0,0 +1,220 @@
+/*
+* Description:
+*
+* Benchmark for the number formatting of the log library: log_format_fixed
+* against snprintf for the "%2.3f" the point lines are written with, and a
+* whole point line built with the log_append helpers (as show_points does)
+* against the snprintf of its format (as log_event did).
+*
+*     ./fmt_bench [values] [rounds]
+*
+* Before anything is timed, log_format_fixed is checked byte for byte against
+* snprintf: for float coordinates, for doubles of every magnitude it handles
+* itself (and some it leaves to snprintf), for exact halves (which are rounded
+* to even) and for a range of widths (left justified too) and precisions. The
+* first few differences are printed, and any difference makes the benchmark
+* fail.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+#include "log_mgr.h"
+#include "log_format.h"
+#include "bench.h"
+
+#define DEFAULT_VALUES  1000000
+#define DEFAULT_ROUNDS  3
+/* values checked against snprintf for each kind, and differences printed */
+#define CHECKS          1000000
+#define MAX_REPORTED    10
+
+/* the line show_points writes for a point */
+#define POINT_FORMAT  "   ├── Idx:%" PRIu64 " = Point(is_valid=%d, x=%2.3f, y=%2.3f)"
+
+static uint64_t State = 88172645463325252ull;
+static long Sink = 0;
+
+/* xorshift64, identical across runs */
+static uint64_t next_random() {
+	State ^= State << 13;
+	State ^= State >> 7;
+	State ^= State << 17;
+	return State;
+}
+
+/* a float coordinate such as the input files hold, in [-1000, 1000) */
+static float random_coordinate() {
+	return (float) ((int64_t) (next_random() % 2000000) - 1000000) / 1000.0f;
+}
+
+/* a double with random bits, finite and below 2^60 in magnitude */
+static double random_double() {
+	double value;
+	uint64_t bits;
+
+	do {
+		bits = next_random();
+		memcpy(&value, &bits, sizeof(value));
+	} while (isnan(value) || isinf(value) || fabs(value) >= 1152921504606846976.0);
+	return value;
+}
+
+/* compares one value, printing the first few differences */
+static bool check_value(double value, int width, int precision, long* errors) {
+	int expected_len, len;
+	char expected[512], text[512];
+
+	expected_len = snprintf(expected, sizeof(expected), "%*.*f", width, precision, value);
+	len = log_format_fixed(text, sizeof(text), value, width, precision);
+	if (len == expected_len && !strcmp(text, expected)) {
+		return true;
+	}
+	if ((*errors)++ < MAX_REPORTED) {
+		printf("  ERROR: %%%d.%df of %a is \"%s\", snprintf writes \"%s\"\n", width, precision, value, text, expected);
+	}
+	return false;
+}
+
+static long check() {
+	long idx, errors = 0;
+	int width, precision;
+
+	for (idx = 0; idx < CHECKS; idx++) {
+		check_value(random_coordinate(), 2, 3, &errors);
+		check_value(random_double(), 2, 3, &errors);
+		/* exact halves at the third decimal (k/16000 has them at every 1/2000) */
+		check_value((double) ((int64_t) (next_random() % 64000000) - 32000000) / 16000.0, 2, 3, &errors);
+		/* small values, which round to (a signed) zero */
+		check_value(ldexp((double) (next_random() % 1000), -(int) (next_random() % 1100)) * (idx & 1 ? -1 : 1),
+		            2, 3, &errors);
+	}
+	/* a negative width left justifies */
+	for (width = -12; width <= 12; width++) {
+		for (precision = 0; precision <= 10; precision++) {
+			for (idx = 0; idx < CHECKS / 100; idx++) {
+				check_value(random_coordinate(), width, precision, &errors);
+				check_value(random_double() / 1e6, width, precision, &errors);
+			}
+			check_value(0.0, width, precision, &errors);
+			check_value(-0.0, width, precision, &errors);
+			check_value(0.5, width, precision, &errors);
+			check_value(1.5, width, precision, &errors);
+			check_value(2.5, width, precision, &errors);
+			check_value(-2.5, width, precision, &errors);
+			check_value(9007199254740991.0, width, precision, &errors);
+			check_value(1e300, width, precision, &errors);
+			check_value(INFINITY, width, precision, &errors);
+			check_value(-INFINITY, width, precision, &errors);
+			check_value(NAN, width, precision, &errors);
+		}
+	}
+	return errors;
+}
+
+static void report(const char* what, const char* impl, double ns, long ops) {
+	printf("  %-11s %-9s %8.1f ns/op %12.0f ops/sec\n", what, impl, ns/ops, ops/(ns/1.0e9));
+}
+
+static void time_values(float* values, long count) {
+	long idx;
+	double start, with_snprintf, with_fixed;
+	char text[64];
+
+	start = now_ns();
+	for (idx = 0; idx < count; idx++) {
+		Sink += snprintf(text, sizeof(text), "%2.3f", values[idx]);
+	}
+	with_snprintf = now_ns() - start;
+	report("%2.3f", "snprintf", with_snprintf, count);
+
+	start = now_ns();
+	for (idx = 0; idx < count; idx++) {
+		Sink += log_format_fixed(text, sizeof(text), values[idx], 2, 3);
+	}
+	with_fixed = now_ns() - start;
+	report("%2.3f", "fixed", with_fixed, count);
+	printf("  (%.1fx)\n", with_snprintf / with_fixed);
+}
+
+/* returns false if a line built with the helpers differs */
+static bool time_lines(float* values, long count) {
+	long idx;
+	bool same = true;
+	double start, with_snprintf, with_helpers;
+	char text[LOG_LINE_SIZE];
+	LogLine line;
+
+	start = now_ns();
+	for (idx = 0; idx + 1 < count; idx += 2) {
+		Sink += snprintf(text, sizeof(text), POINT_FORMAT, (uint64_t) idx, 1, values[idx], values[idx + 1]);
+	}
+	with_snprintf = now_ns() - start;
+	report("point line", "snprintf", with_snprintf, count / 2);
+
+	start = now_ns();
+	for (idx = 0; idx + 1 < count; idx += 2) {
+		log_line_start(&line);
+		log_append_string(&line, "   ├── Idx:");
+		log_append_uint(&line, idx);
+		log_append_string(&line, " = Point(is_valid=");
+		log_append_int(&line, 1);
+		log_append_string(&line, ", x=");
+		log_append_fixed(&line, values[idx], 2, 3);
+		log_append_string(&line, ", y=");
+		log_append_fixed(&line, values[idx + 1], 2, 3);
+		log_append_string(&line, ")");
+		Sink += line.length;
+	}
+	with_helpers = now_ns() - start;
+	report("point line", "helpers", with_helpers, count / 2);
+	printf("  (%.1fx)\n", with_snprintf / with_helpers);
+
+	/* the last line is compared */
+	if (count >= 2) {
+		idx = (count - 2) & ~1L;
+		snprintf(text, sizeof(text), POINT_FORMAT, (uint64_t) idx, 1, values[idx], values[idx + 1]);
+		same = line.length == strlen(text) && !memcmp(line.text, text, line.length);
+		if (!same) {
+			printf("  ERROR: the line \"%.*s\" should be \"%s\"\n", (int) line.length, line.text, text);
+		}
+	}
+	return same;
+}
+
+int main(int argc, char *argv[]) {
+	long idx, errors, count = DEFAULT_VALUES;
+	int round, rounds = DEFAULT_ROUNDS;
+	float *values;
+
+	if (argc > 1) {
+		count = atol(argv[1]);
+	}
+	if (argc > 2) {
+		rounds = atoi(argv[2]);
+	}
+	if (count < 2 || rounds < 1) {
+		printf("usage: %s [values >= 2] [rounds >= 1]\n", argv[0]);
+		return 1;
+	}
+
+	errors = check();
+	printf("checked against snprintf: %ld differences\n", errors);
+
+	values = malloc(count * sizeof(float));
+	for (idx = 0; idx < count; idx++) {
+		values[idx] = random_coordinate();
+	}
+	for (round = 1; round <= rounds; round++) {
+		printf("round %d (%ld values)\n", round, count);
+		time_values(values, count);
+		errors += !time_lines(values, count);
+	}
+	printf("(sink %ld)\n", Sink);
+	free(values);
+	return errors != 0;
+}
@@ -0,0 +1,282 @@
+/*
+* Description:
+*
+* Microbenchmark for insert, lookup, delete and iterate over the libstore hash
+* tables. Hash is an (out of line) wrapper over the generic HashNodeMap, IdMap
+* is a typed map generated here with MAP_DEFINE so that every operation is
+* inlined (64-bit keys, int values, no void* boxing). OldHash is a copy of the
+* table Hash used to be, kept here as the baseline: a node malloc'd per insert,
+* a fixed number of slots (it is given twice the keys, since it cannot grow),
+* deletes that empty the slot and iteration over every slot.
+*
+*     ./hash_bench [num_keys] [rounds]
+*
+* The iterate case mirrors how SegmentNodes is used: a table created with
+* SHM_MAX_SEGMENTS slots holding only a handful of segments.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "map_gen.h"
+#include "hash_table.h"
+#include "list.h"
+#include "shared_mem.h"
+#include "bench.h"
+
+#define DEFAULT_KEYS    100000
+#define DEFAULT_ROUNDS  5
+#define FEW_SEGMENTS    8
+#define ITERATIONS      100000
+
+static long Visited = 0;
+
+MAP_DEFINE(IdMap, uint64_t, int, map_hash_u64, map_eq_u64)
+
+/* the table Hash used to be, with linear probing over node pointers */
+typedef struct OldHash {
+	int size;
+	HashNode* hash_array[];
+} OldHash;
+
+static OldHash* old_new(int size) {
+	OldHash *hash = malloc(sizeof(OldHash) + size*sizeof(HashNode*));
+	hash->size = size;
+	memset(hash->hash_array, 0, size*sizeof(HashNode*));
+	return hash;
+}
+
+static HashNode* old_get(OldHash* hash, int key) {
+	int idx = ((unsigned int) key) % hash->size;
+
+	while (hash->hash_array[idx] != NULL) {
+		if (hash->hash_array[idx]->key == key) {
+			return hash->hash_array[idx];
+		}
+		idx = (idx + 1) % hash->size;
+	}
+	return NULL;
+}
+
+static void old_insert(OldHash* hash, int key, void* value, int size) {
+	HashNode *item = malloc(sizeof(HashNode));
+	int idx = ((unsigned int) key) % hash->size;
+
+	item->key = key;
+	item->size = size;
+	item->value = value;
+	while (hash->hash_array[idx] != NULL && hash->hash_array[idx]->key != key) {
+		idx = (idx + 1) % hash->size;
+	}
+	/* an overwritten node leaked, as it did */
+	hash->hash_array[idx] = item;
+}
+
+/* emptying the slot cuts the probe chains running through it, as it did */
+static bool old_delete(OldHash* hash, int key) {
+	int idx = ((unsigned int) key) % hash->size;
+
+	while (hash->hash_array[idx] != NULL) {
+		if (hash->hash_array[idx]->key == key) {
+			free(hash->hash_array[idx]);
+			hash->hash_array[idx] = NULL;
+			return true;
+		}
+		idx = (idx + 1) % hash->size;
+	}
+	return false;
+}
+
+static void old_iterate(OldHash* hash, void (*processor)(void *)) {
+	int idx;
+
+	for (idx = 0; idx < hash->size; idx++) {
+		if (hash->hash_array[idx] != NULL) {
+			(*processor)(hash->hash_array[idx]);
+		}
+	}
+}
+
+static void old_destroy(OldHash* hash) {
+	int idx;
+
+	for (idx = 0; idx < hash->size; idx++) {
+		free(hash->hash_array[idx]);
+	}
+	free(hash);
+}
+
+static void count_node(void *node) {
+	Visited += ((HashNode*) node)->key & 1;
+}
+
+static int* make_keys(int num_keys) {
+	int idx;
+	unsigned int state = 2463534242u;
+	int *keys = malloc(num_keys*sizeof(int));
+
+	/* xorshift, distinct enough for a benchmark and identical across runs */
+	for (idx=0; idx<num_keys; idx++) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		keys[idx] = (int) (state & 0x7fffffff);
+	}
+	return keys;
+}
+
+static void report(const char* op, const char* impl, double ns, long ops) {
+	printf("  %-8s %-7s %10.2f ns/op %12.0f ops/sec\n", op, impl, ns/ops, ops/(ns/1.0e9));
+}
+
+static void bench_hash(int* keys, int num_keys, int size_hint, const char* impl) {
+	int idx;
+	long found = 0;
+	double start;
+	Hash* hash = new_hash(size_hint);
+
+	start = now_ns();
+	for (idx=0; idx<num_keys; idx++) {
+		insert_hash_item(hash, keys[idx], NULL, 0);
+	}
+	report("insert", impl, now_ns() - start, num_keys);
+
+	start = now_ns();
+	for (idx=0; idx<num_keys; idx++) {
+		found += get_hash_item(hash, keys[idx]) != NULL;
+	}
+	report("lookup", impl, now_ns() - start, num_keys);
+
+	start = now_ns();
+	for (idx=0; idx<num_keys; idx++) {
+		delete_hash_item(hash, keys[idx]);
+	}
+	report("delete", impl, now_ns() - start, num_keys);
+
+	destroy_hash(hash);
+	printf("  (%s found %ld of %d keys)\n", impl, found, num_keys);
+}
+
+static void bench_old(int* keys, int num_keys) {
+	int idx;
+	long found = 0;
+	double start;
+	OldHash* hash = old_new(2*num_keys);
+
+	start = now_ns();
+	for (idx=0; idx<num_keys; idx++) {
+		old_insert(hash, keys[idx], NULL, 0);
+	}
+	report("insert", "OldHash", now_ns() - start, num_keys);
+
+	start = now_ns();
+	for (idx=0; idx<num_keys; idx++) {
+		found += old_get(hash, keys[idx]) != NULL;
+	}
+	report("lookup", "OldHash", now_ns() - start, num_keys);
+
+	start = now_ns();
+	for (idx=0; idx<num_keys; idx++) {
+		old_delete(hash, keys[idx]);
+	}
+	report("delete", "OldHash", now_ns() - start, num_keys);
+
+	old_destroy(hash);
+	printf("  (OldHash found %ld of %d keys)\n", found, num_keys);
+}
+
+static void bench_typed(int* keys, int num_keys) {
+	int idx;
+	long found = 0;
+	double start;
+	IdMap map;
+
+	IdMap_init(&map, 0);
+
+	start = now_ns();
+	for (idx=0; idx<num_keys; idx++) {
+		IdMap_put(&map, (uint64_t) keys[idx] << 20, idx);
+	}
+	report("insert", "IdMap", now_ns() - start, num_keys);
+
+	start = now_ns();
+	for (idx=0; idx<num_keys; idx++) {
+		found += IdMap_get(&map, (uint64_t) keys[idx] << 20) != NULL;
+	}
+	report("lookup", "IdMap", now_ns() - start, num_keys);
+
+	start = now_ns();
+	for (idx=0; idx<num_keys; idx++) {
+		IdMap_del(&map, (uint64_t) keys[idx] << 20);
+	}
+	report("delete", "IdMap", now_ns() - start, num_keys);
+
+	IdMap_destroy(&map);
+	printf("  (IdMap found %ld of %d keys)\n", found, num_keys);
+}
+
+static void bench_iterate(int* keys) {
+	int idx;
+	double start;
+	Hash* hash = new_hash(SHM_MAX_SEGMENTS);
+	OldHash* old;
+
+	for (idx=0; idx<FEW_SEGMENTS; idx++) {
+		insert_hash_item(hash, keys[idx], NULL, 0);
+	}
+
+	start = now_ns();
+	for (idx=0; idx<ITERATIONS; idx++) {
+		iterate_hash(hash, count_node);
+	}
+	report("iterate", "Hash", now_ns() - start, ITERATIONS);
+	destroy_hash(hash);
+
+	old = old_new(SHM_MAX_SEGMENTS);
+	for (idx=0; idx<FEW_SEGMENTS; idx++) {
+		old_insert(old, keys[idx], NULL, 0);
+	}
+
+	start = now_ns();
+	for (idx=0; idx<ITERATIONS; idx++) {
+		old_iterate(old, count_node);
+	}
+	report("iterate", "OldHash", now_ns() - start, ITERATIONS);
+	old_destroy(old);
+}
+
+int main(int argc, char *argv[]) {
+	int round;
+	int num_keys = DEFAULT_KEYS;
+	int rounds = DEFAULT_ROUNDS;
+	int *keys;
+
+	if (argc > 1) {
+		num_keys = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		rounds = atoi(argv[2]);
+	}
+	if (num_keys < FEW_SEGMENTS || rounds < 1) {
+		printf("usage: %s [num_keys >= %d] [rounds >= 1]\n", argv[0], FEW_SEGMENTS);
+		return 1;
+	}
+
+	keys = make_keys(num_keys);
+	for (round=0; round<rounds; round++) {
+		printf("round %d (%d keys, iterate over %d of %d slots)\n",
+					 round, num_keys, FEW_SEGMENTS, SHM_MAX_SEGMENTS);
+		/* sized up front, and growing from empty */
+		bench_hash(keys, num_keys, num_keys, "Hash");
+		bench_hash(keys, num_keys, 0, "Hash+");
+		bench_old(keys, num_keys);
+		bench_typed(keys, num_keys);
+		bench_iterate(keys);
+	}
+
+	free(keys);
+	printf("(visited %ld)\n", Visited);
+	return 0;
+}
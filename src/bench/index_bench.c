@@ -0,0 +1,209 @@
+/*
+* Description:
+*
+* Benchmark for the point id index: lookups of bound and unknown ids, and the
+* writer rebinding slots to new ids (each rebind drops the id the slot held),
+* in an index of num_ids slots.
+*
+*     ./index_bench [num_ids] [rounds]
+*
+* Before anything is timed, rebinding is checked: an id dropped from its slot
+* must not resolve to it anymore, an id moved to another slot must leave the
+* first, the entry of a removed id is reused so that ids coming and going never
+* fill the index, and a reader looking ids up while the writer rebinds must only
+* ever find an id at its own slot. Each broken expectation is printed, and
+* the exit status is 1 if there was any.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "point_index.h"
+#include "bench.h"
+
+#define DEFAULT_IDS     (1024*1024)
+#define DEFAULT_ROUNDS  5
+/* ids k and k + CHECK_SLOTS compete for slot k of the concurrent check */
+#define CHECK_SLOTS     1024
+#define CHECK_REBINDS   2000000
+
+static long Sink = 0;
+static long Errors = 0;
+
+static void expect(bool ok, const char* what) {
+	if (!ok) {
+		printf("  ERROR: %s\n", what);
+		Errors++;
+	}
+}
+
+static PointIndex* new_index(uint32_t capacity) {
+	PointIndex* index = calloc(1, point_index_size(capacity));
+	point_index_init(index, capacity);
+	return index;
+}
+
+static void check_rebinding() {
+	uint32_t count;
+	uint64_t id;
+	PointIndex* index = new_index(8);
+
+	expect(point_index_insert(index, 100, 3) && point_index_lookup(index, 100) == 3, "bind 100 to slot 3");
+	expect(point_index_insert(index, 200, 3), "bind 200 to slot 3");
+	expect(point_index_lookup(index, 200) == 3, "200 resolves to slot 3");
+	expect(point_index_lookup(index, 100) == POINT_INDEX_NO_SLOT, "100 dropped from slot 3");
+
+	expect(point_index_insert(index, 200, 5), "move 200 to slot 5");
+	expect(point_index_lookup(index, 200) == 5, "200 resolves to slot 5");
+	expect(point_index_insert(index, 300, 3) && point_index_lookup(index, 200) == 5,
+	       "binding slot 3 again leaves 200 at slot 5");
+	expect(point_index_insert(index, 400, 5) && point_index_lookup(index, 200) == POINT_INDEX_NO_SLOT,
+	       "200 dropped from slot 5");
+	expect(point_index_insert(index, 100, 1) && point_index_lookup(index, 100) == 1, "100 bound again");
+
+	expect(!point_index_insert(index, 500, 8) && !point_index_insert(index, 500, -1), "slots out of range refused");
+	expect(point_index_remove(index, 300) && point_index_lookup(index, 300) == POINT_INDEX_NO_SLOT, "remove 300");
+	expect(!point_index_remove(index, 300) && !point_index_remove(index, 999), "remove unbound ids");
+	expect(point_index_insert(index, 600, 3) && point_index_lookup(index, 600) == 3, "slot 3 free again");
+
+	/* the entry of a removed id is taken by the next new id */
+	count = index->count;
+	expect(point_index_remove(index, 600), "remove 600");
+	expect(point_index_insert(index, 700, 2) && index->count == count, "entry of 600 reused");
+	expect(point_index_lookup(index, 700) == 2 && point_index_lookup(index, 600) == POINT_INDEX_NO_SLOT,
+	       "600 replaced by 700");
+	free(index);
+
+	/* churn through many more ids than entries */
+	index = new_index(4);
+	for (id = 1; id < 100000; id++) {
+		if (!point_index_insert(index, id * 7919, id % 4)) {
+			expect(false, "churn fills the index");
+			break;
+		}
+	}
+	expect(index->count == 4 && point_index_lookup(index, 99999 * 7919) == 3
+	       && point_index_lookup(index, 99995 * 7919) == POINT_INDEX_NO_SLOT, "one entry for each slot");
+	free(index);
+}
+
+typedef struct ReaderWork {
+	PointIndex* index;
+	bool done;
+	long lookups;
+	long found;
+	long wrong;
+} ReaderWork;
+
+/* a lookup may miss while an id is rebound, but never finds it at another slot */
+static void* read_ids(void* arg) {
+	ReaderWork* work = arg;
+	uint64_t id;
+	int slot;
+	unsigned int state = 2463534242u;
+
+	while (!__atomic_load_n(&work->done, __ATOMIC_ACQUIRE)) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		id = 1 + state % (4*CHECK_SLOTS);
+		slot = point_index_lookup(work->index, id);
+		if (slot != POINT_INDEX_NO_SLOT) {
+			work->found++;
+			if ((uint64_t) slot != (id - 1) % CHECK_SLOTS) {
+				work->wrong++;
+			}
+		}
+		work->lookups++;
+	}
+	return NULL;
+}
+
+static void check_concurrent() {
+	long idx;
+	uint64_t id;
+	pthread_t reader;
+	ReaderWork work = {new_index(CHECK_SLOTS), false, 0, 0, 0};
+	unsigned int state = 88675123u;
+
+	pthread_create(&reader, NULL, read_ids, &work);
+	for (idx = 0; idx < CHECK_REBINDS; idx++) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		id = 1 + state % (4*CHECK_SLOTS);
+		if (idx % 3 == 0) {
+			point_index_remove(work.index, id);
+		} else if (!point_index_insert(work.index, id, (id - 1) % CHECK_SLOTS)) {
+			expect(false, "rebinding filled the index");
+			break;
+		}
+	}
+	__atomic_store_n(&work.done, true, __ATOMIC_RELEASE);
+	pthread_join(reader, NULL);
+
+	printf("  concurrent: %ld lookups, %ld found, %ld at the wrong slot\n", work.lookups, work.found, work.wrong);
+	expect(work.wrong == 0, "a lookup found an id at another slot");
+	free(work.index);
+}
+
+static void report(const char* what, double ns, long ops) {
+	printf("  %-8s %8.1f ns/op %12.0f ops/sec\n", what, ns/ops, ops/(ns/1.0e9));
+}
+
+static void bench(PointIndex* index, uint32_t num_ids, int round) {
+	uint32_t idx;
+	uint64_t base = (uint64_t) round * num_ids;
+	double start;
+
+	/* each round binds every slot to a new id, dropping the ids of the round before */
+	start = now_ns();
+	for (idx = 0; idx < num_ids; idx++) {
+		point_index_insert(index, ((base + idx) << 20) | 1, idx);
+	}
+	report("rebind", now_ns() - start, num_ids);
+
+	start = now_ns();
+	for (idx = 0; idx < num_ids; idx++) {
+		Sink += point_index_lookup(index, ((base + idx) << 20) | 1);
+	}
+	report("hit", now_ns() - start, num_ids);
+
+	start = now_ns();
+	for (idx = 0; idx < num_ids; idx++) {
+		Sink += point_index_lookup(index, ((base + idx) << 20) | 2);
+	}
+	report("miss", now_ns() - start, num_ids);
+}
+
+int main(int argc, char *argv[]) {
+	int round, rounds = DEFAULT_ROUNDS;
+	long num_ids = DEFAULT_IDS;
+	PointIndex* index;
+
+	if (argc > 1) {
+		num_ids = atol(argv[1]);
+	}
+	if (argc > 2) {
+		rounds = atoi(argv[2]);
+	}
+	if (num_ids < 1 || num_ids > POINT_INDEX_MAX_CAPACITY || rounds < 1) {
+		printf("usage: %s [num_ids in 1..%u] [rounds >= 1]\n", argv[0], POINT_INDEX_MAX_CAPACITY);
+		return 1;
+	}
+
+	check_rebinding();
+	check_concurrent();
+	printf("checked rebinding: %ld errors\n", Errors);
+
+	index = new_index(num_ids);
+	for (round = 0; round < rounds; round++) {
+		printf("round %d (%ld ids)\n", round, num_ids);
+		bench(index, num_ids, round);
+	}
+	free(index);
+	printf("(sink %ld)\n", Sink);
+	return Errors != 0;
+}
@@ -0,0 +1,221 @@
+/*
+* Description:
+*
+* Microbenchmark for push, iterate and remove over the libstore lists. List
+* mallocs a node per push and stores a pointer to the caller's value, ChunkList
+* copies the values inline into cache line aligned blocks, DList links items
+* through a DListLink embedded in the (caller allocated) item. The List and
+* ChunkList are also run inside an Arena, where teardown is a single reset.
+*
+*     ./list_bench [num_items] [rounds]
+*
+* The values pushed are PointTasks, the same records install_data keeps.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "arena.h"
+#include "list.h"
+#include "point_index.h"
+#include "change_ring.h"
+#include "point_columns.h"
+#include "point_grid.h"
+#include "point_history.h"
+#include "point_summary.h"
+#include "point.h"
+#include "bench.h"
+
+#define DEFAULT_ITEMS   100000
+#define DEFAULT_ROUNDS  5
+/* removals are O(n) for List, keep the count small enough to finish */
+#define REMOVALS        1000
+
+typedef struct LinkedTask {
+	DListLink link;
+	PointTask task;
+} LinkedTask;
+
+static double Sum = 0;
+
+static void report(const char* op, const char* impl, double ns, long ops) {
+	printf("  %-8s %-9s %10.2f ns/op %12.0f ops/sec\n", op, impl, ns/ops, ops/(ns/1.0e9));
+}
+
+static void sum_task(void *task) {
+	Sum += ((PointTask*) task)->point.x;
+}
+
+static void sum_link(DListLink *link) {
+	Sum += DLIST_ITEM(link, LinkedTask, link)->task.point.x;
+}
+
+static void fill_task(PointTask *task, int idx) {
+	task->id = idx + 1;
+	task->index = idx % DEFAULT_NUM_POINTS;
+	task->delay = 0;
+	task->point.is_valid = 1;
+	task->point.x = idx & 0xff;
+	task->point.y = 1.0;
+}
+
+static void bench_list(int num_items) {
+	int idx;
+	double start;
+	List* list = new_list();
+	PointTask *tasks = malloc(num_items*sizeof(PointTask));
+
+	for (idx=0; idx<num_items; idx++) {
+		fill_task(&tasks[idx], idx);
+	}
+
+	start = now_ns();
+	for (idx=0; idx<num_items; idx++) {
+		push_list_item(list, &tasks[idx], sizeof(PointTask));
+	}
+	report("push", "List", now_ns() - start, num_items);
+
+	start = now_ns();
+	iterate_list(list, sum_task);
+	report("iterate", "List", now_ns() - start, num_items);
+
+	/* remove from the middle, each removal scans half of the list */
+	start = now_ns();
+	for (idx=0; idx<REMOVALS && idx<num_items; idx++) {
+		remove_list_item(list, &tasks[num_items/2 + idx]);
+	}
+	report("remove", "List", now_ns() - start, idx);
+
+	destroy_list(list);
+	free(tasks);
+}
+
+static void bench_chunk_list(int num_items) {
+	int idx;
+	double start;
+	PointTask task;
+	ChunkList* list = new_chunk_list(sizeof(PointTask));
+
+	start = now_ns();
+	for (idx=0; idx<num_items; idx++) {
+		fill_task(&task, idx);
+		push_chunk_list_item(list, &task);
+	}
+	report("push", "ChunkList", now_ns() - start, num_items);
+
+	start = now_ns();
+	iterate_chunk_list(list, sum_task);
+	report("iterate", "ChunkList", now_ns() - start, num_items);
+
+	/* pushing again after a clear reuses the blocks */
+	clear_chunk_list(list);
+	start = now_ns();
+	for (idx=0; idx<num_items; idx++) {
+		fill_task(&task, idx);
+		push_chunk_list_item(list, &task);
+	}
+	report("repush", "ChunkList", now_ns() - start, num_items);
+
+	destroy_chunk_list(list);
+}
+
+static void bench_in_arena(int num_items, Arena* arena) {
+	int idx;
+	double start;
+	PointTask task;
+	List* list;
+	ChunkList* chunk_list;
+	PointTask *tasks = malloc(num_items*sizeof(PointTask));
+
+	for (idx=0; idx<num_items; idx++) {
+		fill_task(&tasks[idx], idx);
+	}
+
+	/* the arena is reused across rounds, so its chunks are already allocated */
+	start = now_ns();
+	list = new_list_in(arena);
+	for (idx=0; idx<num_items; idx++) {
+		push_list_item(list, &tasks[idx], sizeof(PointTask));
+	}
+	report("push", "List@A", now_ns() - start, num_items);
+
+	start = now_ns();
+	chunk_list = new_chunk_list_in(sizeof(PointTask), arena);
+	for (idx=0; idx<num_items; idx++) {
+		fill_task(&task, idx);
+		push_chunk_list_item(chunk_list, &task);
+	}
+	report("push", "Chunk@A", now_ns() - start, num_items);
+
+	start = now_ns();
+	iterate_chunk_list(chunk_list, sum_task);
+	report("iterate", "Chunk@A", now_ns() - start, num_items);
+
+	start = now_ns();
+	reset_arena(arena);
+	report("teardown", "Arena", now_ns() - start, 2*num_items);
+	printf("  (arena holds %d chunks)\n", arena_chunks(arena));
+
+	free(tasks);
+}
+
+static void bench_dlist(int num_items) {
+	int idx;
+	double start;
+	DList list;
+	LinkedTask *items = malloc(num_items*sizeof(LinkedTask));
+
+	init_dlist(&list);
+	for (idx=0; idx<num_items; idx++) {
+		fill_task(&items[idx].task, idx);
+	}
+
+	start = now_ns();
+	for (idx=0; idx<num_items; idx++) {
+		push_dlist_item(&list, &items[idx].link);
+	}
+	report("push", "DList", now_ns() - start, num_items);
+
+	start = now_ns();
+	iterate_dlist(&list, sum_link);
+	report("iterate", "DList", now_ns() - start, num_items);
+
+	start = now_ns();
+	for (idx=0; idx<REMOVALS && idx<num_items; idx++) {
+		unlink_dlist_item(&list, &items[num_items/2 + idx].link);
+	}
+	report("remove", "DList", now_ns() - start, idx);
+
+	free(items);
+}
+
+int main(int argc, char *argv[]) {
+	int round;
+	Arena* arena = new_arena(0);
+	int num_items = DEFAULT_ITEMS;
+	int rounds = DEFAULT_ROUNDS;
+
+	if (argc > 1) {
+		num_items = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		rounds = atoi(argv[2]);
+	}
+	if (num_items < 2*REMOVALS || rounds < 1) {
+		printf("usage: %s [num_items >= %d] [rounds >= 1]\n", argv[0], 2*REMOVALS);
+		return 1;
+	}
+
+	for (round=1; round<=rounds; round++) {
+		printf("round %d (%d items of %zu bytes, %d removals)\n",
+					 round, num_items, sizeof(PointTask), REMOVALS);
+		bench_list(num_items);
+		bench_chunk_list(num_items);
+		bench_in_arena(num_items, arena);
+		bench_dlist(num_items);
+	}
+	destroy_arena(arena);
+	printf("(sum %.0f)\n", Sum);
+	return 0;
+}
@@ -0,0 +1,490 @@
+/*
+* Description:
+*
+* Benchmark for the log library: the time a thread spends in log_event (the
+* producer side latency) writing to a log file, with each line written by the
+* caller (the synchronous mode) and with the lines handed to the writer thread
+* (start_async_log), blocking or dropping lines when the ring is full, and with
+* binary records instead of text (use_binary_log), synchronous and async, and
+* with the lines copied into a mapped file rotated every MAP_FILE_KB
+* (map_logfile), synchronous and async, and with the lines kept by the flight
+* recorder only (start_flight_recorder, the log file taking none of them). The
+* latencies of every call are sorted and reported as percentiles, along with
+* the time until the last line is in the file and the size of the file. The
+* allocations made by the producers are counted (by wrapping malloc, with
+* glibc), there should be none.
+*
+*     ./log_bench [lines] [threads] [logfile]
+*
+* The log file defaults to /tmp/log_bench.log, it is truncated before each run
+* and the number of lines in it (less the ones reporting dropped lines) has to
+* be the number logged and not dropped (the rotated files of a mapped log are
+* counted too, and removed before each run). For a binary log the events
+* are counted, and the first one is rendered to check it against the line the
+* text path writes. For the flight recorder the records in its ring are counted,
+* and the newest one is rendered and checked the same way. Last, a line built
+* with the log_append functions (log_line) is logged to a binary log and to the
+* flight recorder, followed in memory by bytes that are not a NUL, and the
+* records are checked to hold the line and nothing past it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "log_mgr.h"
+#include "log_format.h"
+#include "log_recorder.h"
+#include "list.h"
+#include "shared_mem.h"
+#include "bench.h"
+
+#define DEFAULT_LINES    200000
+#define DEFAULT_THREADS  1
+#define MAX_THREADS      64
+#define DEFAULT_LOGFILE  "/tmp/log_bench.log"
+#define LINE_MAX_RECORD  4096
+/* a mapped log is rotated every 4 MB, and every rotated file is kept */
+#define MAP_FILE_KB      4096
+#define MAP_KEEP         64
+/* the flight recorder segment (of 32768 slots) */
+#define RECORDER_KEY     0x10675
+#define RECORDER_KB      4200
+
+typedef struct Producer {
+	int id;
+	long lines;
+	long dropped;
+	long allocations;
+	double* latencies;
+} Producer;
+
+/* the allocations made by the thread so far */
+static __thread long Allocations = 0;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+	Allocations++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+	Allocations++;
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	Allocations++;
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+static int compare_doubles(const void* a, const void* b) {
+	double x = *(const double*) a, y = *(const double*) b;
+	return x < y ? -1 : x > y;
+}
+
+/* the line shaped like the ones show_points writes */
+#define BENCH_FORMAT  "   ├── Idx:%ld = Point(is_valid=%d, x=%2.3f, y=%2.3f)"
+
+static void* produce(void* arg) {
+	long idx;
+	double start;
+	Producer *producer = arg;
+	long allocations = Allocations;
+
+	for (idx = 0; idx < producer->lines; idx++) {
+		start = now_ns();
+		if (log_event(WARNING, BENCH_FORMAT, idx, producer->id, idx * 0.5f, idx * 0.25f) != LOG_OK) {
+			producer->dropped++;
+		}
+		producer->latencies[idx] = now_ns() - start;
+	}
+	producer->allocations = Allocations - allocations;
+	return NULL;
+}
+
+/* counts the lines of a text log, and adds the ones reporting dropped lines
+(which the writer thread logs each time it finds more) to reports */
+static long count_lines(const char* logfile, long* reports) {
+	long lines = 0;
+	size_t room = 0;
+	char *line = NULL;
+	FILE *file = fopen(logfile, "r");
+
+	if (file == NULL) {
+		return -1;
+	}
+	while (getline(&line, &room, file) != -1) {
+		lines++;
+		*reports += strstr(line, "[LOGMGR] Dropped ") != NULL;
+	}
+	free(line);
+	fclose(file);
+	return lines;
+}
+
+/* counts the events of a binary log (text lines count as one each), and
+renders the first one into line (empty if there is none) */
+static long count_records(const char* logfile, char* line, size_t size) {
+	int c;
+	long records = 0;
+	char *record = malloc(LINE_MAX_RECORD);
+	LogRecord *header = (LogRecord*) record;
+	FILE *file = fopen(logfile, "r");
+
+	line[0] = '\0';
+	if (file == NULL || record == NULL) {
+		free(record);
+		return -1;
+	}
+	while ((c = getc(file)) != EOF) {
+		if (c != LOG_BINARY_MARK) {
+			while (c != '\n' && (c = getc(file)) != EOF);
+			records++;
+			continue;
+		}
+		record[0] = c;
+		if (fread(record + 1, 1, sizeof(LogRecord) - 1, file) != sizeof(LogRecord) - 1
+		    || header->length < sizeof(LogRecord) || header->length > LINE_MAX_RECORD
+		    || fread(record + sizeof(LogRecord), 1, header->length - sizeof(LogRecord), file)
+		       != header->length - sizeof(LogRecord)) {
+			records = -1;
+			break;
+		}
+		if (header->type == LOG_RECORD_EVENT) {
+			if (records++ == 0) {
+				log_render_line(header, BENCH_FORMAT, line, size);
+			}
+		}
+	}
+	fclose(file);
+	free(record);
+	return records;
+}
+
+static long file_size(const char* logfile) {
+	struct stat st;
+	return stat(logfile, &st) == 0 ? st.st_size : -1;
+}
+
+/* counts the records put in the ring of the flight recorder (the oldest of which
+may have been overwritten), and renders the newest one into line (empty if there
+is none) */
+static long count_recorded(char* line, size_t size) {
+	long records = -1;
+	uint64_t position;
+	LogRecorder *recorder = connect_shm(RECORDER_KEY, shm_size(RECORDER_KEY));
+	LogRecorderSlot *slot;
+
+	line[0] = '\0';
+	if (recorder == NULL) {
+		return -1;
+	}
+	if (recorder->magic == LOG_RECORDER_MAGIC) {
+		/* every record of the benchmark takes a single slot */
+		records = recorder->tail;
+		position = recorder->tail - 1;
+		slot = &LOG_RECORDER_RING(recorder)[position & (recorder->capacity - 1)];
+		if (records > 0 && slot->ready == position + 1 && slot->slots == 1) {
+			log_render_line((LogRecord*) slot->bytes, BENCH_FORMAT, line, size);
+		}
+	}
+	destroy_shm(RECORDER_KEY);
+	return records;
+}
+
+/* the name of the idx-th rotated file of a mapped log (the log itself for 0) */
+static const char* rotated_file(const char* logfile, int idx) {
+	static char name[4096];
+
+	if (idx == 0) {
+		return logfile;
+	}
+	snprintf(name, sizeof(name), "%s.%d", logfile, idx);
+	return name;
+}
+
+/* counts the lines of a log, including its rotated files, the ones among them
+reporting dropped lines, and its size */
+static long count_log(const char* logfile, bool binary, char* first, size_t size, long* reports, long* bytes) {
+	int idx;
+	long count, lines = 0;
+	char other[256];
+
+	*reports = 0;
+	*bytes = 0;
+	for (idx = MAP_KEEP; idx >= 0; idx--) {
+		if (file_size(rotated_file(logfile, idx)) < 0) {
+			continue;
+		}
+		/* the first line is in the oldest file */
+		count = binary ? count_records(rotated_file(logfile, idx), lines == 0 ? first : other, lines == 0 ? size : sizeof(other))
+		               : count_lines(rotated_file(logfile, idx), reports);
+		if (count < 0) {
+			return -1;
+		}
+		lines += count;
+		*bytes += file_size(rotated_file(logfile, idx));
+	}
+	return lines;
+}
+
+/* a LogLine followed by bytes that are not a NUL, none of which may end up in
+the records of the line */
+typedef struct GuardedLine {
+	LogLine line;
+	char after[64];
+} GuardedLine;
+
+/* builds a line of length 'x's */
+static void fill_line(GuardedLine* guarded, size_t length) {
+	memset(guarded, 'y', sizeof(GuardedLine));
+	log_line_start(&guarded->line);
+	while (guarded->line.length < length) {
+		log_append_string(&guarded->line, "x");
+	}
+}
+
+/* true if the event record holds the text of the line, and nothing more */
+static bool holds_line(const LogRecord* record, const GuardedLine* guarded) {
+	int len;
+	size_t length = guarded->line.length;
+	char line[LOG_LINE_SIZE + 64];
+
+	if (record->type != LOG_RECORD_EVENT || record->length != sizeof(LogRecord) + 2*sizeof(uint32_t) + length) {
+		return false;
+	}
+	len = log_render_line(record, "%.*s", line, sizeof(line));
+	return len > (int) length + 1 && len < (int) sizeof(line) && line[len - 1] == '\n'
+	       && line[len - length - 2] == '|' && !memcmp(line + len - length - 1, guarded->line.text, length);
+}
+
+/* logs a whole line to a binary log, and a shorter one (in a single slot) to
+the flight recorder, and checks their records */
+static int check_line(const char* logfile) {
+	int errors = 0;
+	bool found = false;
+	uint64_t position;
+	char *record = malloc(LINE_MAX_RECORD);
+	LogRecord *header = (LogRecord*) record;
+	LogRecorder *recorder;
+	LogRecorderSlot *slot;
+	GuardedLine guarded;
+	FILE *file;
+
+	truncate(logfile, 0);
+	use_binary_log(true);
+	if (record == NULL || set_logfile(logfile) != LOG_OK) {
+		printf("ERROR: unable to open %s\n", logfile);
+		free(record);
+		return 1;
+	}
+	fill_line(&guarded, LOG_LINE_SIZE);
+	log_line(WARNING, &guarded.line);
+	close_logfile();
+	use_binary_log(false);
+
+	/* the format record comes first, then the event */
+	file = fopen(logfile, "r");
+	while (file != NULL && !found && fread(record, 1, sizeof(LogRecord), file) == sizeof(LogRecord)
+	       && header->mark == LOG_BINARY_MARK && header->length >= sizeof(LogRecord)
+	       && header->length <= LINE_MAX_RECORD
+	       && fread(record + sizeof(LogRecord), 1, header->length - sizeof(LogRecord), file)
+	          == header->length - sizeof(LogRecord)) {
+		found = header->type == LOG_RECORD_EVENT;
+	}
+	if (file != NULL) {
+		fclose(file);
+	}
+	if (!found || !holds_line(header, &guarded)) {
+		printf("ERROR: the binary record of a line of %d bytes does not hold it\n", LOG_LINE_SIZE);
+		errors++;
+	}
+	free(record);
+
+	set_logfile(logfile);
+	set_log_level(LOG_MODULES, FATAL);
+	if (shm_size(RECORDER_KEY) != 0 && connect_shm(RECORDER_KEY, shm_size(RECORDER_KEY)) != NULL) {
+		destroy_shm(RECORDER_KEY);
+	}
+	if (start_flight_recorder(RECORDER_KEY, RECORDER_KB, DEBUG) != LOG_OK) {
+		printf("ERROR: unable to start the flight recorder\n");
+		set_log_level(LOG_MODULES, INFO);
+		close_logfile();
+		return errors + 1;
+	}
+	fill_line(&guarded, 64);
+	log_line(WARNING, &guarded.line);
+	stop_flight_recorder();
+	set_log_level(LOG_MODULES, INFO);
+	close_logfile();
+
+	recorder = connect_shm(RECORDER_KEY, shm_size(RECORDER_KEY));
+	found = false;
+	if (recorder != NULL && recorder->magic == LOG_RECORDER_MAGIC && recorder->tail > 0) {
+		position = recorder->tail - 1;
+		slot = &LOG_RECORDER_RING(recorder)[position & (recorder->capacity - 1)];
+		found = slot->ready == position + 1 && slot->slots == 1 && holds_line((LogRecord*) slot->bytes, &guarded);
+	}
+	if (recorder != NULL) {
+		destroy_shm(RECORDER_KEY);
+	}
+	if (!found) {
+		printf("ERROR: the flight recorder record of a line does not hold it\n");
+		errors++;
+	}
+	return errors;
+}
+
+static int run(const char* name, int mode, bool binary, bool mapped, bool recorded, long lines, int threads,
+               const char* logfile) {
+	int idx;
+	long total = lines*threads, dropped = 0, allocations = 0, found, reports, bytes, expected_index = 0;
+	char first[256], expected[256];
+	double start, enqueued, written;
+	double *latencies = malloc(total*sizeof(double));
+	pthread_t workers[MAX_THREADS];
+	Producer producers[MAX_THREADS];
+
+	truncate(logfile, 0);
+	for (idx = 1; idx <= MAP_KEEP; idx++) {
+		unlink(rotated_file(logfile, idx));
+	}
+	use_binary_log(binary);
+	if (mapped ? map_logfile(logfile, MAP_FILE_KB, MAP_KEEP) != LOG_OK : set_logfile(logfile) != LOG_OK) {
+		printf("  %-13s unable to open %s\n", name, logfile);
+		free(latencies);
+		return 1;
+	}
+	if (recorded) {
+		set_log_level(LOG_MODULES, FATAL);
+		/* a segment left by an earlier run would be recorded into */
+		if (shm_size(RECORDER_KEY) != 0 && connect_shm(RECORDER_KEY, shm_size(RECORDER_KEY)) != NULL) {
+			destroy_shm(RECORDER_KEY);
+		}
+		if (start_flight_recorder(RECORDER_KEY, RECORDER_KB, DEBUG) != LOG_OK) {
+			printf("  %-13s unable to start the flight recorder\n", name);
+			free(latencies);
+			return 1;
+		}
+	}
+	if (mode >= 0 && start_async_log(0, mode) != LOG_OK) {
+		printf("  %-12s unable to start the writer thread\n", name);
+		free(latencies);
+		return 1;
+	}
+
+	start = now_ns();
+	for (idx = 0; idx < threads; idx++) {
+		producers[idx].id = idx;
+		producers[idx].lines = lines;
+		producers[idx].dropped = 0;
+		producers[idx].allocations = 0;
+		producers[idx].latencies = latencies + idx*lines;
+		pthread_create(&workers[idx], NULL, produce, &producers[idx]);
+	}
+	for (idx = 0; idx < threads; idx++) {
+		pthread_join(workers[idx], NULL);
+		dropped += producers[idx].dropped;
+		allocations += producers[idx].allocations;
+	}
+	enqueued = now_ns() - start;
+	stop_async_log();
+	close_logfile();
+	written = now_ns() - start;
+
+	qsort(latencies, total, sizeof(double), compare_doubles);
+	use_binary_log(false);
+	found = count_log(logfile, binary, first, sizeof(first), &reports, &bytes);
+	if (recorded) {
+		stop_flight_recorder();
+		set_log_level(LOG_MODULES, INFO);
+		if (found != 0) {
+			printf("ERROR: %ld lines in %s, which logs FATAL lines only\n", found, logfile);
+			free(latencies);
+			return 1;
+		}
+		/* the newest record is the last line of some thread */
+		found = count_recorded(first, sizeof(first));
+		bytes = RECORDER_KB * 1024L;
+		binary = true;
+		expected_index = lines - 1;
+	}
+	printf("  %-13s p50 %7.0f ns  p99 %8.0f ns  p99.9 %9.0f ns  max %10.0f ns  calls %7.1f ms  written %7.1f ms"
+	       "  %6.1f MB  allocs %ld",
+	       name, latencies[total/2], latencies[total*99/100], latencies[total*999/1000], latencies[total - 1],
+	       enqueued / 1.0e6, written / 1.0e6, bytes / 1.0e6, allocations);
+	if (dropped > 0) {
+		printf("  dropped %ld", dropped);
+	}
+	printf("\n");
+	free(latencies);
+
+	if (allocations > 0) {
+		printf("ERROR: %ld allocations in log_event\n", allocations);
+		return 1;
+	}
+
+	/* a run that dropped lines also logged how many, in as many lines as it took */
+	if (found - reports != total - dropped || (dropped == 0 && reports != 0)) {
+		printf("ERROR: %ld lines logged, %ld dropped, %ld in %s (%ld reporting drops)\n", total, dropped, found,
+		       logfile, reports);
+		return 1;
+	}
+
+	/* the first line is the one of some thread for index 0, apart from its time */
+	idx = strstr(first, "is_valid=") != NULL ? atoi(strstr(first, "is_valid=") + 9) : 0;
+	snprintf(expected, sizeof(expected), BENCH_FORMAT "\n", expected_index, idx, expected_index * 0.5f,
+	         expected_index * 0.25f);
+	if (binary && (strlen(first) < 23 || strcmp(first + 23, expected) || strncmp(first + 14, "WARNING", 7))) {
+		printf("ERROR: the first record renders as \"%s\"\n", first);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	int errors = 0;
+	long lines = DEFAULT_LINES;
+	int threads = DEFAULT_THREADS;
+	const char *logfile = DEFAULT_LOGFILE;
+
+	if (argc > 1) {
+		lines = atol(argv[1]);
+	}
+	if (argc > 2) {
+		threads = atoi(argv[2]);
+	}
+	if (argc > 3) {
+		logfile = argv[3];
+	}
+	if (lines < 1 || threads < 1 || threads > MAX_THREADS) {
+		printf("usage: %s [lines] [threads] [logfile]\n", argv[0]);
+		return 1;
+	}
+
+	/* the time zone is loaded once, before anything is measured */
+	tzset();
+	printf("%ld lines from each of %d threads to %s\n", lines, threads, logfile);
+	errors += run("sync", -1, false, false, false, lines, threads, logfile);
+	errors += run("async block", LOG_BLOCK, false, false, false, lines, threads, logfile);
+	errors += run("async drop", LOG_DROP, false, false, false, lines, threads, logfile);
+	errors += run("binary sync", -1, true, false, false, lines, threads, logfile);
+	errors += run("binary async", LOG_BLOCK, true, false, false, lines, threads, logfile);
+	errors += run("mapped sync", -1, false, true, false, lines, threads, logfile);
+	errors += run("mapped async", LOG_BLOCK, false, true, false, lines, threads, logfile);
+	errors += run("mapped binary", -1, true, true, false, lines, threads, logfile);
+	errors += run("recorder", -1, false, false, true, lines, threads, logfile);
+	errors += check_line(logfile);
+	return errors != 0;
+}
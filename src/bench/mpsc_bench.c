@@ -0,0 +1,158 @@
+/*
+* Description:
+*
+* Throughput and latency benchmark for MPSCQueue. For 1, 2, 4 ... max_producers
+* producer threads, every producer enqueues a stream of stamped records (spinning
+* while the queue is full) and a single consumer drains them in batches. The
+* consumer measures the time each record spent between enqueue and dequeue.
+*
+*     ./mpsc_bench [max_producers] [records_per_producer] [capacity]
+*
+* The consumer checks that the records of each producer arrive complete and in
+* order, and reports the ones that do not.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "mpsc_queue.h"
+#include "bench.h"
+
+#define DEFAULT_RECORDS   200000
+#define DEFAULT_CAPACITY  1024
+#define BATCH             64
+
+typedef struct Record {
+	int producer;
+	long seq;
+	uint64_t stamp_ns;
+} Record;
+
+typedef struct Producer {
+	pthread_t pthread;
+	int id;
+	long full_spins;
+} Producer;
+
+static MPSCQueue* Queue;
+static long RecordsPerProducer = DEFAULT_RECORDS;
+static bool Go;
+
+static int compare_latency(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+	return x < y ? -1 : x > y;
+}
+
+static void* run_producer(void *args) {
+	Producer *producer = args;
+	Record record;
+
+	while (!__atomic_load_n(&Go, __ATOMIC_ACQUIRE)) {
+		sched_yield();
+	}
+
+	record.producer = producer->id;
+	for (record.seq = 0; record.seq < RecordsPerProducer; record.seq++) {
+		record.stamp_ns = now_ns();
+		while (!mpsc_enqueue(Queue, &record)) {
+			producer->full_spins++;
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+static long run(int num_producers, unsigned int capacity) {
+	int idx;
+	unsigned int count, n;
+	long received = 0, errors = 0, spins = 0;
+	long total = RecordsPerProducer * num_producers;
+	uint64_t start, elapsed;
+	Record batch[BATCH];
+	Producer *producers = calloc(num_producers, sizeof(Producer));
+	long *next_seq = calloc(num_producers, sizeof(long));
+	uint64_t *latency = malloc(total*sizeof(uint64_t));
+
+	Queue = new_mpsc_queue(capacity, sizeof(Record));
+	__atomic_store_n(&Go, false, __ATOMIC_RELEASE);
+	for (idx = 0; idx < num_producers; idx++) {
+		producers[idx].id = idx;
+		pthread_create(&producers[idx].pthread, NULL, run_producer, &producers[idx]);
+	}
+
+	/* this thread is the consumer */
+	start = now_ns();
+	__atomic_store_n(&Go, true, __ATOMIC_RELEASE);
+	while (received < total) {
+		count = mpsc_dequeue_batch(Queue, batch, BATCH);
+		if (count == 0) {
+			sched_yield();
+			continue;
+		}
+		for (n = 0; n < count; n++) {
+			latency[received++] = now_ns() - batch[n].stamp_ns;
+			if (batch[n].seq != next_seq[batch[n].producer]++) {
+				errors++;
+			}
+		}
+	}
+	elapsed = now_ns() - start;
+
+	for (idx = 0; idx < num_producers; idx++) {
+		pthread_join(producers[idx].pthread, NULL);
+		spins += producers[idx].full_spins;
+	}
+
+	qsort(latency, total, sizeof(uint64_t), compare_latency);
+	printf("  %9d %14.0f %10lu %10lu %10lu %12ld\n", num_producers,
+				 total / (elapsed / 1.0e9),
+				 (unsigned long) latency[total/2],
+				 (unsigned long) latency[(long) (total*0.99)],
+				 (unsigned long) latency[(long) (total*0.999)],
+				 spins);
+
+	destroy_mpsc_queue(Queue);
+	free(latency);
+	free(next_seq);
+	free(producers);
+	return errors;
+}
+
+int main(int argc, char *argv[]) {
+	int num_producers;
+	long errors = 0;
+	int max_producers = sysconf(_SC_NPROCESSORS_ONLN);
+	int capacity = DEFAULT_CAPACITY;
+
+	if (argc > 1) {
+		max_producers = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		RecordsPerProducer = atol(argv[2]);
+	}
+	if (argc > 3) {
+		capacity = atoi(argv[3]);
+	}
+	if (max_producers < 1 || RecordsPerProducer < 1 || capacity < 2) {
+		printf("usage: %s [max_producers] [records_per_producer] [capacity >= 2]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%ld records per producer, capacity %d, batches of %d\n",
+				 RecordsPerProducer, capacity, BATCH);
+	printf("  %9s %14s %10s %10s %10s %12s\n",
+				 "producers", "ops/sec", "p50 ns", "p99 ns", "p999 ns", "full spins");
+	for (num_producers = 1; num_producers <= max_producers; num_producers *= 2) {
+		errors += run(num_producers, capacity);
+	}
+
+	if (errors != 0) {
+		printf("ERROR: %ld records arrived out of order\n", errors);
+		return 1;
+	}
+	return 0;
+}
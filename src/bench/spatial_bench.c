@@ -0,0 +1,212 @@
+/*
+* Description:
+*
+* Benchmark for the spatial grid kept over the valid points (see point_grid.h).
+* For 1K, 10K, ... up to max_points uniformly spread points, box queries
+* (about 16 points each) and nearest neighbour queries (k = 10) through the grid
+* are timed against a brute-force scan over all the points.
+*
+*     ./spatial_bench [max_points] [queries]
+*
+* Every answer of the grid has to match the scan of the same query (the same
+* number of points in a box, the same distances for the neighbours), a query
+* where they differ is printed. Fewer scans are made for the larger sizes.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include "point_grid.h"
+#include "bench.h"
+
+#define DEFAULT_MAX_POINTS  (10*1000*1000)
+#define DEFAULT_QUERIES     10000
+#define EXTENT              1000.0f
+#define POINTS_PER_BOX      16
+#define NEIGHBOURS          10
+
+typedef struct Sample {
+	float x;
+	float y;
+} Sample;
+
+static unsigned int State = 2463534242u;
+
+static float uniform() {
+	State ^= State << 13;
+	State ^= State >> 17;
+	State ^= State << 5;
+	return (State >> 8) * (EXTENT / 16777216.0f);
+}
+
+static int brute_range(Sample* points, long num_points, float min_x, float min_y, float max_x, float max_y) {
+	long idx;
+	int found = 0;
+	for (idx = 0; idx < num_points; idx++) {
+		if (points[idx].x >= min_x && points[idx].x <= max_x && points[idx].y >= min_y && points[idx].y <= max_y) {
+			found++;
+		}
+	}
+	return found;
+}
+
+/* keeps the k smallest squared distances in ascending order */
+static int brute_nearest(Sample* points, long num_points, float x, float y, int k, float* best) {
+	long idx;
+	int found = 0, pos;
+	double dx, dy;
+	float distance2;
+	/* the same arithmetic as the grid, so the distances compare exactly */
+	for (idx = 0; idx < num_points; idx++) {
+		dx = (double) points[idx].x - x;
+		dy = (double) points[idx].y - y;
+		distance2 = dx*dx + dy*dy;
+		if (found == k && distance2 >= best[k-1]) {
+			continue;
+		}
+		pos = found < k ? found++ : k-1;
+		while (pos > 0 && best[pos-1] > distance2) {
+			best[pos] = best[pos-1];
+			pos--;
+		}
+		best[pos] = distance2;
+	}
+	return found;
+}
+
+static void report(const char* what, double ns, int queries) {
+	printf("  %-14s %12.3f us/query\n", what, ns / queries / 1.0e3);
+}
+
+static int run(long num_points, int queries) {
+	long idx;
+	int query, scans, found, expected, pos;
+	double start, grid_ns, brute_ns;
+	float half, x, y, best[NEIGHBOURS];
+	float cell_size = EXTENT * sqrtf(4.0f / num_points);
+	Sample *points, *centres;
+	PointGrid *grid;
+	PointGridHit *hits;
+	int errors = 0;
+	long total = 0;
+
+	points = malloc(num_points*sizeof(Sample));
+	centres = malloc(queries*sizeof(Sample));
+	hits = malloc(num_points*sizeof(PointGridHit));
+	if (posix_memalign((void**) &grid, 64, point_grid_size(num_points)) || !points || !centres || !hits) {
+		printf("unable to allocate %ld points\n", num_points);
+		exit(1);
+	}
+
+	start = now_ns();
+	point_grid_init(grid, num_points, cell_size);
+	for (idx = 0; idx < num_points; idx++) {
+		points[idx].x = uniform();
+		points[idx].y = uniform();
+		point_grid_insert(grid, idx, points[idx].x, points[idx].y);
+	}
+	printf("%ld points, cell size %.4f, %d queries\n", num_points, cell_size, queries);
+	printf("  %-14s %12.3f ms\n", "build", (now_ns() - start) / 1.0e6);
+
+	for (query = 0; query < queries; query++) {
+		centres[query].x = uniform();
+		centres[query].y = uniform();
+	}
+	/* a box holding POINTS_PER_BOX points on average */
+	half = EXTENT * sqrtf((float) POINTS_PER_BOX / num_points) / 2;
+	/* keep the scans to about 2*10^9 point visits */
+	scans = 2000000000L / num_points;
+	scans = scans < 1 ? 1 : scans > queries ? queries : scans;
+
+	start = now_ns();
+	for (query = 0; query < queries; query++) {
+		x = centres[query].x;
+		y = centres[query].y;
+		total += point_grid_range(grid, x - half, y - half, x + half, y + half, hits, num_points);
+	}
+	grid_ns = now_ns() - start;
+	report("range grid", grid_ns, queries);
+
+	brute_ns = 0;
+	for (query = 0; query < scans; query++) {
+		x = centres[query].x;
+		y = centres[query].y;
+		found = point_grid_range(grid, x - half, y - half, x + half, y + half, hits, num_points);
+		start = now_ns();
+		expected = brute_range(points, num_points, x - half, y - half, x + half, y + half);
+		brute_ns += now_ns() - start;
+		if (found != expected) {
+			printf("ERROR: box around (%f, %f) holds %d points, the grid found %d\n", x, y, expected, found);
+			errors++;
+		}
+	}
+	report("range scan", brute_ns, scans);
+	printf("  %-14s %12.1fx (%.1f points/box)\n", "speedup", brute_ns / scans / (grid_ns / queries),
+	       (double) total / queries);
+
+	start = now_ns();
+	for (query = 0; query < queries; query++) {
+		point_grid_nearest(grid, centres[query].x, centres[query].y, NEIGHBOURS, hits);
+	}
+	grid_ns = now_ns() - start;
+	report("nearest grid", grid_ns, queries);
+
+	brute_ns = 0;
+	for (query = 0; query < scans; query++) {
+		x = centres[query].x;
+		y = centres[query].y;
+		found = point_grid_nearest(grid, x, y, NEIGHBOURS, hits);
+		start = now_ns();
+		expected = brute_nearest(points, num_points, x, y, NEIGHBOURS, best);
+		brute_ns += now_ns() - start;
+		if (found != expected) {
+			printf("ERROR: %d neighbours of (%f, %f) expected, the grid found %d\n", expected, x, y, found);
+			errors++;
+			continue;
+		}
+		for (pos = 0; pos < found; pos++) {
+			if (hits[pos].distance2 != best[pos]) {
+				printf("ERROR: neighbour %d of (%f, %f) is at %g, the grid found %g\n", pos, x, y,
+				       sqrt(best[pos]), sqrt(hits[pos].distance2));
+				errors++;
+				break;
+			}
+		}
+	}
+	report("nearest scan", brute_ns, scans);
+	printf("  %-14s %12.1fx\n", "speedup", brute_ns / scans / (grid_ns / queries));
+
+	free(points);
+	free(centres);
+	free(hits);
+	free(grid);
+	return errors;
+}
+
+int main(int argc, char *argv[]) {
+	long num_points;
+	long max_points = DEFAULT_MAX_POINTS;
+	int queries = DEFAULT_QUERIES;
+	int errors = 0;
+
+	if (argc > 1) {
+		max_points = atol(argv[1]);
+	}
+	if (argc > 2) {
+		queries = atoi(argv[2]);
+	}
+	if (max_points < 1000 || max_points > (1L << 30) || queries < 1) {
+		printf("usage: %s [max_points] [queries]\n", argv[0]);
+		return 1;
+	}
+
+	for (num_points = 1000; num_points <= max_points; num_points *= 10) {
+		errors += run(num_points, queries);
+	}
+	if (errors) {
+		printf("%d ERRORS\n", errors);
+	}
+	return errors != 0;
+}
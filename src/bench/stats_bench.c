@@ -0,0 +1,137 @@
+/*
+* Description:
+*
+* Benchmark for the per-tick statistics scan (count, sum and mean of x and y
+* over the valid points). The array-of-structs loop used by show_points for
+* POINT_LAYOUT_AOS is compared with the PointColumns kernels (scalar, SSE2 and
+* AVX2, as far as the CPU supports them) used for POINT_LAYOUT_SOA.
+*
+*     ./stats_bench [num_points] [valid_percent] [rounds]
+*
+* Each SIMD kernel has to come to the same count and sums as the AoS scan over
+* the same points, a kernel that does not is reported.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include "point_index.h"
+#include "change_ring.h"
+#include "point_columns.h"
+#include "point_grid.h"
+#include "point_history.h"
+#include "point_summary.h"
+#include "point.h"
+#include "bench.h"
+
+#define DEFAULT_POINTS   (4*1024*1024)
+#define DEFAULT_VALID    50
+#define DEFAULT_ROUNDS   10
+
+static void report(const char* impl, double ns, long points, int rounds, PointSums* sums) {
+	double per_scan = ns / rounds;
+	printf("  %-12s %10.3f ms/scan %10.1f Mpoints/s  count=%lu mean=(%.4f, %.4f)\n", impl,
+				 per_scan / 1.0e6,
+				 points / per_scan * 1.0e3,
+				 (unsigned long) sums->count,
+				 sums->count ? sums->sum_x / sums->count : 0,
+				 sums->count ? sums->sum_y / sums->count : 0);
+}
+
+/* the AoS loop of show_points, without the sequence counters */
+static void sums_aos(Point* points, long num_points, PointSums* sums) {
+	long idx;
+	sums->count = 0;
+	sums->sum_x = 0;
+	sums->sum_y = 0;
+	for (idx = 0; idx < num_points; idx++) {
+		if (points[idx].is_valid == 1) {
+			sums->count += 1;
+			sums->sum_x += points[idx].x;
+			sums->sum_y += points[idx].y;
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	long idx;
+	int round, kernel;
+	double start;
+	unsigned int state = 2463534242u;
+	long num_points = DEFAULT_POINTS;
+	int valid_percent = DEFAULT_VALID;
+	int rounds = DEFAULT_ROUNDS;
+	const char *names[] = {"SoA scalar", "SoA sse2", "SoA avx2"};
+	Point *points;
+	PointColumns *columns;
+	PointSums expected, sums;
+	int errors = 0;
+
+	if (argc > 1) {
+		num_points = atol(argv[1]);
+	}
+	if (argc > 2) {
+		valid_percent = atoi(argv[2]);
+	}
+	if (argc > 3) {
+		rounds = atoi(argv[3]);
+	}
+	if (num_points < 1 || valid_percent < 0 || valid_percent > 100 || rounds < 1) {
+		printf("usage: %s [num_points] [valid_percent] [rounds]\n", argv[0]);
+		return 1;
+	}
+
+	points = malloc(num_points*sizeof(Point));
+	if (posix_memalign((void**) &columns, 64, point_columns_size(num_points)) || points == NULL) {
+		printf("unable to allocate %ld points\n", num_points);
+		return 1;
+	}
+	point_columns_init(columns, num_points);
+
+	for (idx = 0; idx < num_points; idx++) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		points[idx].is_valid = (state % 100) < valid_percent;
+		points[idx].x = (float) (state % 10000) / 100;
+		points[idx].y = (float) (idx % 1000) - 500;
+		point_columns_set(columns, idx, points[idx].x, points[idx].y);
+		if (!points[idx].is_valid) {
+			point_columns_invalidate(columns, idx);
+		}
+	}
+
+	printf("%ld points (%d%% valid), %d scans each\n", num_points, valid_percent, rounds);
+
+	start = now_ns();
+	for (round = 0; round < rounds; round++) {
+		sums_aos(points, num_points, &expected);
+	}
+	report("AoS scalar", now_ns() - start, num_points, rounds, &expected);
+
+	for (kernel = POINT_KERNEL_SCALAR; kernel <= POINT_KERNEL_AVX2; kernel++) {
+		if (!point_columns_use_kernel(kernel)) {
+			printf("  %-12s (not supported by this CPU)\n", names[kernel]);
+			continue;
+		}
+		start = now_ns();
+		for (round = 0; round < rounds; round++) {
+			point_columns_sums(columns, num_points, &sums);
+		}
+		report(names[kernel], now_ns() - start, num_points, rounds, &sums);
+
+		/* the summation order differs, so allow for rounding */
+		if (sums.count != expected.count
+		    || fabs(sums.sum_x - expected.sum_x) > 1e-9 * fabs(expected.sum_x) + 1e-6
+		    || fabs(sums.sum_y - expected.sum_y) > 1e-9 * fabs(expected.sum_y) + 1e-6) {
+			printf("ERROR: %s disagrees with the AoS scan\n", names[kernel]);
+			errors++;
+		}
+	}
+
+	free(points);
+	free(columns);
+	return errors != 0;
+}
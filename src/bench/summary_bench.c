@@ -0,0 +1,214 @@
+/*
+* Description:
+*
+* Benchmark for point_segment_summary: the time of a pass over a segment of
+* num_points points (half of them valid) for each set of statistics (just the
+* count, the mean, mean and variance, the bounding box, and everything with a
+* 64x64 histogram), with the scalar and the AVX2 kernel on one thread and with
+* the AVX2 kernel split between threads, in both point layouts.
+*
+*     ./summary_bench [num_points] [threads] [rounds]
+*
+* Every result has to match a plain two-pass computation over the points the
+* segment was filled with, a mismatch is printed along with what was computed.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include "point_index.h"
+#include "change_ring.h"
+#include "point_columns.h"
+#include "point_grid.h"
+#include "point_history.h"
+#include "point_summary.h"
+#include "point.h"
+#include "bench.h"
+
+#define DEFAULT_POINTS   (4*1024*1024)
+#define DEFAULT_THREADS  0
+#define DEFAULT_ROUNDS   10
+#define BINS             64
+#define FILL_BATCH       65536
+/* far enough from the origin for a naive variance to lose digits */
+#define OFFSET_X         10000.0f
+
+static bool close_to(double value, double expected) {
+	return fabs(value - expected) <= 1e-6 * fabs(expected) + 1e-6;
+}
+
+/* what the summary should come up with, from the source points */
+static void reference(Point* points, long num_points, PointSummary* summary, uint64_t* bins) {
+	long idx;
+	uint32_t bin_x, bin_y;
+	double dx, dy;
+
+	memset(bins, 0, BINS*BINS*sizeof(uint64_t));
+	point_summary_init(summary, 0, 0, 0);
+	for (idx = 0; idx < num_points; idx++) {
+		if (!points[idx].is_valid) {
+			continue;
+		}
+		summary->count++;
+		summary->mean_x += points[idx].x;
+		summary->mean_y += points[idx].y;
+		summary->min_x = points[idx].x < summary->min_x ? points[idx].x : summary->min_x;
+		summary->max_x = points[idx].x > summary->max_x ? points[idx].x : summary->max_x;
+		summary->min_y = points[idx].y < summary->min_y ? points[idx].y : summary->min_y;
+		summary->max_y = points[idx].y > summary->max_y ? points[idx].y : summary->max_y;
+		bin_x = (points[idx].x - OFFSET_X) * (BINS / 1000.0f);
+		bin_y = points[idx].y * (BINS / 1000.0f);
+		bins[(bin_y < BINS ? bin_y : BINS - 1)*BINS + (bin_x < BINS ? bin_x : BINS - 1)]++;
+	}
+	summary->mean_x /= summary->count;
+	summary->mean_y /= summary->count;
+	for (idx = 0; idx < num_points; idx++) {
+		if (points[idx].is_valid) {
+			dx = points[idx].x - summary->mean_x;
+			dy = points[idx].y - summary->mean_y;
+			summary->var_x += dx*dx;
+			summary->var_y += dy*dy;
+		}
+	}
+	summary->var_x /= summary->count;
+	summary->var_y /= summary->count;
+}
+
+static int check(const char* name, int what, PointSummary* summary, PointSummary* expected, uint64_t* expected_bins) {
+	int bin, errors = 0;
+
+	if (summary->count != expected->count) {
+		errors++;
+	}
+	if ((what & POINT_SUMMARY_MEAN)
+	    && (!close_to(summary->mean_x, expected->mean_x) || !close_to(summary->mean_y, expected->mean_y))) {
+		errors++;
+	}
+	if ((what & POINT_SUMMARY_VARIANCE)
+	    && (!close_to(summary->var_x, expected->var_x) || !close_to(summary->var_y, expected->var_y))) {
+		errors++;
+	}
+	if ((what & POINT_SUMMARY_BOUNDS)
+	    && (summary->min_x != expected->min_x || summary->max_x != expected->max_x
+	        || summary->min_y != expected->min_y || summary->max_y != expected->max_y)) {
+		errors++;
+	}
+	if (what & POINT_SUMMARY_HISTOGRAM) {
+		for (bin = 0; bin < BINS*BINS; bin++) {
+			errors += summary->bins[bin] != expected_bins[bin];
+		}
+		errors += summary->outside != 0;
+	}
+	if (errors) {
+		printf("ERROR: %s disagrees with the reference (count=%lu mean=(%f, %f) var=(%f, %f))\n", name,
+		       (unsigned long) summary->count, summary->mean_x, summary->mean_y, summary->var_x, summary->var_y);
+	}
+	return errors != 0;
+}
+
+static int run(void* segment, long num_points, int threads, int rounds, PointSummary* expected, uint64_t* expected_bins) {
+	int set, config, round, errors = 0;
+	int sets[] = {0, POINT_SUMMARY_MEAN, POINT_SUMMARY_VARIANCE, POINT_SUMMARY_BOUNDS, POINT_SUMMARY_ALL};
+	const char *set_names[] = {"count", "mean", "mean+var", "bounds", "all+hist"};
+	const char *config_names[] = {"scalar", "avx2", "avx2"};
+	int kernels[] = {POINT_KERNEL_SCALAR, POINT_KERNEL_AVX2, POINT_KERNEL_AVX2};
+	uint64_t bins[BINS*BINS];
+	double start, per_pass;
+	char name[64];
+	PointSummary summary;
+
+	for (set = 0; set < 5; set++) {
+		for (config = 0; config < 3; config++) {
+			if (!point_summary_use_kernel(kernels[config])) {
+				printf("  %-9s %-7s (not supported by this CPU)\n", set_names[set], config_names[config]);
+				continue;
+			}
+			summary.bins_x = BINS;
+			summary.bins_y = BINS;
+			summary.hist_min_x = OFFSET_X;
+			summary.hist_max_x = OFFSET_X + 1000;
+			summary.hist_min_y = 0;
+			summary.hist_max_y = 1000;
+			summary.bins = bins;
+
+			start = now_ns();
+			for (round = 0; round < rounds; round++) {
+				point_segment_summary(segment, sets[set], config < 2 ? 1 : threads, &summary);
+			}
+			per_pass = (now_ns() - start) / rounds;
+			printf("  %-9s %-7s %-11s %10.3f ms/pass %10.1f Mpoints/s\n", set_names[set], config_names[config],
+			       config < 2 ? "1 thread" : "threads", per_pass / 1.0e6, num_points / per_pass * 1.0e3);
+
+			snprintf(name, sizeof(name), "%s (%s)", set_names[set], config_names[config]);
+			errors += check(name, sets[set], &summary, expected, expected_bins);
+		}
+	}
+	return errors;
+}
+
+int main(int argc, char *argv[]) {
+	long idx, slot, count;
+	int layout, errors = 0;
+	unsigned int state = 2463534242u;
+	long num_points = DEFAULT_POINTS;
+	int threads = DEFAULT_THREADS;
+	int rounds = DEFAULT_ROUNDS;
+	int *indices;
+	Point *points;
+	void *segment;
+	PointSummary expected;
+	uint64_t expected_bins[BINS*BINS];
+
+	if (argc > 1) {
+		num_points = atol(argv[1]);
+	}
+	if (argc > 2) {
+		threads = atoi(argv[2]);
+	}
+	if (argc > 3) {
+		rounds = atoi(argv[3]);
+	}
+	if (num_points < 1 || num_points > POINT_MAX_CAPACITY || threads < 0 || rounds < 1) {
+		printf("usage: %s [num_points] [threads] [rounds]\n", argv[0]);
+		return 1;
+	}
+
+	points = malloc(num_points*sizeof(Point));
+	indices = malloc(FILL_BATCH*sizeof(int));
+	if (posix_memalign(&segment, 64, point_segment_size(num_points, 0)) || points == NULL || indices == NULL) {
+		printf("unable to allocate %ld points\n", num_points);
+		return 1;
+	}
+	for (idx = 0; idx < num_points; idx++) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		points[idx].is_valid = state & 1;
+		points[idx].x = OFFSET_X + (state >> 8) % 100000 / 100.0f;
+		points[idx].y = (float) (idx % 1000);
+	}
+	reference(points, num_points, &expected, expected_bins);
+	printf("%ld points (%lu valid), %d passes each\n", num_points, (unsigned long) expected.count, rounds);
+
+	for (layout = POINT_LAYOUT_AOS; layout <= POINT_LAYOUT_SOA; layout++) {
+		memset(segment, 0, point_segment_size(num_points, 0));
+		point_segment_init(segment, num_points, layout, POINT_GRID_CELL_SIZE, 0);
+		for (idx = 0; idx < num_points; idx += count) {
+			count = num_points - idx < FILL_BATCH ? num_points - idx : FILL_BATCH;
+			for (slot = 0; slot < count; slot++) {
+				indices[slot] = idx + slot;
+			}
+			install_points_batch(segment, indices, points + idx, count);
+		}
+		printf("%s layout\n", layout == POINT_LAYOUT_SOA ? "SoA" : "AoS");
+		errors += run(segment, num_points, threads, rounds, &expected, expected_bins);
+	}
+
+	free(points);
+	free(indices);
+	free(segment);
+	return errors != 0;
+}
@@ -25,14 +25,19 @@
 * The file which install_data reads will be a text file. Each line of the file will
 * follow the following format:
 *
-*     <index> <x_value> <y_value> <time increment>¬
+*     <index> <x_value> <y_value> <time increment> [<id>]¬
 *
 * where:
 *
-* - index ranges from 0 to 19 and indicates which element of the shared memory
-*   structure is to be written to;
+* - index ranges from 0 to 19 (or up to the capacity given with -n, less one) and
+*   indicates which element of the shared memory structure is to be written to;
 * - x_value and y_value are floating point numbers which are to be installed in the
 *   x and y members of that structure.
+* - id is an optional (non-zero) 64-bit point id. When given, the id is bound to the
+*   index in the id index kept in the shared memory segment so that readers can
+*   find the point by id. An index holds one id: binding another id to it drops
+*   the one bound before (which then resolves to nothing). An index of -1
+*   together with an id refers to the index the id is currently bound to.
 *
 * If the time increment variable is nonnegative, then this value represents the
 * integral number of seconds to delay until the data on that line are installed in
@@ -42,6 +47,28 @@
 * case.) There can be any number of white space (tabs or spaces) between each
 * field on a line.
 *
+* Optional flags may follow the file name:
+*
+*     install_data <file> [-n <capacity>] [-cell <size>] [-history <depth>] [-recorder <key>] [-soa] [-binlog] [-q]
+*
+* -n sizes the segment for the given number of points (20 by default, up to
+* 2^30), -soa stores the points as a structure of arrays (validity bitmap, x[] and
+* y[]) instead of an array of Point structs. The capacity and layout are recorded
+* in the segment header, which is where monitor_shm finds them. -cell sets the
+* width of the cells of the spatial grid kept over the valid points (1 by
+* default); about the distance between neighbouring points works best. -history
+* keeps the last <depth> changes of every slot in the segment, along with <depth>
+* per second and per minute summaries (see point_history.h); there is no history
+* by default. -binlog writes the log as binary records (see use_binary_log), which
+* log_decode turns back into text. -recorder also keeps every line down to DEBUG
+* in a flight recorder in the shared memory segment with the given key (see
+* start_flight_recorder), which log_dump prints, even after a crash.
+*
+* Repeated log lines are collapsed into a count (see dedupe_log), and the lines
+* about bad entries of the file are rate limited, so a large or broken file does
+* not flood the log. After each batch of tasks only the points it changed are
+* listed.
+*
 * Additionally, install_data should handle errors in the input data file; the
 * output of install_data (that is, what gets installed into shared memory) is
 * undefined in this case, but the program should never "core dump" or get caught
@@ -58,6 +85,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <errno.h>
 #include <signal.h>
 #include <string.h>
@@ -65,38 +94,64 @@
 #include <unistd.h>
 #include "log_mgr.h"
 #include "thread_mgr.h"
+#include "arena.h"
 #include "hash_table.h"
 #include "list.h"
 #include "shared_mem.h"
+#include "point_index.h"
+#include "change_ring.h"
+#include "point_columns.h"
+#include "point_grid.h"
+#include "point_history.h"
+#include "point_summary.h"
 #include "point.h"
 
 #define SHM_KEY   8675309
 #define OK        0
 
 /* this represents the work to be done from the input file. A list of tasks
-will  represent the file in global memory */
-List* Tasks;
-
-/* The shared memory address to install the data will be stored here */
+will  represent the file in global memory (the tasks are stored inline). The
+list lives in TaskArena, so (re)loading the file is a reset of the arena plus a
+few chunk allocations. */
+ChunkList* Tasks;
+Arena* TaskArena;
+char* TaskFile;
+
+/* the tasks due at the same instant (a task and the tasks with a delay of 0 that
+follow it), which are written to the segment together. Only the worker thread
+uses these. */
+PointTask** Batch = NULL;
+int BatchSize = 0;
+int BatchCapacity = 0;
+
+/* The shared memory address to install the data will be stored here, along with
+the number of points it is sized for */
 void* ShmAddr;
+uint64_t Capacity = DEFAULT_NUM_POINTS;
 bool ReinstallTasks = false;
+/* the generation of the segment the points were last listed at (0 for never),
+only the worker thread uses it */
+uint64_t Listed = 0;
 
 pthread_cond_t TaskingCompleted;
 pthread_mutex_t SyncMutex;
 
-static void create_entry(List* task_list, char* line) {
+static void create_entry(ChunkList* task_list, char* line) {
 	int found_items;
-	PointTask *task;
+	PointTask entry;
+	PointTask *task = &entry;
 
-	task = malloc(sizeof(PointTask));
+	/* the task is parsed on the stack and copied into the list */
+	task->id = POINT_NO_ID;
 
-	found_items = sscanf(line, "%d %f %f %d",
+	found_items = sscanf(line, "%d %f %f %d %" SCNu64,
 								&task->index,
 								&task->point.x,
 								&task->point.y,
-								&task->delay);
-	if (found_items != 4){
-		log_event(FATAL, " [MAIN] Unable to parse line (%d items found). Skipping entry. (line:'%s')", found_items, line);
+								&task->delay,
+								&task->id);
+	if (found_items != 4 && found_items != 5){
+		log_limited(10, 20, FATAL, " [MAIN] Unable to parse line (%d items found). Skipping entry. (line:'%s')", found_items, line);
 		return;
 	}
 
@@ -110,47 +165,135 @@ static void create_entry(List* task_list, char* line) {
 
 	Answer: only install valid points defined in the file, otherwise skip over invalid point
 	installations/invalidations */
-	if (task->index < 0 || task->index >= MAX_NUM_POINTS) {
-		log_event(WARNING, " [MAIN] Error: invalid point index given (%d). Skipping entry.", task->index);
+	if (task->index == -1 && task->id != POINT_NO_ID) {
+		/* the index is resolved through the id index when the task runs */
+		push_chunk_list_item(task_list, (void *) task);
+	} else if (task->index < 0 || (uint64_t) task->index >= Capacity) {
+		log_limited(10, 20, WARNING, " [MAIN] Error: invalid point index given (%d). Skipping entry.", task->index);
 	} else {
-		push_list_item(task_list, (void *) task, sizeof(PointTask));
+		push_chunk_list_item(task_list, (void *) task);
+	}
+
+}
+
+// intended to be private: the slot a task writes to, or -1 to skip the task
+static int resolve_slot(PointTask* task, PointIndex* index, char* name) {
+	int slot = task->index;
+
+	/* only this thread writes the id index, lookups need no lock */
+	if (slot == -1) {
+		slot = point_index_lookup(index, task->id);
+		if (slot == POINT_INDEX_NO_SLOT) {
+			log_limited(10, 20, WARNING, " [%s] Skipping task, id %" PRIu64 " is not bound to an index", name, task->id);
+			return -1;
+		}
 	}
 
+	if (slot < 0 || (uint64_t) slot >= Capacity){
+		log_limited(10, 20, WARNING, " [%s] Skipping task due to bad index (%d)", name, slot);
+		return -1;
+	}
+	return slot;
+}
+
+// intended to be private: writes all of the tasks collected in Batch
+static void flush_batch() {
+	char * name = get_thread_name();
+	PointIndex *index = point_segment_index(ShmAddr);
+	Arena *scratch = thread_arena();
+	int *slots;
+	Point *points;
+	int idx, run, slot, count;
+	bool install;
+
+	if (BatchSize == 0) {
+		return;
+	}
+	slots = arena_alloc(scratch, BatchSize*sizeof(int));
+	points = arena_alloc(scratch, BatchSize*sizeof(Point));
+
+	/* REQ_install_data_3: ...Write the data to the shared memory at the designated
+	time... */
+	if(shm_lock(SHM_KEY)) {
+		/* consecutive tasks of the same kind go out as one batch (only the first
+		task of a batch can be an invalidation, the others have a delay of 0) */
+		for (idx = 0; idx < BatchSize; idx = run) {
+			install = Batch[idx]->delay >= 0;
+			count = 0;
+			for (run = idx; run < BatchSize && (Batch[run]->delay >= 0) == install; run++) {
+				if ((slot = resolve_slot(Batch[run], index, name)) == -1) {
+					continue;
+				}
+				/* bind the id before the point appears so readers never find a point
+				that cannot be resolved by its id (an id the slot was bound to before
+				stops resolving to it) */
+				if (install && Batch[run]->id != POINT_NO_ID && !point_index_insert(index, Batch[run]->id, slot)) {
+					log_event(WARNING, " [%s] Id index is full, id %" PRIu64 " is not bound", name, Batch[run]->id);
+				}
+				slots[count] = slot;
+				points[count] = Batch[run]->point;
+				count++;
+			}
+
+			if (count == 0) {
+				continue;
+			} else if (install) {
+				install_points_batch(ShmAddr, slots, points, count);
+			} else {
+				invalidate_points_batch(ShmAddr, slots, count);
+			}
+		}
+
+		// after operating on shared memory, show the points the batch changed
+		Listed = show_changed_points(ShmAddr, Listed, DEFAULT_NUM_POINTS);
+		shm_unlock(SHM_KEY);
+	} else {
+		log_event(WARNING, " [%s] Skipping %d tasks due to segment lock error.", name, BatchSize);
+	}
+
+	BatchSize = 0;
+	reset_arena(scratch);
 }
 
 static void process_entry(void* node) {
 	char * name = get_thread_name();
 	PointTask *task = (PointTask *) node;
+	PointTask **grown;
+	int capacity;
 
 	/* REQ_install_data_5: If the time increment variable is nonnegative, then this
 	value represents the integral number of seconds to delay until the data on that
 	line are installed in the shared memory. If the time increment value is
 	negative, the absolute value of this increment represents the integral number of
 	seconds to delay before making the corresponding index invalid. (The x and y
-	values are ignored in this case.). */
-	log_event(INFO, " [%s] Sleeping %d", name, task->delay);
-	sleep(abs(task->delay));
-
-	if (task->index < 0 || task->index >= MAX_NUM_POINTS){
-		log_event(WARNING, " [%s] Skipping task due to bad index (%d)", name, task->index);
-		return;
+	values are ignored in this case.).
+
+	A task without a delay is due at the same instant as the one before it, so it
+	joins that batch. Any other task is due later, so what has been collected so
+	far is written out before sleeping. */
+	if (task->delay != 0) {
+		flush_batch();
+		log_event(INFO, " [%s] Sleeping %d", name, task->delay);
+		sleep(abs(task->delay));
 	}
 
-	/* REQ_install_data_3: ...Write the data to the shared memory at the designated
-	time... */
-	if(shm_lock(SHM_KEY)) {
-		if (task->delay >= 0){
-			install_point(ShmAddr, task->index, &task->point);
+	if (BatchSize == BatchCapacity) {
+		capacity = BatchCapacity ? 2*BatchCapacity : 64;
+		grown = realloc(Batch, capacity*sizeof(PointTask*));
+		if (grown != NULL) {
+			Batch = grown;
+			BatchCapacity = capacity;
+		} else if (BatchCapacity > 0) {
+			/* the batch cannot grow, so what it holds goes out early and the task
+			starts the next one */
+			log_event(WARNING, " [%s] Error: no memory to grow the batch, writing out %d tasks early", name, BatchSize);
+			flush_batch();
 		} else {
-			invalidate_point(ShmAddr, task->index);
+			log_event(FATAL, " [%s] Error: no memory for a batch, skipping task (index:%d)", name, task->index);
+			return;
 		}
-
-		// after operating on shared memory, show all points in shared memory
-		show_points(ShmAddr, MAX_NUM_POINTS);
-		shm_unlock(SHM_KEY);
-	} else {
-		log_event(WARNING, " [%s] Skipping task due to segment lock error.", name);
 	}
+	Batch[BatchSize++] = task;
 
 	/* Note: the task item is not removed from the Tasks list since it is
 	possible for SIGINT to cause the list to be needed again */
@@ -161,7 +304,9 @@ void * thread_entry_point(void * x){
 
 	// announce when you have started and stopped work
 	log_event(INFO, " [%s] Thread starting to process each entry", name);
-	iterate_list(Tasks, process_entry);
+	BatchSize = 0;
+	iterate_chunk_list(Tasks, process_entry);
+	flush_batch();
 	log_event(INFO, " [%s] Thread completed!", name);
 
 	/* wake up main() so that it may exit */
@@ -194,38 +339,106 @@ static void graceful_exit() {
 static void clear_and_restart() {
 	log_event(WARNING, " [MAIN] Got SIGHUP! Clear segment and re-install...");
 
-	/* ensure main is retriggered to install tasks  */
+	/* ensure main is retriggered to install tasks (main clears the segment once
+	the worker has stopped, so that the worker is the only writer while running) */
 	ReinstallTasks = true;
 
-	/* REQ_install_data_6: clear shared memory segment of all data
-	(not just invalidate) */
-	memset(ShmAddr, 0, sizeof(Point)*MAX_NUM_POINTS);
-
 	/* wake up main() so that it may reinstall tasks */
 	pthread_mutex_lock(&SyncMutex);
 	pthread_cond_signal(&TaskingCompleted);
 	pthread_mutex_unlock(&SyncMutex);
 }
 
-int main(int argc, char *argv[]) {
+// intended to be private
+static bool load_tasks() {
 	FILE * fp;
 	char * line = NULL;
 	size_t len = 0;
+
+	/* REQ_install_data_1: Verify that the argument file is provided on the command
+	line, and that the file can be opened for reading. */
+	if ((fp = fopen( TaskFile, "r" )) == NULL) {
+		log_event (FATAL, " [MAIN] Error: Could not open file (%d): %s", errno, strerror(errno));
+		return false;
+	}
+
+	/* the tasks of a previous load (if any) are released all at once */
+	reset_arena(TaskArena);
+	Tasks = new_chunk_list_in(sizeof(PointTask), TaskArena);
+
+	/* REQ_install_data_3: Process the data from the file, a line at a time.... */
+	while (getline(&line, &len, fp) != -1) {
+		create_entry(Tasks, line);
+	}
+
+	// clean up resources that will no longer be needed
+	free(line);
+	fclose(fp);
+
+	log_event (INFO, " [MAIN] Completed processing input file");
+	iterate_chunk_list(Tasks, show_task);
+	return true;
+}
+
+int main(int argc, char *argv[]) {
 	sigset_t mask;
+	bool quiet = false;
+	bool binlog = false;
+	int layout = POINT_LAYOUT_AOS;
+	float cell_size = POINT_GRID_CELL_SIZE;
+	long history_depth = 0;
+	int recorder_key = 0;
+
+	/* optional flags follow the file name: -q, -soa (store the points as a
+	structure of arrays, see point_segment_init), -binlog, -n <capacity>,
+	-cell <size>, -history <depth> and -recorder <key> */
+	while (argc > 2) {
+		if (!strcmp(argv[argc-1], "-q")) {
+			quiet = true;
+		} else if (!strcmp(argv[argc-1], "-soa")) {
+			layout = POINT_LAYOUT_SOA;
+		} else if (!strcmp(argv[argc-1], "-binlog")) {
+			binlog = true;
+		} else if (argc > 3 && !strcmp(argv[argc-2], "-n")) {
+			Capacity = strtoull(argv[argc-1], NULL, 10);
+			argc--;
+		} else if (argc > 3 && !strcmp(argv[argc-2], "-cell")) {
+			cell_size = strtof(argv[argc-1], NULL);
+			argc--;
+		} else if (argc > 3 && !strcmp(argv[argc-2], "-history")) {
+			history_depth = strtol(argv[argc-1], NULL, 10);
+			argc--;
+		} else if (argc > 3 && !strcmp(argv[argc-2], "-recorder")) {
+			recorder_key = strtol(argv[argc-1], NULL, 0);
+			argc--;
+		} else {
+			break;
+		}
+		/* forget about this argument entirely */
+		argc--;
+	}
 
 	/* just one little easter-egg that helps in testing */
-	if (argc == 3 && !strcmp(argv[2], "-q")) {
+	if (quiet) {
 		printf("Ssssshhhh, don't be so loud!\n");
-		/* forget about this argument entirely */
-		argc = 2;
 	} else {
 		also_print_log(true);
 	}
+	use_binary_log(binlog);
+	dedupe_log(true);
 	set_logfile("/var/log/install_data.log");
+	/* the lines are written by a thread of the log library, so logging never
+	holds up a caller that has the segment locked */
+	start_async_log(0, LOG_BLOCK);
 
 	/* this is not necessary, but I wanted to be explicit with a log entry */
 	use_semaphores(false);
 
+	/* after use_semaphores, the recorder is a segment of its own */
+	if (recorder_key != 0 && start_flight_recorder(recorder_key, 0, DEBUG) != LOG_OK) {
+		exit(1);
+	}
+
 	th_use_sigint_handler(false);
 	th_use_sigquit_handler(false);
 
@@ -250,32 +463,40 @@ int main(int argc, char *argv[]) {
 		exit(1);
 	}
 
-	log_event(INFO, " [MAIN] Started install_data");
-
-	/* REQ_install_data_1: Verify that the argument file is provided on the command
-	line, and that the file can be opened for reading. */
-	if ((fp = fopen( argv[1], "r" )) == NULL) {
-		log_event (FATAL, " [MAIN] Error: Could not open file (%d): %s", errno, strerror(errno));
+	if (Capacity == 0 || Capacity > POINT_MAX_CAPACITY) {
+		log_event(FATAL, " [MAIN] Invalid capacity given");
+		printf("The capacity should be between 1 and %u points.\n", POINT_MAX_CAPACITY);
 		exit(1);
 	}
 
-	Tasks = new_list();
+	if (!(cell_size > 0) || cell_size > 1e30f) {
+		log_event(FATAL, " [MAIN] Invalid cell size given");
+		printf("The cell size should be a positive number.\n");
+		exit(1);
+	}
 
-	/* REQ_install_data_3: Process the data from the file, a line at a time.... */
-	while (getline(&line, &len, fp) != -1) {
-		create_entry(Tasks, line);
+	if (history_depth < 0 || history_depth > POINT_HISTORY_MAX_DEPTH) {
+		log_event(FATAL, " [MAIN] Invalid history depth given");
+		printf("The history depth should be between 0 and %d entries.\n", POINT_HISTORY_MAX_DEPTH);
+		exit(1);
 	}
 
-	// clean up resources that will no longer be needed
-	free(line);
-	fclose(fp);
+	log_event(INFO, " [MAIN] Started install_data");
 
-	log_event (INFO, " [MAIN] Completed processing input file");
-	iterate_list(Tasks, show_task);
+	TaskFile = argv[1];
+	TaskArena = new_arena(0);
+	if (!load_tasks()) {
+		exit(1);
+	}
 
 	/* REQ_install_data_2: Call connect_shm( ) which should return a pointer to the
 	shared memory area. */
-	ShmAddr = (void*) connect_shm(SHM_KEY, MAX_NUM_POINTS*sizeof(Point));
+	if (shm_size(SHM_KEY) != 0 && shm_size(SHM_KEY) < point_segment_size(Capacity, history_depth)) {
+		/* a segment cannot grow, it has to be destroyed (once everyone detached) */
+		log_event(FATAL, " [MAIN] Error: the existing segment (%zu bytes) is too small for %" PRIu64 " points",
+		          shm_size(SHM_KEY), Capacity);
+	}
+	ShmAddr = (void*) connect_shm(SHM_KEY, point_segment_size(Capacity, history_depth));
 	shm_lock(SHM_KEY);
 		show_segments();
 	shm_unlock(SHM_KEY);
@@ -285,6 +506,15 @@ int main(int argc, char *argv[]) {
 		exit(1);
 	}
 
+	/* install_data is the only writer of the segment header, the id index, the
+	change ring, the grid and the history. An existing index, ring or history
+	(from a previous run against the same segment with the same capacity) is kept
+	as is */
+	if (!point_segment_init(ShmAddr, Capacity, layout, cell_size, history_depth)) {
+		log_event(FATAL, " [MAIN] Error: failed to set up memory segment");
+		exit(1);
+	}
+
 	/* this condition is used to determine when the tasking has been fully completed
 	with no requests for restart. Since restarting means kill the thread and
 	restart it then a simple pthread wait is not good enough. Instead positive
@@ -318,6 +548,24 @@ int main(int argc, char *argv[]) {
 			log_event(FATAL, " [MAIN] Error: failed to wait for threads");
 		}
 
+		if (ReinstallTasks) {
+			/* REQ_install_data_6: clear shared memory segment of all data
+			(not just invalidate) */
+			if (shm_lock(SHM_KEY)) {
+				clear_points(ShmAddr);
+				shm_unlock(SHM_KEY);
+			} else {
+				log_event(WARNING, " [MAIN] Skipping clear due to segment lock error.");
+			}
+
+			/* the worker is gone, so the file can be read again (from the beginning)
+			into the same arena. If the file can no longer be read the previous
+			tasks are installed again. */
+			if (!load_tasks()) {
+				log_event(WARNING, " [MAIN] Re-installing the previously loaded tasks");
+			}
+		}
+
 	} while(ReinstallTasks);
 
 	/* since the tasks have been installed, ensure we don't attempt to handle any
@@ -342,7 +590,9 @@ int main(int argc, char *argv[]) {
 	log_event(INFO, " [MAIN] Destroyed %d (return:%d)", SHM_KEY, destroy_shm(SHM_KEY));
 
 	// ensure the list elements are cleanly destroyed before exiting
-	destroy_list(Tasks);
+	destroy_chunk_list(Tasks);
+	destroy_arena(TaskArena);
+	free(Batch);
 
 	log_event (INFO, " [MAIN] Completed!");
 	return OK;
@@ -0,0 +1,152 @@
+/*
+* Description:
+*
+* The log_decode program turns a log written with use_binary_log (see log_mgr.h
+* and log_format.h) back into the text lines log_event would have written, on
+* stdout:
+*
+*     log_decode [logfile ...]
+*
+* Several files are decoded one after the other, stdin is read when no file is
+* given, so that a log can be followed with "tail -c +1 -f logfile | log_decode".
+* Text lines found in the log (from processes not in binary mode, or lines that
+* could not be recorded in binary) are passed through as they are, so any log
+* can be decoded. An event whose format was never defined in the file (the
+* definition was dropped, or the file was cut) is reported as such instead. NUL
+* bytes between lines (the unused end of a mapped log file, see map_logfile) are
+* skipped.
+*
+* Returns 0 if the whole of every file was decoded, 1 otherwise.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include "log_format.h"
+#include "map_gen.h"
+
+/* the format strings by id, they live until the program exits */
+MAP_DEFINE(FormatMap, uint64_t, char*, map_hash_u64, map_eq_u64)
+
+static FormatMap Formats;
+static char *Record = NULL;
+static size_t RecordSize = 0;
+static char *Line = NULL;
+static size_t LineSize = 0;
+
+
+/* prints the text line of an event record */
+static bool print_event(const LogRecord* record) {
+	int len;
+	char **fmt = FormatMap_get(&Formats, record->format_id);
+
+	if (fmt == NULL) {
+		printf("(event with an unknown format id %08x)\n", record->format_id);
+		return true;
+	}
+	len = log_render_grow(record, *fmt, &Line, &LineSize);
+	if (len == LOG_RENDER_NO_MEMORY) {
+		return false;
+	}
+	if (len < 0) {
+		printf("(event that does not match its format \"%s\")\n", *fmt);
+		return true;
+	}
+	fwrite(Line, 1, len, stdout);
+	return true;
+}
+
+/* remembers the format defined by the record, a later definition of the same
+id (from another process) has the same text */
+static bool define_format(const LogRecord* record) {
+	char *fmt;
+	size_t length = record->length - sizeof(LogRecord);
+
+	if (FormatMap_get(&Formats, record->format_id) != NULL) {
+		return true;
+	}
+	fmt = malloc(length + 1);
+	if (fmt == NULL) {
+		return false;
+	}
+	memcpy(fmt, Record + sizeof(LogRecord), length);
+	fmt[length] = '\0';
+	return FormatMap_put(&Formats, record->format_id, fmt) != NULL;
+}
+
+/* decodes the whole stream, returns false if it ended within a record */
+static bool decode(FILE* file, const char* name) {
+	int c;
+	LogRecord *record;
+
+	while ((c = getc(file)) != EOF) {
+		if (c == '\0') {
+			continue;
+		} else if (c != LOG_BINARY_MARK) {
+			/* a text line, up to and including its newline */
+			do {
+				putchar(c);
+			} while (c != '\n' && (c = getc(file)) != EOF);
+			continue;
+		}
+
+		if (!log_reserve(&Record, &RecordSize, sizeof(LogRecord))) {
+			return false;
+		}
+		Record[0] = c;
+		if (fread(Record + 1, 1, sizeof(LogRecord) - 1, file) != sizeof(LogRecord) - 1) {
+			fprintf(stderr, "%s: truncated record\n", name);
+			return false;
+		}
+		record = (LogRecord*) Record;
+		if (record->length < sizeof(LogRecord)) {
+			fprintf(stderr, "%s: bad record length %u\n", name, record->length);
+			return false;
+		}
+		if (!log_reserve(&Record, &RecordSize, record->length)) {
+			return false;
+		}
+		record = (LogRecord*) Record;
+		if (fread(Record + sizeof(LogRecord), 1, record->length - sizeof(LogRecord), file)
+		    != record->length - sizeof(LogRecord)) {
+			fprintf(stderr, "%s: truncated record\n", name);
+			return false;
+		}
+
+		if (record->type == LOG_RECORD_FORMAT && !define_format(record)) {
+			return false;
+		} else if (record->type == LOG_RECORD_EVENT && !print_event(record)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	int idx;
+	bool ok = true;
+	FILE *file;
+
+	if (!FormatMap_init(&Formats, 256)) {
+		fprintf(stderr, "unable to allocate the formats\n");
+		return 1;
+	}
+
+	if (argc < 2) {
+		ok = decode(stdin, "stdin");
+	}
+	for (idx = 1; idx < argc; idx++) {
+		file = fopen(argv[idx], "r");
+		if (file == NULL) {
+			fprintf(stderr, "%s: %s\n", argv[idx], strerror(errno));
+			ok = false;
+			continue;
+		}
+		ok = decode(file, argv[idx]) && ok;
+		fclose(file);
+	}
+	return ok ? 0 : 1;
+}
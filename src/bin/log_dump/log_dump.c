@@ -0,0 +1,201 @@
+/*
+* Description:
+*
+* The log_dump program prints the records kept by the flight recorder of a
+* process (see start_flight_recorder in log_mgr.h and log_recorder.h) as the text
+* lines log_event would have written, oldest first, on stdout:
+*
+*     log_dump [-remove] <key>
+*
+* The key is the one the process passed to start_flight_recorder (in decimal, or
+* in hex with a leading 0x). The segment outlives the process, so the last
+* records of a process that crashed can be read after the fact; the recorder of
+* a running process can be read as well, in which case the records it writes
+* while the ring is being read may be left out (the number of records that were
+* overwritten before they could be read is reported). The segment is attached
+* read-only and is left in place, unless -remove is given, in which case it is
+* removed once it was dumped.
+*
+* Returns 0 if the segment was dumped, 1 otherwise.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include "log_format.h"
+#include "log_recorder.h"
+#include "map_gen.h"
+
+#define ALIGN_UP(size, align) (((size) + (align) - 1) / (align) * (align))
+
+/* the format strings by id, they point into the segment */
+MAP_DEFINE(FormatMap, uint64_t, const char*, map_hash_u64, map_eq_u64)
+
+static FormatMap Formats;
+static char *Record = NULL;
+static size_t RecordSize = 0;
+static char *Line = NULL;
+static size_t LineSize = 0;
+
+
+/* remembers the formats of the table (a format added twice has the same text) */
+static bool load_formats(const LogRecorder* recorder) {
+	uint64_t pos, used = __atomic_load_n(&recorder->formats_used, __ATOMIC_ACQUIRE);
+	const char *table = LOG_RECORDER_TABLE(recorder);
+	const LogRecord *record;
+
+	used = used < recorder->formats_size ? used : recorder->formats_size;
+	for (pos = 0; pos + sizeof(LogRecord) <= used; pos += ALIGN_UP(record->length, 8)) {
+		record = (const LogRecord *) (table + pos);
+		if (record->length < sizeof(LogRecord) || record->length > used - pos) {
+			/* still being written, or cut short by a crash */
+			break;
+		}
+		if (__atomic_load_n(&record->mark, __ATOMIC_ACQUIRE) != LOG_BINARY_MARK
+		    || record->type != LOG_RECORD_FORMAT || FormatMap_get(&Formats, record->format_id) != NULL
+		    || memchr(record + 1, '\0', record->length - sizeof(LogRecord)) == NULL) {
+			continue;
+		}
+		if (FormatMap_put(&Formats, record->format_id, (const char *) (record + 1)) == NULL) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* prints the text line of an event record */
+static bool print_event(const LogRecord* record) {
+	int len;
+	const char **fmt = FormatMap_get(&Formats, record->format_id);
+
+	if (fmt == NULL) {
+		printf("(event with an unknown format id %08x)\n", record->format_id);
+		return true;
+	}
+	len = log_render_grow(record, *fmt, &Line, &LineSize);
+	if (len == LOG_RENDER_NO_MEMORY) {
+		return false;
+	}
+	if (len < 0) {
+		printf("(event that does not match its format \"%s\")\n", *fmt);
+		return true;
+	}
+	fwrite(Line, 1, len, stdout);
+	return true;
+}
+
+/* prints the records of the ring, oldest first, up to the given tail */
+static bool dump(const LogRecorder* recorder, uint64_t tail, uint64_t* lost) {
+	uint64_t idx, slots, length, position;
+	uint64_t mask = recorder->capacity - 1;
+	size_t piece;
+	const LogRecorderSlot *ring = LOG_RECORDER_RING(recorder);
+	const LogRecorderSlot *slot;
+
+	position = tail > recorder->capacity ? tail - recorder->capacity : 0;
+	while (position < tail) {
+		slot = &ring[position & mask];
+		if (__atomic_load_n(&slot->ready, __ATOMIC_ACQUIRE) != position + 1) {
+			/* the rest of a record, or one that was never finished */
+			position++;
+			continue;
+		}
+		length = slot->length;
+		slots = slot->slots;
+		if (length < sizeof(LogRecord) || slots != (length + LOG_RECORDER_BYTES - 1) / LOG_RECORDER_BYTES
+		    || slots > recorder->capacity || !log_reserve(&Record, &RecordSize, length)) {
+			position++;
+			continue;
+		}
+		for (idx = 0; idx < slots; idx++) {
+			piece = length - idx * LOG_RECORDER_BYTES;
+			piece = piece < LOG_RECORDER_BYTES ? piece : LOG_RECORDER_BYTES;
+			memcpy(Record + idx * LOG_RECORDER_BYTES, ring[(position + idx) & mask].bytes, piece);
+		}
+
+		/* the record was whole if no writer got around the ring to it meanwhile */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&recorder->tail, __ATOMIC_ACQUIRE) > position + recorder->capacity) {
+			(*lost)++;
+			position++;
+			continue;
+		}
+		if (((LogRecord *) Record)->mark == LOG_BINARY_MARK && ((LogRecord *) Record)->type == LOG_RECORD_EVENT
+		    && ((LogRecord *) Record)->length == length && !print_event((LogRecord *) Record)) {
+			return false;
+		}
+		position += slots;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	int shm_id;
+	bool ok, remove = false;
+	char *end;
+	long key;
+	uint64_t tail, lost = 0;
+	struct shmid_ds info;
+	const LogRecorder *recorder;
+
+	if (argc > 1 && !strcmp(argv[1], "-remove")) {
+		remove = true;
+		argv++;
+		argc--;
+	}
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s [-remove] <key>\n", argv[0]);
+		return 1;
+	}
+	key = strtol(argv[1], &end, 0);
+	if (*end != '\0') {
+		fprintf(stderr, "not a key: %s\n", argv[1]);
+		return 1;
+	}
+
+	/* attached without connect_shm, which would create a missing segment and
+	could not attach it read-only */
+	shm_id = shmget((key_t) key, 0, 0);
+	if (shm_id == -1 || shmctl(shm_id, IPC_STAT, &info) == -1) {
+		fprintf(stderr, "no segment with the key %s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	recorder = shmat(shm_id, NULL, SHM_RDONLY);
+	if (recorder == (void *) -1) {
+		fprintf(stderr, "unable to attach the segment: %s\n", strerror(errno));
+		return 1;
+	}
+	if (info.shm_segsz < sizeof(LogRecorder) || recorder->magic != LOG_RECORDER_MAGIC
+	    || recorder->slot_size != LOG_RECORDER_SLOT || recorder->capacity == 0
+	    || (recorder->capacity & (recorder->capacity - 1)) != 0
+	    || sizeof(LogRecorder) + recorder->formats_size + recorder->capacity * LOG_RECORDER_SLOT > info.shm_segsz) {
+		fprintf(stderr, "the segment with the key %s is not a flight recorder\n", argv[1]);
+		shmdt(recorder);
+		return 1;
+	}
+
+	if (!FormatMap_init(&Formats, 256)) {
+		fprintf(stderr, "unable to allocate the formats\n");
+		return 1;
+	}
+	/* a format is in the table before the first record using it, so the
+	formats read after the tail cover the records before it */
+	tail = __atomic_load_n(&recorder->tail, __ATOMIC_ACQUIRE);
+	ok = load_formats(recorder) && dump(recorder, tail, &lost);
+	if (lost > 0) {
+		fprintf(stderr, "%" PRIu64 " records were overwritten while being read\n", lost);
+	}
+
+	shmdt(recorder);
+	if (ok && remove && shmctl(shm_id, IPC_RMID, NULL) == -1) {
+		fprintf(stderr, "unable to remove the segment: %s\n", strerror(errno));
+		ok = false;
+	}
+	return ok ? 0 : 1;
+}
@@ -16,31 +16,124 @@
 *
 * Before monitor_shm exits, it shall detach (but not destroy) the shared memory
 * segment.
+*
+* The points are read without taking the segment lock: every block of points has
+* a sequence counter that the writer bumps around its changes, and a block that
+* changed while it was being read is simply read again.
+*
+* The number of points (and how they are stored) is read from the segment header
+* written by install_data, so monitor_shm attaches to a segment of any size. When
+* there is no segment yet, one for the default 20 points is created.
+*
+* After the first second, only the points changed since the previous second are
+* listed (found through the generation stamps in the segment, see point.h), and
+* a second in which nothing changed is reported as such without reading any
+* point. Every change made to the points since the previous second is also read
+* from the change ring in the segment (without taking the segment lock) and
+* reported, including changes that were undone within the second.
+*
+* Any further arguments are taken as point ids to watch. Each second the point
+* bound to each watched id is looked up through the id index in the segment
+* (without taking the segment lock) and reported as well:
+*
+*     monitor_shm [-binlog] [-maplog <MB>] [-recorder <key>] [-verify <ticks>] [-stats <list>] [seconds] [id ...]
+*
+* The statistics come from the aggregates the writer keeps in the segment header.
+* With -verify, every <ticks> seconds they are also cross-checked against a full
+* rescan of the points, and any drift is reported.
+*
+* With -stats, further statistics are computed each second in one pass over the
+* points (split between threads for large segments). The list is made of any of
+* mean (the centroid), var (variance and standard deviation), bounds (the
+* bounding box) and hist (an 8x8 histogram over the bounding box of the previous
+* second), separated by commas, or all. Only the ones listed are computed.
+*
+* With -binlog, the log is written as binary records (see use_binary_log), which
+* log_decode turns back into text. With -maplog, the log file is mapped into
+* memory (see map_logfile) and rotated every <MB> megabytes, keeping the last
+* MAP_LOG_KEEP rotated files, so that a monitor left running takes bounded space.
+* With -recorder, every line down to DEBUG is also kept in a flight recorder in
+* the shared memory segment with the given key (see start_flight_recorder), which
+* log_dump prints, while the log file keeps to its own levels (see LOG_LEVEL).
+* Repeated lines (the statistics of a segment that does not change) are logged
+* once and then counted, see dedupe_log.
+*
+* When install_data keeps a history (see its -history flag), the trajectory of a
+* point over the last <seconds> can be printed instead of monitoring:
+*
+*     monitor_shm -history <index> [seconds]
+*
+* which reports the changes still held for the index, followed by the per
+* minute summaries, straight from the segment (no copy and no lock is taken).
 */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <errno.h>
 #include <signal.h>
 #include <string.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <time.h>
 #include "log_mgr.h"
+#include "map_gen.h"
 #include "hash_table.h"
 #include "list.h"
 #include "shared_mem.h"
+#include "point_index.h"
+#include "change_ring.h"
+#include "point_columns.h"
+#include "point_grid.h"
+#include "point_history.h"
+#include "point_summary.h"
 #include "point.h"
 
 #define SHM_KEY           8675309
 #define DEFAULT_DURATION  600
 #define ERROR             -1
+#define CHANGE_BATCH      64
+#define HISTOGRAM_BINS    8
 #define OK                0
+#define MAP_LOG_KEEP      4
+#define LOGFILE           "/var/log/monitor_shm.log"
 
 /* The shared memory address to install the data will be stored here */
 void* ShmAddr;
 bool Running = true;
 
+/* sequence number of the next change to report */
+uint64_t ChangeCursor;
+
+/* point ids given on the command line */
+uint64_t* WatchedIds;
+int NumWatchedIds = 0;
+
+/* cross-check the running aggregates every so many seconds (0 never does) */
+int VerifyTicks = 0;
+
+/* print the history of this index and exit (-1 monitors instead) */
+int HistoryIndex = -1;
+
+/* the rotation size of the mapped log file asked for with -maplog (0 for none) */
+int MapLogMb = 0;
+/* the key of the flight recorder segment asked for with -recorder (0 for none) */
+int RecorderKey = 0;
+
+/* the statistics asked for with -stats (POINT_SUMMARY_*) */
+int SummaryWhat = 0;
+PointSummary Summary;
+uint64_t SummaryBins[HISTOGRAM_BINS*HISTOGRAM_BINS];
+/* whether the box of the previous second is known, for the histogram */
+bool HaveBox = false;
+/* the statistics the current Summary was computed for (-1 before the first) */
+int SummaryDone = -1;
+
+/* generation of the points as last reported */
+uint64_t Generation;
+
 
 // intended to be private
 static void signal_exit() {
@@ -77,14 +170,197 @@ void install_signal_handler(int signum, void* handler) {
 	}
 }
 
+// intended to be private
+static void show_changes() {
+	int idx, count;
+	uint64_t missed = 0;
+	ChangeRecord changes[CHANGE_BATCH];
+	ChangeRing *ring = point_segment_changes(ShmAddr);
+
+	do {
+		count = change_ring_read(ring, &ChangeCursor, changes, CHANGE_BATCH, &missed);
+		for (idx = 0; idx < count; idx++) {
+			show_change(&changes[idx]);
+		}
+	} while (count == CHANGE_BATCH);
+
+	if (missed > 0) {
+		log_event(WARNING, " [MAIN] Missed %" PRIu64 " changes, the writer overran the change ring", missed);
+	}
+}
+
+// intended to be private
+static void show_watched_ids() {
+	int idx, slot;
+	Point point;
+	PointIndex *index = point_segment_index(ShmAddr);
+
+	for (idx = 0; idx < NumWatchedIds; idx++) {
+		slot = point_index_lookup(index, WatchedIds[idx]);
+		if (slot == POINT_INDEX_NO_SLOT) {
+			log_event(WARNING, " ● Id:%" PRIu64 " is not bound to a point", WatchedIds[idx]);
+		} else {
+			get_point(ShmAddr, slot, &point);
+			log_event(WARNING, " ● Id:%" PRIu64 " -> Idx:%d = Point(is_valid=%d, x=%2.3f, y=%2.3f)",
+												WatchedIds[idx],
+												slot,
+												point.is_valid,
+												point.x,
+												point.y);
+		}
+	}
+}
+
+// intended to be private: one pass over the view, false if the writer overwrote
+// part of it meanwhile (whatever was printed then is to be disregarded)
+static bool show_history_tier(PointHistory* hist, int tier, uint64_t from_ns) {
+	int run;
+	uint32_t idx;
+	PointHistoryView view;
+	const PointHistorySample *sample;
+	const PointHistoryBucket *bucket;
+
+	point_history_range(hist, HistoryIndex, tier, from_ns, UINT64_MAX, &view);
+	for (run = 0; run < 2; run++) {
+		for (idx = 0; idx < view.counts[run]; idx++) {
+			if (tier == POINT_HISTORY_RAW) {
+				sample = &view.runs[run].samples[idx];
+				log_event(WARNING, " ● %" PRIu64 ".%03" PRIu64 " Idx:%d = Point(is_valid=%d, x=%2.3f, y=%2.3f)",
+				          sample->timestamp_ns / 1000000000, sample->timestamp_ns / 1000000 % 1000,
+				          HistoryIndex, sample->is_valid, sample->x, sample->y);
+			} else {
+				bucket = &view.runs[run].buckets[idx];
+				log_event(WARNING, " ● %" PRIu64 " Idx:%d minute of %u changes: x=%2.3f [%2.3f, %2.3f], y=%2.3f [%2.3f, %2.3f]",
+				          bucket->start_ns / 1000000000, HistoryIndex, bucket->count,
+				          bucket->mean_x, bucket->min_x, bucket->max_x,
+				          bucket->mean_y, bucket->min_y, bucket->max_y);
+			}
+		}
+	}
+	return point_history_check(&view);
+}
+
+// intended to be private
+static int show_history(int seconds) {
+	struct timespec ts;
+	uint64_t from_ns;
+	PointHistory *hist = point_segment_history(ShmAddr);
+
+	if (hist == NULL || point_history_depth(hist) == 0) {
+		log_event(WARNING, " [MAIN] The segment keeps no history (see install_data -history)");
+		return ERROR;
+	}
+	if ((uint64_t) HistoryIndex >= point_segment_capacity(ShmAddr)) {
+		log_event(WARNING, " [MAIN] There is no point at index %d", HistoryIndex);
+		return ERROR;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	from_ns = (ts.tv_sec - seconds) * 1000000000ull + ts.tv_nsec;
+	log_event(INFO, " [MAIN] Changes of index %d over the last %d seconds", HistoryIndex, seconds);
+	while (!show_history_tier(hist, POINT_HISTORY_RAW, from_ns)) {
+		log_event(INFO, " [MAIN] The writer overwrote part of the history, reading it again");
+	}
+	log_event(INFO, " [MAIN] Summary per minute");
+	while (!show_history_tier(hist, POINT_HISTORY_MINUTES, from_ns)) {
+		log_event(INFO, " [MAIN] The writer overwrote part of the history, reading it again");
+	}
+	return OK;
+}
+
+// intended to be private: turns a -stats list into POINT_SUMMARY_* flags, -1 if
+// something in it is not known
+static int parse_stats(char* list) {
+	int what = 0;
+	char *name, *rest;
+
+	for (name = strtok_r(list, ",", &rest); name != NULL; name = strtok_r(NULL, ",", &rest)) {
+		if (!strcmp(name, "mean")) {
+			what |= POINT_SUMMARY_MEAN;
+		} else if (!strcmp(name, "var")) {
+			what |= POINT_SUMMARY_VARIANCE;
+		} else if (!strcmp(name, "bounds")) {
+			what |= POINT_SUMMARY_BOUNDS;
+		} else if (!strcmp(name, "hist")) {
+			/* the box of each second is the histogram box of the next one */
+			what |= POINT_SUMMARY_HISTOGRAM | POINT_SUMMARY_BOUNDS;
+		} else if (!strcmp(name, "all")) {
+			what |= POINT_SUMMARY_ALL;
+		} else {
+			return -1;
+		}
+	}
+	return what;
+}
+
+// intended to be private: the statistics are only computed again when the
+// points changed (or the histogram box just became known)
+static void show_summary(bool changed) {
+	int row, col, what = SummaryWhat;
+	char line[HISTOGRAM_BINS*21 + 1];
+
+	if (what == 0) {
+		return;
+	}
+	if (!HaveBox) {
+		what &= ~POINT_SUMMARY_HISTOGRAM;
+	}
+	if (changed || what != SummaryDone) {
+		Summary.bins_x = HISTOGRAM_BINS;
+		Summary.bins_y = HISTOGRAM_BINS;
+		Summary.hist_min_x = Summary.min_x;
+		Summary.hist_max_x = Summary.max_x;
+		Summary.hist_min_y = Summary.min_y;
+		Summary.hist_max_y = Summary.max_y;
+		Summary.bins = SummaryBins;
+		point_segment_summary(ShmAddr, what, 0, &Summary);
+		HaveBox = Summary.count > 0;
+		SummaryDone = what;
+	}
+
+	if (Summary.what & POINT_SUMMARY_MEAN) {
+		log_event(WARNING, " ● Centroid(count=%" PRIu64 ", x=%2.3f, y=%2.3f)",
+		          Summary.count, Summary.mean_x, Summary.mean_y);
+	}
+	if (Summary.what & POINT_SUMMARY_VARIANCE) {
+		log_event(WARNING, " ● Spread(var_x=%2.3f, var_y=%2.3f, stddev_x=%2.3f, stddev_y=%2.3f)",
+		          Summary.var_x, Summary.var_y, Summary.stddev_x, Summary.stddev_y);
+	}
+	if (Summary.what & POINT_SUMMARY_BOUNDS) {
+		log_event(WARNING, " ● BoundingBox(min_x=%2.3f, max_x=%2.3f, min_y=%2.3f, max_y=%2.3f)",
+		          Summary.min_x, Summary.max_x, Summary.min_y, Summary.max_y);
+	}
+	if (Summary.what & POINT_SUMMARY_HISTOGRAM) {
+		log_event(WARNING, " ● Histogram(%dx%d over x=[%2.3f, %2.3f] y=[%2.3f, %2.3f], outside=%" PRIu64 ")",
+		          HISTOGRAM_BINS, HISTOGRAM_BINS, Summary.hist_min_x, Summary.hist_max_x,
+		          Summary.hist_min_y, Summary.hist_max_y, Summary.outside);
+		/* the top row (highest y) first, as on a plot */
+		for (row = HISTOGRAM_BINS - 1; row >= 0; row--) {
+			line[0] = '\0';
+			for (col = 0; col < HISTOGRAM_BINS; col++) {
+				snprintf(line + strlen(line), sizeof(line) - strlen(line), " %6" PRIu64,
+				         SummaryBins[row*HISTOGRAM_BINS + col]);
+			}
+			log_event(WARNING, "   %s %s", row > 0 ? "├──" : "└──", line);
+		}
+	}
+}
+
 
 int main(int argc, char *argv[]) {
 	sigset_t mask;
+	int idx, tick = 0, status;
+	uint64_t generation;
+	size_t size;
 	/* REQ_monitor_2: ...If the argument is not present, 30 seconds will be the default value. */
 	int seconds = DEFAULT_DURATION;
 
 	also_print_log(true);
-	set_logfile("/var/log/monitor_shm.log");
+	dedupe_log(true);
+	set_logfile(LOGFILE);
+	/* the lines are written by a thread of the log library, so logging never
+	holds up a caller that has the segment locked */
+	start_async_log(0, LOG_BLOCK);
 
 	/* this is not necessary, but I wanted to be explicit with a log entry */
 	use_semaphores(false);
@@ -96,20 +372,86 @@ int main(int argc, char *argv[]) {
 	install_signal_handler(SIGINT, signal_exit);
 	install_signal_handler(SIGQUIT, signal_exit);
 
+	/* the optional -binlog, -maplog <MB>, -recorder <key>, -verify <ticks>,
+	-stats <list> and -history <index> come before everything else */
+	while (argc > 1 && argv[1][0] == '-') {
+		if (!strcmp(argv[1], "-binlog")) {
+			use_binary_log(true);
+			argv[1] = argv[0];
+			argv++;
+			argc--;
+			continue;
+		} else if (argc < 3) {
+			break;
+		} else if (!strcmp(argv[1], "-maplog")) {
+			MapLogMb = atoi(argv[2]);
+			if (MapLogMb < 1) {
+				printf("Invalid argument: -maplog takes a file size in MB > 0\n");
+				exit(ERROR);
+			}
+		} else if (!strcmp(argv[1], "-recorder")) {
+			RecorderKey = strtol(argv[2], NULL, 0);
+			if (RecorderKey == 0) {
+				printf("Invalid argument: -recorder takes a segment key other than 0\n");
+				exit(ERROR);
+			}
+		} else if (!strcmp(argv[1], "-verify")) {
+			VerifyTicks = atoi(argv[2]);
+			if (VerifyTicks < 1) {
+				printf("Invalid argument: -verify takes a number of seconds > 0\n");
+				exit(ERROR);
+			}
+		} else if (!strcmp(argv[1], "-stats")) {
+			SummaryWhat = parse_stats(argv[2]);
+			if (SummaryWhat < 0) {
+				printf("Invalid argument: -stats takes a list of mean, var, bounds, hist or all\n");
+				exit(ERROR);
+			}
+		} else if (!strcmp(argv[1], "-history")) {
+			HistoryIndex = atoi(argv[2]);
+			if (HistoryIndex < 0) {
+				printf("Invalid argument: -history takes a point index >= 0\n");
+				exit(ERROR);
+			}
+		} else {
+			break;
+		}
+		/* the remaining arguments are handled as if the option was never there */
+		argv[2] = argv[0];
+		argv += 2;
+		argc -= 2;
+	}
+
+	if (MapLogMb > 0 && map_logfile(LOGFILE, MapLogMb*1024, MAP_LOG_KEEP) != LOG_OK) {
+		exit(ERROR);
+	}
+	if (RecorderKey != 0 && start_flight_recorder(RecorderKey, 0, DEBUG) != LOG_OK) {
+		exit(ERROR);
+	}
+
 	/* REQ_monitor_1: The monitor_shm program shall take one optional argument. This
 	argument, if present, would be an integer which represents the amount of time in
 	seconds to monitor the shared memory segment. */
-	if (argc == 2) {
+	if (argc >= 2) {
 		seconds = atoi(argv[1]);
 	}
+	if (argc > 2) {
+		NumWatchedIds = argc - 2;
+		WatchedIds = malloc(NumWatchedIds*sizeof(uint64_t));
+		for (idx = 0; idx < NumWatchedIds; idx++) {
+			WatchedIds[idx] = strtoull(argv[idx + 2], NULL, 10);
+		}
+	}
 	if (seconds < 1) {
 		log_event (FATAL, " [MAIN] Invalid argument given");
 		printf("Invlid argument: given seconds should be > 0\n");
 		exit(ERROR);
 	}
 
-	/* connect to (and possibly create) the shared memory segment */
-	ShmAddr = (void*) connect_shm(SHM_KEY, MAX_NUM_POINTS*sizeof(Point));
+	/* connect to (and possibly create) the shared memory segment, an existing
+	segment is attached whatever its size */
+	size = shm_size(SHM_KEY);
+	ShmAddr = (void*) connect_shm(SHM_KEY, size != 0 ? size : point_segment_size(DEFAULT_NUM_POINTS, 0));
 	shm_lock(SHM_KEY);
 		show_segments();
 	shm_unlock(SHM_KEY);
@@ -119,19 +461,43 @@ int main(int argc, char *argv[]) {
 		exit(1);
 	}
 
+	if (HistoryIndex >= 0) {
+		status = show_history(seconds);
+		detach_shm(ShmAddr);
+		free(WatchedIds);
+		return status;
+	}
+
+	/* only report the changes made from now on */
+	ChangeCursor = change_ring_head(point_segment_changes(ShmAddr));
+
 	log_event(INFO, " [MAIN] Monitoring for the next %d seconds", seconds);
 	while (seconds > 0 && Running == true) {
 		log_event(INFO, " [MAIN] %d seconds left", seconds);
 
-		/* REQ_monitor_3 is fulfulled by show_points() */
-		if (shm_lock(SHM_KEY) == false) {
-			log_event(WARNING, " [MAIN] The lock has been lost! Accessing the shared memory segment is potentially dangerous.");
-
-			/* though, to ensure I am fulfilling the requirement, I will show the points anyway */
-			show_points(ShmAddr, MAX_NUM_POINTS);
+		/* REQ_monitor_3 is fulfulled by show_points(). The segment lock is not
+		taken, the points are read under their sequence counters (see point.h) so
+		the writer is never held up by a monitor. After the first second only the
+		points changed since are looked at, and a second without any change
+		costs a single load. */
+		generation = point_segment_generation(ShmAddr);
+		if (tick == 0) {
+			Generation = generation;
+			show_points(ShmAddr, DEFAULT_NUM_POINTS);
+			show_summary(true);
+		} else if (generation != Generation) {
+			Generation = show_changed_points(ShmAddr, Generation, DEFAULT_NUM_POINTS);
+			show_summary(true);
 		} else {
-			show_points(ShmAddr, MAX_NUM_POINTS);
-			shm_unlock(SHM_KEY);
+			log_event(WARNING, " ● PointStats unchanged (generation=%" PRIu64 ")", Generation);
+			show_summary(false);
+		}
+		show_changes();
+		show_watched_ids();
+
+		tick += 1;
+		if (VerifyTicks > 0 && tick % VerifyTicks == 0) {
+			verify_point_stats(ShmAddr);
 		}
 
 		sleep(1);
@@ -143,6 +509,7 @@ int main(int argc, char *argv[]) {
 	the shared memory segment. */
 	log_event(INFO, " [MAIN] Detaching from %d", SHM_KEY);
 	detach_shm(ShmAddr);
+	free(WatchedIds);
 
 	log_event (INFO, " [MAIN] Completed!");
 	return OK;
@@ -0,0 +1,396 @@
+/*
+* Library: log_mgr - manage and interface with a set of logs
+*/
+
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <time.h>
+#include "log_mgr.h"
+#include "log_format.h"
+
+/* the longest conversion (say "%-+#012.10lld") render_line copies out of a format */
+#define SPEC_MAX  32
+/* strings up to this long are made NUL terminated on the stack */
+#define STRING_MAX  256
+/* what log_format_fixed works out itself: the precision, the width and the
+magnitude (the 53 bits of a double with an exponent of at most 0), beyond which
+it leaves the value to snprintf */
+#define FIXED_MAX_PRECISION  9
+#define FIXED_MAX_WIDTH      32
+#define FIXED_MAX_EXPONENT   0
+/* the least log_reserve allocates, which most lines and records fit in */
+#define RESERVE_MIN          2048
+
+static const uint64_t POWERS_OF_TEN[FIXED_MAX_PRECISION + 1] = {
+	1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull, 1000000000ull};
+
+const char *LOG_LEVEL_STRING[] = {"DEBUG", "INFO", "WARNING", "FATAL"};
+
+/* where the next piece of a line goes: nowhere once the line is full, so that
+snprintf only counts what it would have written */
+#define OUT(line, size, pos)  ((pos) < (size) ? (line) + (pos) : NULL)
+#define ROOM(size, pos)       ((pos) < (size) ? (size) - (pos) : 0)
+
+/* formats a single value with the conversion, passing the '*' ints before it */
+#define RENDER(line, size, pos, conv, spec, star, value) \
+	((spec).stars == 0 ? snprintf(OUT(line, size, pos), ROOM(size, pos), conv, value) \
+	 : (spec).stars == 1 ? snprintf(OUT(line, size, pos), ROOM(size, pos), conv, star[0], value) \
+	 : snprintf(OUT(line, size, pos), ROOM(size, pos), conv, star[0], star[1], value))
+
+int log_format_spec (const char *spec, LogFormatSpec *parsed) {
+	const char *c = spec + 1;
+	int longs = 0;
+	char size = 0;
+
+	parsed->type = LOG_ARG_NONE;
+	parsed->stars = 0;
+	parsed->precision = LOG_NO_PRECISION;
+	if (*c == '%') {
+		return 2;
+	}
+
+	/* flags, width and precision */
+	while (*c != '\0' && strchr("-+ #0'", *c) != NULL) {
+		c++;
+	}
+	if (*c == '*') {
+		parsed->stars++;
+		c++;
+	}
+	while (isdigit((unsigned char) *c)) {
+		c++;
+	}
+	if (*c == '.') {
+		c++;
+		if (*c == '*') {
+			parsed->stars++;
+			parsed->precision = LOG_STAR_PRECISION;
+			c++;
+		} else {
+			parsed->precision = 0;
+		}
+		while (isdigit((unsigned char) *c)) {
+			if (parsed->precision < 100000000) {
+				parsed->precision = parsed->precision * 10 + (*c - '0');
+			}
+			c++;
+		}
+	}
+
+	/* length modifier */
+	if (*c == 'h') {
+		c += c[1] == 'h' ? 2 : 1;
+	} else if (*c == 'l') {
+		longs = c[1] == 'l' ? 2 : 1;
+		c += longs;
+	} else if (*c == 'q') {
+		longs = 2;
+		c++;
+	} else if (*c == 'L' || *c == 'j' || *c == 'z' || *c == 't') {
+		size = *c++;
+	}
+
+	switch (*c) {
+		case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+			if (*c == 'c' && (longs || size)) {
+				/* wide characters are not supported */
+				return 0;
+			}
+			parsed->type = size == 'j' ? LOG_ARG_INTMAX
+			             : size == 'z' ? LOG_ARG_SIZE
+			             : size == 't' ? LOG_ARG_PTRDIFF
+			             : longs == 2 ? LOG_ARG_LONG_LONG
+			             : longs == 1 ? LOG_ARG_LONG
+			             : LOG_ARG_INT;
+			break;
+		case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+			parsed->type = size == 'L' ? LOG_ARG_LONG_DOUBLE : LOG_ARG_DOUBLE;
+			break;
+		case 's':
+			if (longs || size) {
+				return 0;
+			}
+			parsed->type = LOG_ARG_STRING;
+			break;
+		case 'p':
+			parsed->type = LOG_ARG_POINTER;
+			break;
+		default:
+			/* %n, or not a conversion at all */
+			return 0;
+	}
+	return c - spec + 1;
+}
+
+// intended to be private: copies the next size bytes of the arguments into value
+static bool take(const char **args, const char *end, void *value, size_t size) {
+	if ((size_t) (end - *args) < size) {
+		return false;
+	}
+	memcpy(value, *args, size);
+	*args += size;
+	return true;
+}
+
+int log_render_line (const LogRecord *record, const char *fmt, char *line, size_t size) {
+	int idx, len;
+	size_t pos = 0;
+	int star[2];
+	char conv[SPEC_MAX];
+	char small[STRING_MAX];
+	char *text;
+	const char *args = (const char *) (record + 1);
+	const char *end = (const char *) record + record->length;
+	int32_t int_value;
+	int64_t long_value;
+	uint32_t string_length;
+	double double_value;
+	long double long_double_value;
+	time_t secs = record->timestamp_ns / 1000000000ull;
+	struct tm local;
+	LogFormatSpec spec;
+
+	localtime_r(&secs, &local);
+	pos += snprintf(OUT(line, size, pos), ROOM(size, pos), "%02d:%02d:%02d.%03d  %-7s |",
+	                local.tm_hour, local.tm_min, local.tm_sec, (int) (record->timestamp_ns / 1000000 % 1000),
+	                record->level <= FATAL ? LOG_LEVEL_STRING[record->level] : "?");
+
+	while (*fmt != '\0') {
+		if (*fmt != '%') {
+			for (len = 0; fmt[len] != '\0' && fmt[len] != '%'; len++);
+			if (pos < size) {
+				memcpy(line + pos, fmt, len < (int) (size - pos) ? len : (int) (size - pos));
+			}
+			pos += len;
+			fmt += len;
+			continue;
+		}
+
+		len = log_format_spec(fmt, &spec);
+		if (len == 0 || len >= SPEC_MAX) {
+			return -1;
+		}
+		memcpy(conv, fmt, len);
+		conv[len] = '\0';
+		fmt += len;
+
+		for (idx = 0; idx < spec.stars; idx++) {
+			if (!take(&args, end, &star[idx], sizeof(int32_t))) {
+				return -1;
+			}
+		}
+		switch (spec.type) {
+			case LOG_ARG_NONE:
+				len = snprintf(OUT(line, size, pos), ROOM(size, pos), "%%");
+				break;
+			case LOG_ARG_INT:
+				if (!take(&args, end, &int_value, sizeof(int32_t))) {
+					return -1;
+				}
+				len = RENDER(line, size, pos, conv, spec, star, (int) int_value);
+				break;
+			case LOG_ARG_LONG:
+			case LOG_ARG_LONG_LONG:
+			case LOG_ARG_SIZE:
+			case LOG_ARG_INTMAX:
+			case LOG_ARG_PTRDIFF:
+			case LOG_ARG_POINTER:
+				if (!take(&args, end, &long_value, sizeof(int64_t))) {
+					return -1;
+				}
+				len = spec.type == LOG_ARG_LONG ? RENDER(line, size, pos, conv, spec, star, (long) long_value)
+				    : spec.type == LOG_ARG_LONG_LONG ? RENDER(line, size, pos, conv, spec, star, (long long) long_value)
+				    : spec.type == LOG_ARG_SIZE ? RENDER(line, size, pos, conv, spec, star, (size_t) long_value)
+				    : spec.type == LOG_ARG_INTMAX ? RENDER(line, size, pos, conv, spec, star, (intmax_t) long_value)
+				    : spec.type == LOG_ARG_PTRDIFF ? RENDER(line, size, pos, conv, spec, star, (ptrdiff_t) long_value)
+				    : RENDER(line, size, pos, conv, spec, star, (void *) (uintptr_t) long_value);
+				break;
+			case LOG_ARG_DOUBLE:
+				if (!take(&args, end, &double_value, sizeof(double))) {
+					return -1;
+				}
+				len = RENDER(line, size, pos, conv, spec, star, double_value);
+				break;
+			case LOG_ARG_LONG_DOUBLE:
+				if (!take(&args, end, &long_double_value, sizeof(long double))) {
+					return -1;
+				}
+				args += 16 - sizeof(long double);
+				len = RENDER(line, size, pos, conv, spec, star, long_double_value);
+				break;
+			case LOG_ARG_STRING:
+				if (!take(&args, end, &string_length, sizeof(uint32_t))) {
+					return -1;
+				}
+				if (string_length == LOG_NULL_STRING) {
+					len = RENDER(line, size, pos, conv, spec, star, (char *) NULL);
+					break;
+				}
+				if ((size_t) (end - args) < string_length) {
+					return -1;
+				}
+				text = string_length < STRING_MAX ? small : malloc(string_length + 1);
+				if (text == NULL) {
+					return -1;
+				}
+				memcpy(text, args, string_length);
+				text[string_length] = '\0';
+				args += string_length;
+				len = RENDER(line, size, pos, conv, spec, star, text);
+				if (text != small) {
+					free(text);
+				}
+				break;
+			default:
+				return -1;
+		}
+		pos += len > 0 ? len : 0;
+	}
+
+	if (pos < size) {
+		line[pos] = '\n';
+	}
+	pos++;
+	if (size > 0) {
+		line[pos < size ? pos : size - 1] = '\0';
+	}
+	return pos;
+}
+
+bool log_reserve (char **buffer, size_t *size, size_t needed) {
+	char *grown;
+
+	if (needed <= *size) {
+		return true;
+	}
+	needed = needed > RESERVE_MIN ? needed : RESERVE_MIN;
+	grown = realloc(*buffer, needed);
+	if (grown == NULL) {
+		return false;
+	}
+	*buffer = grown;
+	*size = needed;
+	return true;
+}
+
+int log_render_grow (const LogRecord *record, const char *fmt, char **line, size_t *size) {
+	int len = log_render_line(record, fmt, *line, *size);
+
+	if (len >= 0 && (size_t) len >= *size) {
+		if (!log_reserve(line, size, (size_t) len + 1)) {
+			return LOG_RENDER_NO_MEMORY;
+		}
+		len = log_render_line(record, fmt, *line, *size);
+	}
+	return len;
+}
+
+int log_format_uint (char *out, uint64_t value) {
+	int idx, len = 0;
+	char digits[LOG_INT_SIZE];
+
+	do {
+		digits[len++] = '0' + value % 10;
+		value /= 10;
+	} while (value != 0);
+	for (idx = 0; idx < len; idx++) {
+		out[idx] = digits[len - 1 - idx];
+	}
+	return len;
+}
+
+int log_format_int (char *out, int64_t value) {
+	if (value < 0) {
+		out[0] = '-';
+		/* the negation is done unsigned, which INT64_MIN needs */
+		return 1 + log_format_uint(out + 1, -(uint64_t) value);
+	}
+	return log_format_uint(out, value);
+}
+
+int log_format_fixed (char *out, size_t size, double value, int width, int precision) {
+	int exponent, shift, len, pos = LOG_FIXED_SIZE;
+	bool negative;
+	uint64_t bits, mantissa, whole, fraction;
+	unsigned __int128 scaled, rounded, rest, half;
+	char text[LOG_FIXED_SIZE];
+
+	memcpy(&bits, &value, sizeof(bits));
+	negative = bits >> 63;
+	exponent = (bits >> 52) & 0x7FF;
+	mantissa = bits & ((1ull << 52) - 1);
+	/* a negative width left justifies, which is left to snprintf as well */
+	if (exponent == 0x7FF || precision < 0 || precision > FIXED_MAX_PRECISION
+	    || width < 0 || width > FIXED_MAX_WIDTH) {
+		return snprintf(out, size, "%*.*f", width, precision, value);
+	}
+	/* the value is mantissa * 2^exponent */
+	if (exponent == 0) {
+		exponent = 1;
+	} else {
+		mantissa |= 1ull << 52;
+	}
+	exponent -= 1075;
+	if (exponent > FIXED_MAX_EXPONENT) {
+		return snprintf(out, size, "%*.*f", width, precision, value);
+	}
+
+	/* value * 10^precision is exact in 128 bits (below 2^83), it is rounded to
+	an integer by looking at the bits shifted out: to nearest, ties to even */
+	scaled = (unsigned __int128) mantissa * POWERS_OF_TEN[precision];
+	shift = -exponent;
+	if (shift == 0) {
+		rounded = scaled;
+	} else if (shift >= 127) {
+		/* below 2^-44, far from a half */
+		rounded = 0;
+	} else {
+		rounded = scaled >> shift;
+		rest = scaled & (((unsigned __int128) 1 << shift) - 1);
+		half = (unsigned __int128) 1 << (shift - 1);
+		if (rest > half || (rest == half && (rounded & 1))) {
+			rounded++;
+		}
+	}
+	/* the whole part is below 2^53, a 128 bit division is only needed for the
+	largest values */
+	if ((uint64_t) (rounded >> 64) == 0) {
+		whole = (uint64_t) rounded / POWERS_OF_TEN[precision];
+		fraction = (uint64_t) rounded % POWERS_OF_TEN[precision];
+	} else {
+		whole = rounded / POWERS_OF_TEN[precision];
+		fraction = rounded % POWERS_OF_TEN[precision];
+	}
+
+	/* the digits are written backwards from the end of the text */
+	for (len = 0; len < precision; len++) {
+		text[--pos] = '0' + fraction % 10;
+		fraction /= 10;
+	}
+	if (precision > 0) {
+		text[--pos] = '.';
+	}
+	do {
+		text[--pos] = '0' + whole % 10;
+		whole /= 10;
+	} while (whole != 0);
+	if (negative) {
+		text[--pos] = '-';
+	}
+	while (LOG_FIXED_SIZE - pos < width) {
+		text[--pos] = ' ';
+	}
+
+	len = LOG_FIXED_SIZE - pos;
+	if (size > 0) {
+		memcpy(out, text + pos, (size_t) len < size ? (size_t) len : size - 1);
+		out[(size_t) len < size ? (size_t) len : size - 1] = '\0';
+	}
+	return len;
+}
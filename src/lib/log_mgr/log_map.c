@@ -0,0 +1,433 @@
+/*
+* Library: log_mgr - manage and interface with a set of logs
+*/
+
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "log_mgr.h"
+#include "log_map.h"
+
+#define ALIGN_UP(size, align) (((size) + (align) - 1) / (align) * (align))
+/* maps in use or waiting to be fsynced, taken without allocating */
+#define MAP_POOL  4
+/* how long lines are appended to a full file before mapping a new one is tried again */
+#define RETRY_NS  1000000000ull
+
+/* a mapped file: writers reserve [offset, offset + length) and copy into it */
+typedef struct LogMap {
+	char *base;
+	/* the rotation size, all of it is mapped (only allocated bytes may be touched) */
+	uint64_t size;
+	uint64_t offset __attribute__((aligned(64)));
+	/* writers still copying into the map */
+	int active __attribute__((aligned(64)));
+	uint64_t allocated;
+	pthread_mutex_t grow;
+	int fd;
+	/* in the pool (or allocated) */
+	bool pooled;
+	bool taken;
+	/* the next rotated file waiting to be fsynced */
+	struct LogMap *next;
+} LogMap;
+
+static LogMap *Map = NULL;
+/* held while the map is replaced (rotated, opened or closed) */
+static pthread_mutex_t MapLock = PTHREAD_MUTEX_INITIALIZER;
+static char Name[PATH_MAX];
+static uint64_t FileSize;
+static unsigned int Keep;
+static LogMapPreamble Preamble;
+static LogMap Pool[MAP_POOL];
+
+/* the full file (unmapped, appended to with write) while no new file could be
+mapped on a rotation, and when to try again */
+static LogMap *Spill = NULL;
+static uint64_t SpillRetry;
+
+/* the rotated files waiting for the syncer thread */
+static LogMap *Retired = NULL;
+static bool SyncerRunning = false;
+static pthread_t Syncer;
+static pthread_mutex_t SyncLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t SyncCond = PTHREAD_COND_INITIALIZER;
+
+
+// intended to be private: makes sure the file holds [0, end), a chunk ahead
+static bool grow_map(LogMap *map, uint64_t end) {
+	int ret = 0;
+	uint64_t target;
+
+	pthread_mutex_lock(&map->grow);
+	if (map->allocated < end) {
+		target = ALIGN_UP(end, LOG_MAP_CHUNK) + LOG_MAP_CHUNK;
+		target = target < map->size ? target : map->size;
+		ret = posix_fallocate(map->fd, map->allocated, target - map->allocated);
+		if (ret == 0) {
+			__atomic_store_n(&map->allocated, target, __ATOMIC_RELEASE);
+		} else {
+			fprintf(stderr, "LOG_ERROR: Could not grow the log file: %s\n", strerror(ret));
+		}
+	}
+	pthread_mutex_unlock(&map->grow);
+	return ret == 0;
+}
+
+// intended to be private: a map from the pool (a rotation does not allocate
+// unless the syncer thread fell behind)
+static LogMap* new_map() {
+	int idx;
+	LogMap *map = NULL;
+
+	pthread_mutex_lock(&SyncLock);
+	for (idx = 0; idx < MAP_POOL && map == NULL; idx++) {
+		if (!Pool[idx].taken) {
+			map = &Pool[idx];
+		}
+	}
+	if (map != NULL) {
+		memset(map, 0, sizeof(LogMap));
+		map->pooled = true;
+		map->taken = true;
+	}
+	pthread_mutex_unlock(&SyncLock);
+	return map != NULL ? map : calloc(1, sizeof(LogMap));
+}
+
+// intended to be private
+static void free_map(LogMap *map) {
+	pthread_mutex_destroy(&map->grow);
+	if (!map->pooled) {
+		free(map);
+		return;
+	}
+	pthread_mutex_lock(&SyncLock);
+	map->taken = false;
+	pthread_mutex_unlock(&SyncLock);
+}
+
+// intended to be private: maps the file, after what it holds already
+static LogMap* open_map(const char *logfile_name, uint64_t size) {
+	struct stat st;
+	LogMap *map = new_map();
+
+	if (map == NULL) {
+		return NULL;
+	}
+	pthread_mutex_init(&map->grow, NULL);
+	map->fd = open(logfile_name, O_CREAT | O_RDWR | O_APPEND, 0666);
+	if (map->fd == BAD_FILE || fstat(map->fd, &st) != 0) {
+		fprintf(stderr, "LOG_ERROR: Could not open file '%s' for mapping: %s\n", logfile_name, strerror(errno));
+		if (map->fd != BAD_FILE) {
+			close(map->fd);
+		}
+		free_map(map);
+		return NULL;
+	}
+	map->size = (uint64_t) st.st_size > size ? (uint64_t) st.st_size : size;
+	map->base = mmap(NULL, map->size, PROT_READ | PROT_WRITE, MAP_SHARED, map->fd, 0);
+	if (map->base == MAP_FAILED) {
+		fprintf(stderr, "LOG_ERROR: Could not map file '%s': %s\n", logfile_name, strerror(errno));
+		close(map->fd);
+		free_map(map);
+		return NULL;
+	}
+	map->offset = st.st_size;
+	map->allocated = st.st_size;
+	grow_map(map, map->offset + 1);
+	return map;
+}
+
+// intended to be private
+static uint64_t coarse_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// intended to be private: the syncer thread, fsyncs and closes the rotated files
+static void* sync_maps(void *arg) {
+	LogMap *map;
+
+	while (true) {
+		pthread_mutex_lock(&SyncLock);
+		while (Retired == NULL) {
+			pthread_cond_wait(&SyncCond, &SyncLock);
+		}
+		map = Retired;
+		Retired = map->next;
+		pthread_mutex_unlock(&SyncLock);
+
+		fsync(map->fd);
+		close(map->fd);
+		free_map(map);
+	}
+	return NULL;
+}
+
+// intended to be private: waits for the writers still in a map no writer can
+// find anymore
+static void wait_writers(LogMap *map) {
+	while (__atomic_load_n(&map->active, __ATOMIC_ACQUIRE) > 0) {
+		sched_yield();
+	}
+}
+
+// intended to be private: cuts the file of a map no writer can find anymore to
+// its length once the writers still copying into it are done, and unmaps it
+static void unmap_map(LogMap *map, uint64_t used) {
+	wait_writers(map);
+	munmap(map->base, map->size);
+	if (ftruncate(map->fd, used < map->allocated ? used : map->allocated) != 0) {
+		fprintf(stderr, "LOG_ERROR: Could not cut the log file to its length: %s\n", strerror(errno));
+	}
+}
+
+// intended to be private: closes the file of an unmapped map, or hands it to
+// the syncer thread to be fsynced first
+static void release_map(LogMap *map, bool sync) {
+	if (!sync || !SyncerRunning) {
+		close(map->fd);
+		free_map(map);
+		return;
+	}
+	pthread_mutex_lock(&SyncLock);
+	map->next = Retired;
+	Retired = map;
+	pthread_cond_signal(&SyncCond);
+	pthread_mutex_unlock(&SyncLock);
+}
+
+// intended to be private
+static void retire_map(LogMap *map, uint64_t used, bool sync) {
+	unmap_map(map, used);
+	release_map(map, sync);
+}
+
+// intended to be private: renames <name>.<n> to <name>.<n+1>, dropping the oldest
+static void shift_files() {
+	unsigned int idx;
+	char from[PATH_MAX + 16], to[PATH_MAX + 16];
+
+	if (Keep == 0) {
+		unlink(Name);
+		return;
+	}
+	for (idx = Keep; idx > 1; idx--) {
+		snprintf(from, sizeof(from), "%s.%u", Name, idx - 1);
+		snprintf(to, sizeof(to), "%s.%u", Name, idx);
+		rename(from, to);
+	}
+	snprintf(to, sizeof(to), "%s.1", Name);
+	rename(Name, to);
+}
+
+// intended to be private: moves from the full map to a new file, the writers
+// reserved the first used bytes of the full one
+static void rotate_map(LogMap *full, uint64_t used) {
+	LogMap *map;
+
+	pthread_mutex_lock(&MapLock);
+	if (__atomic_load_n(&Map, __ATOMIC_ACQUIRE) != full) {
+		/* closed in the meantime */
+		pthread_mutex_unlock(&MapLock);
+		return;
+	}
+	shift_files();
+	map = open_map(Name, FileSize);
+	if (map == NULL) {
+		/* no line is lost: they go on to the end of the full file (now <name>.1)
+		until a new file can be mapped. The writers waiting for the rotation
+		wait on MapLock until the spill is set up. */
+		__atomic_store_n(&Map, NULL, __ATOMIC_SEQ_CST);
+		unmap_map(full, used);
+		__atomic_store_n(&SpillRetry, coarse_ns() + RETRY_NS, __ATOMIC_RELAXED);
+		__atomic_store_n(&Spill, full, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&MapLock);
+		return;
+	}
+	if (Preamble != NULL) {
+		map->offset = Preamble(map->base, map->allocated);
+	}
+	__atomic_store_n(&Map, map, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&MapLock);
+
+	retire_map(full, used, true);
+}
+
+// intended to be private: tries again to map a new file for the lines going to
+// the full one
+static void retry_rotation(LogMap *spill) {
+	LogMap *map = NULL;
+
+	pthread_mutex_lock(&MapLock);
+	if (__atomic_load_n(&Spill, __ATOMIC_ACQUIRE) == spill && coarse_ns() >= SpillRetry) {
+		map = open_map(Name, FileSize);
+		if (map == NULL) {
+			__atomic_store_n(&SpillRetry, coarse_ns() + RETRY_NS, __ATOMIC_RELAXED);
+		} else {
+			if (Preamble != NULL) {
+				map->offset = Preamble(map->base, map->allocated);
+			}
+			__atomic_store_n(&Spill, NULL, __ATOMIC_SEQ_CST);
+			__atomic_store_n(&Map, map, __ATOMIC_SEQ_CST);
+		}
+	}
+	pthread_mutex_unlock(&MapLock);
+
+	if (map != NULL) {
+		wait_writers(spill);
+		release_map(spill, true);
+	}
+}
+
+// intended to be private: appends the piece to the full file, returns LOG_OK,
+// LOG_ERROR or 1 if the file is not the one lines go to anymore
+static int spill_write(LogMap *spill, const struct iovec *iov, int count, uint64_t length) {
+	ssize_t written;
+
+	__atomic_fetch_add(&spill->active, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&Spill, __ATOMIC_SEQ_CST) != spill) {
+		__atomic_fetch_sub(&spill->active, 1, __ATOMIC_RELEASE);
+		return 1;
+	}
+	/* one writev on a file opened O_APPEND, the piece is not split by others */
+	written = writev(spill->fd, iov, count);
+	__atomic_fetch_sub(&spill->active, 1, __ATOMIC_RELEASE);
+	return written == (ssize_t) length ? LOG_OK : LOG_ERROR;
+}
+
+
+int log_map_open (const char *logfile_name, uint64_t file_size, unsigned int keep, LogMapPreamble preamble) {
+	struct stat st;
+	LogMap *map;
+
+	log_map_close();
+	if (strlen(logfile_name) >= sizeof(Name)) {
+		return LOG_ERROR;
+	}
+
+	pthread_mutex_lock(&MapLock);
+	if (!SyncerRunning && pthread_create(&Syncer, NULL, sync_maps, NULL) == 0) {
+		pthread_detach(Syncer);
+		SyncerRunning = true;
+	}
+	snprintf(Name, sizeof(Name), "%s", logfile_name);
+	FileSize = file_size;
+	Keep = keep;
+	Preamble = preamble;
+	/* a file that is full already is rotated first */
+	if (stat(Name, &st) == 0 && (uint64_t) st.st_size >= file_size) {
+		shift_files();
+	}
+	map = open_map(Name, FileSize);
+	__atomic_store_n(&Map, map, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&MapLock);
+	return map != NULL ? LOG_OK : LOG_ERROR;
+}
+
+int log_map_write (const struct iovec *iov, int count) {
+	int idx;
+	int ret;
+	uint64_t start, length = 0;
+	bool waited = false;
+	LogMap *map, *spill;
+
+	for (idx = 0; idx < count; idx++) {
+		length += iov[idx].iov_len;
+	}
+
+	while (true) {
+		map = __atomic_load_n(&Map, __ATOMIC_ACQUIRE);
+		if (map == NULL) {
+			spill = __atomic_load_n(&Spill, __ATOMIC_ACQUIRE);
+			if (spill == NULL) {
+				/* a rotation may be setting up the spill, wait for it once */
+				if (waited) {
+					return LOG_ERROR;
+				}
+				pthread_mutex_lock(&MapLock);
+				pthread_mutex_unlock(&MapLock);
+				waited = true;
+				continue;
+			}
+			if (coarse_ns() >= __atomic_load_n(&SpillRetry, __ATOMIC_RELAXED)) {
+				retry_rotation(spill);
+				continue;
+			}
+			ret = spill_write(spill, iov, count, length);
+			if (ret != 1) {
+				return ret;
+			}
+			continue;
+		}
+		if (length > map->size) {
+			return LOG_ERROR;
+		}
+		/* the map is only retired once no writer is in it (and a writer that
+		came in after it was replaced leaves again) */
+		__atomic_fetch_add(&map->active, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&Map, __ATOMIC_SEQ_CST) != map) {
+			__atomic_fetch_sub(&map->active, 1, __ATOMIC_RELEASE);
+			continue;
+		}
+
+		start = __atomic_fetch_add(&map->offset, length, __ATOMIC_RELAXED);
+		if (start + length <= map->size) {
+			break;
+		}
+		__atomic_fetch_sub(&map->active, 1, __ATOMIC_RELEASE);
+		if (start <= map->size) {
+			/* the one piece running past the end rotates the file */
+			rotate_map(map, start);
+		} else {
+			while (__atomic_load_n(&Map, __ATOMIC_ACQUIRE) == map) {
+				sched_yield();
+			}
+		}
+	}
+
+	if (start + length > __atomic_load_n(&map->allocated, __ATOMIC_ACQUIRE) && !grow_map(map, start + length)) {
+		__atomic_fetch_sub(&map->active, 1, __ATOMIC_RELEASE);
+		return LOG_ERROR;
+	}
+	for (idx = 0; idx < count; idx++) {
+		memcpy(map->base + start, iov[idx].iov_base, iov[idx].iov_len);
+		start += iov[idx].iov_len;
+	}
+	__atomic_fetch_sub(&map->active, 1, __ATOMIC_RELEASE);
+	return LOG_OK;
+}
+
+void log_map_close (void) {
+	uint64_t used;
+	LogMap *map, *spill;
+
+	pthread_mutex_lock(&MapLock);
+	map = __atomic_exchange_n(&Map, NULL, __ATOMIC_SEQ_CST);
+	spill = __atomic_exchange_n(&Spill, NULL, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&MapLock);
+
+	if (spill != NULL) {
+		wait_writers(spill);
+		release_map(spill, false);
+	}
+	if (map != NULL) {
+		used = __atomic_load_n(&map->offset, __ATOMIC_ACQUIRE);
+		retire_map(map, used < map->size ? used : map->size, false);
+	}
+}
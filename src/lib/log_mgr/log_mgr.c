@@ -8,12 +8,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
+#include <stdint.h>
 #include <sys/file.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <time.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
 #include "log_mgr.h"
+#include "log_format.h"
+#include "log_map.h"
+#include "log_recorder.h"
 
 #define RESET  "\x1B[0m"
 #define RED  "\x1B[31m"
@@ -21,72 +30,1048 @@
 #define YELLOW  "\x1B[33m"
 #define BLUE  "\x1B[34m"
 
-static const char *LEVEL_STRING[] = {"INFO", "WARNING", "FATAL"};
+/* the async ring is made of fixed size slots, a line takes as many consecutive
+slots as its text needs (only the first slot of a line has its header filled) */
+#define SLOT_SIZE          128
+#define SLOT_TEXT          (SLOT_SIZE - 16)
+#define DEFAULT_RING_KB    1024
+/* the most slots the writer hands to a single writev */
+#define WRITEV_SLOTS       256
+/* how long the idle writer sleeps before looking at the ring anyway, which is
+as long as a line may wait in the ring, and how full (1/WAKE_FRACTION) the
+ring has to be before a producer wakes the writer any sooner */
+#define WRITER_IDLE_MS     10
+#define WAKE_FRACTION      8
+/* how long flush_log waits between looks at the ring */
+#define FLUSH_WAIT_US      100
+/* how many times stop_async_log looks for lines still being queued */
+#define STOP_MAX_TRIES     1000
+/* enqueue_line could not take a line that is larger than the whole ring */
+#define RING_TOO_SMALL     1
+/* what emit_line did with a line besides writing it (LOG_OK) or failing to */
+#define LINE_QUEUED        2
+#define LINE_DROPPED       3
+/* log_binary leaves the line to the text path */
+#define BINARY_UNSUPPORTED 4
+
+/* Fd while the lines go to a mapped file (see log_map.h), and the size such a
+file is rotated at unless told otherwise */
+#define MAPPED_FILE        -2
+#define DEFAULT_MAP_KB     (16*1024)
+#define MIN_MAP_KB         64
+
+/* the size of the flight recorder segment unless told otherwise */
+#define DEFAULT_RECORDER_KB 1024
+
+/* the formats seen in binary mode, by address (format strings are expected to
+be literals), and the most bytes of arguments an event record may carry */
+#define FORMAT_SLOTS       1024
+#define FORMAT_HASH_SHIFT  54
+#define RECORD_SIZE        2048
+enum {FORMAT_PENDING, FORMAT_BINARY, FORMAT_TEXT};
+
+/* text lines are formatted in a buffer of the thread, after a prefix of the
+time ("HH:MM:SS.mmm  ", PREFIX_CLOCK bytes) and the level padded to LEVEL_WIDTH */
+#define LINE_BUFFER_SIZE   2048
+#define PREFIX_CLOCK       14
+#define LEVEL_WIDTH        7
+#define PREFIX_LENGTH      (PREFIX_CLOCK + LEVEL_WIDTH + 2)
+
+/* the call sites a thread keeps the last line of while deduplicating (by the
+address of their format), and how often the count of a line that keeps
+repeating is logged */
+#define DEDUPE_SITES       16
+#define DEDUPE_REPORT_S    10
+
+typedef struct LogSlot {
+	/* position + 1 once the line starting at this position is published */
+	uint64_t ready;
+	uint32_t length;
+	uint16_t slots;
+	/* the Levels value of the line, for the colour it is printed in */
+	uint16_t level;
+	char text[SLOT_TEXT];
+} LogSlot;
+
+/* Producers reserve slots by moving the tail with a CAS, copy their line in and
+publish it by storing its ready word last. The writer thread is the only one
+moving the head, which it does once the lines before it are written. */
+typedef struct LogRing {
+	uint64_t tail __attribute__((aligned(64)));
+	uint64_t head __attribute__((aligned(64)));
+	uint64_t dropped __attribute__((aligned(64)));
+	uint64_t capacity;
+	LogSlot* slots;
+} LogRing;
+
+/* a format string as parsed for binary records */
+typedef struct LogFormat {
+	/* the key, set once (with a CAS) by the thread that sets the entry up */
+	const char *fmt;
+	/* FORMAT_PENDING until the rest of the entry is filled in */
+	int state;
+	uint32_t id;
+	/* file generation the format was last defined in, and flight recorder
+	generation it was added to the table of */
+	uint32_t defined;
+	uint32_t recorded;
+	int nargs;
+	uint8_t types[LOG_MAX_ARGS];
+	/* the precision of each string argument (see LogFormatSpec), the bytes
+	read from it are bounded by it */
+	int precisions[LOG_MAX_ARGS];
+} LogFormat;
+
+/* the buffer a thread formats its text lines in, and the HH:MM:SS of the
+second it last logged in */
+typedef struct LineBuffer {
+	time_t second;
+	char clock[8];
+	char text[LINE_BUFFER_SIZE];
+} LineBuffer;
+
+/* the line a call site last logged in a thread, and the times it was repeated */
+typedef struct LogSite {
+	const char *fmt;
+	/* of the message, or of the arguments in binary mode */
+	uint64_t hash;
+	uint32_t repeats;
+	Levels level;
+	/* when the repeats being counted started */
+	time_t since;
+} LogSite;
+
 static int Fd = BAD_FILE;
 static bool AlsoPrint = false;
 
+/* the least level each module writes to the log file, the least level of
+either the file or the flight recorder (what log_enabled looks at), and the
+names set_log_levels knows the modules by */
+static Levels FileLevels[LOG_MODULES] = {INFO, INFO, INFO, INFO};
+Levels LogLevels[LOG_MODULES] = {INFO, INFO, INFO, INFO};
+static const char *MODULE_NAMES[] = {"main", "libshm", "thdlib", "store"};
+static __thread LineBuffer Line = {-1};
+/* the format log_line logs a LogLine with, which the text path copies rather
+than formats */
+static const char LineFormat[] = "%.*s";
+static bool Dedupe = false;
+static __thread LogSite Sites[DEDUPE_SITES];
+/* the sites of a thread are only its own, a thread that counted repeats logs
+them when it exits (from the destructor of this key) */
+static pthread_key_t SitesKey;
+static pthread_once_t SitesOnce = PTHREAD_ONCE_INIT;
+static __thread bool SitesKeyed = false;
+
+/* the binary mode state: the formats by address, and by id for printing. The
+file generation moves on with every log file, which gets its own definitions. */
+static bool Binary = false;
+static LogFormat Formats[FORMAT_SLOTS];
+static LogFormat *FormatIds[FORMAT_SLOTS];
+static uint32_t FileGeneration = 1;
+
+/* the flight recorder state: whether it is on, the least level it records and
+the generation that moves on with every segment (the formats are added to the
+table of each) */
+static bool Recording = false;
+static Levels RecorderLevel = DEBUG;
+static uint32_t RecorderGeneration = 0;
+static pthread_mutex_t RecorderLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the async state: the writer thread and the ring it drains */
+static bool Async = false;
+static bool Stopping = false;
+static bool WriterSleeping = false;
+static LogOverflow Overflow = LOG_BLOCK;
+static LogRing Ring;
+static pthread_t Writer;
+static pthread_mutex_t WakeLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t WakeCond = PTHREAD_COND_INITIALIZER;
+/* held while the log file is written, so that it is not swapped under the writer */
+static pthread_mutex_t FdLock = PTHREAD_MUTEX_INITIALIZER;
+static bool ExitHandler = false;
+
 void also_print_log(bool print) {
 	AlsoPrint = print;
 }
 
-int _log_event(const char *fmt, va_list ap) {
-	int bufferSize = 2048;
-	int resultSize;
-	char buffer[bufferSize];
-	char *logStr = buffer;
-	int ret = LOG_OK;
-	va_list ap_copy;
+void use_binary_log(bool binary) {
+	__atomic_store_n(&Binary, binary, __ATOMIC_RELEASE);
+}
 
-	/* attempt to format the log string from the argument list, resizing
-	the buffer on the heap if necessary (and trying again). Copy the ap list
-	in case this doesn't work so that we can try again. */
-	va_copy(ap_copy, ap);
-	resultSize = vsnprintf(logStr, bufferSize, fmt, ap);
-	if (resultSize >= bufferSize) {
-		bufferSize = resultSize + 1;
-		logStr = (char *) malloc(bufferSize);
+// intended to be private: also has last minute formatting for different kinds of log lines
+static void print_line(Levels l, const char *logStr) {
+	if (l == FATAL) {
+		printf("%s%s%s", RED, logStr, RESET);
+	} else if (l == WARNING) {
+		printf("%s%s%s", YELLOW, logStr, RESET);
+	} else if (l == DEBUG) {
+		printf("%s%s%s", BLUE, logStr, RESET);
+	} else {
+		printf("%s", logStr);
+	}
+}
 
-		resultSize = vsnprintf(logStr, bufferSize, fmt, ap_copy);
-		/* check if enough size was allocated, if not then bail */
-		if (resultSize >= bufferSize) {
+// intended to be private: the entry of the format with the given id
+static LogFormat* format_by_id(uint32_t id) {
+	int probe;
+	LogFormat *format;
+
+	for (probe = 0; probe < FORMAT_SLOTS; probe++) {
+		format = __atomic_load_n(&FormatIds[(id + probe) & (FORMAT_SLOTS - 1)], __ATOMIC_ACQUIRE);
+		if (format == NULL || format->id == id) {
+			return format;
+		}
+	}
+	return NULL;
+}
+
+// intended to be private: prints the text line of a binary event record
+static void print_record(const LogRecord *record, const char *fmt) {
+	char buffer[RECORD_SIZE];
+	char *line = buffer;
+	int len = log_render_line(record, fmt, buffer, sizeof(buffer));
+
+	if (len >= (int) sizeof(buffer)) {
+		line = malloc(len + 1);
+		if (line == NULL) {
+			return;
+		}
+		log_render_line(record, fmt, line, len + 1);
+	}
+	if (len >= 0) {
+		print_line(record->level, line);
+	}
+	if (line != buffer) {
+		free(line);
+	}
+}
+
+// intended to be private: writes every byte of the vector, carrying on after
+// short writes
+static int writev_all(int fd, struct iovec *iov, int count) {
+	ssize_t written;
+
+	while (count > 0) {
+		written = writev(fd, iov, count);
+		if (written == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
 			fprintf(stderr,
-							"LOG_ERROR: Buffer too small: %s\n",
+							"LOG_ERROR: Could not write to file: %s\n",
 							strerror(errno));
-			ret = LOG_ERROR;
+			return LOG_ERROR;
+		}
+		while (count > 0 && (size_t) written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0) {
+			iov->iov_base = (char *) iov->iov_base + written;
+			iov->iov_len -= written;
 		}
 	}
+	return LOG_OK;
+}
 
-	/* only attempt to write the formatted log string to the log if there aren't
-	any errors from formatting the string */
-	if (ret != LOG_ERROR) {
-		int bytesWritten = write(Fd, logStr, strlen(logStr));
+// intended to be private: writes the vector to the log file, or copies it into
+// the mapped one
+static int write_vector(struct iovec *iov, int count) {
+	int ret;
 
-		/* optionally print the message to stdout; also has last minute formatting for different kinds of log lines */
+	pthread_mutex_lock(&FdLock);
+	ret = Fd == MAPPED_FILE ? log_map_write(iov, count) : writev_all(Fd, iov, count);
+	pthread_mutex_unlock(&FdLock);
+	return ret;
+}
+
+// intended to be private
+static void wake_writer() {
+	pthread_mutex_lock(&WakeLock);
+	pthread_cond_signal(&WakeCond);
+	pthread_mutex_unlock(&WakeLock);
+}
+
+// intended to be private: true if the line at the head of the ring is published
+static bool ring_ready() {
+	uint64_t head = __atomic_load_n(&Ring.head, __ATOMIC_RELAXED);
+	return __atomic_load_n(&Ring.slots[head & (Ring.capacity - 1)].ready, __ATOMIC_SEQ_CST) == head + 1;
+}
+
+// intended to be private: copies the line into the ring. Returns LOG_ERROR if
+// the ring is full and lines are to be dropped, RING_TOO_SMALL if it never fits.
+static int enqueue_line(Levels l, const char *logStr, size_t length) {
+	uint64_t idx, tail, slots = length > 0 ? (length + SLOT_TEXT - 1) / SLOT_TEXT : 1;
+	size_t piece, offset = 0;
+	LogSlot *slot;
+
+	if (slots > Ring.capacity || slots > UINT16_MAX) {
+		return RING_TOO_SMALL;
+	}
+
+	tail = __atomic_load_n(&Ring.tail, __ATOMIC_RELAXED);
+	do {
+		while (tail + slots - __atomic_load_n(&Ring.head, __ATOMIC_ACQUIRE) > Ring.capacity) {
+			if (Overflow == LOG_DROP) {
+				__atomic_fetch_add(&Ring.dropped, 1, __ATOMIC_RELAXED);
+				return LOG_ERROR;
+			}
+			/* let the writer make room */
+			wake_writer();
+			sched_yield();
+			tail = __atomic_load_n(&Ring.tail, __ATOMIC_RELAXED);
+		}
+	} while (!__atomic_compare_exchange_n(&Ring.tail, &tail, tail + slots, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	for (idx = 0; idx < slots; idx++) {
+		slot = &Ring.slots[(tail + idx) & (Ring.capacity - 1)];
+		piece = length - offset < SLOT_TEXT ? length - offset : SLOT_TEXT;
+		memcpy(slot->text, logStr + offset, piece);
+		offset += piece;
+	}
+	slot = &Ring.slots[tail & (Ring.capacity - 1)];
+	slot->length = length;
+	slot->slots = slots;
+	slot->level = l;
+	__atomic_store_n(&slot->ready, tail + 1, __ATOMIC_RELEASE);
+
+	/* the writer comes round on its own soon enough, unless the ring fills up
+	(the fence pairs with the writer setting WriterSleeping) */
+	if (tail + slots - __atomic_load_n(&Ring.head, __ATOMIC_RELAXED) >= Ring.capacity / WAKE_FRACTION) {
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&WriterSleeping, __ATOMIC_RELAXED)) {
+			wake_writer();
+		}
+	}
+	return LOG_OK;
+}
+
+// intended to be private: writes (and prints) the published lines at the head of
+// the ring with a single writev and hands their slots back, returns the number
+// of lines written
+static int drain_ring() {
+	int count = 0, lines = 0;
+	bool print;
+	uint64_t idx, head = __atomic_load_n(&Ring.head, __ATOMIC_RELAXED);
+	size_t left, piece;
+	struct iovec iov[WRITEV_SLOTS];
+	static char *printBuffer = NULL;
+	static size_t printSize = 0;
+	char *grown;
+	LogSlot *slot;
+	LogFormat *format;
+
+	while (true) {
+		slot = &Ring.slots[head & (Ring.capacity - 1)];
+		if (__atomic_load_n(&slot->ready, __ATOMIC_ACQUIRE) != head + 1
+		    || (count > 0 && count + slot->slots > WRITEV_SLOTS)) {
+			break;
+		}
+		/* printing needs the line in one piece */
+		if (AlsoPrint && slot->length + 1 > printSize) {
+			grown = realloc(printBuffer, slot->length + 1);
+			if (grown != NULL) {
+				printBuffer = grown;
+				printSize = slot->length + 1;
+			}
+		}
+		print = AlsoPrint && slot->length < printSize;
+		left = slot->length;
+		for (idx = 0; idx < slot->slots; idx++) {
+			piece = left < SLOT_TEXT ? left : SLOT_TEXT;
+			/* a line longer than a whole batch gets a writev of its own */
+			if (count == WRITEV_SLOTS) {
+				write_vector(iov, count);
+				count = 0;
+			}
+			iov[count].iov_base = Ring.slots[(head + idx) & (Ring.capacity - 1)].text;
+			iov[count].iov_len = piece;
+			if (print) {
+				memcpy(printBuffer + slot->length - left, iov[count].iov_base, piece);
+			}
+			count++;
+			left -= piece;
+		}
+		if (print) {
+			printBuffer[slot->length] = '\0';
+			if ((uint8_t) printBuffer[0] != LOG_BINARY_MARK) {
+				print_line(slot->level, printBuffer);
+			} else if (((LogRecord *) printBuffer)->type == LOG_RECORD_EVENT
+			           && (format = format_by_id(((LogRecord *) printBuffer)->format_id)) != NULL) {
+				print_record((LogRecord *) printBuffer, format->fmt);
+			}
+		}
+		head += slot->slots;
+		lines++;
+	}
+
+	if (count > 0) {
+		write_vector(iov, count);
+	}
+	if (lines > 0) {
 		if (AlsoPrint) {
-			if (strstr(logStr, "FATAL") != NULL || strstr(logStr, "Error") != NULL || strstr(logStr, "ERROR") != NULL) {
-				printf("%s%s%s", RED, logStr, RESET);
-			} else if (strstr(logStr, "WARNING") != NULL) {
-				printf("%s%s%s", YELLOW, logStr, RESET);
-			} else {
-				printf("%s", logStr);
+			fflush(stdout);
+		}
+		/* the slots can be reused from now on */
+		__atomic_store_n(&Ring.head, head, __ATOMIC_RELEASE);
+	}
+	return lines;
+}
+
+// intended to be private
+static void* log_writer(void* arg) {
+	uint64_t dropped, reported = 0;
+	struct timespec until;
+
+	while (true) {
+		if (drain_ring() > 0) {
+			dropped = __atomic_load_n(&Ring.dropped, __ATOMIC_RELAXED);
+			if (dropped != reported) {
+				log_event(WARNING, " [LOGMGR] Dropped %lu log lines, the log ring was full",
+				          (unsigned long) (dropped - reported));
+				reported = dropped;
 			}
+			continue;
+		}
+		if (__atomic_load_n(&Stopping, __ATOMIC_ACQUIRE)) {
+			break;
 		}
 
-		if (bytesWritten == -1) {
-			fprintf(stderr,
-							"LOG_ERROR: Could not write to file: %s\n",
-							strerror(errno));
-			ret = LOG_ERROR;
-		} else if (bytesWritten < strlen(logStr)) {
+		pthread_mutex_lock(&WakeLock);
+		__atomic_store_n(&WriterSleeping, true, __ATOMIC_SEQ_CST);
+		if (!ring_ready() && !__atomic_load_n(&Stopping, __ATOMIC_ACQUIRE)) {
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_nsec += WRITER_IDLE_MS * 1000000L;
+			until.tv_sec += until.tv_nsec / 1000000000L;
+			until.tv_nsec %= 1000000000L;
+			pthread_cond_timedwait(&WakeCond, &WakeLock, &until);
+		}
+		__atomic_store_n(&WriterSleeping, false, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&WakeLock);
+	}
+	return NULL;
+}
+
+static void flush_repeats();
+
+// intended to be private: called at exit, a mapped file is cut to its length
+static void stop_log_at_exit() {
+	flush_repeats();
+	stop_async_log();
+	if (Fd == MAPPED_FILE) {
+		close_logfile();
+	}
+}
+
+int start_async_log(unsigned int ring_kb, LogOverflow overflow) {
+	uint64_t capacity = 1;
+	uint64_t wanted = (uint64_t) (ring_kb ? ring_kb : DEFAULT_RING_KB) * 1024 / SLOT_SIZE;
+
+	if (Async) {
+		return LOG_ERROR;
+	}
+	while (capacity < wanted) {
+		capacity <<= 1;
+	}
+
+	/* a ring left over from an earlier start is reused if it has the right size */
+	if (Ring.slots != NULL && Ring.capacity != capacity) {
+		free(Ring.slots);
+		Ring.slots = NULL;
+	}
+	if (Ring.slots == NULL) {
+		Ring.slots = calloc(capacity, sizeof(LogSlot));
+		if (Ring.slots == NULL) {
+			printf("LOG_ERROR: Could not allocate the log ring (%u KB)\n", ring_kb);
+			return LOG_ERROR;
+		}
+		Ring.capacity = capacity;
+		Ring.head = 0;
+		Ring.tail = 0;
+	}
+	Ring.dropped = 0;
+	Overflow = overflow;
+	Stopping = false;
+
+	if (pthread_create(&Writer, NULL, log_writer, NULL)) {
+		printf("LOG_ERROR: Could not start the log writer: %s\n", strerror(errno));
+		return LOG_ERROR;
+	}
+	__atomic_store_n(&Async, true, __ATOMIC_RELEASE);
+
+	/* whatever is still in the ring is written before the process goes away */
+	if (!ExitHandler) {
+		atexit(stop_log_at_exit);
+		ExitHandler = true;
+	}
+	return LOG_OK;
+}
+
+void flush_log(void) {
+	uint64_t tail;
+	struct timespec pause = {0, FLUSH_WAIT_US * 1000L};
+
+	if (!__atomic_load_n(&Async, __ATOMIC_ACQUIRE) || pthread_equal(pthread_self(), Writer)) {
+		return;
+	}
+	tail = __atomic_load_n(&Ring.tail, __ATOMIC_ACQUIRE);
+	while (__atomic_load_n(&Ring.head, __ATOMIC_ACQUIRE) < tail) {
+		wake_writer();
+		nanosleep(&pause, NULL);
+	}
+}
+
+void stop_async_log(void) {
+	int tries;
+
+	if (!__atomic_load_n(&Async, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	/* new lines are written straight away from now on, the writer finishes
+	off the ones already in the ring */
+	__atomic_store_n(&Async, false, __ATOMIC_RELEASE);
+	__atomic_store_n(&Stopping, true, __ATOMIC_RELEASE);
+	wake_writer();
+	pthread_join(Writer, NULL);
+
+	/* a line that was being queued as the writer stopped (a thread that died
+	halfway through queueing its line is not waited for forever) */
+	for (tries = 0; __atomic_load_n(&Ring.tail, __ATOMIC_ACQUIRE) != Ring.head && tries < STOP_MAX_TRIES; tries++) {
+		if (drain_ring() == 0) {
+			sched_yield();
+		}
+	}
+}
+
+// intended to be private: hands a line (or binary record) to the writer thread
+// in async mode, writes it to the log file otherwise. A line too large for the
+// ring is written here, once the lines before it are out. Returns LINE_QUEUED
+// or LINE_DROPPED in async mode, LOG_OK or LOG_ERROR when it was written.
+static int emit_line(Levels l, const char *logStr, size_t length) {
+	int ret;
+	ssize_t bytesWritten;
+	struct iovec iov = {(void *) logStr, length};
+
+	if (__atomic_load_n(&Async, __ATOMIC_ACQUIRE)) {
+		ret = enqueue_line(l, logStr, length);
+		if (ret != RING_TOO_SMALL) {
+			return ret == LOG_OK ? LINE_QUEUED : LINE_DROPPED;
+		}
+		flush_log();
+	}
+
+	/* a mapped file takes the line without a system call */
+	if (Fd == MAPPED_FILE) {
+		return log_map_write(&iov, 1);
+	}
+
+	bytesWritten = write(Fd, logStr, length);
+	if (bytesWritten == -1) {
+		fprintf(stderr,
+						"LOG_ERROR: Could not write to file: %s\n",
+						strerror(errno));
+		return LOG_ERROR;
+	} else if (bytesWritten < length) {
+		fprintf(stderr,
+						"LOG_ERROR: Short write: %s\n",
+						strerror(errno));
+		return LOG_ERROR;
+	}
+	return LOG_OK;
+}
+
+// intended to be private: writes "HH:MM:SS.mmm  LEVEL   |" (what every text
+// line starts with) into text and returns its length. The HH:MM:SS is only
+// worked out again (and kept in the buffer) once the second is over.
+static int line_prefix(LineBuffer *buffer, char *text, Levels l) {
+	int ms, len;
+	struct timespec now;
+	struct tm local;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	if (now.tv_sec != buffer->second) {
+		localtime_r(&now.tv_sec, &local);
+		buffer->clock[0] = '0' + local.tm_hour / 10;
+		buffer->clock[1] = '0' + local.tm_hour % 10;
+		buffer->clock[2] = ':';
+		buffer->clock[3] = '0' + local.tm_min / 10;
+		buffer->clock[4] = '0' + local.tm_min % 10;
+		buffer->clock[5] = ':';
+		/* a leap second is 60 */
+		buffer->clock[6] = '0' + local.tm_sec / 10;
+		buffer->clock[7] = '0' + local.tm_sec % 10;
+		buffer->second = now.tv_sec;
+	}
+
+	ms = now.tv_nsec / 1000000;
+	memcpy(text, buffer->clock, sizeof(buffer->clock));
+	text[8] = '.';
+	text[9] = '0' + ms / 100;
+	text[10] = '0' + ms / 10 % 10;
+	text[11] = '0' + ms % 10;
+	text[12] = ' ';
+	text[13] = ' ';
+
+	/* the level, padded to LEVEL_WIDTH */
+	len = strlen(LOG_LEVEL_STRING[l]);
+	memcpy(text + PREFIX_CLOCK, LOG_LEVEL_STRING[l], len);
+	memset(text + PREFIX_CLOCK + len, ' ', LEVEL_WIDTH - len + 1);
+	text[PREFIX_CLOCK + LEVEL_WIDTH + 1] = '|';
+	return PREFIX_LENGTH;
+}
+
+void dedupe_log(bool dedupe) {
+	__atomic_store_n(&Dedupe, dedupe, __ATOMIC_RELAXED);
+
+	/* the counts still open are logged before the process goes away */
+	if (dedupe && !ExitHandler) {
+		atexit(stop_log_at_exit);
+		ExitHandler = true;
+	}
+}
+
+// intended to be private: FNV-1a, of a message (or of the arguments of a record)
+static uint64_t bytes_hash(const char *bytes, size_t length) {
+	size_t idx;
+	uint64_t hash = 14695981039346656037ull;
+
+	for (idx = 0; idx < length; idx++) {
+		hash = (hash ^ (uint8_t) bytes[idx]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+// intended to be private: logs how many times the line of the site was left out
+static void log_repeats(LogSite *site) {
+	int len, ret;
+	char text[PREFIX_LENGTH + 256];
+
+	len = line_prefix(&Line, text, site->level);
+	len += snprintf(text + len, sizeof(text) - len, " [LOGMGR] Line \"%.160s\" repeated %u more time%s",
+	                site->fmt, site->repeats, site->repeats == 1 ? "" : "s");
+	text[len++] = '\n';
+	text[len] = '\0';
+	site->repeats = 0;
+
+	ret = emit_line(site->level, text, len);
+	if (AlsoPrint && ret != LINE_QUEUED && ret != LINE_DROPPED) {
+		print_line(site->level, text);
+	}
+}
+
+// intended to be private: the destructor of SitesKey
+static void flush_thread_repeats(void *sites) {
+	flush_repeats();
+}
+
+// intended to be private
+static void make_sites_key() {
+	pthread_key_create(&SitesKey, flush_thread_repeats);
+}
+
+// intended to be private: true if the line (its message, or the arguments of
+// its record) is the one its call site last logged in this thread, in which
+// case it is only counted. The count is logged once the site logs another
+// line, and every DEDUPE_REPORT_S seconds while the line keeps repeating.
+static bool repeated(Levels l, const char *fmt, const char *bytes, size_t length) {
+	struct timespec now;
+	uint64_t hash = bytes_hash(bytes, length);
+	LogSite *site = &Sites[((uintptr_t) fmt >> 3) % DEDUPE_SITES];
+
+	if (site->fmt == fmt && site->hash == hash && site->level == l) {
+		clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+		if (site->repeats == 0) {
+			site->since = now.tv_sec;
+			/* the destructor only runs for a non-NULL value */
+			if (!SitesKeyed) {
+				pthread_once(&SitesOnce, make_sites_key);
+				pthread_setspecific(SitesKey, Sites);
+				SitesKeyed = true;
+			}
+		} else if (now.tv_sec - site->since >= DEDUPE_REPORT_S) {
+			log_repeats(site);
+			site->since = now.tv_sec;
+		}
+		site->repeats++;
+		return true;
+	}
+
+	/* another line of the site, or of a site sharing the entry */
+	if (site->repeats > 0) {
+		log_repeats(site);
+	}
+	site->fmt = fmt;
+	site->hash = hash;
+	site->level = l;
+	return false;
+}
+
+// intended to be private: logs the counts of the lines this thread left out
+// (the counts of other threads are logged when they exit)
+static void flush_repeats() {
+	int idx;
+
+	if (Fd == BAD_FILE) {
+		return;
+	}
+	for (idx = 0; idx < DEDUPE_SITES; idx++) {
+		if (Sites[idx].repeats > 0) {
+			log_repeats(&Sites[idx]);
+		}
+	}
+}
+
+long long log_limit (LogLimit *limit) {
+	uint64_t now_ns, full, next;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	now_ns = now.tv_sec * 1000000000ull + now.tv_nsec;
+
+	/* every token is back at full (the theoretical arrival time of GCRA), a
+	line takes one as long as that leaves full within the burst of now */
+	full = __atomic_load_n(&limit->full_at, __ATOMIC_RELAXED);
+	do {
+		next = (full > now_ns ? full : now_ns) + limit->interval_ns;
+		if (next - now_ns > limit->burst_ns) {
+			__atomic_fetch_add(&limit->skipped, 1, __ATOMIC_RELAXED);
+			return -1;
+		}
+	} while (!__atomic_compare_exchange_n(&limit->full_at, &full, next, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	return __atomic_exchange_n(&limit->skipped, 0, __ATOMIC_RELAXED);
+}
+
+// intended to be private: FNV-1a, the id of a format in every process
+static uint32_t format_id(const char *fmt) {
+	uint32_t hash = 2166136261u;
+
+	while (*fmt != '\0') {
+		hash = (hash ^ (uint8_t) *fmt++) * 16777619u;
+	}
+	return hash;
+}
+
+// intended to be private: parses the format and makes it known by its id, or
+// leaves it to the text path (not supported, or its id is taken)
+static void setup_format(LogFormat *format, const char *fmt) {
+	int probe, len, state = FORMAT_BINARY;
+	const char *c;
+	LogFormat *other, *expected;
+	LogFormatSpec spec;
+
+	format->nargs = 0;
+	for (c = fmt; *c != '\0' && state == FORMAT_BINARY; c++) {
+		if (*c != '%') {
+			continue;
+		}
+		len = log_format_spec(c, &spec);
+		if (len == 0 || format->nargs + spec.stars + 1 > LOG_MAX_ARGS) {
+			state = FORMAT_TEXT;
+			break;
+		}
+		while (spec.stars-- > 0) {
+			format->types[format->nargs++] = LOG_ARG_INT;
+		}
+		if (spec.type != LOG_ARG_NONE) {
+			format->precisions[format->nargs] = spec.precision;
+			format->types[format->nargs++] = spec.type;
+		}
+		c += len - 1;
+	}
+
+	format->id = format_id(fmt);
+	format->defined = 0;
+	for (probe = 0; probe < FORMAT_SLOTS && state == FORMAT_BINARY; probe++) {
+		expected = NULL;
+		if (__atomic_compare_exchange_n(&FormatIds[(format->id + probe) & (FORMAT_SLOTS - 1)], &expected, format,
+		                                false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+		other = expected;
+		if (other->id == format->id) {
+			/* the same text at another address is fine, a clash of ids is not */
+			if (strcmp(other->fmt, fmt) != 0) {
+				state = FORMAT_TEXT;
+			}
+			break;
+		}
+	}
+	if (probe == FORMAT_SLOTS) {
+		state = FORMAT_TEXT;
+	}
+	__atomic_store_n(&format->state, state, __ATOMIC_RELEASE);
+}
+
+// intended to be private: the entry of the format, NULL if its lines are to be
+// written as text
+static LogFormat* format_of(const char *fmt) {
+	int probe, state;
+	uint64_t hash = ((uintptr_t) fmt >> 3) * 0x9E3779B97F4A7C15ull;
+	const char *key;
+	LogFormat *format;
+
+	for (probe = 0; probe < FORMAT_SLOTS; probe++) {
+		format = &Formats[((hash >> FORMAT_HASH_SHIFT) + probe) & (FORMAT_SLOTS - 1)];
+		key = __atomic_load_n(&format->fmt, __ATOMIC_ACQUIRE);
+		if (key == NULL) {
+			if (__atomic_compare_exchange_n(&format->fmt, &key, fmt, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				setup_format(format, fmt);
+			}
+		}
+		if (key == NULL || key == fmt) {
+			/* another thread may still be setting the entry up */
+			while ((state = __atomic_load_n(&format->state, __ATOMIC_ACQUIRE)) == FORMAT_PENDING) {
+				sched_yield();
+			}
+			return state == FORMAT_BINARY ? format : NULL;
+		}
+	}
+	return NULL;
+}
+
+// intended to be private: writes the record defining the format into the
+// current file (once per file, though racing threads may both write it)
+static int define_format(LogFormat *format, uint32_t generation) {
+	int ret;
+	size_t length = sizeof(LogRecord) + strlen(format->fmt) + 1;
+	union {
+		LogRecord header;
+		char bytes[RECORD_SIZE];
+	} buffer;
+	LogRecord *record = length <= RECORD_SIZE ? &buffer.header : malloc(length);
+
+	if (record == NULL) {
+		return LOG_ERROR;
+	}
+	memset(record, 0, sizeof(LogRecord));
+	record->mark = LOG_BINARY_MARK;
+	record->type = LOG_RECORD_FORMAT;
+	record->length = length;
+	record->format_id = format->id;
+	strcpy((char *) (record + 1), format->fmt);
+	ret = emit_line(INFO, (char *) record, length);
+	if (record != &buffer.header) {
+		free(record);
+	}
+
+	if (ret == LOG_OK || ret == LINE_QUEUED) {
+		__atomic_store_n(&format->defined, generation, __ATOMIC_RELEASE);
+		return LOG_OK;
+	}
+	return LOG_ERROR;
+}
+
+// intended to be private: appends the bytes of an argument to the record
+static bool put_arg(char *record, size_t *pos, const void *value, size_t size) {
+	if (*pos + size > RECORD_SIZE) {
+		return false;
+	}
+	memcpy(record + *pos, value, size);
+	*pos += size;
+	return true;
+}
+
+// intended to be private: fills in the binary record of the event, the
+// arguments are copied as they are (see log_format.h). Returns its length, or 0
+// if the arguments do not fit in a record.
+static size_t encode_event(Levels l, LogFormat *format, va_list ap, char *bytes) {
+	int idx, precision;
+	bool fits = true;
+	size_t pos = sizeof(LogRecord);
+	LogRecord *record = (LogRecord *) bytes;
+	uint32_t length;
+	int32_t int_value = 0;
+	int64_t long_value;
+	double double_value;
+	long double long_double_value[2] = {0, 0};
+	const char *string;
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	for (idx = 0; idx < format->nargs && fits; idx++) {
+		switch (format->types[idx]) {
+			case LOG_ARG_INT:
+				int_value = va_arg(ap, int);
+				fits = put_arg(bytes, &pos, &int_value, sizeof(int32_t));
+				break;
+			case LOG_ARG_LONG:
+			case LOG_ARG_LONG_LONG:
+			case LOG_ARG_SIZE:
+			case LOG_ARG_INTMAX:
+			case LOG_ARG_PTRDIFF:
+			case LOG_ARG_POINTER:
+				long_value = format->types[idx] == LOG_ARG_LONG ? (int64_t) va_arg(ap, long)
+				           : format->types[idx] == LOG_ARG_LONG_LONG ? (int64_t) va_arg(ap, long long)
+				           : format->types[idx] == LOG_ARG_SIZE ? (int64_t) va_arg(ap, size_t)
+				           : format->types[idx] == LOG_ARG_INTMAX ? (int64_t) va_arg(ap, intmax_t)
+				           : format->types[idx] == LOG_ARG_PTRDIFF ? (int64_t) va_arg(ap, ptrdiff_t)
+				           : (int64_t) (uintptr_t) va_arg(ap, void *);
+				fits = put_arg(bytes, &pos, &long_value, sizeof(int64_t));
+				break;
+			case LOG_ARG_DOUBLE:
+				double_value = va_arg(ap, double);
+				fits = put_arg(bytes, &pos, &double_value, sizeof(double));
+				break;
+			case LOG_ARG_LONG_DOUBLE:
+				long_double_value[0] = va_arg(ap, long double);
+				fits = put_arg(bytes, &pos, long_double_value, 16);
+				break;
+			case LOG_ARG_STRING:
+				string = va_arg(ap, const char *);
+				/* a '*' precision is the int just before the string, and a
+				negative one is no precision at all (as for printf) */
+				precision = format->precisions[idx] == LOG_STAR_PRECISION ? int_value : format->precisions[idx];
+				length = string == NULL ? LOG_NULL_STRING
+				         : precision >= 0 ? strnlen(string, precision) : strlen(string);
+				fits = put_arg(bytes, &pos, &length, sizeof(uint32_t))
+				       && (string == NULL || put_arg(bytes, &pos, string, length));
+				break;
+		}
+	}
+	if (!fits) {
+		return 0;
+	}
+
+	record->mark = LOG_BINARY_MARK;
+	record->type = LOG_RECORD_EVENT;
+	record->level = l;
+	record->unused = 0;
+	record->length = pos;
+	record->format_id = format->id;
+	record->unused2 = 0;
+	record->timestamp_ns = now.tv_sec * 1000000000ull + now.tv_nsec;
+	return pos;
+}
+
+// intended to be private: writes the event as a binary record
+static int log_binary(Levels l, const char *fmt, va_list ap) {
+	int ret;
+	size_t pos;
+	union {
+		LogRecord header;
+		char bytes[RECORD_SIZE];
+	} record;
+	uint32_t generation = __atomic_load_n(&FileGeneration, __ATOMIC_ACQUIRE);
+	LogFormat *format = format_of(fmt);
+
+	if (format == NULL) {
+		return BINARY_UNSUPPORTED;
+	}
+	if (__atomic_load_n(&format->defined, __ATOMIC_ACQUIRE) != generation && define_format(format, generation) != LOG_OK) {
+		return LOG_ERROR;
+	}
+	pos = encode_event(l, format, ap, record.bytes);
+	if (pos == 0) {
+		/* too long for a record, the text path copes with any length */
+		return BINARY_UNSUPPORTED;
+	}
+
+	if (__atomic_load_n(&Dedupe, __ATOMIC_RELAXED)
+	    && repeated(l, fmt, record.bytes + sizeof(LogRecord), pos - sizeof(LogRecord))) {
+		return LOG_OK;
+	}
+
+	ret = emit_line(l, record.bytes, pos);
+	if (ret == LINE_QUEUED) {
+		return LOG_OK;
+	} else if (ret == LINE_DROPPED) {
+		return LOG_ERROR;
+	}
+	if (AlsoPrint) {
+		print_record(&record.header, fmt);
+	}
+	return ret;
+}
+
+// intended to be private: puts the binary record of the event in the flight
+// recorder (a line binary records cannot carry is not recorded)
+static void record_event(Levels l, const char *fmt, va_list ap) {
+	size_t pos;
+	union {
+		LogRecord header;
+		char bytes[RECORD_SIZE];
+	} record;
+	uint32_t generation = __atomic_load_n(&RecorderGeneration, __ATOMIC_ACQUIRE);
+	LogFormat *format = format_of(fmt);
+
+	if (format == NULL) {
+		return;
+	}
+	if (__atomic_load_n(&format->recorded, __ATOMIC_ACQUIRE) != generation
+	    && log_recorder_define(format->id, fmt)) {
+		__atomic_store_n(&format->recorded, generation, __ATOMIC_RELEASE);
+	}
+	pos = encode_event(l, format, ap, record.bytes);
+	if (pos != 0) {
+		log_recorder_write(record.bytes, pos);
+	}
+}
+
+// intended to be private: formats the line in the buffer of the thread (only a
+// line too long for it is formatted on the heap) and writes it
+static int _log_event(Levels l, const char *fmt, va_list ap) {
+	int prefix, resultSize, bufferSize;
+	char *logStr = Line.text;
+	const char *text;
+	int ret = LOG_OK;
+	va_list ap_copy;
+
+	/* attempt to format the message after the prefix, moving to the heap if the
+	line does not fit (and trying again). Copy the ap list in case this doesn't
+	work so that we can try again. Room is left for the newline. A LogLine (see
+	log_line) is already formatted, and always fits. */
+	va_copy(ap_copy, ap);
+	prefix = line_prefix(&Line, Line.text, l);
+	if (fmt == LineFormat) {
+		resultSize = va_arg(ap, int);
+		text = va_arg(ap, const char *);
+		memcpy(logStr + prefix, text, resultSize);
+	} else {
+		resultSize = vsnprintf(logStr + prefix, sizeof(Line.text) - prefix - 1, fmt, ap);
+	}
+	if (resultSize >= 0 && resultSize >= (int) sizeof(Line.text) - prefix - 1) {
+		bufferSize = prefix + resultSize + 2;
+		logStr = (char *) malloc(bufferSize);
+		if (logStr != NULL) {
+			memcpy(logStr, Line.text, prefix);
+			resultSize = vsnprintf(logStr + prefix, bufferSize - prefix - 1, fmt, ap_copy);
+		}
+		/* check if enough size was allocated, if not then bail */
+		if (logStr == NULL || resultSize >= bufferSize - prefix - 1) {
 			fprintf(stderr,
-							"LOG_ERROR: Short write: %s\n",
+							"LOG_ERROR: Buffer too small: %s\n",
 							strerror(errno));
 			ret = LOG_ERROR;
 		}
+	} else if (resultSize < 0) {
+		ret = LOG_ERROR;
+	}
+
+	/* only attempt to write the formatted log string to the log if there aren't
+	any errors from formatting the string, nor if it repeats the line before it
+	(which is only counted). In async mode the line is only copied into the
+	ring, the writer thread writes (and prints) it. */
+	if (ret != LOG_ERROR && __atomic_load_n(&Dedupe, __ATOMIC_RELAXED)
+	    && repeated(l, fmt, logStr + prefix, resultSize)) {
+		ret = LOG_OK;
+	} else if (ret != LOG_ERROR) {
+		resultSize += prefix;
+		logStr[resultSize++] = '\n';
+		logStr[resultSize] = '\0';
+		ret = emit_line(l, logStr, resultSize);
+
+		/* optionally print the message to stdout */
+		if (AlsoPrint && ret != LINE_QUEUED && ret != LINE_DROPPED) {
+			print_line(l, logStr);
+		}
+		ret = ret == LINE_QUEUED ? LOG_OK : ret == LINE_DROPPED ? LOG_ERROR : ret;
 	}
 
 	/* if the heap buffer was used for the logStr then free it */
-	if (logStr != buffer) {
+	if (logStr != Line.text && logStr != NULL) {
 		free(logStr);
 	}
 
@@ -97,12 +1082,104 @@ int _log_event(const char *fmt, va_list ap) {
 	return ret;
 }
 
-int log_event (Levels l, const char *fmt, ...) {
+// intended to be private: sets what log_enabled lets through, the lines of
+// either the log file or the flight recorder
+static void update_gates() {
+	int idx;
+	Levels file;
+	bool recording = __atomic_load_n(&Recording, __ATOMIC_RELAXED);
+
+	for (idx = 0; idx < LOG_MODULES; idx++) {
+		file = __atomic_load_n(&FileLevels[idx], __ATOMIC_RELAXED);
+		__atomic_store_n(&LogLevels[idx], recording && RecorderLevel < file ? RecorderLevel : file, __ATOMIC_RELAXED);
+	}
+}
+
+void set_log_level (LogModule module, Levels l) {
+	int idx;
+
+	for (idx = 0; idx < LOG_MODULES; idx++) {
+		if (module == LOG_MODULES || module == idx) {
+			__atomic_store_n(&FileLevels[idx], l, __ATOMIC_RELAXED);
+		}
+	}
+	update_gates();
+}
+
+// intended to be private: the level (or module) named by the first len bytes
+// of name, -1 if there is none
+static int find_name(const char **names, int count, const char *name, size_t len) {
+	int idx;
+
+	for (idx = 0; idx < count; idx++) {
+		if (strlen(names[idx]) == len && strncasecmp(names[idx], name, len) == 0) {
+			return idx;
+		}
+	}
+	return -1;
+}
+
+int set_log_levels (const char *spec) {
+	int idx, module, level;
+	size_t len;
+	const char *item, *equals;
+	Levels levels[LOG_MODULES];
+
+	for (idx = 0; idx < LOG_MODULES; idx++) {
+		levels[idx] = __atomic_load_n(&FileLevels[idx], __ATOMIC_RELAXED);
+	}
+
+	/* the whole list is checked before any level is changed */
+	for (item = spec; *item != '\0'; item += len + (item[len] == ',')) {
+		len = strcspn(item, ",");
+		equals = memchr(item, '=', len);
+		if (equals == NULL) {
+			module = LOG_MODULES;
+			level = find_name(LOG_LEVEL_STRING, FATAL + 1, item, len);
+		} else {
+			module = find_name(MODULE_NAMES, LOG_MODULES, item, equals - item);
+			level = find_name(LOG_LEVEL_STRING, FATAL + 1, equals + 1, item + len - equals - 1);
+		}
+		if (module < 0 || level < 0) {
+			return LOG_ERROR;
+		}
+		for (idx = 0; idx < LOG_MODULES; idx++) {
+			if (module == LOG_MODULES || module == idx) {
+				levels[idx] = level;
+			}
+		}
+	}
+
+	for (idx = 0; idx < LOG_MODULES; idx++) {
+		set_log_level(idx, levels[idx]);
+	}
+	return LOG_OK;
+}
+
+// intended to be private: applies LOG_LEVEL before main runs
+__attribute__((constructor))
+static void levels_from_environment(void) {
+	const char *spec = getenv("LOG_LEVEL");
+
+	if (spec != NULL && set_log_levels(spec) != LOG_OK) {
+		fprintf(stderr, "LOG_ERROR: Ignoring LOG_LEVEL=%s, expected a list such as WARNING,libshm=DEBUG\n", spec);
+	}
+}
+
+// intended to be private: hands the line to the flight recorder and to the
+// log file, as far as their levels go
+static int log_module_va(LogModule module, Levels l, const char *fmt, va_list ap) {
 		int ret;
-		int len;
-		va_list ap;
-		char *new_fmt;
-		const char fmt_template[] = "%02d:%02d:%02d.%03d  %-7s |";
+		va_list ap_copy;
+
+		if (__atomic_load_n(&Recording, __ATOMIC_ACQUIRE) && l >= RecorderLevel) {
+			va_copy(ap_copy, ap);
+			record_event(l, fmt, ap_copy);
+			va_end(ap_copy);
+		}
+		if (l < __atomic_load_n(&FileLevels[module], __ATOMIC_RELAXED)) {
+			return LOG_OK;
+		}
 
 		if (Fd == BAD_FILE) {
 			int open_ret = set_logfile(DEFAULT_LOG_NAME);
@@ -111,45 +1188,105 @@ int log_event (Levels l, const char *fmt, ...) {
 			}
 		}
 
-		/* get the local time for the log line */
-		time_t secs = time(0);
-		int ms;
-		struct timespec ms_local;
-		struct tm *local = localtime(&secs);
-		clock_gettime(CLOCK_REALTIME, &ms_local);
+		/* in binary mode the arguments are recorded as they are, formatting is
+		left to whoever reads the log */
+		if (__atomic_load_n(&Binary, __ATOMIC_ACQUIRE)) {
+			va_copy(ap_copy, ap);
+			ret = log_binary(l, fmt, ap_copy);
+			va_end(ap_copy);
+			if (ret != BINARY_UNSUPPORTED) {
+				return ret;
+			}
+		}
 
-		ms = (int) (ms_local.tv_nsec / 1.0e6);
+		return _log_event(l, fmt, ap);
+}
 
+/* the name in parentheses is not taken for the log_event macro */
+int (log_event) (Levels l, const char *fmt, ...) {
+		int ret;
+		va_list ap;
 
-		/* find the length for the augmented format string and allocate. */
-		len = snprintf(NULL, 0, fmt_template, local->tm_hour,
-																					local->tm_min,
-																					local->tm_sec,
-																					ms,
-																					LEVEL_STRING[l]);
+		va_start(ap, fmt);
+		ret = log_module_va(LOG_MAIN, l, fmt, ap);
+		va_end(ap);
+		return ret;
+}
 
-		// +2 for newline and null termination
-		len += strlen(fmt) + 2;
+int log_module_event (LogModule module, Levels l, const char *fmt, ...) {
+		int ret;
+		va_list ap;
 
-		new_fmt = malloc(len);
+		va_start(ap, fmt);
+		ret = log_module_va(module, l, fmt, ap);
+		va_end(ap);
+		return ret;
+}
 
-		/* add the new format string to the buffer */
-		len = snprintf(new_fmt, len, fmt_template, local->tm_hour,
-																			 				 local->tm_min,
-																							 local->tm_sec,
-																							 ms,
-																							 LEVEL_STRING[l]);
+// intended to be private: appends what fits of the bytes to the line
+static void append(LogLine *line, const char *bytes, size_t length) {
+	size_t room = sizeof(line->text) - line->length;
 
-		/* keep the user format and add a newline */
-		strcat(new_fmt, fmt);
-		strcat(new_fmt, "\n");
+	length = length < room ? length : room;
+	memcpy(line->text + line->length, bytes, length);
+	line->length += length;
+}
 
-		va_start(ap, fmt);
-		ret = _log_event(new_fmt, ap);
-		va_end(ap);
+void log_append_string (LogLine *line, const char *string) {
+	append(line, string, strlen(string));
+}
 
-		free(new_fmt);
-		return ret;
+void log_append_int (LogLine *line, int64_t value) {
+	char digits[LOG_INT_SIZE];
+
+	append(line, digits, log_format_int(digits, value));
+}
+
+void log_append_uint (LogLine *line, uint64_t value) {
+	char digits[LOG_INT_SIZE];
+
+	append(line, digits, log_format_uint(digits, value));
+}
+
+void log_append_fixed (LogLine *line, double value, int width, int precision) {
+	int len;
+	char digits[LOG_FIXED_SIZE];
+
+	len = log_format_fixed(digits, sizeof(digits), value, width, precision);
+	append(line, digits, len < (int) sizeof(digits) ? len : (int) sizeof(digits) - 1);
+}
+
+int log_module_line (LogModule module, Levels l, LogLine *line) {
+	return log_module_event(module, l, LineFormat, (int) line->length, line->text);
+}
+
+int start_flight_recorder (int key, unsigned int size_kb, Levels l) {
+	int ret;
+
+	pthread_mutex_lock(&RecorderLock);
+	__atomic_store_n(&Recording, false, __ATOMIC_RELEASE);
+	ret = log_recorder_open(key, (uint64_t) (size_kb ? size_kb : DEFAULT_RECORDER_KB) * 1024);
+	if (ret == LOG_OK) {
+		/* the formats have to be added to the table of this segment */
+		__atomic_fetch_add(&RecorderGeneration, 1, __ATOMIC_RELEASE);
+		RecorderLevel = l;
+		__atomic_store_n(&Recording, true, __ATOMIC_RELEASE);
+	}
+	update_gates();
+	pthread_mutex_unlock(&RecorderLock);
+
+	if (ret != LOG_OK) {
+		printf("LOG_ERROR: Could not attach the flight recorder (key:%d)\n", key);
+	}
+	return ret;
+}
+
+void stop_flight_recorder (void) {
+	pthread_mutex_lock(&RecorderLock);
+	__atomic_store_n(&Recording, false, __ATOMIC_RELEASE);
+	update_gates();
+	log_recorder_close();
+	pthread_mutex_unlock(&RecorderLock);
 }
 
 int set_logfile (const char *logfile_name) {
@@ -162,21 +1299,97 @@ int set_logfile (const char *logfile_name) {
 		return LOG_ERROR;
 	}
 
+	/* the lines still queued belong to the current file */
+	flush_log();
+
 	/* check to see if the logfile is already open. If so, close this one
 	and open the new log file. */
-	close_logfile();
+	pthread_mutex_lock(&FdLock);
+	if (Fd >= 0) {
+		close(Fd);
+	} else if (Fd == MAPPED_FILE) {
+		log_map_close();
+	}
 
-	/* use the new file descriptor */
+	/* use the new file descriptor, binary formats have to be defined again */
 	Fd = tmp_fd;
+	__atomic_fetch_add(&FileGeneration, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&FdLock);
 
 	return LOG_OK;
 }
 
 void close_logfile (void) {
-	if (Fd >= 0){
-		close(Fd);
+	/* the lines still queued (or counted) belong to this file */
+	flush_repeats();
+	flush_log();
+
+	pthread_mutex_lock(&FdLock);
+	if (Fd >= 0 || Fd == MAPPED_FILE){
+		if (Fd == MAPPED_FILE) {
+			log_map_close();
+		} else {
+			close(Fd);
+		}
 		/* allow for this file to be closed, but if logging is invoked again,
 	  then treat allow for the default logfile to be used */
 		Fd = BAD_FILE;
 	}
+	pthread_mutex_unlock(&FdLock);
+}
+
+// intended to be private: the definitions of the binary formats known so far,
+// which every file the mapped log rotates to starts with
+static size_t define_formats(char *at, size_t room) {
+	int idx;
+	size_t length, used = 0;
+	LogRecord record;
+	LogFormat *format;
+
+	for (idx = 0; idx < FORMAT_SLOTS; idx++) {
+		format = &Formats[idx];
+		if (__atomic_load_n(&format->state, __ATOMIC_ACQUIRE) != FORMAT_BINARY) {
+			continue;
+		}
+		length = sizeof(LogRecord) + strlen(format->fmt) + 1;
+		if (used + length > room) {
+			break;
+		}
+		memset(&record, 0, sizeof(record));
+		record.mark = LOG_BINARY_MARK;
+		record.type = LOG_RECORD_FORMAT;
+		record.length = length;
+		record.format_id = format->id;
+		memcpy(at + used, &record, sizeof(record));
+		memcpy(at + used + sizeof(record), format->fmt, length - sizeof(record));
+		used += length;
+	}
+	return used;
+}
+
+int map_logfile (const char *logfile_name, unsigned int file_kb, unsigned int keep) {
+	int ret;
+	uint64_t kb = file_kb ? file_kb : DEFAULT_MAP_KB;
+
+	/* the lines still queued belong to the current file */
+	flush_log();
+
+	pthread_mutex_lock(&FdLock);
+	if (Fd >= 0) {
+		close(Fd);
+	}
+	ret = log_map_open(logfile_name, (kb > MIN_MAP_KB ? kb : MIN_MAP_KB) * 1024, keep, define_formats);
+	Fd = ret == LOG_OK ? MAPPED_FILE : BAD_FILE;
+	__atomic_fetch_add(&FileGeneration, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&FdLock);
+
+	if (!ExitHandler) {
+		atexit(stop_log_at_exit);
+		ExitHandler = true;
+	}
+
+	if (ret != LOG_OK) {
+		printf("LOG_ERROR: Could not map file '%s' for logging\n", logfile_name);
+	}
+	return ret;
 }
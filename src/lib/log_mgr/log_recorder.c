@@ -0,0 +1,175 @@
+/*
+* Library: log_mgr - manage and interface with a set of logs
+*/
+
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include "log_mgr.h"
+#include "log_format.h"
+#include "log_recorder.h"
+
+#define ALIGN_UP(size, align) (((size) + (align) - 1) / (align) * (align))
+/* a ring of fewer slots is not worth having */
+#define MIN_SLOTS  64
+
+static LogRecorder *Recorder = NULL;
+/* writers still copying into the ring */
+static int Active = 0;
+
+
+// intended to be private: true if the header describes a ring that fits
+static bool set_up(LogRecorder *recorder, size_t size) {
+	return recorder->magic == LOG_RECORDER_MAGIC && recorder->slot_size == LOG_RECORDER_SLOT
+	       && recorder->capacity >= MIN_SLOTS && (recorder->capacity & (recorder->capacity - 1)) == 0
+	       && sizeof(LogRecorder) + recorder->formats_size + recorder->capacity * LOG_RECORDER_SLOT <= size;
+}
+
+// intended to be private: lays an empty recorder out over the segment
+static bool set_up_ring(LogRecorder *recorder, size_t size) {
+	uint64_t capacity = 1;
+	uint64_t room = size > sizeof(LogRecorder) + LOG_RECORDER_FORMATS
+	                ? (size - sizeof(LogRecorder) - LOG_RECORDER_FORMATS) / LOG_RECORDER_SLOT : 0;
+
+	while (capacity * 2 <= room) {
+		capacity *= 2;
+	}
+	if (room < MIN_SLOTS) {
+		return false;
+	}
+
+	/* the magic goes in last, a recorder set up halfway is set up again */
+	recorder->magic = 0;
+	recorder->slot_size = LOG_RECORDER_SLOT;
+	recorder->capacity = capacity;
+	recorder->formats_size = LOG_RECORDER_FORMATS;
+	recorder->formats_used = 0;
+	recorder->tail = 0;
+	memset(LOG_RECORDER_TABLE(recorder), 0, LOG_RECORDER_FORMATS + capacity * LOG_RECORDER_SLOT);
+	__atomic_store_n(&recorder->magic, LOG_RECORDER_MAGIC, __ATOMIC_RELEASE);
+	return true;
+}
+
+
+int log_recorder_open (int key, uint64_t size) {
+	int shm_id;
+	struct shmid_ds info;
+	LogRecorder *recorder;
+
+	log_recorder_close();
+	/* attached with shmget and shmat rather than connect_shm, shmlib (and the
+	store under it) log through this library */
+	shm_id = shmget((key_t) key, 0, 0);
+	if (shm_id != -1 && shmctl(shm_id, IPC_STAT, &info) == 0) {
+		/* the size of a segment cannot change, whoever set it up chose it */
+		size = info.shm_segsz;
+	} else {
+		shm_id = shmget((key_t) key, size, IPC_CREAT | 0644);
+	}
+	if (shm_id == -1) {
+		fprintf(stderr, "LOG_ERROR: Could not get the flight recorder segment (key:%d): %s\n", key, strerror(errno));
+		return LOG_ERROR;
+	}
+	recorder = shmat(shm_id, NULL, 0);
+	if (recorder == (void *) -1) {
+		fprintf(stderr, "LOG_ERROR: Could not attach the flight recorder segment (key:%d): %s\n", key, strerror(errno));
+		return LOG_ERROR;
+	}
+	if (!set_up(recorder, size) && !set_up_ring(recorder, size)) {
+		fprintf(stderr, "LOG_ERROR: The flight recorder segment (key:%d) is too small\n", key);
+		shmdt(recorder);
+		return LOG_ERROR;
+	}
+	__atomic_store_n(&Recorder, recorder, __ATOMIC_SEQ_CST);
+	return LOG_OK;
+}
+
+bool log_recorder_define (uint32_t id, const char *fmt) {
+	uint64_t pos, used, start, length;
+	char *table;
+	LogRecord *record;
+	LogRecorder *recorder = __atomic_load_n(&Recorder, __ATOMIC_ACQUIRE);
+
+	if (recorder == NULL) {
+		return false;
+	}
+	table = LOG_RECORDER_TABLE(recorder);
+
+	/* the table of a recorder that was set up before may have the format */
+	used = __atomic_load_n(&recorder->formats_used, __ATOMIC_ACQUIRE);
+	used = used < recorder->formats_size ? used : recorder->formats_size;
+	for (pos = 0; pos + sizeof(LogRecord) <= used; pos += ALIGN_UP(record->length, 8)) {
+		record = (LogRecord *) (table + pos);
+		if (record->length < sizeof(LogRecord)) {
+			/* still being written */
+			break;
+		}
+		if (__atomic_load_n(&record->mark, __ATOMIC_ACQUIRE) == LOG_BINARY_MARK && record->format_id == id) {
+			return true;
+		}
+	}
+
+	length = sizeof(LogRecord) + strlen(fmt) + 1;
+	start = __atomic_fetch_add(&recorder->formats_used, ALIGN_UP(length, 8), __ATOMIC_ACQ_REL);
+	if (start + length > recorder->formats_size) {
+		return false;
+	}
+	record = (LogRecord *) (table + start);
+	memset(record, 0, sizeof(LogRecord));
+	record->type = LOG_RECORD_FORMAT;
+	record->format_id = id;
+	strcpy((char *) (record + 1), fmt);
+	__atomic_store_n(&record->length, length, __ATOMIC_RELEASE);
+	/* the mark goes in last, it is what readers trust */
+	__atomic_store_n(&record->mark, LOG_BINARY_MARK, __ATOMIC_RELEASE);
+	return true;
+}
+
+void log_recorder_write (const char *record, size_t length) {
+	uint64_t idx, position, slots = (length + LOG_RECORDER_BYTES - 1) / LOG_RECORDER_BYTES;
+	size_t piece;
+	LogRecorder *recorder = __atomic_load_n(&Recorder, __ATOMIC_ACQUIRE);
+	LogRecorderSlot *ring, *slot;
+
+	if (recorder == NULL || slots == 0) {
+		return;
+	}
+	/* the segment is only detached once no writer is in it */
+	__atomic_fetch_add(&Active, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&Recorder, __ATOMIC_SEQ_CST) != recorder || slots > recorder->capacity) {
+		__atomic_fetch_sub(&Active, 1, __ATOMIC_RELEASE);
+		return;
+	}
+
+	ring = LOG_RECORDER_RING(recorder);
+	position = __atomic_fetch_add(&recorder->tail, slots, __ATOMIC_ACQ_REL);
+	for (idx = 0; idx < slots; idx++) {
+		piece = length - idx * LOG_RECORDER_BYTES;
+		piece = piece < LOG_RECORDER_BYTES ? piece : LOG_RECORDER_BYTES;
+		memcpy(ring[(position + idx) & (recorder->capacity - 1)].bytes, record + idx * LOG_RECORDER_BYTES, piece);
+	}
+	slot = &ring[position & (recorder->capacity - 1)];
+	slot->length = length;
+	slot->slots = slots;
+	__atomic_store_n(&slot->ready, position + 1, __ATOMIC_RELEASE);
+	__atomic_fetch_sub(&Active, 1, __ATOMIC_RELEASE);
+}
+
+void log_recorder_close (void) {
+	LogRecorder *recorder = __atomic_exchange_n(&Recorder, NULL, __ATOMIC_SEQ_CST);
+
+	if (recorder == NULL) {
+		return;
+	}
+	while (__atomic_load_n(&Active, __ATOMIC_ACQUIRE) > 0) {
+		sched_yield();
+	}
+	shmdt(recorder);
+}
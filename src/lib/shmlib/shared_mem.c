@@ -9,20 +9,50 @@
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/shm.h>
 #include <sys/sem.h>
+/* the lines of this library are filtered by its own level (see set_log_level) */
+#define LOG_MODULE LOG_LIBSHM
 #include "log_mgr.h"
-#include "hash_table.h"
+#include "cmap.h"
 #include "list.h"
 #include "shared_mem.h"
 
-/* key to SegmentNode lookup */
-Hash* SegmentNodes = NULL;
+/* key to SegmentNode lookup (read and written from any thread, see segment_nodes()) */
+CMap* SegmentNodes = NULL;
+
+/* serializes adding a key to SegmentNodes (the lookup and the insert) and every
+use of the attachment lists, which are not safe to share between threads */
+static pthread_mutex_t SegmentsLock = PTHREAD_MUTEX_INITIALIZER;
 
 /* controls whether or not semaphores are created on connect_shm() */
 bool UseSemaphores = false;
 
 
+// intended to be private
+static CMap* segment_nodes() {
+	CMap *nodes = __atomic_load_n(&SegmentNodes, __ATOMIC_ACQUIRE);
+	CMap *expected = NULL;
+
+	if (nodes == NULL) {
+		/* REQ_conn_3: A program using this library function must be able to use it to
+		attach the maximum number of shared memory segments to the calling process.
+		(Note that Solaris 11 does not have a limit to the number of attachments, so you
+		can use the limit that Linux supports. */
+		nodes = new_cmap(SHM_MAX_SEGMENTS);
+
+		/* another thread may have raced to create the map, use the first one */
+		if (!__atomic_compare_exchange_n(&SegmentNodes, &expected, nodes, false,
+		                                 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			destroy_cmap(nodes);
+			nodes = expected;
+		}
+	}
+	return nodes;
+}
+
+
 void use_semaphores(bool set){
 	UseSemaphores = set;
 
@@ -34,18 +64,16 @@ void use_semaphores(bool set){
 
 
 bool shm_lock(int key) {
-	HashNode *segment_hash_obj;
 	SegmentNode *node;
 	struct sembuf sem;
 
 	if (UseSemaphores) {
 		/* obtain the shared segment id from the global data structure */
-		segment_hash_obj = get_hash_item(SegmentNodes, key);
-		if (segment_hash_obj == NULL){
+		node = get_cmap_item(segment_nodes(), key);
+		if (node == NULL){
 			log_event(WARNING, " [LIBSHM] Error: Unable to find node to lock (key:%d)", key);
 			return false;
 		}
-		node = segment_hash_obj->value;
 
 		/* wait on the semaphore (unless it's value is non-negative) */
 		sem.sem_num = 0;
@@ -65,18 +93,16 @@ bool shm_lock(int key) {
 
 
 bool shm_unlock(int key) {
-	HashNode *segment_hash_obj;
 	SegmentNode *node;
 	struct sembuf sem;
 
 	if (UseSemaphores) {
 		/* obtain the shared segment id from the global data structure */
-		segment_hash_obj = get_hash_item(SegmentNodes, key);
-		if (segment_hash_obj == NULL){
+		node = get_cmap_item(segment_nodes(), key);
+		if (node == NULL){
 			log_event(WARNING, " [LIBSHM] Error: Unable to find node to unlock (key:%d)", key);
 			return false;
 		}
-		node = segment_hash_obj->value;
 
 		/* signal the semaphore (increase its value by one) */
 		sem.sem_num = 0;
@@ -96,12 +122,12 @@ bool shm_unlock(int key) {
 
 
 // intended to be private
-static void show_segment_node(void *hash_node){
+static void show_segment_node(void *segment_node){
 	int attachments;
-	SegmentNode* node = ((HashNode*) hash_node)->value;
+	SegmentNode* node = segment_node;
 	attachments = ((SegmentNode *)node)->attachments->size;
 
-	log_event(WARNING, " ● Segment(key=%d, shm_id=%d, size=%d, attachments=%d)",
+	log_event(WARNING, " ● Segment(key=%d, shm_id=%d, size=%zu, attachments=%d)",
 						((SegmentNode *)node)->key,
 						((SegmentNode *)node)->shm_id,
 						((SegmentNode *)node)->size,
@@ -122,32 +148,36 @@ static void show_segment_node(void *hash_node){
 
 
 void show_segments() {
-	if (SegmentNodes != NULL && SegmentNodes->size > 0) {
-		iterate_hash(SegmentNodes, show_segment_node);
+	if (SegmentNodes != NULL && cmap_count(SegmentNodes) > 0) {
+		pthread_mutex_lock(&SegmentsLock);
+		iterate_cmap(SegmentNodes, show_segment_node);
+		pthread_mutex_unlock(&SegmentsLock);
 	} else {
 		log_event(WARNING, " No segments created yet");
 	}
 }
 
 
-void* connect_shm(int key, int size) {
+size_t shm_size(int key) {
+	int shm_id;
+	struct shmid_ds ds_obj;
+
+	/* a size of 0 matches any existing segment, and none is created */
+	if ((shm_id = shmget(key, 0, 0)) == -1 || shmctl(shm_id, IPC_STAT, &ds_obj) == -1) {
+		return 0;
+	}
+	return ds_obj.shm_segsz;
+}
+
+
+void* connect_shm(int key, size_t size) {
 	int shm_id;
 	void* shm_ptr;
 	struct sembuf sem;
-	HashNode* segment_hash_obj;
 	SegmentNode* node;
 
-	if (SegmentNodes == NULL) {
-
-		/* REQ_conn_3: A program using this library function must be able to use it to
-		attach the maximum number of shared memory segments to the calling process.
-		(Note that Solaris 11 does not have a limit to the number of attachments, so you
-		can use the limit that Linux supports. */
-		SegmentNodes = new_hash(SHM_MAX_SEGMENTS);
-	}
-
 	if ((shm_id = shmget(key, size, IPC_CREAT | 0644)) == -1) {
-		log_event(WARNING, " [LIBSHM] Error: Unable to get shared memory segment (%d): %s", errno, strerror(errno));
+		log_event(WARNING, " [LIBSHM] Error: Unable to get shared memory segment of %zu bytes (%d): %s", size, errno, strerror(errno));
 		return NULL;
 	}
 
@@ -172,8 +202,11 @@ void* connect_shm(int key, int size) {
 		return NULL;
 	}
 
-	segment_hash_obj = get_hash_item(SegmentNodes, key);
-	if (segment_hash_obj == NULL){
+	/* the lookup and the insert are one step, so two threads connecting to a new
+	key cannot both create (and semaphore-unlock) a node for it */
+	pthread_mutex_lock(&SegmentsLock);
+	node = get_cmap_item(segment_nodes(), key);
+	if (node == NULL){
 		// this is the first time we've seen this segment, take note of it
 		node = (SegmentNode*) malloc(sizeof(SegmentNode));
 		node->key = key;
@@ -188,6 +221,10 @@ void* connect_shm(int key, int size) {
 
 				/* since all coordinated operations depend on the use of a semaphore, not
 				being able to get a semephore should be 'fatal' */
+				pthread_mutex_unlock(&SegmentsLock);
+				destroy_list(node->attachments);
+				free(node);
+				shmdt(shm_ptr);
 				return NULL;
 			}
 
@@ -204,15 +241,13 @@ void* connect_shm(int key, int size) {
 		}
 
 		/* semaphore and shared memory segment obtained! */
-		insert_hash_item(SegmentNodes, key, node, sizeof(SegmentNode));
-
-	} else {
-		// this is a new attachment to a segment key that was already used
-		node = segment_hash_obj->value;
+		insert_cmap_item(segment_nodes(), key, node);
 	}
+	/* otherwise this is a new attachment to a segment key that was already used */
 
 	// add the attachment address to the segment node list
 	push_list_item(node->attachments, (void*) shm_ptr, sizeof(shm_ptr));
+	pthread_mutex_unlock(&SegmentsLock);
 
 	/* REQ_conn_1: The return value for this function is a pointer to the shared
 	memory area which has been attached (and possibly created) by this function.
@@ -223,48 +258,46 @@ void* connect_shm(int key, int size) {
 }
 
 
-// this is intended to be private
-static int find_key_for_address(Hash* nodes, void* addr) {
-	int i;
-	SegmentNode* node;
-	ListNode* attachment_list_obj;
+// this is intended to be private: the caller must hold SegmentsLock
+static bool segment_has_address(void* segment_node, void* addr) {
+	ListNode* attachment_list_obj = ((SegmentNode*) segment_node)->attachments->head;
 
-	// for all segments...
-	for(i = 0; i<nodes->size; i++) {
-		if(nodes->hash_array[i] != NULL){
-			node = nodes->hash_array[i]->value;
-
-			// for all attachments to a segment...
-			attachment_list_obj = node->attachments->head;
-			while (attachment_list_obj != NULL) {
-
-				// find the matching address (from what was given)
-				if ( attachment_list_obj->value == addr){
-					return node->key;
-				}
-				attachment_list_obj = attachment_list_obj->next;
-			}
+	// for all attachments to a segment...
+	while (attachment_list_obj != NULL) {
+
+		// find the matching address (from what was given)
+		if ( attachment_list_obj->value == addr){
+			return true;
 		}
+		attachment_list_obj = attachment_list_obj->next;
 	}
-	return SHM_ERROR;
+	return false;
+}
+
+
+// this is intended to be private: the caller must hold SegmentsLock
+static int find_key_for_address(CMap* nodes, void* addr) {
+	// for all segments...
+	SegmentNode* node = search_cmap(nodes, segment_has_address, addr);
+	if (node == NULL) {
+		return SHM_ERROR;
+	}
+	return node->key;
 }
 
 
 static void destroy_shm_lock(int key) {
-	HashNode *segment_hash_obj;
 	SegmentNode *node;
 	struct sembuf sem;
 	struct shmid_ds ds_obj;
 
 	if (UseSemaphores) {
-		segment_hash_obj = get_hash_item(SegmentNodes, key);
-		if (segment_hash_obj == NULL){
+		node = get_cmap_item(segment_nodes(), key);
+		if (node == NULL){
 			log_event(WARNING, " [LIBSHM] Error: Unexpected key given to destroy_shm_lock (key:%d)", key);
 			return;
 		}
 
-		node = segment_hash_obj->value;
-
 		if (shmctl(node->shm_id, IPC_STAT, &ds_obj) == -1) {
 			/* Invalid Argument: when a bad id is given (say one that has already been destroyed) */
 			if (errno == 22) {
@@ -298,13 +331,15 @@ static void destroy_shm_lock(int key) {
 
 
 int detach_shm(void* addr) {
-	HashNode* segment_hash_obj;
 	SegmentNode* node;
 	int key;
 
-	key = find_key_for_address(SegmentNodes, addr);
+	/* held until the address is off the list, so that it is detached only once */
+	pthread_mutex_lock(&SegmentsLock);
+	key = find_key_for_address(segment_nodes(), addr);
 
 	if (key == SHM_ERROR){
+		pthread_mutex_unlock(&SegmentsLock);
 		log_event(WARNING, " [LIBSHM] Error: Address does not belong to an attached shared memory segment! (addr:%p)", addr );
 
 		/* REQ_detach_2: This function will return OK (0) on success, and ERROR (-1) otherwise. */
@@ -314,21 +349,22 @@ int detach_shm(void* addr) {
 	/* REQ_detach_1: This function detaches the shared memory segment attached to the process via the argument addr. */
 	if (shmdt(addr) == SHM_ERROR) {
 		log_event(WARNING, " [LIBSHM] Error: Could not detatch shared memory segment (addr:%p): %s (%d)",  addr, strerror(errno), errno );
+		pthread_mutex_unlock(&SegmentsLock);
 
 		/* REQ_detach_2: This function will return OK (0) on success, and ERROR (-1) otherwise. */
 		return SHM_ERROR;
 	}
 
 	// remove address from attachment for this segment
-	segment_hash_obj = get_hash_item(SegmentNodes, key);
-	if (segment_hash_obj == NULL){
+	node = get_cmap_item(segment_nodes(), key);
+	if (node == NULL){
 		log_event(WARNING, " [LIBSHM] Error: Expected to find Segment Obj, but not found (addr:%p, key:%d)", addr, key);
 	} else {
-		node = segment_hash_obj->value;
 		if (remove_list_item(node->attachments, addr) == false) {
 			log_event(WARNING, " [LIBSHM] Error: Expected to find Address in Segment Obj attachment list, but not found (addr:%p, key:%d)", addr, key);
 		}
 	}
+	pthread_mutex_unlock(&SegmentsLock);
 
 	/* destroy semephore (if no other attachments on the memory segment are detected)
 	Note: if semaphore usage is disabled this will do nothing */
@@ -340,31 +376,39 @@ int detach_shm(void* addr) {
 
 
 int destroy_shm(int key) {
-	HashNode *segment_hash_obj;
 	SegmentNode *node;
-	ListNode *cur, *next;
+	ListNode *cur;
+	void **addrs;
+	int idx, count = 0;
 
 	/* REQ_destroy_1: This function detaches all shared memory segments (attached to
 	the calling process by connect_shm( )) associated with the argument key from the
 	calling process. */
-	segment_hash_obj = get_hash_item(SegmentNodes, key);
-	if (segment_hash_obj == NULL){
+	node = get_cmap_item(segment_nodes(), key);
+	if (node == NULL){
 		log_event(WARNING, " [LIBSHM] Error: Unexpected key given to destroy_shm (key:%d)",key);
 
 		/* REQ_destroy_3: This function will return OK (0) on success, and ERROR (-1) otherwise. */
 		return SHM_ERROR;
 	}
 
+	/* take a copy of the addresses, detach_shm() takes the lock to change the list */
+	pthread_mutex_lock(&SegmentsLock);
+	addrs = malloc((node->attachments->size + 1) * sizeof(void*));
+	if (addrs != NULL) {
+		for (cur = node->attachments->head; cur != NULL; cur = cur->next) {
+			addrs[count++] = cur->value;
+		}
+	}
+	pthread_mutex_unlock(&SegmentsLock);
+
 	// perform the detach for each address found...
-	node = segment_hash_obj->value;
-	cur = node->attachments->head;
-	while (cur != NULL) {
-		next = cur->next;
+	for (idx = 0; idx < count; idx++) {
 		/* no need to check this return value since we need to iterate accross this
 		entire list and logging of errors is facilitated by detach_shm() */
-		detach_shm(cur->value);
-		cur = next;
+		detach_shm(addrs[idx]);
 	}
+	free(addrs);
 
 	/* destroy semephore (if no other attachments on the memory segment are detected)
 	Note: if semaphore usage is disabled this will do nothing */
@@ -378,7 +422,7 @@ int destroy_shm(int key) {
 			log_event(WARNING, " [LIBSHM] Segment has (probably) already been destroyed (key:%d)", key);
 
 			/* remove the metadata from the lib store since it is already positively gone */
-			delete_hash_item(SegmentNodes, key);
+			delete_cmap_item(segment_nodes(), key);
 		} else {
 			log_event(FATAL, " [LIBSHM] Error: Unable to destroy shared memory segment (key:%d): %s (%d)", key, strerror(errno), errno);
 		}
@@ -388,7 +432,7 @@ int destroy_shm(int key) {
 	}
 
 	/* remove the metadata from the lib store if successfully (positively) removed */
-	delete_hash_item(SegmentNodes, key);
+	delete_cmap_item(segment_nodes(), key);
 
 	/* REQ_destroy_3: This function will return OK (0) on success, and ERROR (-1) otherwise. */
 	return SHM_OK;
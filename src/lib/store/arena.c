@@ -0,0 +1,155 @@
+/*
+ * Library: store - a generic set of storage data structures
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "arena.h"
+
+typedef struct ArenaChunk {
+	struct ArenaChunk *next;
+	size_t size;
+	size_t used;
+	/* keeps data aligned to ARENA_MAX_ALIGN (the chunk itself is as well) */
+	char pad[ARENA_MAX_ALIGN - 3*sizeof(size_t)];
+	char data[];
+} ArenaChunk;
+
+struct Arena {
+	size_t chunk_size;
+	int num_chunks;
+	/* chunks are kept in allocation order, current is the one being filled.
+	The chunks after current are empty (left over from a reset). */
+	ArenaChunk *head;
+	ArenaChunk *current;
+};
+
+static pthread_key_t ThreadArenaKey;
+static pthread_once_t ThreadArenaOnce = PTHREAD_ONCE_INIT;
+
+
+// intended to be private
+static ArenaChunk* new_arena_chunk(size_t size) {
+	ArenaChunk *chunk;
+	if (posix_memalign((void**) &chunk, ARENA_MAX_ALIGN, sizeof(ArenaChunk) + size)) {
+		return NULL;
+	}
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+	return chunk;
+}
+
+// intended to be private
+static void* bump(ArenaChunk* chunk, size_t size, size_t align) {
+	size_t offset = (chunk->used + align - 1) & ~(align - 1);
+	if (offset > chunk->size || chunk->size - offset < size) {
+		return NULL;
+	}
+	chunk->used = offset + size;
+	return chunk->data + offset;
+}
+
+Arena* new_arena(size_t chunk_size) {
+	Arena *arena = (Arena*)malloc(sizeof(Arena));
+	if (arena == NULL) {
+		return NULL;
+	}
+	arena->chunk_size = chunk_size > 0 ? chunk_size : ARENA_CHUNK_SIZE;
+	arena->num_chunks = 0;
+	arena->head = NULL;
+	arena->current = NULL;
+	return arena;
+}
+
+void* arena_alloc_aligned(Arena* arena, size_t size, size_t align) {
+	void *ptr;
+	ArenaChunk *chunk;
+
+	if (align == 0 || align > ARENA_MAX_ALIGN || (align & (align - 1)) != 0) {
+		return NULL;
+	}
+
+	if (arena->current != NULL) {
+		if ((ptr = bump(arena->current, size, align)) != NULL) {
+			return ptr;
+		}
+		/* move on to an empty chunk kept by reset_arena() if it is big enough */
+		chunk = arena->current->next;
+		if (chunk != NULL && (ptr = bump(chunk, size, align)) != NULL) {
+			arena->current = chunk;
+			return ptr;
+		}
+	}
+
+	chunk = new_arena_chunk(size > arena->chunk_size ? size : arena->chunk_size);
+	if (chunk == NULL) {
+		return NULL;
+	}
+	arena->num_chunks += 1;
+
+	/* insert after the current chunk so that any empty chunks stay reusable */
+	if (arena->current == NULL) {
+		chunk->next = arena->head;
+		arena->head = chunk;
+	} else {
+		chunk->next = arena->current->next;
+		arena->current->next = chunk;
+	}
+	arena->current = chunk;
+	return bump(chunk, size, align);
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+	return arena_alloc_aligned(arena, size, ARENA_ALIGN);
+}
+
+void reset_arena(Arena* arena) {
+	ArenaChunk *chunk;
+	for (chunk = arena->head; chunk != NULL; chunk = chunk->next) {
+		chunk->used = 0;
+	}
+	arena->current = arena->head;
+}
+
+int arena_chunks(Arena* arena) {
+	return arena->num_chunks;
+}
+
+void destroy_arena(Arena* arena) {
+	ArenaChunk *last;
+	ArenaChunk *chunk = arena->head;
+	while (chunk != NULL) {
+		last = chunk;
+		chunk = chunk->next;
+		free(last);
+	}
+	free(arena);
+}
+
+// intended to be private
+static void destroy_thread_arena(void* arena) {
+	destroy_arena((Arena*) arena);
+}
+
+// intended to be private
+static void create_thread_arena_key() {
+	pthread_key_create(&ThreadArenaKey, destroy_thread_arena);
+}
+
+Arena* thread_arena() {
+	Arena *arena;
+
+	pthread_once(&ThreadArenaOnce, create_thread_arena_key);
+	arena = (Arena*) pthread_getspecific(ThreadArenaKey);
+	if (arena == NULL) {
+		arena = new_arena(0);
+		pthread_setspecific(ThreadArenaKey, arena);
+	}
+	return arena;
+}
@@ -0,0 +1,128 @@
+/*
+ * Library: store - a generic set of storage data structures
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "change_ring.h"
+
+#define RECORD_WORDS  (sizeof(ChangeRecord) / sizeof(uint64_t))
+/* marks a record the producer is in the middle of rewriting */
+#define SEQ_WRITING   UINT64_MAX
+
+/* the first word of a record is its sequence number, which doubles as a
+seqlock: the producer replaces it with SEQ_WRITING before touching the other
+words and stores the new sequence number last. A reader that sees the number it
+expects both before and after copying the record got a consistent copy. */
+
+// intended to be private
+static uint64_t* record_words(ChangeRing* ring, uint64_t seq) {
+	return (uint64_t*) &ring->records[seq & (ring->capacity - 1)];
+}
+
+
+size_t change_ring_size(uint32_t capacity) {
+	return sizeof(ChangeRing) + (size_t) capacity*sizeof(ChangeRecord);
+}
+
+void change_ring_init(ChangeRing* ring, uint32_t capacity) {
+	if (__atomic_load_n(&ring->capacity, __ATOMIC_ACQUIRE) == capacity) {
+		return;
+	}
+
+	memset(ring, 0, change_ring_size(capacity));
+
+	/* readers treat the ring as empty until the capacity is published */
+	__atomic_store_n(&ring->capacity, capacity, __ATOMIC_RELEASE);
+}
+
+void change_ring_append(ChangeRing* ring, int index, int op, float x, float y) {
+	unsigned int word;
+	uint64_t words[RECORD_WORDS];
+	uint64_t *slot;
+	struct timespec ts;
+	ChangeRecord record;
+	uint64_t seq = ring->head;
+
+	if (ring->capacity == 0) {
+		return;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	record.seq = seq;
+	record.timestamp_ns = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	record.index = index;
+	record.op = op;
+	record.x = x;
+	record.y = y;
+	memcpy(words, &record, sizeof(record));
+
+	slot = record_words(ring, seq);
+	__atomic_store_n(&slot[0], SEQ_WRITING, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	for (word = 1; word < RECORD_WORDS; word++) {
+		__atomic_store_n(&slot[word], words[word], __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&slot[0], seq, __ATOMIC_RELEASE);
+
+	__atomic_store_n(&ring->head, seq + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t change_ring_head(ChangeRing* ring) {
+	return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+int change_ring_read(ChangeRing* ring, uint64_t* cursor, ChangeRecord* records, int max, uint64_t* missed) {
+	unsigned int word;
+	int count = 0;
+	uint64_t words[RECORD_WORDS];
+	uint64_t *slot;
+	uint64_t head, oldest;
+	uint32_t capacity = __atomic_load_n(&ring->capacity, __ATOMIC_ACQUIRE);
+
+	if (capacity == 0) {
+		return 0;
+	}
+
+	head = change_ring_head(ring);
+	/* a cursor ahead of the ring means the ring was set up again, start over */
+	if (*cursor > head) {
+		*cursor = head;
+	}
+
+	while (count < max && *cursor < head) {
+		/* skip what the producer has already overwritten */
+		oldest = head > capacity ? head - capacity : 0;
+		if (*cursor < oldest) {
+			*missed += oldest - *cursor;
+			*cursor = oldest;
+		}
+
+		slot = record_words(ring, *cursor);
+		words[0] = __atomic_load_n(&slot[0], __ATOMIC_ACQUIRE);
+		for (word = 1; word < RECORD_WORDS; word++) {
+			words[word] = __atomic_load_n(&slot[word], __ATOMIC_RELAXED);
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (words[0] != *cursor || __atomic_load_n(&slot[0], __ATOMIC_RELAXED) != *cursor) {
+			/* lapped while copying, move the cursor up to what is still there */
+			head = change_ring_head(ring);
+			if (head - *cursor < capacity) {
+				/* should not happen, but never spin on a record */
+				*missed += 1;
+				*cursor += 1;
+			}
+			continue;
+		}
+
+		memcpy(&records[count++], words, sizeof(ChangeRecord));
+		*cursor += 1;
+	}
+	return count;
+}
@@ -0,0 +1,369 @@
+/*
+ * Library: store - a generic set of storage data structures
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "map_gen.h"
+#include "cmap.h"
+
+#define CMAP_MIN_SLOTS     16
+#define CMAP_STRIPES       16
+#define CMAP_READER_SLOTS  16
+#define CACHE_LINE         64
+
+/* slots are claimed for a key exactly once and never reused for another key
+(a deleted key only clears the value), so a reader that has seen a key in a
+slot can trust it without any lock. The table is rebuilt once 3/4 of the slots
+have been claimed. */
+#define CMAP_MAX_CLAIMED(slots) (((slots) / 4) * 3)
+
+enum {SLOT_EMPTY, SLOT_CLAIMED, SLOT_KEYED};
+
+typedef struct CMapSlot {
+	int state;
+	int key;
+	void* value;
+} CMapSlot;
+
+typedef struct CMapTable {
+	uint32_t mask;
+	uint32_t claimed;
+	struct CMapTable* retired_next;
+	CMapSlot slots[];
+} CMapTable;
+
+/* the locks and reader counters each get their own cache line so that threads
+working on different stripes do not invalidate each other */
+typedef union CMapStripe {
+	pthread_mutex_t lock;
+	char pad[CACHE_LINE];
+} __attribute__((aligned(CACHE_LINE))) CMapStripe;
+
+typedef union CMapReaders {
+	long active;
+	char pad[CACHE_LINE];
+} __attribute__((aligned(CACHE_LINE))) CMapReaders;
+
+struct CMap {
+	CMapTable* table;
+	int count;
+	/* tables replaced by a resize, freed once no reader can still see them */
+	CMapTable* retired;
+	CMapStripe stripes[CMAP_STRIPES];
+	CMapReaders readers[CMAP_READER_SLOTS];
+};
+
+/* each thread announces its reads on one of the reader counters */
+static int NextReaderSlot = 0;
+static __thread int ReaderSlot = -1;
+
+
+static CMapTable* new_table(uint32_t num_slots) {
+	CMapTable* table = calloc(1, sizeof(CMapTable) + num_slots*sizeof(CMapSlot));
+	if (table != NULL) {
+		table->mask = num_slots - 1;
+	}
+	return table;
+}
+
+static int reader_enter(CMap* map) {
+	if (ReaderSlot < 0) {
+		ReaderSlot = __atomic_fetch_add(&NextReaderSlot, 1, __ATOMIC_RELAXED) % CMAP_READER_SLOTS;
+	}
+	__atomic_fetch_add(&map->readers[ReaderSlot].active, 1, __ATOMIC_SEQ_CST);
+	return ReaderSlot;
+}
+
+static void reader_exit(CMap* map, int reader) {
+	__atomic_fetch_sub(&map->readers[reader].active, 1, __ATOMIC_RELEASE);
+}
+
+static CMapTable* current_table(CMap* map) {
+	return __atomic_load_n(&map->table, __ATOMIC_SEQ_CST);
+}
+
+static CMapStripe* stripe_for(CMap* map, uint32_t hash) {
+	/* the low bits pick the home slot, use the high bits for the stripe */
+	return &map->stripes[(hash >> 24) % CMAP_STRIPES];
+}
+
+// intended to be private: the caller must hold the stripe lock for the key
+static CMapSlot* find_slot(CMapTable* table, int key, uint32_t hash, bool claim) {
+	uint32_t probes;
+	uint32_t slot = hash & table->mask;
+	bool reserved = false;
+	int state;
+	int expected;
+
+	for (probes = 0; probes <= table->mask; ) {
+		CMapSlot* s = &table->slots[slot];
+		state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+
+		if (state == SLOT_KEYED && s->key == key) {
+			return s;
+		}
+
+		if (state == SLOT_EMPTY) {
+			/* an empty slot ends the probe chain, the key is not in the table */
+			if (!claim) {
+				return NULL;
+			}
+			if (!reserved) {
+				if (__atomic_fetch_add(&table->claimed, 1, __ATOMIC_RELAXED) >= CMAP_MAX_CLAIMED(table->mask + 1)) {
+					__atomic_fetch_sub(&table->claimed, 1, __ATOMIC_RELAXED);
+					return NULL;
+				}
+				reserved = true;
+			}
+
+			/* another stripe may be claiming the same slot for a different key */
+			expected = SLOT_EMPTY;
+			if (__atomic_compare_exchange_n(&s->state, &expected, SLOT_CLAIMED, false,
+			                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				s->key = key;
+				__atomic_store_n(&s->state, SLOT_KEYED, __ATOMIC_RELEASE);
+				return s;
+			}
+			/* lost the race, look at this slot again */
+			continue;
+		}
+
+		slot = (slot + 1) & table->mask;
+		probes++;
+	}
+
+	if (reserved) {
+		__atomic_fetch_sub(&table->claimed, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static void reclaim_retired(CMap* map) {
+	int i;
+	CMapTable *table, *next;
+
+	/* any reader that starts after the new table was published can only see the
+	new table, so once no reader is active the retired tables are unreachable */
+	for (i = 0; i < CMAP_READER_SLOTS; i++) {
+		if (__atomic_load_n(&map->readers[i].active, __ATOMIC_SEQ_CST) != 0) {
+			return;
+		}
+	}
+
+	table = map->retired;
+	while (table != NULL) {
+		next = table->retired_next;
+		free(table);
+		table = next;
+	}
+	map->retired = NULL;
+}
+
+static bool resize_cmap(CMap* map, CMapTable* seen) {
+	int i;
+	uint32_t idx, num_slots = CMAP_MIN_SLOTS;
+	uint32_t live;
+	CMapTable *table, *old;
+	bool ret = true;
+
+	for (i = 0; i < CMAP_STRIPES; i++) {
+		pthread_mutex_lock(&map->stripes[i].lock);
+	}
+
+	old = map->table;
+	/* someone else already rebuilt the table while we were waiting */
+	if (old == seen) {
+		/* leave the new table at most half way to the next rebuild */
+		live = __atomic_load_n(&map->count, __ATOMIC_RELAXED);
+		while (CMAP_MAX_CLAIMED(num_slots) < 2*(live + 1)) {
+			num_slots <<= 1;
+		}
+
+		table = new_table(num_slots);
+		if (table == NULL) {
+			ret = false;
+		} else {
+			for (idx = 0; idx <= old->mask; idx++) {
+				CMapSlot *from = &old->slots[idx], *to;
+				if (from->state == SLOT_KEYED && from->value != NULL) {
+					to = find_slot(table, from->key, map_hash_int(from->key), true);
+					to->value = from->value;
+				}
+			}
+
+			__atomic_store_n(&map->table, table, __ATOMIC_SEQ_CST);
+			old->retired_next = map->retired;
+			map->retired = old;
+			reclaim_retired(map);
+		}
+	}
+
+	for (i = CMAP_STRIPES - 1; i >= 0; i--) {
+		pthread_mutex_unlock(&map->stripes[i].lock);
+	}
+	return ret;
+}
+
+
+CMap* new_cmap(int size) {
+	int i;
+	uint32_t num_slots = CMAP_MIN_SLOTS;
+	CMap* map;
+
+	if (posix_memalign((void**) &map, CACHE_LINE, sizeof(CMap))) {
+		return NULL;
+	}
+	memset(map, 0, sizeof(CMap));
+
+	while (size > 0 && CMAP_MAX_CLAIMED(num_slots) < (uint32_t) size) {
+		num_slots <<= 1;
+	}
+	map->table = new_table(num_slots);
+	if (map->table == NULL) {
+		free(map);
+		return NULL;
+	}
+
+	for (i = 0; i < CMAP_STRIPES; i++) {
+		pthread_mutex_init(&map->stripes[i].lock, NULL);
+	}
+	return map;
+}
+
+void* get_cmap_item(CMap* map, int key) {
+	uint32_t probes;
+	uint32_t hash = map_hash_int(key);
+	int reader = reader_enter(map);
+	CMapTable* table = current_table(map);
+	uint32_t slot = hash & table->mask;
+	void* value = NULL;
+	int state;
+
+	/* at most one pass over the table, never waiting on a writer */
+	for (probes = 0; probes <= table->mask; probes++) {
+		CMapSlot* s = &table->slots[slot];
+		state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+		if (state == SLOT_EMPTY) {
+			break;
+		}
+		if (state == SLOT_KEYED && s->key == key) {
+			value = __atomic_load_n(&s->value, __ATOMIC_ACQUIRE);
+			break;
+		}
+		slot = (slot + 1) & table->mask;
+	}
+
+	reader_exit(map, reader);
+	return value;
+}
+
+bool insert_cmap_item(CMap* map, int key, void* value) {
+	uint32_t hash = map_hash_int(key);
+	CMapStripe* stripe = stripe_for(map, hash);
+	CMapTable* table;
+	CMapSlot* slot;
+
+	if (value == NULL) {
+		return false;
+	}
+
+	while (true) {
+		pthread_mutex_lock(&stripe->lock);
+		/* the table can only be replaced while all stripes are held */
+		table = map->table;
+		slot = find_slot(table, key, hash, true);
+		if (slot != NULL) {
+			if (__atomic_exchange_n(&slot->value, value, __ATOMIC_RELEASE) == NULL) {
+				__atomic_fetch_add(&map->count, 1, __ATOMIC_RELAXED);
+			}
+			pthread_mutex_unlock(&stripe->lock);
+			return true;
+		}
+		pthread_mutex_unlock(&stripe->lock);
+
+		if (!resize_cmap(map, table)) {
+			return false;
+		}
+	}
+}
+
+bool delete_cmap_item(CMap* map, int key) {
+	uint32_t hash = map_hash_int(key);
+	CMapStripe* stripe = stripe_for(map, hash);
+	CMapSlot* slot;
+	bool ret = false;
+
+	pthread_mutex_lock(&stripe->lock);
+	slot = find_slot(map->table, key, hash, false);
+	if (slot != NULL && __atomic_exchange_n(&slot->value, NULL, __ATOMIC_RELEASE) != NULL) {
+		__atomic_fetch_sub(&map->count, 1, __ATOMIC_RELAXED);
+		ret = true;
+	}
+	pthread_mutex_unlock(&stripe->lock);
+	return ret;
+}
+
+int cmap_count(CMap* map) {
+	return __atomic_load_n(&map->count, __ATOMIC_RELAXED);
+}
+
+void* search_cmap(CMap *map, bool (*match)(void *value, void *arg), void *arg) {
+	uint32_t idx;
+	int reader = reader_enter(map);
+	CMapTable* table = current_table(map);
+	void* value;
+	void* found = NULL;
+
+	for (idx = 0; idx <= table->mask && found == NULL; idx++) {
+		if (__atomic_load_n(&table->slots[idx].state, __ATOMIC_ACQUIRE) == SLOT_KEYED) {
+			value = __atomic_load_n(&table->slots[idx].value, __ATOMIC_ACQUIRE);
+			if (value != NULL && (*match)(value, arg)) {
+				found = value;
+			}
+		}
+	}
+
+	reader_exit(map, reader);
+	return found;
+}
+
+void iterate_cmap(CMap *map, void (*processor)(void *)) {
+	uint32_t idx;
+	int reader = reader_enter(map);
+	CMapTable* table = current_table(map);
+	void* value;
+
+	for (idx = 0; idx <= table->mask; idx++) {
+		if (__atomic_load_n(&table->slots[idx].state, __ATOMIC_ACQUIRE) == SLOT_KEYED) {
+			value = __atomic_load_n(&table->slots[idx].value, __ATOMIC_ACQUIRE);
+			if (value != NULL) {
+				(*processor)(value);
+			}
+		}
+	}
+
+	reader_exit(map, reader);
+}
+
+void destroy_cmap(CMap* map) {
+	int i;
+	CMapTable *table, *next;
+
+	table = map->retired;
+	while (table != NULL) {
+		next = table->retired_next;
+		free(table);
+		table = next;
+	}
+	free(map->table);
+
+	for (i = 0; i < CMAP_STRIPES; i++) {
+		pthread_mutex_destroy(&map->stripes[i].lock);
+	}
+	free(map);
+}
@@ -7,81 +7,58 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include "arena.h"
 #include "hash_table.h"
 
 
+/* Note: the Hash API is a thin wrapper over the int -> HashNode instantiation
+of the generic map (HashNodeMap), new code should prefer its own MAP_DEFINE */
 Hash* new_hash(int size) {
-	int i;
-	Hash *hash = (Hash*)malloc(sizeof(Hash)+size*sizeof(HashNode));
-	hash->size = size;
-	for(i = 0; i<size; i++) {
-		hash->hash_array[i] = NULL;
+	Hash *hash = (Hash*)malloc(sizeof(Hash));
+	hash->arena = NULL;
+	if (!HashNodeMap_init(&hash->map, size > 0 ? size : 0)) {
+		free(hash);
+		return NULL;
 	}
 	return hash;
 }
 
-static int get_hash_index(Hash* hash, int key) {
-	return ((unsigned int)key) % hash->size;
+Hash* new_hash_in(int size, Arena* arena) {
+	Hash *hash = (Hash*)arena_alloc(arena, sizeof(Hash));
+	if (hash == NULL) {
+		return NULL;
+	}
+	hash->arena = arena;
+	if (!HashNodeMap_init(&hash->map, size > 0 ? size : 0)) {
+		return NULL;
+	}
+	return hash;
 }
 
 
 HashNode *get_hash_item(Hash* hash, int key) {
-	 int hash_index = get_hash_index(hash, key);
-
-	while(hash->hash_array[hash_index] != NULL) {
-		if(hash->hash_array[hash_index]->key == key){
-			return hash->hash_array[hash_index];
-		}
-
-		++hash_index;
-		hash_index %= hash->size;
-	}
-
-	return NULL;
+	return HashNodeMap_get(&hash->map, key);
 }
 
 void insert_hash_item(Hash* hash, int key, void* value, int size) {
-	HashNode *item = (HashNode*) malloc(sizeof(HashNode));
-	item->size = size;
-	item->value = value;
-	item->key = key;
-
-	int hash_index = get_hash_index(hash, key);
-
-	while(hash->hash_array[hash_index] != NULL) {
-		// allow for overwrites
-		if (hash->hash_array[hash_index]->key == key){
-			break;
-		}
-		++hash_index;
-		hash_index %= hash->size;
+	HashNode item = {key, size, value};
+	if (HashNodeMap_put(&hash->map, key, item) == NULL) {
+		printf("Hash: unable to grow table past %u entries\n", HashNodeMap_count(&hash->map));
 	}
-	hash->hash_array[hash_index] = item;
 }
 
 bool delete_hash_item(Hash* hash, int key) {
-	int hash_index = get_hash_index(hash, key);
-
-	while(hash->hash_array[hash_index] != NULL) {
-		if(hash->hash_array[hash_index]->key == key) {
-			free(hash->hash_array[hash_index]);
-			hash->hash_array[hash_index] = NULL;
-			return true;
-		}
-
-		++hash_index;
-		hash_index %= hash->size;
-	}
+	return HashNodeMap_del(&hash->map, key);
+}
 
-	return false;
+int hash_count(Hash* hash) {
+	return HashNodeMap_count(&hash->map);
 }
 
 void iterate_hash(Hash *hash, void (*processor)(void *)){
-	int i = 0;
-	for(i = 0; i<hash->size; i++) {
-		if(hash->hash_array[i] != NULL) {
-			(*processor)(hash->hash_array[i]);
-		}
+	uint32_t i;
+	for(i = 0; i<HashNodeMap_count(&hash->map); i++) {
+		(*processor)(&HashNodeMap_at(&hash->map, i)->value);
 	}
 
 }
@@ -93,11 +70,8 @@ void show_hash(void* hash_node) {
 
 
 void destroy_hash(Hash* hash) {
-	int i;
-	for(i = 0; i<hash->size; i++) {
-		if(hash->hash_array[i] != NULL){
-			free(hash->hash_array[i]);
-		}
+	HashNodeMap_destroy(&hash->map);
+	if (hash->arena == NULL) {
+		free(hash);
 	}
-	free(hash);
 }
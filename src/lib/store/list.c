@@ -6,25 +6,43 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include "arena.h"
 #include "list.h"
 
+/* ChunkList blocks are allocated in multiples of a cache line */
+#define CACHE_LINE        64
+#define CHUNK_BLOCK_SIZE  (4*CACHE_LINE)
+
 List* new_list() {
 	List *list = (List*)malloc(sizeof(List));
 	list->size = 0;
+	list->arena = NULL;
+	list->head = NULL;
+	list->tail = NULL;
+	return list;
+}
+
+List* new_list_in(Arena* arena) {
+	List *list = (List*)arena_alloc(arena, sizeof(List));
+	list->size = 0;
+	list->arena = arena;
 	list->head = NULL;
 	list->tail = NULL;
 	return list;
 }
 
 void push_list_item(List* list, void* value, unsigned int value_size) {
-	int idx;
-	ListNode* new_node = (ListNode*)malloc(sizeof(ListNode)+value_size);
-	new_node->value = value;
-  new_node->next = NULL;
+	ListNode* new_node;
 
-	for (idx=0; idx<value_size; idx++) {
-		*(char *)(new_node->value + idx) = *(char *)(value + idx);
+	/* the node refers to the caller's value, it is not copied (callers such as
+	shmlib compare the stored value by address) */
+	if (list->arena != NULL) {
+		new_node = (ListNode*)arena_alloc(list->arena, sizeof(ListNode));
+	} else {
+		new_node = (ListNode*)malloc(sizeof(ListNode));
 	}
+	new_node->value = value;
+  new_node->next = NULL;
 
 	if (list->head == NULL) {
 		list->head = new_node;
@@ -50,13 +68,14 @@ bool remove_list_item(List* list, void* value) {
 			}
 
 			// if this is tail, replace it
-			if (prev == NULL){
-				list->tail = NULL;
-			} else {
+			if (node == list->tail){
 				list->tail = prev;
 			}
 
 			list->size -= 1;
+			if (list->arena == NULL) {
+				free(node);
+			}
 			return true;
 		}
 		prev = node;
@@ -76,6 +95,12 @@ void iterate_list(List *list, void (*processor)(void *)){
 void destroy_list(List* list) {
   ListNode *last;
 	ListNode *node = list->head;
+
+	/* everything was allocated from the arena, which still owns it */
+	if (list->arena != NULL) {
+		return;
+	}
+
 	while (node != NULL) {
 		last = node;
 		node = node->next;
@@ -83,3 +108,148 @@ void destroy_list(List* list) {
 	}
 	free(list);
 }
+
+// intended to be private
+static ChunkList* init_chunk_list(ChunkList* list, unsigned int value_size, Arena* arena) {
+	unsigned int block_size = CHUNK_BLOCK_SIZE;
+
+	/* a value that does not fit a default block gets a block of its own, rounded
+	up to whole cache lines */
+	while (block_size - sizeof(ChunkBlock) < value_size) {
+		block_size += CACHE_LINE;
+	}
+
+	list->size = 0;
+	list->value_size = value_size;
+	list->per_block = (block_size - sizeof(ChunkBlock)) / value_size;
+	list->arena = arena;
+	list->head = NULL;
+	list->tail = NULL;
+	return list;
+}
+
+ChunkList* new_chunk_list(unsigned int value_size) {
+	return init_chunk_list((ChunkList*)malloc(sizeof(ChunkList)), value_size, NULL);
+}
+
+ChunkList* new_chunk_list_in(unsigned int value_size, Arena* arena) {
+	return init_chunk_list((ChunkList*)arena_alloc(arena, sizeof(ChunkList)), value_size, arena);
+}
+
+// intended to be private
+static ChunkBlock* new_chunk_block(ChunkList* list) {
+	ChunkBlock* block;
+	size_t block_size = sizeof(ChunkBlock) + list->per_block*list->value_size;
+
+	block_size = (block_size + CACHE_LINE - 1) & ~(size_t) (CACHE_LINE - 1);
+	if (list->arena != NULL) {
+		block = (ChunkBlock*)arena_alloc_aligned(list->arena, block_size, CACHE_LINE);
+		if (block == NULL) {
+			return NULL;
+		}
+	} else if (posix_memalign((void**) &block, CACHE_LINE, block_size)) {
+		return NULL;
+	}
+	block->next = NULL;
+	block->count = 0;
+	return block;
+}
+
+void* push_chunk_list_item(ChunkList* list, void *value) {
+	void *item;
+	ChunkBlock *block = list->tail;
+
+	if (block == NULL || block->count == list->per_block) {
+		/* blocks left over from clear_chunk_list() are reused first */
+		if (block != NULL && block->next != NULL) {
+			block = block->next;
+		} else {
+			block = new_chunk_block(list);
+			if (block == NULL) {
+				return NULL;
+			}
+			if (list->head == NULL) {
+				list->head = block;
+			} else {
+				list->tail->next = block;
+			}
+		}
+		list->tail = block;
+	}
+
+	item = block->values + block->count*list->value_size;
+	memcpy(item, value, list->value_size);
+	block->count += 1;
+	list->size += 1;
+	return item;
+}
+
+void iterate_chunk_list(ChunkList *list, void (*processor)(void *)) {
+	unsigned int idx;
+	ChunkBlock *block = list->head;
+
+	/* blocks after the tail are empty (see clear_chunk_list) */
+	while (block != NULL && block->count > 0) {
+		for (idx=0; idx < block->count; idx++) {
+			(*processor)(block->values + idx*list->value_size);
+		}
+		block = block->next;
+	}
+}
+
+void clear_chunk_list(ChunkList* list) {
+	ChunkBlock *block;
+	for (block = list->head; block != NULL; block = block->next) {
+		block->count = 0;
+	}
+	list->tail = list->head;
+	list->size = 0;
+}
+
+void destroy_chunk_list(ChunkList* list) {
+	ChunkBlock *last;
+	ChunkBlock *block = list->head;
+
+	if (list->arena != NULL) {
+		return;
+	}
+	while (block != NULL) {
+		last = block;
+		block = block->next;
+		free(last);
+	}
+	free(list);
+}
+
+void init_dlist(DList* list) {
+	list->size = 0;
+	list->head.prev = &list->head;
+	list->head.next = &list->head;
+}
+
+void push_dlist_item(DList* list, DListLink* link) {
+	link->prev = list->head.prev;
+	link->next = &list->head;
+	list->head.prev->next = link;
+	list->head.prev = link;
+	list->size += 1;
+}
+
+void unlink_dlist_item(DList* list, DListLink* link) {
+	link->prev->next = link->next;
+	link->next->prev = link->prev;
+	link->prev = NULL;
+	link->next = NULL;
+	list->size -= 1;
+}
+
+void iterate_dlist(DList *list, void (*processor)(DListLink *)) {
+	DListLink *next;
+	DListLink *link = list->head.next;
+	while (link != &list->head) {
+		/* the processor is allowed to unlink the current link */
+		next = link->next;
+		(*processor)(link);
+		link = next;
+	}
+}
@@ -0,0 +1,137 @@
+/*
+ * Library: store - a generic set of storage data structures
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "mpsc_queue.h"
+
+#define CACHE_LINE  64
+
+/* every cell carries a sequence number that tells producers and the consumer
+whose turn it is: a cell at position pos is free for the producer that claims
+pos when seq == pos, and holds an element for the consumer when seq == pos + 1.
+After dequeuing, the consumer hands the cell to the producer of the next lap by
+setting seq = pos + capacity. */
+typedef struct MPSCCell {
+	uint64_t seq;
+	char data[];
+} MPSCCell;
+
+struct MPSCQueue {
+	/* read-only after creation, shared by everyone */
+	uint64_t mask;
+	size_t cell_size;
+	unsigned int elem_size;
+	char *cells;
+	/* claimed by producers with a CAS */
+	uint64_t tail __attribute__((aligned(CACHE_LINE)));
+	/* only touched by the consumer */
+	uint64_t head __attribute__((aligned(CACHE_LINE)));
+	char pad[CACHE_LINE - sizeof(uint64_t)];
+};
+
+
+// intended to be private
+static MPSCCell* cell_at(MPSCQueue* queue, uint64_t pos) {
+	return (MPSCCell*) (queue->cells + (pos & queue->mask)*queue->cell_size);
+}
+
+MPSCQueue* new_mpsc_queue(unsigned int capacity, unsigned int elem_size) {
+	uint64_t idx, num_cells = 2;
+	MPSCQueue *queue;
+
+	if (posix_memalign((void**) &queue, CACHE_LINE, sizeof(MPSCQueue))) {
+		return NULL;
+	}
+	memset(queue, 0, sizeof(MPSCQueue));
+
+	while (num_cells < capacity) {
+		num_cells <<= 1;
+	}
+	queue->mask = num_cells - 1;
+	queue->elem_size = elem_size;
+	/* keep the sequence numbers of neighbouring cells 8-byte aligned */
+	queue->cell_size = (sizeof(MPSCCell) + elem_size + 7) & ~(size_t) 7;
+
+	if (posix_memalign((void**) &queue->cells, CACHE_LINE, num_cells*queue->cell_size)) {
+		free(queue);
+		return NULL;
+	}
+	for (idx = 0; idx < num_cells; idx++) {
+		cell_at(queue, idx)->seq = idx;
+	}
+	return queue;
+}
+
+bool mpsc_enqueue(MPSCQueue* queue, const void* elem) {
+	MPSCCell *cell;
+	uint64_t seq;
+	uint64_t pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+	int64_t diff;
+
+	while (true) {
+		cell = cell_at(queue, pos);
+		seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		diff = (int64_t) (seq - pos);
+
+		if (diff == 0) {
+			/* the cell is free, try to claim the position */
+			if (__atomic_compare_exchange_n(&queue->tail, &pos, pos + 1, true,
+			                                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+			/* pos has been reloaded by the failed CAS */
+		} else if (diff < 0) {
+			/* the consumer has not emptied this cell since the last lap */
+			return false;
+		} else {
+			/* another producer claimed pos, catch up */
+			pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	memcpy(cell->data, elem, queue->elem_size);
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+bool mpsc_dequeue(MPSCQueue* queue, void* elem) {
+	return mpsc_dequeue_batch(queue, elem, 1) == 1;
+}
+
+unsigned int mpsc_dequeue_batch(MPSCQueue* queue, void* elems, unsigned int max) {
+	unsigned int count;
+	uint64_t pos = queue->head;
+	MPSCCell *cell;
+
+	for (count = 0; count < max; count++, pos++) {
+		cell = cell_at(queue, pos);
+		/* stop at the first cell that has not been published yet, even if later
+		cells are (the queue stays FIFO) */
+		if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+			break;
+		}
+		memcpy((char*) elems + (size_t) count*queue->elem_size, cell->data, queue->elem_size);
+		__atomic_store_n(&cell->seq, pos + queue->mask + 1, __ATOMIC_RELEASE);
+	}
+
+	/* atomic only so that mpsc_queue_count() may read it from other threads */
+	__atomic_store_n(&queue->head, pos, __ATOMIC_RELAXED);
+	return count;
+}
+
+unsigned int mpsc_queue_count(MPSCQueue* queue) {
+	uint64_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+	uint64_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+	return tail > head ? (unsigned int) (tail - head) : 0;
+}
+
+void destroy_mpsc_queue(MPSCQueue* queue) {
+	free(queue->cells);
+	free(queue);
+}
@@ -7,17 +7,819 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+/* the lines of this library are filtered by its own level (see set_log_level) */
+#define LOG_MODULE LOG_STORE
 #include "log_mgr.h"
+#include "point_index.h"
+#include "change_ring.h"
+#include "point_columns.h"
+#include "point_grid.h"
+#include "point_history.h"
+#include "point_summary.h"
+#include "point_dirty.h"
 #include "point.h"
 
 
+/* The segment starts with a one cache line header (PointSegment) that describes
+the rest of it. The change ring and the id index follow at fixed offsets, so
+readers can use them before the header is set up (zero filled they read as
+empty). The points come last since their size depends on the capacity, room is
+reserved for either layout, followed by one sequence counter (and count of
+valid points) per block of POINT_SEQ_BLOCK points, the spatial grid over the valid points, the stamps
+telling which points changed in which generation and the (optional) history of
+every slot. */
+#define ALIGN_UP(size, align) (((size) + (align) - 1) & ~(uint64_t) ((align) - 1))
+#define CHANGES_OFFSET sizeof(PointSegment)
+#define INDEX_OFFSET ALIGN_UP(CHANGES_OFFSET + change_ring_size(POINT_CHANGE_RING_SIZE), 64)
+#define NUM_BLOCKS(capacity) (((capacity) + POINT_SEQ_BLOCK - 1) / POINT_SEQ_BLOCK)
+/* a writer that died in the middle of a block leaves its counter odd. Readers
+retry for as long as the counter moves, however busy the writer is, and only
+give up once it stayed at the same odd value for SEQ_STUCK_NS, well beyond the
+longest a live writer keeps a block (clear_points rewrites all of them). They
+spin SEQ_SPINS times before they start yielding and looking at the clock. */
+#define SEQ_STUCK_NS 5000000000ull
+#define SEQ_SPINS 1000
+/* how far the running sums may be from a rescan (relative) before it counts as
+drift. The rescan is a plain double sum, so it has some error of its own. */
+#define STATS_TOLERANCE 1e-6
+/* the fewest points worth a summary thread of their own, and the most threads */
+#define SUMMARY_THREAD_POINTS (256*1024)
+#define SUMMARY_MAX_THREADS 64
+/* number of changed points asked for at a time (by show_changed_points and
+clear_points) */
+#define CHANGED_BATCH 256
+
+static const char *CHANGE_OP_STRING[] = {"none", "install", "invalidate", "clear"};
+
+/* the counter of a block, and the number of valid points in it. The count is
+only changed by the writer while the counter is odd, readers use it to skip the
+blocks without any valid point. */
+typedef struct BlockSeq {
+	uint32_t seq;
+	uint32_t valid;
+} BlockSeq;
+
+// intended to be private
+static uint64_t points_offset_for(uint64_t capacity) {
+	return ALIGN_UP(INDEX_OFFSET + point_index_size(capacity), 64);
+}
+
+// intended to be private
+static uint64_t points_size_for(uint64_t capacity) {
+	uint64_t aos_size = capacity*sizeof(Point);
+	uint64_t soa_size = point_columns_size(capacity);
+	return aos_size > soa_size ? aos_size : soa_size;
+}
+
+// intended to be private
+static uint64_t seqs_offset_for(uint64_t capacity) {
+	return ALIGN_UP(points_offset_for(capacity) + points_size_for(capacity), 64);
+}
+
+// intended to be private
+static uint64_t grid_offset_for(uint64_t capacity) {
+	return ALIGN_UP(seqs_offset_for(capacity) + NUM_BLOCKS(capacity)*sizeof(BlockSeq), 64);
+}
+
+// intended to be private
+static uint64_t dirty_offset_for(uint64_t capacity) {
+	return ALIGN_UP(grid_offset_for(capacity) + point_grid_size(capacity), 64);
+}
+
+// intended to be private
+static uint64_t history_offset_for(uint64_t capacity) {
+	return ALIGN_UP(dirty_offset_for(capacity) + point_dirty_size(capacity), 64);
+}
+
+size_t point_segment_size(uint64_t capacity, uint32_t history_depth) {
+	return history_offset_for(capacity) + point_history_size(capacity, history_depth);
+}
+
+PointIndex* point_segment_index(void* shmaddr) {
+	return (PointIndex*) ((char*) shmaddr + INDEX_OFFSET);
+}
+
+ChangeRing* point_segment_changes(void* shmaddr) {
+	return (ChangeRing*) ((char*) shmaddr + CHANGES_OFFSET);
+}
+
+uint64_t point_segment_capacity(void* shmaddr) {
+	PointSegment *segment = shmaddr;
+
+	if (__atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE) != POINT_SEGMENT_MAGIC
+	    || segment->elem_size != sizeof(Point)) {
+		return 0;
+	}
+	return segment->capacity;
+}
+
+int point_segment_layout(void* shmaddr) {
+	return __atomic_load_n(&((PointSegment*) shmaddr)->layout, __ATOMIC_ACQUIRE);
+}
+
+// intended to be private: only meaningful once the header is set up
+static Point* point_array(void* shmaddr) {
+	return (Point*) ((char*) shmaddr + ((PointSegment*) shmaddr)->points_offset);
+}
+
+// intended to be private: only meaningful once the header is set up
+static PointColumns* point_columns(void* shmaddr) {
+	return (PointColumns*) ((char*) shmaddr + ((PointSegment*) shmaddr)->points_offset);
+}
+
+enum {SEQ_DONE, SEQ_AGAIN, SEQ_STUCK};
+
+/* what a reader knows of the writer it is waiting for */
+typedef struct SeqWait {
+	uint32_t seen;
+	uint32_t spins;
+	uint64_t since;
+} SeqWait;
+
+// intended to be private: the counter and count of the block holding the index
+static BlockSeq* block_of(void* shmaddr, uint64_t index) {
+	BlockSeq *blocks = (BlockSeq*) ((char*) shmaddr + ((PointSegment*) shmaddr)->seqs_offset);
+	return &blocks[index / POINT_SEQ_BLOCK];
+}
+
+// intended to be private: the sequence counter of the block holding the index
+static uint32_t* block_seq(void* shmaddr, uint64_t index) {
+	return &block_of(shmaddr, index)->seq;
+}
+
+// intended to be private: the count of valid points of the block holding the index
+static uint32_t* block_valid(void* shmaddr, uint64_t index) {
+	return &block_of(shmaddr, index)->valid;
+}
+
+// intended to be private: only the writer changes the counts, within the block
+static void count_valid(void* shmaddr, uint64_t index, bool was_valid, bool is_valid) {
+	uint32_t *valid = block_valid(shmaddr, index);
+
+	if (was_valid != is_valid) {
+		__atomic_store_n(valid, is_valid ? *valid + 1 : *valid - 1, __ATOMIC_RELAXED);
+	}
+}
+
+// intended to be private: only the writer changes the counters
+static void write_begin(uint32_t* seq) {
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	/* the odd counter is visible before any of the changes to the block */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// intended to be private
+static void write_end(uint32_t* seq) {
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+// intended to be private
+static uint32_t read_begin(uint32_t* seq) {
+	return __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+}
+
+// intended to be private: makes the counter even again after a writer died
+// in the middle of an update (only the writer may call this)
+static void write_settle(uint32_t* seq) {
+	if (*seq & 1) {
+		__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+	}
+}
+
+// intended to be private
+static uint64_t monotonic_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// intended to be private: SEQ_DONE if the copy taken since read_begin is whole,
+// SEQ_AGAIN if it may be torn, SEQ_STUCK if the writer seems to have died
+static int read_retry(uint32_t* seq, uint32_t start, SeqWait* wait) {
+	uint32_t now;
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	now = __atomic_load_n(seq, __ATOMIC_RELAXED);
+	if ((start & 1) == 0 && now == start) {
+		return SEQ_DONE;
+	}
+	if ((now & 1) == 0 || now != wait->seen) {
+		/* the writer is getting somewhere, the wait starts over */
+		wait->seen = now;
+		wait->spins = 0;
+		wait->since = 0;
+		return SEQ_AGAIN;
+	}
+	if (++wait->spins < SEQ_SPINS) {
+		return SEQ_AGAIN;
+	}
+	if (wait->since == 0) {
+		wait->since = monotonic_ns();
+	} else if (monotonic_ns() - wait->since >= SEQ_STUCK_NS) {
+		return SEQ_STUCK;
+	}
+	sched_yield();
+	return SEQ_AGAIN;
+}
+
+// intended to be private: a reader that gave up on a counter says so (once a
+// second at most) rather than handing out what it copied
+static void report_stuck(const char* what) {
+	log_limited(1, 1, WARNING, " Error: the writer of the %s seems to have died in the middle of an update,"
+	            " they cannot be read", what);
+}
+
+// intended to be private: count and sum the valid points of a block, false if
+// the block cannot be read
+static bool block_sums(void* shmaddr, int layout, uint64_t block, uint64_t capacity, PointSums* sums) {
+	uint64_t idx;
+	uint64_t first = block*POINT_SEQ_BLOCK;
+	uint64_t last = first + POINT_SEQ_BLOCK < capacity ? first + POINT_SEQ_BLOCK : capacity;
+	uint32_t *seq = block_seq(shmaddr, first);
+	uint32_t start;
+	int state;
+	SeqWait wait = {0, 0, 0};
+	Point *points = point_array(shmaddr);
+
+	do {
+		start = read_begin(seq);
+		if (layout == POINT_LAYOUT_SOA) {
+			point_columns_sums_range(point_columns(shmaddr), first, last - first, sums);
+		} else {
+			sums->count = 0;
+			sums->sum_x = 0;
+			sums->sum_y = 0;
+			for (idx = first; idx < last; idx++) {
+				if (points[idx].is_valid == 1) {
+					sums->count += 1;
+					sums->sum_x += points[idx].x;
+					sums->sum_y += points[idx].y;
+				}
+			}
+		}
+	} while ((state = read_retry(seq, start, &wait)) == SEQ_AGAIN);
+	return state == SEQ_DONE;
+}
+
+// intended to be private: count and sum every point, false (with all zeros) if
+// a block cannot be read. The writer also has the count of each block stored.
+static bool rescan(void* shmaddr, int layout, uint64_t capacity, PointSums* sums, bool store_counts) {
+	uint64_t block;
+	PointSums block_total;
+
+	sums->count = 0;
+	sums->sum_x = 0;
+	sums->sum_y = 0;
+	for (block = 0; block < NUM_BLOCKS(capacity); block++) {
+		if (!block_sums(shmaddr, layout, block, capacity, &block_total)) {
+			memset(sums, 0, sizeof(PointSums));
+			report_stuck("points");
+			return false;
+		}
+		if (store_counts) {
+			__atomic_store_n(block_valid(shmaddr, block*POINT_SEQ_BLOCK), block_total.count, __ATOMIC_RELAXED);
+		}
+		sums->count += block_total.count;
+		sums->sum_x += block_total.sum_x;
+		sums->sum_y += block_total.sum_y;
+	}
+	return true;
+}
+
+// intended to be private: Neumaier's variant of Kahan summation, the low order
+// bits lost by each addition are collected in comp
+static void neumaier_add(double* sum, double* comp, double value) {
+	double total = *sum + value;
+
+	if (fabs(*sum) >= fabs(value)) {
+		*comp += (*sum - total) + value;
+	} else {
+		*comp += (value - total) + *sum;
+	}
+	*sum = total;
+}
+
+// intended to be private: the writer brackets every change to the points with
+// stats_begin and stats_end, so that a reader that saw the same (even) stats
+// counter before and after a rescan knows nothing changed in between
+static PointStats* stats_begin(void* shmaddr) {
+	PointStats *stats = &((PointSegment*) shmaddr)->stats;
+	write_begin(&stats->seq);
+	return stats;
+}
+
+// intended to be private
+static void stats_end(PointStats* stats) {
+	write_end(&stats->seq);
+}
+
+// intended to be private
+static void stats_add(PointStats* stats, Point* point, int sign) {
+	if (point->is_valid == 1) {
+		stats->count += sign;
+		neumaier_add(&stats->sum_x, &stats->comp_x, sign*(double) point->x);
+		neumaier_add(&stats->sum_y, &stats->comp_y, sign*(double) point->y);
+	}
+}
+
+// intended to be private
+static void stats_set(PointStats* stats, PointSums* sums) {
+	stats->count = sums->count;
+	stats->sum_x = sums->sum_x;
+	stats->comp_x = 0;
+	stats->sum_y = sums->sum_y;
+	stats->comp_y = 0;
+}
+
+// intended to be private
+static void reset_points(void* shmaddr, int layout) {
+	uint64_t capacity = ((PointSegment*) shmaddr)->capacity;
+
+	if (layout == POINT_LAYOUT_SOA) {
+		point_columns_init(point_columns(shmaddr), capacity);
+	} else {
+		memset(point_array(shmaddr), 0, capacity*sizeof(Point));
+	}
+}
+
+// intended to be private: only meaningful once the header is set up
+static PointGrid* grid_of(void* shmaddr) {
+	return (PointGrid*) ((char*) shmaddr + ((PointSegment*) shmaddr)->grid_offset);
+}
+
+// intended to be private: only meaningful once the header is set up
+static PointDirty* dirty_of(void* shmaddr) {
+	return (PointDirty*) ((char*) shmaddr + ((PointSegment*) shmaddr)->dirty_offset);
+}
+
+// intended to be private: stamps the point as changed by the change being made,
+// which gets the generation after the published one
+static void mark_dirty(void* shmaddr, uint64_t index) {
+	point_dirty_mark(dirty_of(shmaddr), index, ((PointSegment*) shmaddr)->generation + 1);
+}
+
+// intended to be private: hands the points marked since the last call over to
+// the readers (only the writer may call this)
+static void publish_generation(void* shmaddr) {
+	PointSegment *segment = shmaddr;
+	__atomic_store_n(&segment->generation, segment->generation + 1, __ATOMIC_RELEASE);
+}
+
+// intended to be private: only meaningful once the header is set up
+static PointHistory* history_of(void* shmaddr) {
+	return (PointHistory*) ((char*) shmaddr + ((PointSegment*) shmaddr)->history_offset);
+}
+
+// intended to be private: changes are stamped with the same clock as the change ring
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// intended to be private: copies a point out under its block counter, false
+// (with a zeroed point) if the block cannot be read
+static bool read_point(void* shmaddr, int layout, uint64_t index, Point* point) {
+	uint32_t *seq = block_seq(shmaddr, index);
+	uint32_t start;
+	int state;
+	SeqWait wait = {0, 0, 0};
+	Point *entry;
+
+	do {
+		start = read_begin(seq);
+		if (layout == POINT_LAYOUT_SOA) {
+			point->is_valid = point_columns_get(point_columns(shmaddr), index, &point->x, &point->y);
+		} else {
+			entry = &point_array(shmaddr)[index];
+			__atomic_load(&entry->is_valid, &point->is_valid, __ATOMIC_RELAXED);
+			__atomic_load(&entry->x, &point->x, __ATOMIC_RELAXED);
+			__atomic_load(&entry->y, &point->y, __ATOMIC_RELAXED);
+		}
+	} while ((state = read_retry(seq, start, &wait)) == SEQ_AGAIN);
+	if (state == SEQ_STUCK) {
+		memset(point, 0, sizeof(Point));
+		report_stuck("points");
+		return false;
+	}
+	return true;
+}
+
+// intended to be private: puts every valid point into a fresh grid
+static void rebuild_grid(void* shmaddr, int layout, uint64_t capacity, float cell_size) {
+	uint64_t idx;
+	Point point;
+	PointGrid *grid = grid_of(shmaddr);
+
+	point_grid_init(grid, capacity, cell_size);
+	for (idx = 0; idx < capacity; idx++) {
+		read_point(shmaddr, layout, idx, &point);
+		if (point.is_valid == 1) {
+			point_grid_insert(grid, idx, point.x, point.y);
+		}
+	}
+}
+
+bool point_segment_init(void* shmaddr, uint64_t capacity, int layout, float cell_size,
+                        uint32_t history_depth) {
+	PointSegment *segment = shmaddr;
+	uint64_t block;
+	bool fresh = false;
+	PointSums sums;
+
+	if (capacity == 0 || capacity > POINT_MAX_CAPACITY) {
+		log_event(WARNING, " Error: invalid point capacity (%" PRIu64 ", at most %u)", capacity, POINT_MAX_CAPACITY);
+		return false;
+	}
+	if (history_depth > POINT_HISTORY_MAX_DEPTH) {
+		log_event(WARNING, " Error: invalid history depth (%u, at most %u)", history_depth, POINT_HISTORY_MAX_DEPTH);
+		return false;
+	}
+
+	if (point_segment_capacity(shmaddr) != capacity || point_segment_layout(shmaddr) != layout) {
+		/* the points of the old layout (or capacity) mean nothing in the new one */
+		log_event(INFO, " Setting up %s point layout for %" PRIu64 " points",
+		          layout == POINT_LAYOUT_SOA ? "SoA" : "AoS", capacity);
+
+		/* readers treat the segment as empty until the magic is published again */
+		__atomic_store_n(&segment->magic, 0, __ATOMIC_RELEASE);
+		segment->elem_size = sizeof(Point);
+		segment->capacity = capacity;
+		segment->points_offset = points_offset_for(capacity);
+		segment->seqs_offset = seqs_offset_for(capacity);
+		segment->grid_offset = grid_offset_for(capacity);
+		segment->dirty_offset = dirty_offset_for(capacity);
+		segment->history_offset = history_offset_for(capacity);
+		__atomic_store_n(&segment->layout, layout, __ATOMIC_RELEASE);
+		memset(block_seq(shmaddr, 0), 0, NUM_BLOCKS(capacity)*sizeof(BlockSeq));
+		reset_points(shmaddr, layout);
+		/* whatever a reader saw before, every point is new to it */
+		point_dirty_init(dirty_of(shmaddr), capacity, segment->generation + 1);
+		fresh = true;
+	} else {
+		/* a previous writer may have died in the middle of an update */
+		for (block = 0; block < NUM_BLOCKS(capacity); block++) {
+			write_settle(block_seq(shmaddr, block*POINT_SEQ_BLOCK));
+		}
+	}
+
+	/* whatever the previous writer left behind, the aggregates start out exact */
+	write_settle(&segment->stats.seq);
+	rescan(shmaddr, layout, capacity, &sums, true);
+	stats_set(stats_begin(shmaddr), &sums);
+	stats_end(&segment->stats);
+
+	/* the grid is cheap enough to rebuild, which also picks up a new cell size */
+	rebuild_grid(shmaddr, layout, capacity, cell_size);
+
+	/* an index of the same capacity (and the ring) are kept as is, so ids
+	survive a restart of the writer. So is a history of the same depth. */
+	point_index_init(point_segment_index(shmaddr), capacity);
+	change_ring_init(point_segment_changes(shmaddr), POINT_CHANGE_RING_SIZE);
+	point_history_init(history_of(shmaddr), capacity, history_depth);
+	segment->size = point_segment_size(capacity, history_depth);
+
+	__atomic_store_n(&segment->magic, POINT_SEGMENT_MAGIC, __ATOMIC_RELEASE);
+	if (fresh) {
+		publish_generation(shmaddr);
+	}
+	return true;
+}
+
+bool point_segment_stats(void* shmaddr, PointSums* sums) {
+	PointStats *stats = &((PointSegment*) shmaddr)->stats;
+	double sum_x, comp_x, sum_y, comp_y;
+	uint32_t start;
+	int state;
+	SeqWait wait = {0, 0, 0};
+
+	if (point_segment_capacity(shmaddr) == 0) {
+		memset(sums, 0, sizeof(PointSums));
+		return false;
+	}
+
+	do {
+		start = read_begin(&stats->seq);
+		sums->count = __atomic_load_n(&stats->count, __ATOMIC_RELAXED);
+		__atomic_load(&stats->sum_x, &sum_x, __ATOMIC_RELAXED);
+		__atomic_load(&stats->comp_x, &comp_x, __ATOMIC_RELAXED);
+		__atomic_load(&stats->sum_y, &sum_y, __ATOMIC_RELAXED);
+		__atomic_load(&stats->comp_y, &comp_y, __ATOMIC_RELAXED);
+	} while ((state = read_retry(&stats->seq, start, &wait)) == SEQ_AGAIN);
+	if (state == SEQ_STUCK) {
+		memset(sums, 0, sizeof(PointSums));
+		report_stuck("point stats");
+		return false;
+	}
+
+	sums->sum_x = sum_x + comp_x;
+	sums->sum_y = sum_y + comp_y;
+	return true;
+}
+
+bool point_segment_rescan(void* shmaddr, PointSums* sums) {
+	return rescan(shmaddr, point_segment_layout(shmaddr), point_segment_capacity(shmaddr), sums, false);
+}
+
+// intended to be private
+static bool sums_agree(double running, double scanned) {
+	return fabs(running - scanned) <= STATS_TOLERANCE*(fabs(scanned) + 1);
+}
+
+int verify_point_stats(void* shmaddr) {
+	uint32_t *seq = &((PointSegment*) shmaddr)->stats.seq;
+	uint32_t start = read_begin(seq);
+	PointSums running, scanned;
+
+	if (!point_segment_stats(shmaddr, &running) || !point_segment_rescan(shmaddr, &scanned)) {
+		log_event(WARNING, " Point stats check skipped, the points cannot be read");
+		return POINT_STATS_STUCK;
+	}
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if ((start & 1) || __atomic_load_n(seq, __ATOMIC_RELAXED) != start) {
+		log_event(INFO, " Point stats check skipped, the points changed during the rescan");
+		return POINT_STATS_BUSY;
+	}
+
+	if (running.count != scanned.count
+	    || !sums_agree(running.sum_x, scanned.sum_x)
+	    || !sums_agree(running.sum_y, scanned.sum_y)) {
+		log_event(WARNING, " ● PointStats drift: running(count=%" PRIu64 ", sum_x=%.6f, sum_y=%.6f) rescan(count=%" PRIu64 ", sum_x=%.6f, sum_y=%.6f)",
+		          running.count,
+		          running.sum_x,
+		          running.sum_y,
+		          scanned.count,
+		          scanned.sum_x,
+		          scanned.sum_y);
+		return POINT_STATS_DRIFT;
+	}
+
+	log_event(INFO, " Point stats verified against a rescan (count=%" PRIu64 ")", running.count);
+	return POINT_STATS_OK;
+}
+
+// intended to be private: takes a consistent copy of a block under its counter,
+// in the PointColumns layout whatever the layout of the segment, and sets
+// count to the number of points in the block. Returns false if the block
+// cannot be read.
+static bool copy_block(void* shmaddr, int layout, uint64_t block, uint64_t capacity,
+                       uint64_t* bitmap, float* x, float* y, uint64_t* count) {
+	uint64_t first = block*POINT_SEQ_BLOCK;
+	uint32_t *seq = block_seq(shmaddr, first);
+	uint32_t start;
+	int state;
+	SeqWait wait = {0, 0, 0};
+	Point *points = point_array(shmaddr) + first;
+
+	*count = first + POINT_SEQ_BLOCK < capacity ? POINT_SEQ_BLOCK : capacity - first;
+	do {
+		start = read_begin(seq);
+		if (layout == POINT_LAYOUT_SOA) {
+			point_columns_copy(point_columns(shmaddr), first, *count, bitmap, x, y);
+		} else {
+			point_columns_gather(&points->is_valid, &points->x, &points->y, sizeof(Point), *count, bitmap, x, y);
+		}
+	} while ((state = read_retry(seq, start, &wait)) == SEQ_AGAIN);
+	return state == SEQ_DONE;
+}
+
+/* the share of the blocks one thread summarizes */
+typedef struct SummaryWork {
+	void* shmaddr;
+	int layout;
+	uint64_t capacity;
+	uint64_t first_block;
+	uint64_t end_block;
+	PointSummary part;
+	/* a block could not be read, the summary is void */
+	bool stuck;
+} SummaryWork;
+
+// intended to be private
+static void* summarize_blocks(void* arg) {
+	SummaryWork *work = arg;
+	uint64_t block, count;
+	uint64_t bitmap[POINT_SEQ_BLOCK/64];
+	float x[POINT_SEQ_BLOCK] __attribute__((aligned(64)));
+	float y[POINT_SEQ_BLOCK] __attribute__((aligned(64)));
+
+	for (block = work->first_block; block < work->end_block && !work->stuck; block++) {
+		if (copy_block(work->shmaddr, work->layout, block, work->capacity, bitmap, x, y, &count)) {
+			point_summary_add(&work->part, bitmap, x, y, count);
+		} else {
+			work->stuck = true;
+		}
+	}
+	return NULL;
+}
+
+// intended to be private: one thread per SUMMARY_THREAD_POINTS points, up to
+// the number asked for (or the number of processors)
+static int summary_threads(uint64_t capacity, int threads) {
+	uint64_t useful = (capacity + SUMMARY_THREAD_POINTS - 1) / SUMMARY_THREAD_POINTS;
+
+	if (threads <= 0) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	threads = threads < SUMMARY_MAX_THREADS ? threads : SUMMARY_MAX_THREADS;
+	threads = (uint64_t) threads < useful ? threads : (int) useful;
+	return threads > 0 ? threads : 1;
+}
+
+bool point_segment_summary(void* shmaddr, int what, int threads, PointSummary* summary) {
+	int idx;
+	bool stuck = false;
+	uint64_t blocks, bins;
+	uint64_t capacity = point_segment_capacity(shmaddr);
+	int layout = point_segment_layout(shmaddr);
+	pthread_t workers[SUMMARY_MAX_THREADS];
+	bool started[SUMMARY_MAX_THREADS];
+	SummaryWork work[SUMMARY_MAX_THREADS];
+	PointSums sums;
+
+	/* the running sums put the shift next to the mean, which keeps the
+	variance accurate however far the points are from the origin */
+	stuck = !point_segment_stats(shmaddr, &sums) && capacity != 0;
+	point_summary_init(summary, what,
+	                   sums.count ? sums.sum_x / sums.count : 0,
+	                   sums.count ? sums.sum_y / sums.count : 0);
+	if (capacity == 0 || stuck) {
+		point_summary_finish(summary);
+		return false;
+	}
+
+	threads = summary_threads(capacity, threads);
+	blocks = NUM_BLOCKS(capacity);
+	bins = (uint64_t) summary->bins_x*summary->bins_y;
+	for (idx = 0; idx < threads; idx++) {
+		work[idx].shmaddr = shmaddr;
+		work[idx].layout = layout;
+		work[idx].capacity = capacity;
+		work[idx].first_block = blocks*idx / threads;
+		work[idx].end_block = blocks*(idx + 1) / threads;
+		work[idx].stuck = false;
+		point_summary_split(&work[idx].part, summary,
+		                    (summary->what & POINT_SUMMARY_HISTOGRAM) ? malloc(bins*sizeof(uint64_t)) : NULL);
+		if ((summary->what & POINT_SUMMARY_HISTOGRAM) && work[idx].part.bins == NULL) {
+			log_event(WARNING, " Error: no memory for the histogram of a summary thread");
+			work[idx].part.what &= ~POINT_SUMMARY_HISTOGRAM;
+			summary->what &= ~POINT_SUMMARY_HISTOGRAM;
+		}
+	}
+
+	/* the calling thread takes the first share, a share that cannot get a
+	thread of its own is done by the calling thread as well */
+	for (idx = 1; idx < threads; idx++) {
+		started[idx] = pthread_create(&workers[idx], NULL, summarize_blocks, &work[idx]) == 0;
+	}
+	summarize_blocks(&work[0]);
+	for (idx = 0; idx < threads; idx++) {
+		if (idx > 0 && started[idx]) {
+			pthread_join(workers[idx], NULL);
+		} else if (idx > 0) {
+			summarize_blocks(&work[idx]);
+		}
+		point_summary_merge(summary, &work[idx].part);
+		free(work[idx].part.bins);
+		stuck = stuck || work[idx].stuck;
+	}
+
+	if (stuck) {
+		/* what was summarized of the other blocks is no summary of the points */
+		report_stuck("points");
+		point_summary_init(summary, what, 0, 0);
+	}
+	point_summary_finish(summary);
+	return !stuck;
+}
+
+PointGrid* point_segment_grid(void* shmaddr) {
+	if (point_segment_capacity(shmaddr) == 0) {
+		return NULL;
+	}
+	return grid_of(shmaddr);
+}
+
+PointHistory* point_segment_history(void* shmaddr) {
+	if (point_segment_capacity(shmaddr) == 0) {
+		return NULL;
+	}
+	return history_of(shmaddr);
+}
+
+uint64_t point_segment_generation(void* shmaddr) {
+	return __atomic_load_n(&((PointSegment*) shmaddr)->generation, __ATOMIC_ACQUIRE);
+}
+
+int point_segment_changed(void* shmaddr, uint64_t since, uint64_t* position, int* indices, int max) {
+	if (point_segment_capacity(shmaddr) == 0) {
+		return 0;
+	}
+	return point_dirty_scan(dirty_of(shmaddr), since, position, indices, max);
+}
+
+bool get_point(void* shmaddr, int index, Point* point) {
+	if (index < 0 || (uint64_t) index >= point_segment_capacity(shmaddr)) {
+		memset(point, 0, sizeof(Point));
+		return false;
+	}
+	return read_point(shmaddr, point_segment_layout(shmaddr), index, point) && point->is_valid == 1;
+}
+
+void show_change(ChangeRecord* change) {
+	struct tm local;
+	time_t secs = change->timestamp_ns / 1000000000ull;
+	int ms = (change->timestamp_ns / 1000000ull) % 1000;
+
+	localtime_r(&secs, &local);
+	log_event(WARNING, " ● Change(seq=%" PRIu64 ", at=%02d:%02d:%02d.%03d, idx=%d, op=%s, x=%2.3f, y=%2.3f)",
+						change->seq,
+						local.tm_hour,
+						local.tm_min,
+						local.tm_sec,
+						ms,
+						change->index,
+						CHANGE_OP_STRING[change->op >= CHANGE_INSTALL && change->op <= CHANGE_CLEAR ? change->op : 0],
+						change->x,
+						change->y);
+}
+
+// intended to be private: appends "Point(is_valid=%d, x=%2.3f, y=%2.3f)"
+static void append_point(LogLine* line, Point* point) {
+	log_append_string(line, "Point(is_valid=");
+	log_append_int(line, point->is_valid);
+	log_append_string(line, ", x=");
+	log_append_fixed(line, point->x, 2, 3);
+	log_append_string(line, ", y=");
+	log_append_fixed(line, point->y, 2, 3);
+	log_append_string(line, ")");
+}
+
+// intended to be private: logs "<branch>Idx:%" PRIu64 " = Point(...)", the
+// lines the points are listed with. They are built with the log_append helpers
+// of log_mgr, which write the same bytes as log_event would without formatting
+// the coordinates through vsnprintf.
+static void show_point_line(const char* branch, uint64_t idx, Point* point) {
+	LogLine line;
+
+	if (!log_enabled(WARNING)) {
+		return;
+	}
+	log_line_start(&line);
+	log_append_string(&line, branch);
+	log_append_uint(&line, idx);
+	log_append_string(&line, " = ");
+	append_point(&line, point);
+	log_line(WARNING, &line);
+}
+
 void show_task(void *task) {
-	log_event(WARNING, " ● Task(idx=%d, delay=%d, Point(is_valid=%d, x=%2.3f, y=%2.3f))",
-						((PointTask *)task)->index,
-						((PointTask *)task)->delay,
-						((PointTask *)task)->point.is_valid,
-						((PointTask *)task)->point.x,
-						((PointTask *)task)->point.y);
+	LogLine line;
+
+	/* " ● Task(idx=%d, delay=%d, Point(is_valid=%d, x=%2.3f, y=%2.3f))" */
+	if (!log_enabled(WARNING)) {
+		return;
+	}
+	log_line_start(&line);
+	log_append_string(&line, " ● Task(idx=");
+	log_append_int(&line, ((PointTask *)task)->index);
+	log_append_string(&line, ", delay=");
+	log_append_int(&line, ((PointTask *)task)->delay);
+	log_append_string(&line, ", ");
+	append_point(&line, &((PointTask *)task)->point);
+	log_append_string(&line, ")");
+	log_line(WARNING, &line);
+}
+
+// intended to be private
+static void show_point_stats(PointSums* sums) {
+	LogLine line;
+
+	if (sums->count > 0) {
+		/* " ● PointStats(valid_count=%" PRIu64 ", avg_x=%2.3f, avg_y=%2.3f)" */
+		if (!log_enabled(WARNING)) {
+			return;
+		}
+		log_line_start(&line);
+		log_append_string(&line, " ● PointStats(valid_count=");
+		log_append_uint(&line, sums->count);
+		log_append_string(&line, ", avg_x=");
+		log_append_fixed(&line, sums->sum_x/sums->count, 2, 3);
+		log_append_string(&line, ", avg_y=");
+		log_append_fixed(&line, sums->sum_y/sums->count, 2, 3);
+		log_append_string(&line, ")");
+		log_line(WARNING, &line);
+	} else {
+		log_event(WARNING, " ● PointStats(valid_count=0, avg_x=0, avg_y=0)");
+	}
 }
 
 void show_points(void* shmaddr, int max) {
@@ -30,67 +832,332 @@ void show_points(void* shmaddr, int max) {
 	-   The average y value over the active array elements.
 	*/
 
-	int idx, valid_points = 0;
-	float sum_x = 0, sum_y = 0;
+	uint64_t idx, block, count, bits, valid_points, listed = 0, to_list;
+	uint64_t capacity = point_segment_capacity(shmaddr);
+	int layout = point_segment_layout(shmaddr);
+	uint64_t bitmap[POINT_SEQ_BLOCK/64];
+	float x[POINT_SEQ_BLOCK] __attribute__((aligned(64)));
+	float y[POINT_SEQ_BLOCK] __attribute__((aligned(64)));
+	Point entry;
+	PointSums sums;
 
-	/* collect data and determine stats */
-	for (idx=0; idx < max; idx++){
-		Point *point = &((Point*) shmaddr)[idx];
-		if (point->is_valid == 1){
-			valid_points += 1;
-			sum_x += point->x;
-			sum_y += point->y;
-		}
-	}
+	/* the writer keeps the stats up to date, there is nothing to collect */
+	point_segment_stats(shmaddr, &sums);
+	valid_points = sums.count;
 
 	/* display stats */
+	show_point_stats(&sums);
 	if (valid_points > 0) {
-		log_event(WARNING, " ● PointStats(valid_count=%d, avg_x=%2.3f, avg_y=%2.3f)",
-												valid_points,
-												(sum_x/valid_points),
-												(sum_y/valid_points));
-
-		/* print each point out as well... i chose not to use iterate_list to make
-		formatting of the list to look nicer */
-		for (idx=0; idx < max; idx++){
-			Point *point = &((Point*) shmaddr)[idx];
-			if (point->is_valid == 1){
-				valid_points -= 1;
-				if (valid_points == 0) {
-					log_event(WARNING, "   └── Idx:%d = Point(is_valid=%d, x=%2.3f, y=%2.3f)",
-															idx,
-															point->is_valid,
-															point->x,
-															point->y);
-				} else {
-					log_event(WARNING, "   ├── Idx:%d = Point(is_valid=%d, x=%2.3f, y=%2.3f)",
-															idx,
-															point->is_valid,
-															point->x,
-															point->y);
+		/* print the first few points out as well... i chose not to use iterate_list
+		to make formatting of the list to look nicer */
+		to_list = valid_points < (uint64_t) max ? valid_points : (uint64_t) max;
+		/* a block at a time, skipping the ones without any valid point, so a
+		sparse segment is not read through to find a few points */
+		for (block = 0; block < NUM_BLOCKS(capacity) && listed < to_list; block++) {
+			if (__atomic_load_n(block_valid(shmaddr, block*POINT_SEQ_BLOCK), __ATOMIC_RELAXED) == 0) {
+				continue;
+			}
+			if (!copy_block(shmaddr, layout, block, capacity, bitmap, x, y, &count)) {
+				report_stuck("points");
+				continue;
+			}
+			for (idx = 0; idx < count && listed < to_list; idx += 64) {
+				bits = bitmap[idx / 64];
+				if (count - idx < 64) {
+					bits &= (1ull << (count - idx)) - 1;
+				}
+				for (; bits != 0 && listed < to_list; bits &= bits - 1) {
+					entry.is_valid = 1;
+					entry.x = x[idx + __builtin_ctzll(bits)];
+					entry.y = y[idx + __builtin_ctzll(bits)];
+					listed += 1;
+					show_point_line(listed == valid_points ? "   └── Idx:" : "   ├── Idx:",
+					                block*POINT_SEQ_BLOCK + idx + __builtin_ctzll(bits), &entry);
 				}
 			}
 		}
+		if (listed < valid_points) {
+			log_event(WARNING, "   └── (%" PRIu64 " more)", valid_points - listed);
+		}
+	}
+}
+
+uint64_t show_changed_points(void* shmaddr, uint64_t since, int max) {
+	int idx, count;
+	int indices[CHANGED_BATCH];
+	uint64_t changed = 0, position = 0, previous = 0;
+	uint64_t generation = point_segment_generation(shmaddr);
+	Point entry;
+	PointSums sums;
+
+	if (point_segment_capacity(shmaddr) == 0) {
+		/* nothing is set up yet, so there is nothing to have seen either */
+		return since;
+	}
+	if (since > generation) {
+		/* the segment was set up from scratch since */
+		since = 0;
+	}
+
+	point_segment_stats(shmaddr, &sums);
+	show_point_stats(&sums);
+
+	/* each point is listed once the next one is found, so the last one gets
+	the closing branch */
+	do {
+		count = point_segment_changed(shmaddr, since, &position, indices, CHANGED_BATCH);
+		for (idx = 0; idx < count; idx++, changed++) {
+			if (changed > 0 && changed <= (uint64_t) max) {
+				get_point(shmaddr, previous, &entry);
+				show_point_line("   ├── Changed Idx:", previous, &entry);
+			}
+			previous = indices[idx];
+		}
+	} while (count == CHANGED_BATCH);
+
+	if (changed > 0 && changed <= (uint64_t) max) {
+		get_point(shmaddr, previous, &entry);
+		show_point_line("   └── Changed Idx:", previous, &entry);
+	} else if (changed > 0) {
+		log_event(WARNING, "   └── (%" PRIu64 " more changed)", changed - max);
+	}
+	return generation;
+}
+
+// intended to be private: the point write itself, under the block counter,
+// was_valid tells whether the point being replaced was valid
+static void store_point(void* addr, int layout, int index, Point* point, bool was_valid) {
+	Point *entry = &point_array(addr)[index];
+	uint32_t *seq = block_seq(addr, index);
+
+	write_begin(seq);
+	if (layout == POINT_LAYOUT_SOA) {
+		point_columns_set(point_columns(addr), index, point->x, point->y);
+		if (point->is_valid != 1) {
+			point_columns_invalidate(point_columns(addr), index);
+		}
+	} else {
+		__atomic_store(&entry->is_valid, &point->is_valid, __ATOMIC_RELAXED);
+		__atomic_store(&entry->x, &point->x, __ATOMIC_RELAXED);
+		__atomic_store(&entry->y, &point->y, __ATOMIC_RELAXED);
+	}
+	count_valid(addr, index, was_valid, point->is_valid == 1);
+	write_end(seq);
+	mark_dirty(addr, index);
+}
+
+// intended to be private
+static void drop_point(void* addr, int layout, int index, bool was_valid) {
+	uint32_t *seq = block_seq(addr, index);
 
+	write_begin(seq);
+	if (layout == POINT_LAYOUT_SOA) {
+		point_columns_invalidate(point_columns(addr), index);
 	} else {
-		log_event(WARNING, " ● PointStats(valid_count=0, avg_x=0, avg_y=0)");
+		__atomic_store_n(&point_array(addr)[index].is_valid, 0, __ATOMIC_RELAXED);
+	}
+	count_valid(addr, index, was_valid, false);
+	write_end(seq);
+	mark_dirty(addr, index);
+}
+
+// intended to be private: keeps the grid in step with a newly written point
+static void place_point(void* addr, int index, Point* point) {
+	if (point->is_valid == 1) {
+		point_grid_insert(grid_of(addr), index, point->x, point->y);
+	} else {
+		point_grid_remove(grid_of(addr), index);
 	}
 }
 
+// intended to be private: folds the change collected by a batch into the
+// running aggregates with a single update of each
+static void stats_merge(PointStats* stats, PointStats* delta) {
+	stats->count += delta->count;
+	neumaier_add(&stats->sum_x, &stats->comp_x, delta->sum_x + delta->comp_x);
+	neumaier_add(&stats->sum_y, &stats->comp_y, delta->sum_y + delta->comp_y);
+}
+
+// intended to be private
+static bool valid_indices(void* addr, int* indices, int count) {
+	int idx;
+	uint64_t capacity = point_segment_capacity(addr);
+
+	for (idx = 0; idx < count; idx++) {
+		if (indices[idx] < 0 || (uint64_t) indices[idx] >= capacity) {
+			log_event(FATAL, " Error: invalid point index (%d) in batch entry %d.", indices[idx], idx);
+			return false;
+		}
+	}
+	return true;
+}
+
 void install_point(void* addr, int index, Point* point) {
-	log_event(INFO, " Installing new point (index:%d)", index);
-	if (index < 0 || index >= MAX_NUM_POINTS) {
+	log_event(DEBUG, " Installing new point (index:%d)", index);
+	if (index < 0 || (uint64_t) index >= point_segment_capacity(addr)) {
 		log_event(FATAL, " Error: invalid point index (%d). Cancelling point installation.", index);
 	} else {
-	  memcpy(&(((Point*) addr)[index]), point, sizeof(Point));
+	  Point old;
+	  PointStats *stats = stats_begin(addr);
+
+	  /* the point being replaced leaves the aggregates */
+	  get_point(addr, index, &old);
+	  stats_add(stats, &old, -1);
+	  store_point(addr, point_segment_layout(addr), index, point, old.is_valid == 1);
+	  stats_add(stats, point, 1);
+	  place_point(addr, index, point);
+
+	  stats_end(stats);
+	  publish_generation(addr);
+	  change_ring_append(point_segment_changes(addr), index, CHANGE_INSTALL, point->x, point->y);
+	  point_history_record(history_of(addr), index, now_ns(), point->is_valid == 1, point->x, point->y);
 	}
 }
 
 void invalidate_point(void* addr, int index) {
-	log_event(INFO, " Invalidating existing point (index:%d)", index);
-	if (index < 0 || index >= MAX_NUM_POINTS) {
+	log_event(DEBUG, " Invalidating existing point (index:%d)", index);
+	if (index < 0 || (uint64_t) index >= point_segment_capacity(addr)) {
 		log_event(FATAL, " Error: invalid point index (%d). Cancelling point invalidation.", index);
 	} else {
-	  (((Point*) addr)[index]).is_valid = 0;
+	  Point old;
+	  PointStats *stats = stats_begin(addr);
+
+	  get_point(addr, index, &old);
+	  stats_add(stats, &old, -1);
+	  drop_point(addr, point_segment_layout(addr), index, old.is_valid == 1);
+	  point_grid_remove(grid_of(addr), index);
+
+	  stats_end(stats);
+	  publish_generation(addr);
+	  change_ring_append(point_segment_changes(addr), index, CHANGE_INVALIDATE, old.x, old.y);
+	  point_history_record(history_of(addr), index, now_ns(), false, 0, 0);
+	}
+}
+
+bool install_points_batch(void* addr, int* indices, Point* points, int count) {
+	int idx, layout = point_segment_layout(addr);
+	uint64_t now;
+	Point old;
+	PointStats delta = {0}, *stats;
+
+	log_event(INFO, " Installing %d new points", count);
+	if (!valid_indices(addr, indices, count)) {
+		log_event(FATAL, " Error: cancelling installation of the whole batch.");
+		return false;
+	}
+
+	stats = stats_begin(addr);
+	for (idx = 0; idx < count; idx++) {
+		get_point(addr, indices[idx], &old);
+		stats_add(&delta, &old, -1);
+		store_point(addr, layout, indices[idx], &points[idx], old.is_valid == 1);
+		stats_add(&delta, &points[idx], 1);
+		place_point(addr, indices[idx], &points[idx]);
+	}
+	stats_merge(stats, &delta);
+	stats_end(stats);
+	publish_generation(addr);
+
+	now = now_ns();
+	for (idx = 0; idx < count; idx++) {
+		change_ring_append(point_segment_changes(addr), indices[idx], CHANGE_INSTALL, points[idx].x, points[idx].y);
+		point_history_record(history_of(addr), indices[idx], now, points[idx].is_valid == 1,
+		                     points[idx].x, points[idx].y);
+	}
+	return true;
+}
+
+bool invalidate_points_batch(void* addr, int* indices, int count) {
+	int idx, layout = point_segment_layout(addr);
+	uint64_t now;
+	Point old;
+	PointStats delta = {0}, *stats;
+
+	log_event(INFO, " Invalidating %d existing points", count);
+	if (!valid_indices(addr, indices, count)) {
+		log_event(FATAL, " Error: cancelling invalidation of the whole batch.");
+		return false;
+	}
+
+	stats = stats_begin(addr);
+	for (idx = 0; idx < count; idx++) {
+		get_point(addr, indices[idx], &old);
+		stats_add(&delta, &old, -1);
+		drop_point(addr, layout, indices[idx], old.is_valid == 1);
+		point_grid_remove(grid_of(addr), indices[idx]);
+	}
+	stats_merge(stats, &delta);
+	stats_end(stats);
+	publish_generation(addr);
+
+	/* x and y are left in place by an invalidation, so they can be read back */
+	now = now_ns();
+	for (idx = 0; idx < count; idx++) {
+		get_point(addr, indices[idx], &old);
+		change_ring_append(point_segment_changes(addr), indices[idx], CHANGE_INVALIDATE, old.x, old.y);
+		point_history_record(history_of(addr), indices[idx], now, false, 0, 0);
+	}
+	return true;
+}
+
+void clear_points(void* addr) {
+	int idx, count, indices[CHANGED_BATCH];
+	uint64_t block, word, bits, now, position = 0, capacity = point_segment_capacity(addr);
+	uint64_t generation = ((PointSegment*) addr)->generation;
+	uint64_t bitmap[POINT_SEQ_BLOCK/64], points;
+	float x[POINT_SEQ_BLOCK] __attribute__((aligned(64)));
+	float y[POINT_SEQ_BLOCK] __attribute__((aligned(64)));
+	PointSums none = {0, 0, 0};
+	PointStats *stats;
+
+	log_event(INFO, " Clearing all points");
+	if (capacity == 0) {
+		return;
+	}
+
+	/* only the points that were valid are worth telling readers about, the
+	blocks without any are skipped */
+	for (block = 0; block < NUM_BLOCKS(capacity); block++) {
+		if (*block_valid(addr, block*POINT_SEQ_BLOCK) == 0) {
+			continue;
+		}
+		copy_block(addr, point_segment_layout(addr), block, capacity, bitmap, x, y, &points);
+		for (word = 0; word*64 < points; word++) {
+			bits = bitmap[word];
+			if (points - word*64 < 64) {
+				bits &= (1ull << (points - word*64)) - 1;
+			}
+			for (; bits != 0; bits &= bits - 1) {
+				mark_dirty(addr, block*POINT_SEQ_BLOCK + word*64 + __builtin_ctzll(bits));
+			}
+		}
+	}
+
+	/* every block is being rewritten */
+	stats = stats_begin(addr);
+	for (block = 0; block < NUM_BLOCKS(capacity); block++) {
+		write_begin(block_seq(addr, block*POINT_SEQ_BLOCK));
+	}
+	reset_points(addr, point_segment_layout(addr));
+	for (block = 0; block < NUM_BLOCKS(capacity); block++) {
+		__atomic_store_n(block_valid(addr, block*POINT_SEQ_BLOCK), 0, __ATOMIC_RELAXED);
+		write_end(block_seq(addr, block*POINT_SEQ_BLOCK));
+	}
+	point_grid_clear(grid_of(addr));
+	stats_set(stats, &none);
+	stats_end(stats);
+	publish_generation(addr);
+	change_ring_append(point_segment_changes(addr), -1, CHANGE_CLEAR, 0, 0);
+
+	/* the history records the end of the points that were still valid, which
+	are the ones stamped with the clear */
+	if (point_history_depth(history_of(addr)) != 0) {
+		now = now_ns();
+		do {
+			count = point_dirty_scan(dirty_of(addr), generation, &position, indices, CHANGED_BATCH);
+			for (idx = 0; idx < count; idx++) {
+				point_history_record(history_of(addr), indices[idx], now, false, 0, 0);
+			}
+		} while (position < capacity);
 	}
 }
@@ -0,0 +1,287 @@
+/*
+ * Library: store - a generic set of storage data structures
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+#include "point_columns.h"
+
+/* the arrays are padded to whole bitmap words (64 points), so the kernels can
+always read a full word worth of x and y values */
+#define WORD_POINTS   64
+#define CACHE_LINE    64
+
+typedef void (*SumsKernel)(const uint64_t*, const float*, const float*, uint64_t, PointSums*);
+
+static SumsKernel Kernel = NULL;
+static int KernelId = POINT_KERNEL_SCALAR;
+static const char *KERNEL_STRING[] = {"scalar", "sse2", "avx2"};
+
+
+// intended to be private
+static uint64_t padded_points(uint64_t capacity) {
+	return (capacity + WORD_POINTS - 1) & ~(uint64_t) (WORD_POINTS - 1);
+}
+
+// intended to be private: the bitmap is a multiple of 8 bytes and follows a
+// one cache line header, the x values start on the next cache line
+static uint64_t x_offset_for(uint64_t capacity) {
+	return (CACHE_LINE + padded_points(capacity)/8 + CACHE_LINE - 1) & ~(uint64_t) (CACHE_LINE - 1);
+}
+
+// intended to be private
+static uint64_t* bitmap_of(PointColumns* columns) {
+	return (uint64_t*) ((char*) columns + columns->bitmap_offset);
+}
+
+// intended to be private
+static float* x_of(PointColumns* columns) {
+	return (float*) ((char*) columns + columns->x_offset);
+}
+
+// intended to be private
+static float* y_of(PointColumns* columns) {
+	return (float*) ((char*) columns + columns->y_offset);
+}
+
+// intended to be private: the valid bits of word w, limited to the first max points
+static uint64_t word_bits(const uint64_t* bitmap, uint64_t w, uint64_t max) {
+	uint64_t bits = __atomic_load_n(&bitmap[w], __ATOMIC_ACQUIRE);
+	uint64_t left = max - w*WORD_POINTS;
+	if (left < WORD_POINTS) {
+		bits &= (1ull << left) - 1;
+	}
+	return bits;
+}
+
+static void sums_scalar(const uint64_t* bitmap, const float* x, const float* y, uint64_t max, PointSums* sums) {
+	uint64_t w, bits, idx;
+	uint64_t words = (max + WORD_POINTS - 1) / WORD_POINTS;
+
+	for (w = 0; w < words; w++) {
+		bits = word_bits(bitmap, w, max);
+		sums->count += __builtin_popcountll(bits);
+		while (bits != 0) {
+			idx = w*WORD_POINTS + __builtin_ctzll(bits);
+			sums->sum_x += x[idx];
+			sums->sum_y += y[idx];
+			bits &= bits - 1;
+		}
+	}
+}
+
+#ifdef HAVE_X86_KERNELS
+/* SSE2 is always there on x86-64, the attribute is for 32-bit x86 builds */
+__attribute__((target("sse2")))
+static void sums_sse2(const uint64_t* bitmap, const float* x, const float* y, uint64_t max, PointSums* sums) {
+	int group;
+	uint64_t w, bits, base;
+	uint64_t words = (max + WORD_POINTS - 1) / WORD_POINTS;
+	const __m128i lanes = _mm_set_epi32(8, 4, 2, 1);
+	__m128d acc_x = _mm_setzero_pd(), acc_y = _mm_setzero_pd();
+	__m128i nibble;
+	__m128 mask, xs, ys;
+	double out[2];
+
+	for (w = 0; w < words; w++) {
+		bits = word_bits(bitmap, w, max);
+		if (bits == 0) {
+			continue;
+		}
+		sums->count += __builtin_popcountll(bits);
+		base = w*WORD_POINTS;
+		for (group = 0; group < WORD_POINTS/4; group++, bits >>= 4) {
+			if ((bits & 0xf) == 0) {
+				continue;
+			}
+			/* expand the 4 valid bits into 4 all-ones/all-zeros lanes */
+			nibble = _mm_and_si128(_mm_set1_epi32((int) (bits & 0xf)), lanes);
+			mask = _mm_castsi128_ps(_mm_cmpeq_epi32(nibble, lanes));
+			xs = _mm_and_ps(_mm_load_ps(x + base + group*4), mask);
+			ys = _mm_and_ps(_mm_load_ps(y + base + group*4), mask);
+			acc_x = _mm_add_pd(acc_x, _mm_add_pd(_mm_cvtps_pd(xs), _mm_cvtps_pd(_mm_movehl_ps(xs, xs))));
+			acc_y = _mm_add_pd(acc_y, _mm_add_pd(_mm_cvtps_pd(ys), _mm_cvtps_pd(_mm_movehl_ps(ys, ys))));
+		}
+	}
+
+	_mm_storeu_pd(out, acc_x);
+	sums->sum_x += out[0] + out[1];
+	_mm_storeu_pd(out, acc_y);
+	sums->sum_y += out[0] + out[1];
+}
+
+__attribute__((target("avx2")))
+static void sums_avx2(const uint64_t* bitmap, const float* x, const float* y, uint64_t max, PointSums* sums) {
+	int group;
+	uint64_t w, bits, base;
+	uint64_t words = (max + WORD_POINTS - 1) / WORD_POINTS;
+	const __m256i lanes = _mm256_set_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+	__m256d acc_x = _mm256_setzero_pd(), acc_y = _mm256_setzero_pd();
+	__m256i byte;
+	__m256 mask, xs, ys;
+	double out[4];
+
+	for (w = 0; w < words; w++) {
+		bits = word_bits(bitmap, w, max);
+		if (bits == 0) {
+			continue;
+		}
+		sums->count += __builtin_popcountll(bits);
+		base = w*WORD_POINTS;
+		for (group = 0; group < WORD_POINTS/8; group++, bits >>= 8) {
+			if ((bits & 0xff) == 0) {
+				continue;
+			}
+			/* expand the 8 valid bits into 8 all-ones/all-zeros lanes */
+			byte = _mm256_and_si256(_mm256_set1_epi32((int) (bits & 0xff)), lanes);
+			mask = _mm256_castsi256_ps(_mm256_cmpeq_epi32(byte, lanes));
+			xs = _mm256_and_ps(_mm256_load_ps(x + base + group*8), mask);
+			ys = _mm256_and_ps(_mm256_load_ps(y + base + group*8), mask);
+			acc_x = _mm256_add_pd(acc_x, _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(xs)),
+			                                           _mm256_cvtps_pd(_mm256_extractf128_ps(xs, 1))));
+			acc_y = _mm256_add_pd(acc_y, _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(ys)),
+			                                           _mm256_cvtps_pd(_mm256_extractf128_ps(ys, 1))));
+		}
+	}
+
+	_mm256_storeu_pd(out, acc_x);
+	sums->sum_x += (out[0] + out[1]) + (out[2] + out[3]);
+	_mm256_storeu_pd(out, acc_y);
+	sums->sum_y += (out[0] + out[1]) + (out[2] + out[3]);
+}
+#endif
+
+// intended to be private
+static SumsKernel kernel_for(int kernel) {
+	switch (kernel) {
+		case POINT_KERNEL_SCALAR:
+			return sums_scalar;
+#ifdef HAVE_X86_KERNELS
+		case POINT_KERNEL_SSE2:
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("sse2") ? sums_sse2 : NULL;
+		case POINT_KERNEL_AVX2:
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2") ? sums_avx2 : NULL;
+#endif
+		default:
+			return NULL;
+	}
+}
+
+// intended to be private
+static void select_kernel() {
+	int kernel;
+	/* pick the widest kernel the CPU supports */
+	for (kernel = POINT_KERNEL_AVX2; kernel > POINT_KERNEL_SCALAR; kernel--) {
+		if (kernel_for(kernel) != NULL) {
+			break;
+		}
+	}
+	point_columns_use_kernel(kernel);
+}
+
+
+size_t point_columns_size(uint64_t capacity) {
+	return x_offset_for(capacity) + 2*padded_points(capacity)*sizeof(float);
+}
+
+void point_columns_init(PointColumns* columns, uint64_t capacity) {
+	uint64_t points = padded_points(capacity);
+
+	memset(columns, 0, point_columns_size(capacity));
+	columns->capacity = capacity;
+	columns->bitmap_offset = CACHE_LINE;
+	columns->x_offset = x_offset_for(capacity);
+	columns->y_offset = columns->x_offset + points*sizeof(float);
+}
+
+void point_columns_set(PointColumns* columns, uint64_t index, float x, float y) {
+	__atomic_store(&x_of(columns)[index], &x, __ATOMIC_RELAXED);
+	__atomic_store(&y_of(columns)[index], &y, __ATOMIC_RELAXED);
+	__atomic_fetch_or(&bitmap_of(columns)[index / WORD_POINTS], 1ull << (index % WORD_POINTS), __ATOMIC_RELEASE);
+}
+
+void point_columns_invalidate(PointColumns* columns, uint64_t index) {
+	__atomic_fetch_and(&bitmap_of(columns)[index / WORD_POINTS], ~(1ull << (index % WORD_POINTS)), __ATOMIC_RELEASE);
+}
+
+bool point_columns_get(PointColumns* columns, uint64_t index, float* x, float* y) {
+	uint64_t bits = __atomic_load_n(&bitmap_of(columns)[index / WORD_POINTS], __ATOMIC_ACQUIRE);
+	__atomic_load(&x_of(columns)[index], x, __ATOMIC_RELAXED);
+	__atomic_load(&y_of(columns)[index], y, __ATOMIC_RELAXED);
+	return (bits >> (index % WORD_POINTS)) & 1;
+}
+
+void point_columns_sums(PointColumns* columns, uint64_t max, PointSums* sums) {
+	point_columns_sums_range(columns, 0, max, sums);
+}
+
+void point_columns_sums_range(PointColumns* columns, uint64_t first, uint64_t count, PointSums* sums) {
+	if (Kernel == NULL) {
+		select_kernel();
+	}
+	sums->count = 0;
+	sums->sum_x = 0;
+	sums->sum_y = 0;
+	/* the kernels start on a bitmap word (and so on a cache line of x and y) */
+	first &= ~(uint64_t) (WORD_POINTS - 1);
+	if (first >= columns->capacity) {
+		return;
+	}
+	if (count > columns->capacity - first) {
+		count = columns->capacity - first;
+	}
+	(*Kernel)(bitmap_of(columns) + first/WORD_POINTS, x_of(columns) + first, y_of(columns) + first, count, sums);
+}
+
+void point_columns_copy(PointColumns* columns, uint64_t first, uint64_t count, uint64_t* bitmap, float* x, float* y) {
+	uint64_t points = padded_points(count);
+
+	memcpy(bitmap, bitmap_of(columns) + first/WORD_POINTS, points/8);
+	memcpy(x, x_of(columns) + first, points*sizeof(float));
+	memcpy(y, y_of(columns) + first, points*sizeof(float));
+}
+
+void point_columns_gather(const int* valid, const float* x, const float* y, size_t stride, uint64_t count,
+                          uint64_t* bitmap, float* out_x, float* out_y) {
+	uint64_t idx, bits = 0;
+
+	for (idx = 0; idx < count; idx++) {
+		out_x[idx] = *(const float*) ((const char*) x + idx*stride);
+		out_y[idx] = *(const float*) ((const char*) y + idx*stride);
+		bits |= (uint64_t) (*(const int*) ((const char*) valid + idx*stride) == 1) << (idx % WORD_POINTS);
+		if (idx % WORD_POINTS == WORD_POINTS - 1) {
+			bitmap[idx / WORD_POINTS] = bits;
+			bits = 0;
+		}
+	}
+	if (count % WORD_POINTS != 0) {
+		bitmap[count / WORD_POINTS] = bits;
+	}
+}
+
+bool point_columns_use_kernel(int kernel) {
+	SumsKernel selected = kernel_for(kernel);
+	if (selected == NULL) {
+		return false;
+	}
+	KernelId = kernel;
+	Kernel = selected;
+	return true;
+}
+
+const char* point_columns_kernel_name() {
+	if (Kernel == NULL) {
+		select_kernel();
+	}
+	return KERNEL_STRING[KernelId];
+}
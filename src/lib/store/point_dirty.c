@@ -0,0 +1,104 @@
+/*
+ * Library: store - a generic set of storage data structures
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "point_dirty.h"
+
+
+#define ALIGN_UP(size, align) (((size) + (align) - 1) & ~(uint64_t) ((align) - 1))
+#define GROUP_SLOTS ((uint64_t) POINT_DIRTY_BLOCK*POINT_DIRTY_GROUP)
+#define NUM_BLOCKS(capacity) (((capacity) + POINT_DIRTY_BLOCK - 1) / POINT_DIRTY_BLOCK)
+#define NUM_GROUPS(capacity) (((capacity) + GROUP_SLOTS - 1) / GROUP_SLOTS)
+
+// intended to be private
+static uint64_t groups_offset_for() {
+	return ALIGN_UP(sizeof(PointDirty), 64);
+}
+
+// intended to be private
+static uint64_t blocks_offset_for(uint64_t capacity) {
+	return ALIGN_UP(groups_offset_for() + NUM_GROUPS(capacity)*sizeof(uint64_t), 64);
+}
+
+// intended to be private
+static uint64_t slots_offset_for(uint64_t capacity) {
+	return ALIGN_UP(blocks_offset_for(capacity) + NUM_BLOCKS(capacity)*sizeof(uint64_t), 64);
+}
+
+// intended to be private
+static uint64_t* stamps_at(PointDirty* dirty, uint64_t offset) {
+	return (uint64_t*) ((char*) dirty + offset);
+}
+
+// intended to be private
+static void fill_stamps(uint64_t* stamps, uint64_t count, uint64_t generation) {
+	uint64_t idx;
+	for (idx = 0; idx < count; idx++) {
+		stamps[idx] = generation;
+	}
+}
+
+
+size_t point_dirty_size(uint64_t capacity) {
+	return slots_offset_for(capacity) + capacity*sizeof(uint64_t);
+}
+
+void point_dirty_init(PointDirty* dirty, uint64_t capacity, uint64_t generation) {
+	/* readers find nothing until the capacity is published again */
+	__atomic_store_n(&dirty->capacity, 0, __ATOMIC_RELEASE);
+	dirty->groups_offset = groups_offset_for();
+	dirty->blocks_offset = blocks_offset_for(capacity);
+	dirty->slots_offset = slots_offset_for(capacity);
+	fill_stamps(stamps_at(dirty, dirty->groups_offset), NUM_GROUPS(capacity), generation);
+	fill_stamps(stamps_at(dirty, dirty->blocks_offset), NUM_BLOCKS(capacity), generation);
+	fill_stamps(stamps_at(dirty, dirty->slots_offset), capacity, generation);
+	__atomic_store_n(&dirty->capacity, capacity, __ATOMIC_RELEASE);
+}
+
+void point_dirty_mark(PointDirty* dirty, uint64_t slot, uint64_t generation) {
+	if (slot >= dirty->capacity) {
+		return;
+	}
+	/* readers only count on the stamps of a generation once the writer has
+	published it, which orders these stores for them */
+	__atomic_store_n(&stamps_at(dirty, dirty->slots_offset)[slot], generation, __ATOMIC_RELAXED);
+	__atomic_store_n(&stamps_at(dirty, dirty->blocks_offset)[slot / POINT_DIRTY_BLOCK], generation, __ATOMIC_RELAXED);
+	__atomic_store_n(&stamps_at(dirty, dirty->groups_offset)[slot / GROUP_SLOTS], generation, __ATOMIC_RELAXED);
+}
+
+int point_dirty_scan(PointDirty* dirty, uint64_t since, uint64_t* position, int* slots, int max) {
+	int count = 0;
+	uint64_t slot = *position;
+	uint64_t capacity = __atomic_load_n(&dirty->capacity, __ATOMIC_ACQUIRE);
+	uint64_t *groups, *blocks, *stamps;
+
+	if (capacity == 0) {
+		return 0;
+	}
+	groups = stamps_at(dirty, dirty->groups_offset);
+	blocks = stamps_at(dirty, dirty->blocks_offset);
+	stamps = stamps_at(dirty, dirty->slots_offset);
+
+	while (slot < capacity && count < max) {
+		if (slot % GROUP_SLOTS == 0 && __atomic_load_n(&groups[slot / GROUP_SLOTS], __ATOMIC_RELAXED) <= since) {
+			slot += GROUP_SLOTS;
+		} else if (slot % POINT_DIRTY_BLOCK == 0
+		           && __atomic_load_n(&blocks[slot / POINT_DIRTY_BLOCK], __ATOMIC_RELAXED) <= since) {
+			slot += POINT_DIRTY_BLOCK;
+		} else {
+			if (__atomic_load_n(&stamps[slot], __ATOMIC_RELAXED) > since) {
+				slots[count++] = slot;
+			}
+			slot++;
+		}
+	}
+
+	*position = slot < capacity ? slot : capacity;
+	return count;
+}
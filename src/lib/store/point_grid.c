@@ -0,0 +1,458 @@
+/*
+ * Library: store - a generic set of storage data structures
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include "map_gen.h"
+#include "point_grid.h"
+
+/* entries and buckets are referenced as (number + 1) so that a zero filled
+region reads as an empty grid */
+#define NO_ENTRY   0
+#define NO_BUCKET  0
+/* a writer that died in the middle of a change leaves the bucket counter odd.
+Readers retry for as long as the counter moves and give up once it stayed at
+the same odd value for SEQ_STUCK_NS, spinning SEQ_SPINS times before they start
+yielding and looking at the clock (as for the blocks of points, see point.c) */
+#define SEQ_STUCK_NS 5000000000ull
+#define SEQ_SPINS 1000
+
+/* points copied out of the buckets by a query, grown as needed */
+typedef struct Candidates {
+	PointGridHit* hits;
+	int count;
+	int capacity;
+} Candidates;
+
+
+/* about one bucket per slot keeps the chains short */
+static uint32_t buckets_for(uint32_t capacity) {
+	uint32_t num_buckets = 64;
+	while (num_buckets < capacity) {
+		num_buckets <<= 1;
+	}
+	return num_buckets;
+}
+
+static uint64_t entries_offset_for(uint32_t capacity) {
+	uint64_t offset = sizeof(PointGrid) + (uint64_t) buckets_for(capacity)*sizeof(PointGridBucket);
+	return (offset + 7) & ~(uint64_t) 7;
+}
+
+// intended to be private
+static PointGridBucket* bucket_at(PointGrid* grid, uint32_t bucket) {
+	return (PointGridBucket*) ((char*) grid + grid->buckets_offset) + bucket;
+}
+
+// intended to be private
+static PointGridEntry* entry_at(PointGrid* grid, uint32_t offset) {
+	return (PointGridEntry*) ((char*) grid + grid->entries_offset) + (offset - 1);
+}
+
+// intended to be private: the cell a coordinate falls in, huge values end up in
+// the outermost cells and NaN in cell 0 (it never matches a query anyway)
+static int32_t cell_of(PointGrid* grid, float value) {
+	double cell = (double) value / grid->cell_size;
+	int64_t whole;
+
+	if (cell != cell) {
+		return 0;
+	} else if (cell <= INT32_MIN) {
+		return INT32_MIN;
+	} else if (cell >= INT32_MAX) {
+		return INT32_MAX;
+	}
+	/* floor() without libm */
+	whole = (int64_t) cell;
+	return whole > cell ? whole - 1 : whole;
+}
+
+// intended to be private
+static uint32_t bucket_of(PointGrid* grid, uint32_t num_buckets, int32_t cx, int32_t cy) {
+	return map_hash_u64(((uint64_t) (uint32_t) cx << 32) | (uint32_t) cy) & (num_buckets - 1);
+}
+
+// intended to be private: only the writer changes the counters
+static void write_begin(uint32_t* seq) {
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// intended to be private
+static void write_end(uint32_t* seq) {
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+// intended to be private
+static void push_candidate(Candidates* out, uint32_t slot, float x, float y) {
+	if (out->count == out->capacity) {
+		out->capacity = out->capacity ? 2*out->capacity : 64;
+		out->hits = realloc(out->hits, out->capacity*sizeof(PointGridHit));
+	}
+	out->hits[out->count].slot = slot;
+	out->hits[out->count].x = x;
+	out->hits[out->count].y = y;
+	out->hits[out->count].distance2 = 0;
+	out->count++;
+}
+
+// intended to be private
+static uint64_t monotonic_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// intended to be private: copies the chain of a bucket to the end of out, false
+// if its counter is stuck
+static bool read_bucket(PointGrid* grid, uint32_t bucket, Candidates* out) {
+	PointGridBucket *head = bucket_at(grid, bucket);
+	PointGridEntry *entry;
+	uint32_t start, offset, steps, now, seen = 0, spins = 0;
+	int mark = out->count;
+	uint64_t since = 0;
+	float x, y;
+
+	do {
+		out->count = mark;
+		start = __atomic_load_n(&head->seq, __ATOMIC_ACQUIRE);
+		offset = __atomic_load_n(&head->head, __ATOMIC_RELAXED);
+		/* the walk is bounded in case the chain changes under us */
+		for (steps = 0; offset != NO_ENTRY && offset <= grid->capacity && steps < grid->capacity; steps++) {
+			entry = entry_at(grid, offset);
+			__atomic_load(&entry->x, &x, __ATOMIC_RELAXED);
+			__atomic_load(&entry->y, &y, __ATOMIC_RELAXED);
+			push_candidate(out, offset - 1, x, y);
+			offset = __atomic_load_n(&entry->next, __ATOMIC_RELAXED);
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		now = __atomic_load_n(&head->seq, __ATOMIC_RELAXED);
+		if ((start & 1) == 0 && now == start) {
+			return true;
+		}
+		if ((now & 1) == 0 || now != seen) {
+			/* the writer is getting somewhere, the wait starts over */
+			seen = now;
+			spins = 0;
+			since = 0;
+		} else if (++spins >= SEQ_SPINS) {
+			if (since == 0) {
+				since = monotonic_ns();
+			} else if (monotonic_ns() - since >= SEQ_STUCK_NS) {
+				out->count = mark;
+				return false;
+			}
+			sched_yield();
+		}
+	} while (true);
+}
+
+// intended to be private: only the writer may unlink
+static void unlink_entry(PointGrid* grid, uint32_t offset) {
+	PointGridEntry *entry = entry_at(grid, offset);
+	PointGridBucket *bucket = bucket_at(grid, entry->bucket - 1);
+	uint32_t *link = &bucket->head;
+	uint32_t steps;
+
+	write_begin(&bucket->seq);
+	for (steps = 0; *link != offset && *link != NO_ENTRY && steps < grid->capacity; steps++) {
+		link = &entry_at(grid, *link)->next;
+	}
+	if (*link == offset) {
+		__atomic_store_n(link, entry->next, __ATOMIC_RELAXED);
+	}
+	write_end(&bucket->seq);
+	entry->bucket = NO_BUCKET;
+}
+
+// intended to be private: max-heap on distance2, so the farthest of the k
+// nearest found so far is hits[0]
+static void offer_nearest(PointGridHit* hits, int* count, int k, PointGridHit* hit) {
+	int idx, child;
+	PointGridHit swap;
+
+	if (*count < k) {
+		idx = (*count)++;
+		hits[idx] = *hit;
+		while (idx > 0 && hits[(idx - 1)/2].distance2 < hits[idx].distance2) {
+			swap = hits[idx];
+			hits[idx] = hits[(idx - 1)/2];
+			hits[(idx - 1)/2] = swap;
+			idx = (idx - 1)/2;
+		}
+		return;
+	}
+	if (hit->distance2 >= hits[0].distance2) {
+		return;
+	}
+
+	hits[0] = *hit;
+	idx = 0;
+	while ((child = 2*idx + 1) < *count) {
+		if (child + 1 < *count && hits[child + 1].distance2 > hits[child].distance2) {
+			child++;
+		}
+		if (hits[child].distance2 <= hits[idx].distance2) {
+			break;
+		}
+		swap = hits[idx];
+		hits[idx] = hits[child];
+		hits[child] = swap;
+		idx = child;
+	}
+}
+
+// intended to be private: copies the candidates of cell (cx, cy) that are in
+// the box (min_x, min_y, max_x, max_y) into hits, other cells sharing the
+// bucket are visited on their own. A cx of INT64_MAX takes every cell.
+static int collect_in_box(PointGrid* grid, Candidates* cand, int64_t cx, int64_t cy, float* box,
+                          PointGridHit* hits, int max_hits, int found) {
+	int idx;
+	PointGridHit *hit;
+
+	for (idx = 0; idx < cand->count; idx++) {
+		hit = &cand->hits[idx];
+		/* written so that NaN is never in the box */
+		if (!(hit->x >= box[0] && hit->y >= box[1] && hit->x <= box[2] && hit->y <= box[3])) {
+			continue;
+		}
+		if (cx != INT64_MAX && (cell_of(grid, hit->x) != cx || cell_of(grid, hit->y) != cy)) {
+			continue;
+		}
+		if (found < max_hits) {
+			hits[found] = *hit;
+		}
+		found++;
+	}
+	return found;
+}
+
+// intended to be private
+static int compare_distance(const void* a, const void* b) {
+	float da = ((const PointGridHit*) a)->distance2;
+	float db = ((const PointGridHit*) b)->distance2;
+	return (da > db) - (da < db);
+}
+
+// intended to be private: offers the candidates of cell (cx, cy) only (every
+// cell for a cx of INT64_MAX), since other cells can share the bucket
+static int offer_cell(PointGrid* grid, Candidates* cand, int64_t cx, int64_t cy, float x, float y,
+                      PointGridHit* hits, int* count, int k) {
+	int idx, offered = 0;
+	double dx, dy;
+	PointGridHit *hit;
+
+	for (idx = 0; idx < cand->count; idx++) {
+		hit = &cand->hits[idx];
+		if (cx != INT64_MAX && (cell_of(grid, hit->x) != cx || cell_of(grid, hit->y) != cy)) {
+			continue;
+		}
+		dx = (double) hit->x - x;
+		dy = (double) hit->y - y;
+		hit->distance2 = dx*dx + dy*dy;
+		if (hit->distance2 != hit->distance2) {
+			/* a NaN point is not near anything */
+			continue;
+		}
+		offer_nearest(hits, count, k, hit);
+		offered++;
+	}
+	return offered;
+}
+
+
+size_t point_grid_size(uint32_t capacity) {
+	return entries_offset_for(capacity) + (size_t) capacity*sizeof(PointGridEntry);
+}
+
+void point_grid_init(PointGrid* grid, uint32_t capacity, float cell_size) {
+	memset(grid, 0, point_grid_size(capacity));
+	grid->capacity = capacity;
+	grid->cell_size = cell_size > 0 ? cell_size : POINT_GRID_CELL_SIZE;
+	grid->buckets_offset = sizeof(PointGrid);
+	grid->entries_offset = entries_offset_for(capacity);
+
+	/* readers treat the grid as empty until the bucket count is published */
+	__atomic_store_n(&grid->num_buckets, buckets_for(capacity), __ATOMIC_RELEASE);
+}
+
+void point_grid_insert(PointGrid* grid, int slot, float x, float y) {
+	uint32_t offset = slot + 1;
+	uint32_t bucket;
+	PointGridEntry *entry;
+	PointGridBucket *head;
+
+	if (grid->num_buckets == 0 || slot < 0 || (uint32_t) slot >= grid->capacity) {
+		return;
+	}
+
+	entry = entry_at(grid, offset);
+	bucket = bucket_of(grid, grid->num_buckets, cell_of(grid, x), cell_of(grid, y)) + 1;
+	head = bucket_at(grid, bucket - 1);
+
+	if (entry->bucket == bucket) {
+		/* still in the same bucket, only the position changes */
+		write_begin(&head->seq);
+		__atomic_store(&entry->x, &x, __ATOMIC_RELAXED);
+		__atomic_store(&entry->y, &y, __ATOMIC_RELAXED);
+		write_end(&head->seq);
+		return;
+	}
+
+	if (entry->bucket != NO_BUCKET) {
+		unlink_entry(grid, offset);
+	} else {
+		__atomic_store_n(&grid->count, grid->count + 1, __ATOMIC_RELAXED);
+	}
+
+	write_begin(&head->seq);
+	__atomic_store(&entry->x, &x, __ATOMIC_RELAXED);
+	__atomic_store(&entry->y, &y, __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->next, head->head, __ATOMIC_RELAXED);
+	entry->bucket = bucket;
+	__atomic_store_n(&head->head, offset, __ATOMIC_RELAXED);
+	write_end(&head->seq);
+}
+
+void point_grid_remove(PointGrid* grid, int slot) {
+	if (grid->num_buckets == 0 || slot < 0 || (uint32_t) slot >= grid->capacity
+	    || entry_at(grid, slot + 1)->bucket == NO_BUCKET) {
+		return;
+	}
+	unlink_entry(grid, slot + 1);
+	__atomic_store_n(&grid->count, grid->count - 1, __ATOMIC_RELAXED);
+}
+
+void point_grid_clear(PointGrid* grid) {
+	uint32_t bucket;
+	PointGridBucket *head;
+
+	for (bucket = 0; bucket < grid->num_buckets; bucket++) {
+		head = bucket_at(grid, bucket);
+		if (head->head != NO_ENTRY) {
+			write_begin(&head->seq);
+			__atomic_store_n(&head->head, NO_ENTRY, __ATOMIC_RELAXED);
+			write_end(&head->seq);
+		}
+	}
+	/* no chain leads to the entries any more */
+	memset(entry_at(grid, 1), 0, (size_t) grid->capacity*sizeof(PointGridEntry));
+	__atomic_store_n(&grid->count, 0, __ATOMIC_RELAXED);
+}
+
+uint32_t point_grid_count(PointGrid* grid) {
+	return __atomic_load_n(&grid->count, __ATOMIC_RELAXED);
+}
+
+int point_grid_range(PointGrid* grid, float min_x, float min_y, float max_x, float max_y, PointGridHit* hits, int max_hits) {
+	uint32_t num_buckets = __atomic_load_n(&grid->num_buckets, __ATOMIC_ACQUIRE);
+	int64_t cx, cy, cx0, cy0, cx1, cy1;
+	uint32_t bucket;
+	int found = 0;
+	float box[4] = {min_x, min_y, max_x, max_y};
+	Candidates cand = {NULL, 0, 0};
+
+	if (num_buckets == 0 || !(min_x <= max_x) || !(min_y <= max_y)) {
+		return 0;
+	}
+
+	cx0 = cell_of(grid, min_x);
+	cy0 = cell_of(grid, min_y);
+	cx1 = cell_of(grid, max_x);
+	cy1 = cell_of(grid, max_y);
+
+	if ((double) (cx1 - cx0 + 1) * (cy1 - cy0 + 1) >= num_buckets) {
+		/* a box covering more cells than there are buckets is cheaper to answer
+		by walking every bucket once */
+		for (bucket = 0; bucket < num_buckets; bucket++) {
+			cand.count = 0;
+			if (!read_bucket(grid, bucket, &cand)) {
+				free(cand.hits);
+				return -1;
+			}
+			found = collect_in_box(grid, &cand, INT64_MAX, 0, box, hits, max_hits, found);
+		}
+	} else {
+		for (cx = cx0; cx <= cx1; cx++) {
+			for (cy = cy0; cy <= cy1; cy++) {
+				cand.count = 0;
+				if (!read_bucket(grid, bucket_of(grid, num_buckets, cx, cy), &cand)) {
+					free(cand.hits);
+					return -1;
+				}
+				found = collect_in_box(grid, &cand, cx, cy, box, hits, max_hits, found);
+			}
+		}
+	}
+
+	free(cand.hits);
+	return found;
+}
+
+int point_grid_nearest(PointGrid* grid, float x, float y, int k, PointGridHit* hits) {
+	uint32_t num_buckets = __atomic_load_n(&grid->num_buckets, __ATOMIC_ACQUIRE);
+	uint32_t total = point_grid_count(grid);
+	uint32_t bucket, seen = 0;
+	int64_t qx, qy, cx, cy, r, step;
+	int count = 0;
+	double reach;
+	Candidates cand = {NULL, 0, 0};
+
+	if (num_buckets == 0 || k <= 0) {
+		return 0;
+	}
+
+	qx = cell_of(grid, x);
+	qy = cell_of(grid, y);
+
+	for (r = 0; ; r++) {
+		if ((double) (2*r + 1) * (2*r + 1) >= num_buckets) {
+			/* the rings cover more cells than there are buckets, look at every
+			point instead */
+			count = 0;
+			for (bucket = 0; bucket < num_buckets; bucket++) {
+				cand.count = 0;
+				if (!read_bucket(grid, bucket, &cand)) {
+					free(cand.hits);
+					return -1;
+				}
+				offer_cell(grid, &cand, INT64_MAX, 0, x, y, hits, &count, k);
+			}
+			break;
+		}
+
+		/* the cells of ring r: whole columns at both ends, the top and bottom
+		cells in between */
+		for (cx = qx - r; cx <= qx + r; cx++) {
+			step = (cx == qx - r || cx == qx + r) ? 1 : 2*r;
+			for (cy = qy - r; cy <= qy + r; cy += step) {
+				if (cx < INT32_MIN || cx > INT32_MAX || cy < INT32_MIN || cy > INT32_MAX) {
+					continue;
+				}
+				cand.count = 0;
+				if (!read_bucket(grid, bucket_of(grid, num_buckets, cx, cy), &cand)) {
+					free(cand.hits);
+					return -1;
+				}
+				seen += offer_cell(grid, &cand, cx, cy, x, y, hits, &count, k);
+			}
+		}
+
+		/* every point outside of the rings so far is at least r cells away */
+		reach = (double) r * grid->cell_size;
+		if ((count == k && hits[0].distance2 <= reach*reach) || seen >= total) {
+			break;
+		}
+	}
+
+	free(cand.hits);
+	qsort(hits, count, sizeof(PointGridHit), compare_distance);
+	return count;
+}
@@ -0,0 +1,241 @@
+/*
+ * Library: store - a generic set of storage data structures
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "point_history.h"
+
+
+#define ALIGN_UP(size, align) (((size) + (align) - 1) & ~(uint64_t) ((align) - 1))
+
+/* width of the intervals of each tier */
+static const uint64_t TIER_NS[POINT_HISTORY_TIERS] = {0, 1000000000ull, 60000000000ull};
+
+/* Every ring has one slot more than its depth: the writer fills the slot after
+the newest entry, which is never part of what readers are shown, and only then
+publishes it by moving the head. An entry at position p is therefore intact as
+long as the head has not gone past p + depth, which is all point_history_check
+has to look at. */
+
+// intended to be private
+static uint64_t slots_for(uint32_t depth) {
+	return (uint64_t) depth + 1;
+}
+
+// intended to be private
+static uint64_t samples_offset_for(uint64_t capacity) {
+	return ALIGN_UP(ALIGN_UP(sizeof(PointHistory), 64) + capacity*sizeof(PointHistoryTrack), 64);
+}
+
+// intended to be private
+static uint64_t buckets_offset_for(uint64_t capacity, uint32_t depth) {
+	return ALIGN_UP(samples_offset_for(capacity) + capacity*slots_for(depth)*sizeof(PointHistorySample), 64);
+}
+
+// intended to be private
+static PointHistoryTrack* track_of(PointHistory* hist, int slot) {
+	return (PointHistoryTrack*) ((char*) hist + hist->tracks_offset) + slot;
+}
+
+// intended to be private: the ring of raw samples of the slot
+static PointHistorySample* samples_of(PointHistory* hist, int slot) {
+	return (PointHistorySample*) ((char*) hist + hist->samples_offset) + slot*slots_for(hist->depth);
+}
+
+// intended to be private: the ring of buckets of the slot in a downsampled tier
+static PointHistoryBucket* buckets_of(PointHistory* hist, int slot, int tier) {
+	uint64_t ring = (uint64_t) slot*(POINT_HISTORY_TIERS - 1) + tier - 1;
+	return (PointHistoryBucket*) ((char*) hist + hist->buckets_offset) + ring*slots_for(hist->depth);
+}
+
+
+size_t point_history_size(uint64_t capacity, uint32_t depth) {
+	if (depth == 0) {
+		return sizeof(PointHistory);
+	}
+	return buckets_offset_for(capacity, depth)
+	       + capacity*(POINT_HISTORY_TIERS - 1)*slots_for(depth)*sizeof(PointHistoryBucket);
+}
+
+void point_history_init(PointHistory* hist, uint64_t capacity, uint32_t depth) {
+	if (depth > POINT_HISTORY_MAX_DEPTH) {
+		depth = POINT_HISTORY_MAX_DEPTH;
+	}
+	if (point_history_depth(hist) == depth && hist->capacity == capacity) {
+		return;
+	}
+
+	/* readers see no history until the depth is published again */
+	__atomic_store_n(&hist->depth, 0, __ATOMIC_RELEASE);
+	hist->capacity = capacity;
+	if (depth == 0) {
+		return;
+	}
+	hist->tracks_offset = ALIGN_UP(sizeof(PointHistory), 64);
+	hist->samples_offset = samples_offset_for(capacity);
+	hist->buckets_offset = buckets_offset_for(capacity, depth);
+	memset((char*) hist + hist->tracks_offset, 0, point_history_size(capacity, depth) - hist->tracks_offset);
+	__atomic_store_n(&hist->depth, depth, __ATOMIC_RELEASE);
+}
+
+uint32_t point_history_depth(PointHistory* hist) {
+	return __atomic_load_n(&hist->depth, __ATOMIC_ACQUIRE);
+}
+
+// intended to be private: hands the bucket over to the readers of the tier
+static void publish_bucket(PointHistory* hist, int slot, int tier, PointHistoryTrack* track) {
+	PointHistoryOpen *open = &track->open[tier - 1];
+	uint64_t head = track->head[tier];
+	PointHistoryBucket *bucket = &buckets_of(hist, slot, tier)[head % slots_for(hist->depth)];
+
+	/* the head that retired the entry in this slot is visible before any of
+	the stores overwriting it */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	bucket->start_ns = open->start_ns;
+	bucket->count = open->count;
+	bucket->min_x = open->min_x;
+	bucket->max_x = open->max_x;
+	bucket->min_y = open->min_y;
+	bucket->max_y = open->max_y;
+	bucket->mean_x = open->sum_x / open->count;
+	bucket->mean_y = open->sum_y / open->count;
+	__atomic_store_n(&track->head[tier], head + 1, __ATOMIC_RELEASE);
+	open->count = 0;
+}
+
+// intended to be private
+static void add_to_bucket(PointHistory* hist, int slot, int tier, PointHistoryTrack* track,
+                          uint64_t timestamp_ns, float x, float y) {
+	PointHistoryOpen *open = &track->open[tier - 1];
+	uint64_t start_ns = timestamp_ns - timestamp_ns % TIER_NS[tier];
+
+	if (open->count != 0 && open->start_ns != start_ns) {
+		publish_bucket(hist, slot, tier, track);
+	}
+	if (open->count == 0) {
+		open->start_ns = start_ns;
+		open->min_x = open->max_x = x;
+		open->min_y = open->max_y = y;
+		open->sum_x = 0;
+		open->sum_y = 0;
+	}
+	open->count++;
+	open->min_x = x < open->min_x ? x : open->min_x;
+	open->max_x = x > open->max_x ? x : open->max_x;
+	open->min_y = y < open->min_y ? y : open->min_y;
+	open->max_y = y > open->max_y ? y : open->max_y;
+	open->sum_x += x;
+	open->sum_y += y;
+}
+
+void point_history_record(PointHistory* hist, int slot, uint64_t timestamp_ns, bool is_valid, float x, float y) {
+	int tier;
+	uint64_t head;
+	PointHistoryTrack *track;
+	PointHistorySample *sample;
+
+	if (hist->depth == 0 || slot < 0 || (uint64_t) slot >= hist->capacity) {
+		return;
+	}
+
+	track = track_of(hist, slot);
+	head = track->head[POINT_HISTORY_RAW];
+	if (!is_valid && (head == 0 || !samples_of(hist, slot)[(head - 1) % slots_for(hist->depth)].is_valid)) {
+		/* nothing to end */
+		return;
+	}
+	if (timestamp_ns < track->last_ns) {
+		timestamp_ns = track->last_ns;
+	}
+	track->last_ns = timestamp_ns;
+
+	sample = &samples_of(hist, slot)[head % slots_for(hist->depth)];
+	/* as in publish_bucket */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	sample->timestamp_ns = timestamp_ns;
+	sample->x = x;
+	sample->y = y;
+	sample->is_valid = is_valid;
+	__atomic_store_n(&track->head[POINT_HISTORY_RAW], head + 1, __ATOMIC_RELEASE);
+
+	for (tier = POINT_HISTORY_SECONDS; tier < POINT_HISTORY_TIERS; tier++) {
+		if (is_valid) {
+			add_to_bucket(hist, slot, tier, track, timestamp_ns, x, y);
+		} else if (track->open[tier - 1].count != 0) {
+			/* the point is gone, so its last interval is complete */
+			publish_bucket(hist, slot, tier, track);
+		}
+	}
+}
+
+// intended to be private: the time an entry of the ring is stamped with
+static uint64_t entry_time(PointHistory* hist, int slot, int tier, uint64_t position) {
+	uint64_t ring_slot = position % slots_for(hist->depth);
+	if (tier == POINT_HISTORY_RAW) {
+		return __atomic_load_n(&samples_of(hist, slot)[ring_slot].timestamp_ns, __ATOMIC_RELAXED);
+	}
+	return __atomic_load_n(&buckets_of(hist, slot, tier)[ring_slot].start_ns, __ATOMIC_RELAXED);
+}
+
+// intended to be private: the first position in [low, high) whose entry is
+// stamped after the given time (the entries are in time order)
+static uint64_t first_after(PointHistory* hist, int slot, int tier, uint64_t low, uint64_t high, uint64_t time_ns) {
+	uint64_t middle;
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		if (entry_time(hist, slot, tier, middle) > time_ns) {
+			high = middle;
+		} else {
+			low = middle + 1;
+		}
+	}
+	return low;
+}
+
+int point_history_range(PointHistory* hist, int slot, int tier, uint64_t from_ns, uint64_t to_ns, PointHistoryView* view) {
+	uint64_t head, oldest, first, end, ring_slot, slots;
+	uint32_t depth = point_history_depth(hist);
+	PointHistoryTrack *track;
+
+	memset(view, 0, sizeof(PointHistoryView));
+	if (depth == 0 || slot < 0 || (uint64_t) slot >= hist->capacity
+	    || tier < POINT_HISTORY_RAW || tier >= POINT_HISTORY_TIERS || from_ns > to_ns) {
+		return 0;
+	}
+
+	track = track_of(hist, slot);
+	head = __atomic_load_n(&track->head[tier], __ATOMIC_ACQUIRE);
+	oldest = head > depth ? head - depth : 0;
+	first = from_ns == 0 ? oldest : first_after(hist, slot, tier, oldest, head, from_ns - 1);
+	end = first_after(hist, slot, tier, first, head, to_ns);
+
+	slots = slots_for(depth);
+	ring_slot = first % slots;
+	view->counts[0] = end - first < slots - ring_slot ? end - first : slots - ring_slot;
+	view->counts[1] = end - first - view->counts[0];
+	if (tier == POINT_HISTORY_RAW) {
+		view->runs[0].samples = &samples_of(hist, slot)[ring_slot];
+		view->runs[1].samples = samples_of(hist, slot);
+	} else {
+		view->runs[0].buckets = &buckets_of(hist, slot, tier)[ring_slot];
+		view->runs[1].buckets = buckets_of(hist, slot, tier);
+	}
+	view->head = &track->head[tier];
+	view->first = first;
+	view->depth = depth;
+	return end - first;
+}
+
+bool point_history_check(PointHistoryView* view) {
+	if (view->head == NULL) {
+		return true;
+	}
+	/* the entries were read before the head is looked at again */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(view->head, __ATOMIC_RELAXED) - view->first <= view->depth;
+}
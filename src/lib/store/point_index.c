@@ -0,0 +1,252 @@
+/*
+ * Library: store - a generic set of storage data structures
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "map_gen.h"
+#include "point_index.h"
+
+/* offsets into the entry array are stored as (entry number + 1) so that a
+zero filled segment reads as a set of empty buckets */
+#define NO_ENTRY  0
+/* walks of a lookup while entries keep moving, before it settles for a miss */
+#define LOOKUP_TRIES  64
+
+/* the bucket array is sized to keep the chains short (about 2 buckets per id) */
+static uint32_t buckets_for(uint32_t capacity) {
+	uint32_t num_buckets = 8;
+	while (num_buckets < 2*capacity) {
+		num_buckets <<= 1;
+	}
+	return num_buckets;
+}
+
+static uint64_t entries_offset_for(uint32_t capacity) {
+	uint64_t offset = sizeof(PointIndex) + (uint64_t) buckets_for(capacity)*sizeof(uint32_t);
+	/* keep the 64-bit ids aligned */
+	return (offset + 7) & ~(uint64_t) 7;
+}
+
+static uint64_t slots_offset_for(uint32_t capacity) {
+	return entries_offset_for(capacity) + (uint64_t) capacity*sizeof(PointIndexEntry);
+}
+
+// intended to be private
+static uint32_t* bucket_array(PointIndex* index) {
+	return (uint32_t*) ((char*) index + index->buckets_offset);
+}
+
+// intended to be private
+static PointIndexEntry* entry_at(PointIndex* index, uint32_t offset) {
+	return &((PointIndexEntry*) ((char*) index + index->entries_offset))[offset - 1];
+}
+
+// intended to be private
+static uint32_t offset_of(PointIndex* index, PointIndexEntry* entry) {
+	return (uint32_t) (entry - entry_at(index, 1)) + 1;
+}
+
+// intended to be private: the entry (as its offset) bound to each slot
+static uint32_t* slot_array(PointIndex* index) {
+	return (uint32_t*) ((char*) index + index->slots_offset);
+}
+
+// intended to be private
+static uint32_t* bucket_of(PointIndex* index, uint32_t num_buckets, uint64_t id) {
+	return &bucket_array(index)[map_hash_u64(id) & (num_buckets - 1)];
+}
+
+// intended to be private
+static PointIndexEntry* find_entry(PointIndex* index, uint32_t num_buckets, uint64_t id) {
+	uint32_t steps;
+	uint32_t offset;
+	PointIndexEntry* entry;
+
+	/* entries are filled in before they are linked into a bucket, so the chain
+	can be walked while the writer is inserting. An entry that is removed or
+	reused while a lookup is on it can lead the lookup off its chain, which
+	the lookup finds out from the moves counter. The walk is bounded in case
+	the segment has been scribbled on. */
+	offset = __atomic_load_n(bucket_of(index, num_buckets, id), __ATOMIC_ACQUIRE);
+	for (steps = 0; offset != NO_ENTRY && steps < index->capacity; steps++) {
+		if (offset > index->capacity) {
+			return NULL;
+		}
+		entry = entry_at(index, offset);
+		if (__atomic_load_n(&entry->id, __ATOMIC_ACQUIRE) == id) {
+			return entry;
+		}
+		offset = __atomic_load_n(&entry->next, __ATOMIC_ACQUIRE);
+	}
+	return NULL;
+}
+
+// intended to be private: unlinks the entry from its bucket and puts it on the
+// free list (the writer only)
+static void free_entry(PointIndex* index, PointIndexEntry* entry) {
+	uint32_t offset = offset_of(index, entry);
+	uint32_t* link = bucket_of(index, index->num_buckets, entry->id);
+	uint32_t* slots = slot_array(index);
+	uint32_t steps;
+
+	for (steps = 0; *link != offset; steps++) {
+		if (*link == NO_ENTRY || steps >= index->capacity) {
+			return;
+		}
+		link = &entry_at(index, *link)->next;
+	}
+	if (entry->slot != POINT_INDEX_NO_SLOT && slots[entry->slot] == offset) {
+		slots[entry->slot] = NO_ENTRY;
+	}
+
+	__atomic_fetch_add(&index->moves, 1, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&entry->slot, POINT_INDEX_NO_SLOT, __ATOMIC_RELEASE);
+	__atomic_store_n(link, entry->next, __ATOMIC_RELEASE);
+	__atomic_store_n(&entry->next, index->free_entries, __ATOMIC_RELEASE);
+	index->free_entries = offset;
+	__atomic_fetch_add(&index->moves, 1, __ATOMIC_SEQ_CST);
+}
+
+// intended to be private: links a new entry for the id, bound to the slot, into
+// its bucket (the writer only). Returns NULL if the index is full.
+static PointIndexEntry* new_entry(PointIndex* index, uint64_t id, int slot) {
+	uint32_t* bucket = bucket_of(index, index->num_buckets, id);
+	uint32_t offset = index->free_entries;
+	PointIndexEntry* entry;
+
+	if (offset != NO_ENTRY) {
+		/* lookups may still be on a freed entry */
+		entry = entry_at(index, offset);
+		index->free_entries = entry->next;
+		__atomic_fetch_add(&index->moves, 1, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&entry->id, id, __ATOMIC_RELEASE);
+		__atomic_store_n(&entry->slot, slot, __ATOMIC_RELEASE);
+		__atomic_store_n(&entry->next, *bucket, __ATOMIC_RELEASE);
+		__atomic_store_n(bucket, offset, __ATOMIC_RELEASE);
+		__atomic_fetch_add(&index->moves, 1, __ATOMIC_SEQ_CST);
+		return entry;
+	}
+
+	if (index->count >= index->capacity) {
+		return NULL;
+	}
+
+	/* fill the entry in completely, then publish it as the head of the bucket */
+	offset = index->count + 1;
+	entry = entry_at(index, offset);
+	entry->id = id;
+	entry->slot = slot;
+	entry->next = *bucket;
+
+	__atomic_store_n(bucket, offset, __ATOMIC_RELEASE);
+	__atomic_store_n(&index->count, offset, __ATOMIC_RELEASE);
+	return entry;
+}
+
+
+size_t point_index_size(uint32_t capacity) {
+	return slots_offset_for(capacity) + (size_t) capacity*sizeof(uint32_t);
+}
+
+void point_index_init(PointIndex* index, uint32_t capacity) {
+	uint32_t num_buckets = buckets_for(capacity);
+
+	if (__atomic_load_n(&index->num_buckets, __ATOMIC_ACQUIRE) == num_buckets
+	    && index->capacity == capacity && index->buckets_offset == sizeof(PointIndex)
+	    && index->entries_offset == entries_offset_for(capacity)
+	    && index->slots_offset == slots_offset_for(capacity)) {
+		/* the previous writer may have died in the middle of moving an entry */
+		if (index->moves & 1) {
+			__atomic_fetch_add(&index->moves, 1, __ATOMIC_SEQ_CST);
+		}
+		return;
+	}
+
+	memset(index, 0, point_index_size(capacity));
+	index->capacity = capacity;
+	index->buckets_offset = sizeof(PointIndex);
+	index->entries_offset = entries_offset_for(capacity);
+	index->slots_offset = slots_offset_for(capacity);
+
+	/* readers treat the index as empty until the bucket count is published */
+	__atomic_store_n(&index->num_buckets, num_buckets, __ATOMIC_RELEASE);
+}
+
+bool point_index_insert(PointIndex* index, uint64_t id, int slot) {
+	uint32_t num_buckets = index->num_buckets;
+	uint32_t* slots;
+	PointIndexEntry* entry;
+
+	if (num_buckets == 0 || slot < 0 || (uint32_t) slot >= index->capacity) {
+		return false;
+	}
+	slots = slot_array(index);
+
+	entry = find_entry(index, num_buckets, id);
+	if (entry != NULL && entry->slot == slot) {
+		return true;
+	}
+
+	/* the id the slot was bound to goes away (which also makes room for the new one) */
+	if (slots[slot] != NO_ENTRY) {
+		free_entry(index, entry_at(index, slots[slot]));
+	}
+
+	if (entry == NULL) {
+		entry = new_entry(index, id, slot);
+		if (entry == NULL) {
+			return false;
+		}
+	} else {
+		/* the id leaves its previous slot */
+		if (entry->slot != POINT_INDEX_NO_SLOT) {
+			slots[entry->slot] = NO_ENTRY;
+		}
+		__atomic_store_n(&entry->slot, slot, __ATOMIC_RELEASE);
+	}
+	slots[slot] = offset_of(index, entry);
+	return true;
+}
+
+bool point_index_remove(PointIndex* index, uint64_t id) {
+	uint32_t num_buckets = index->num_buckets;
+	PointIndexEntry* entry;
+
+	if (num_buckets == 0 || (entry = find_entry(index, num_buckets, id)) == NULL) {
+		return false;
+	}
+	free_entry(index, entry);
+	return true;
+}
+
+int point_index_lookup(PointIndex* index, uint64_t id) {
+	uint32_t num_buckets = __atomic_load_n(&index->num_buckets, __ATOMIC_ACQUIRE);
+	uint32_t moves;
+	int tries, slot;
+	PointIndexEntry* entry;
+
+	if (num_buckets == 0) {
+		return POINT_INDEX_NO_SLOT;
+	}
+
+	for (tries = 0; tries < LOOKUP_TRIES; tries++) {
+		moves = __atomic_load_n(&index->moves, __ATOMIC_ACQUIRE);
+		entry = find_entry(index, num_buckets, id);
+		if (entry != NULL) {
+			/* the entry may have been reused by another id since it matched */
+			slot = __atomic_load_n(&entry->slot, __ATOMIC_ACQUIRE);
+			if (slot != POINT_INDEX_NO_SLOT && __atomic_load_n(&entry->id, __ATOMIC_ACQUIRE) == id) {
+				return slot;
+			}
+		}
+		/* a miss only counts if no entry moved during the walk */
+		if ((moves & 1) == 0 && __atomic_load_n(&index->moves, __ATOMIC_ACQUIRE) == moves) {
+			break;
+		}
+	}
+	return POINT_INDEX_NO_SLOT;
+}
@@ -0,0 +1,339 @@
+/*
+ * Library: store - a generic set of storage data structures
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+#include "point_columns.h"
+#include "point_summary.h"
+
+#define WORD_POINTS   64
+/* the statistics that need a look at every valid point (not just the count) */
+#define PER_POINT     (POINT_SUMMARY_MEAN | POINT_SUMMARY_VARIANCE | POINT_SUMMARY_BOUNDS)
+
+typedef void (*SummaryKernel)(PointSummary*, const uint64_t*, const float*, const float*, uint64_t);
+
+static SummaryKernel Kernel = NULL;
+
+
+// intended to be private: the valid bits of word w, limited to the first count points
+static uint64_t word_bits(const uint64_t* bitmap, uint64_t w, uint64_t count) {
+	uint64_t bits = bitmap[w];
+	uint64_t left = count - w*WORD_POINTS;
+	if (left < WORD_POINTS) {
+		bits &= (1ull << left) - 1;
+	}
+	return bits;
+}
+
+static void add_scalar(PointSummary* summary, const uint64_t* bitmap, const float* x, const float* y, uint64_t count) {
+	uint64_t w, bits, idx;
+	uint64_t words = (count + WORD_POINTS - 1) / WORD_POINTS;
+	bool moments = summary->what & (POINT_SUMMARY_MEAN | POINT_SUMMARY_VARIANCE);
+	bool squares = summary->what & POINT_SUMMARY_VARIANCE;
+	bool bounds = summary->what & POINT_SUMMARY_BOUNDS;
+	double dx, dy;
+
+	for (w = 0; w < words; w++) {
+		bits = word_bits(bitmap, w, count);
+		summary->count += __builtin_popcountll(bits);
+		if ((summary->what & PER_POINT) == 0) {
+			continue;
+		}
+		while (bits != 0) {
+			idx = w*WORD_POINTS + __builtin_ctzll(bits);
+			if (moments) {
+				dx = x[idx] - summary->shift_x;
+				dy = y[idx] - summary->shift_y;
+				summary->sum_x += dx;
+				summary->sum_y += dy;
+				if (squares) {
+					summary->sum2_x += dx*dx;
+					summary->sum2_y += dy*dy;
+				}
+			}
+			if (bounds) {
+				summary->min_x = x[idx] < summary->min_x ? x[idx] : summary->min_x;
+				summary->max_x = x[idx] > summary->max_x ? x[idx] : summary->max_x;
+				summary->min_y = y[idx] < summary->min_y ? y[idx] : summary->min_y;
+				summary->max_y = y[idx] > summary->max_y ? y[idx] : summary->max_y;
+			}
+			bits &= bits - 1;
+		}
+	}
+}
+
+#ifdef HAVE_X86_KERNELS
+// intended to be private
+__attribute__((target("avx2")))
+static double sum_lanes(__m256d acc) {
+	double out[4];
+	_mm256_storeu_pd(out, acc);
+	return (out[0] + out[1]) + (out[2] + out[3]);
+}
+
+// intended to be private
+__attribute__((target("avx2")))
+static float min_lanes(__m256 acc) {
+	int lane;
+	float out[8], min;
+	_mm256_storeu_ps(out, acc);
+	for (min = out[0], lane = 1; lane < 8; lane++) {
+		min = out[lane] < min ? out[lane] : min;
+	}
+	return min;
+}
+
+// intended to be private
+__attribute__((target("avx2")))
+static float max_lanes(__m256 acc) {
+	int lane;
+	float out[8], max;
+	_mm256_storeu_ps(out, acc);
+	for (max = out[0], lane = 1; lane < 8; lane++) {
+		max = out[lane] > max ? out[lane] : max;
+	}
+	return max;
+}
+
+__attribute__((target("avx2")))
+static void add_avx2(PointSummary* summary, const uint64_t* bitmap, const float* x, const float* y, uint64_t count) {
+	int group;
+	uint64_t w, bits, base;
+	uint64_t words = (count + WORD_POINTS - 1) / WORD_POINTS;
+	bool moments = summary->what & (POINT_SUMMARY_MEAN | POINT_SUMMARY_VARIANCE);
+	bool squares = summary->what & POINT_SUMMARY_VARIANCE;
+	bool bounds = summary->what & POINT_SUMMARY_BOUNDS;
+	const __m256i lanes = _mm256_set_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+	const __m256d shift_x = _mm256_set1_pd(summary->shift_x), shift_y = _mm256_set1_pd(summary->shift_y);
+	const __m256 high = _mm256_set1_ps(__builtin_inff()), low = _mm256_set1_ps(-__builtin_inff());
+	__m256d sum_x = _mm256_setzero_pd(), sum_y = _mm256_setzero_pd();
+	__m256d sum2_x = _mm256_setzero_pd(), sum2_y = _mm256_setzero_pd();
+	__m256d mask_lo, mask_hi, dx_lo, dx_hi, dy_lo, dy_hi;
+	__m256 min_x = high, max_x = low, min_y = high, max_y = low;
+	__m256i lane_mask;
+	__m256 mask, xs, ys;
+
+	for (w = 0; w < words; w++) {
+		bits = word_bits(bitmap, w, count);
+		if (bits == 0) {
+			continue;
+		}
+		summary->count += __builtin_popcountll(bits);
+		if ((summary->what & PER_POINT) == 0) {
+			continue;
+		}
+		base = w*WORD_POINTS;
+		for (group = 0; group < WORD_POINTS/8; group++, bits >>= 8) {
+			if ((bits & 0xff) == 0) {
+				continue;
+			}
+			/* expand the 8 valid bits into 8 all-ones/all-zeros lanes */
+			lane_mask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32((int) (bits & 0xff)), lanes), lanes);
+			mask = _mm256_castsi256_ps(lane_mask);
+			xs = _mm256_load_ps(x + base + group*8);
+			ys = _mm256_load_ps(y + base + group*8);
+			if (moments) {
+				/* the same mask, widened to the 4 double lanes of each half */
+				mask_lo = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(_mm256_castsi256_si128(lane_mask)));
+				mask_hi = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(_mm256_extracti128_si256(lane_mask, 1)));
+				dx_lo = _mm256_and_pd(_mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(xs)), shift_x), mask_lo);
+				dx_hi = _mm256_and_pd(_mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(xs, 1)), shift_x), mask_hi);
+				dy_lo = _mm256_and_pd(_mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(ys)), shift_y), mask_lo);
+				dy_hi = _mm256_and_pd(_mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(ys, 1)), shift_y), mask_hi);
+				sum_x = _mm256_add_pd(sum_x, _mm256_add_pd(dx_lo, dx_hi));
+				sum_y = _mm256_add_pd(sum_y, _mm256_add_pd(dy_lo, dy_hi));
+				if (squares) {
+					sum2_x = _mm256_add_pd(sum2_x, _mm256_add_pd(_mm256_mul_pd(dx_lo, dx_lo), _mm256_mul_pd(dx_hi, dx_hi)));
+					sum2_y = _mm256_add_pd(sum2_y, _mm256_add_pd(_mm256_mul_pd(dy_lo, dy_lo), _mm256_mul_pd(dy_hi, dy_hi)));
+				}
+			}
+			if (bounds) {
+				/* invalid lanes become +/-infinity, the new values go first so
+				that a NaN is skipped (as in the scalar kernel) */
+				min_x = _mm256_min_ps(_mm256_blendv_ps(high, xs, mask), min_x);
+				max_x = _mm256_max_ps(_mm256_blendv_ps(low, xs, mask), max_x);
+				min_y = _mm256_min_ps(_mm256_blendv_ps(high, ys, mask), min_y);
+				max_y = _mm256_max_ps(_mm256_blendv_ps(low, ys, mask), max_y);
+			}
+		}
+	}
+
+	if (moments) {
+		summary->sum_x += sum_lanes(sum_x);
+		summary->sum_y += sum_lanes(sum_y);
+		summary->sum2_x += sum_lanes(sum2_x);
+		summary->sum2_y += sum_lanes(sum2_y);
+	}
+	if (bounds) {
+		summary->min_x = min_lanes(min_x) < summary->min_x ? min_lanes(min_x) : summary->min_x;
+		summary->max_x = max_lanes(max_x) > summary->max_x ? max_lanes(max_x) : summary->max_x;
+		summary->min_y = min_lanes(min_y) < summary->min_y ? min_lanes(min_y) : summary->min_y;
+		summary->max_y = max_lanes(max_y) > summary->max_y ? max_lanes(max_y) : summary->max_y;
+	}
+}
+#endif
+
+// intended to be private
+static SummaryKernel kernel_for(int kernel) {
+	switch (kernel) {
+		case POINT_KERNEL_SCALAR:
+			return add_scalar;
+#ifdef HAVE_X86_KERNELS
+		case POINT_KERNEL_AVX2:
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2") ? add_avx2 : NULL;
+#endif
+		default:
+			return NULL;
+	}
+}
+
+// intended to be private: a bin lookup per point, there is nothing to gain
+// from SIMD when every point increments a different counter
+static void add_histogram(PointSummary* summary, const uint64_t* bitmap, const float* x, const float* y, uint64_t count) {
+	uint64_t w, bits, idx;
+	uint64_t words = (count + WORD_POINTS - 1) / WORD_POINTS;
+	uint32_t bin_x, bin_y;
+	float width = summary->hist_max_x - summary->hist_min_x;
+	float height = summary->hist_max_y - summary->hist_min_y;
+	float scale_x = width > 0 ? summary->bins_x / width : 0;
+	float scale_y = height > 0 ? summary->bins_y / height : 0;
+
+	for (w = 0; w < words; w++) {
+		bits = word_bits(bitmap, w, count);
+		while (bits != 0) {
+			idx = w*WORD_POINTS + __builtin_ctzll(bits);
+			bits &= bits - 1;
+			/* written so that NaN ends up outside as well */
+			if (!(x[idx] >= summary->hist_min_x && x[idx] <= summary->hist_max_x
+			      && y[idx] >= summary->hist_min_y && y[idx] <= summary->hist_max_y)) {
+				summary->outside++;
+				continue;
+			}
+			bin_x = (x[idx] - summary->hist_min_x) * scale_x;
+			bin_y = (y[idx] - summary->hist_min_y) * scale_y;
+			/* the upper bounds belong to the last bins */
+			bin_x = bin_x < summary->bins_x ? bin_x : summary->bins_x - 1;
+			bin_y = bin_y < summary->bins_y ? bin_y : summary->bins_y - 1;
+			summary->bins[(uint64_t) bin_y*summary->bins_x + bin_x]++;
+		}
+	}
+}
+
+
+void point_summary_init(PointSummary* summary, int what, double shift_x, double shift_y) {
+	if ((what & POINT_SUMMARY_HISTOGRAM)
+	    && (summary->bins == NULL || summary->bins_x == 0 || summary->bins_y == 0)) {
+		/* there is nowhere to count */
+		what &= ~POINT_SUMMARY_HISTOGRAM;
+	}
+	/* the variance is taken around the mean */
+	if (what & POINT_SUMMARY_VARIANCE) {
+		what |= POINT_SUMMARY_MEAN;
+	}
+
+	summary->what = what;
+	summary->outside = 0;
+	if (what & POINT_SUMMARY_HISTOGRAM) {
+		memset(summary->bins, 0, (uint64_t) summary->bins_x*summary->bins_y*sizeof(uint64_t));
+	}
+	summary->count = 0;
+	summary->mean_x = 0;
+	summary->mean_y = 0;
+	summary->var_x = 0;
+	summary->var_y = 0;
+	summary->stddev_x = 0;
+	summary->stddev_y = 0;
+	summary->min_x = __builtin_inff();
+	summary->max_x = -__builtin_inff();
+	summary->min_y = __builtin_inff();
+	summary->max_y = -__builtin_inff();
+	summary->shift_x = shift_x;
+	summary->shift_y = shift_y;
+	summary->sum_x = 0;
+	summary->sum_y = 0;
+	summary->sum2_x = 0;
+	summary->sum2_y = 0;
+}
+
+void point_summary_split(PointSummary* part, PointSummary* summary, uint64_t* bins) {
+	*part = *summary;
+	part->bins = bins;
+	point_summary_init(part, summary->what, summary->shift_x, summary->shift_y);
+}
+
+void point_summary_add(PointSummary* summary, const uint64_t* bitmap, const float* x, const float* y, uint64_t count) {
+	if (Kernel == NULL && !point_summary_use_kernel(POINT_KERNEL_AVX2)) {
+		point_summary_use_kernel(POINT_KERNEL_SCALAR);
+	}
+	(*Kernel)(summary, bitmap, x, y, count);
+	if (summary->what & POINT_SUMMARY_HISTOGRAM) {
+		add_histogram(summary, bitmap, x, y, count);
+	}
+}
+
+void point_summary_merge(PointSummary* summary, PointSummary* part) {
+	uint64_t bin;
+
+	summary->count += part->count;
+	summary->sum_x += part->sum_x;
+	summary->sum_y += part->sum_y;
+	summary->sum2_x += part->sum2_x;
+	summary->sum2_y += part->sum2_y;
+	summary->min_x = part->min_x < summary->min_x ? part->min_x : summary->min_x;
+	summary->max_x = part->max_x > summary->max_x ? part->max_x : summary->max_x;
+	summary->min_y = part->min_y < summary->min_y ? part->min_y : summary->min_y;
+	summary->max_y = part->max_y > summary->max_y ? part->max_y : summary->max_y;
+	if (summary->what & POINT_SUMMARY_HISTOGRAM) {
+		summary->outside += part->outside;
+		for (bin = 0; bin < (uint64_t) summary->bins_x*summary->bins_y; bin++) {
+			summary->bins[bin] += part->bins[bin];
+		}
+	}
+}
+
+void point_summary_finish(PointSummary* summary) {
+	double offset_x, offset_y;
+
+	if (summary->count == 0 || !(summary->what & POINT_SUMMARY_BOUNDS)) {
+		summary->min_x = summary->max_x = 0;
+		summary->min_y = summary->max_y = 0;
+	}
+	if (summary->count == 0 || !(summary->what & POINT_SUMMARY_MEAN)) {
+		return;
+	}
+
+	/* the mean of the shifted values is how far the mean is from the shift */
+	offset_x = summary->sum_x / summary->count;
+	offset_y = summary->sum_y / summary->count;
+	summary->mean_x = summary->shift_x + offset_x;
+	summary->mean_y = summary->shift_y + offset_y;
+	if (summary->what & POINT_SUMMARY_VARIANCE) {
+		summary->var_x = summary->sum2_x / summary->count - offset_x*offset_x;
+		summary->var_y = summary->sum2_y / summary->count - offset_y*offset_y;
+		/* rounding can take a (next to) zero variance below zero */
+		summary->var_x = summary->var_x > 0 ? summary->var_x : 0;
+		summary->var_y = summary->var_y > 0 ? summary->var_y : 0;
+		summary->stddev_x = sqrt(summary->var_x);
+		summary->stddev_y = sqrt(summary->var_y);
+	}
+}
+
+bool point_summary_use_kernel(int kernel) {
+	SummaryKernel selected = kernel_for(kernel);
+	if (selected == NULL) {
+		return false;
+	}
+	Kernel = selected;
+	return true;
+}
@@ -7,14 +7,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <signal.h>
 #include <unistd.h>
+/* the lines of this library are filtered by its own level (see set_log_level) */
+#define LOG_MODULE LOG_THDLIB
 #include "log_mgr.h"
 #include "thread_mgr.h"
-#include "hash_table.h"
+#include "cmap.h"
 
 #define THREAD_NAME_SIZE 	7
 #define MAX_SIGNAL				15
@@ -28,8 +31,9 @@ static const char *THREAD_STR_STATE[] = {
 	"Pending", "Running", "Canceled", "Finished",
 };
 
-/* signum to void* handler callbacks */
-Hash* SignalHandlers = NULL;
+/* signum to void* handler callbacks (written by any thread, read by the manager
+thread, see signal_handlers()) */
+CMap* SignalHandlers = NULL;
 
 /* Enable flags for the thread-lib-specific signal handlers */
 static bool HandleSigInt = true;
@@ -57,6 +61,24 @@ pthread_key_t ThreadHandleKey;
 ////////////////////////////////////////////////////////////////////////////////
 // These functions below are intended to be private (for internal library use only)
 
+// intended to be private
+static CMap* signal_handlers() {
+	CMap *handlers = __atomic_load_n(&SignalHandlers, __ATOMIC_ACQUIRE);
+	CMap *expected = NULL;
+
+	if (handlers == NULL) {
+		handlers = new_cmap(MAX_SIGNAL);
+
+		/* another thread may have raced to create the map, use the first one */
+		if (!__atomic_compare_exchange_n(&SignalHandlers, &expected, handlers, false,
+		                                 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			destroy_cmap(handlers);
+			handlers = expected;
+		}
+	}
+	return handlers;
+}
+
 // intended to be private
 static void thread_signal_handler(int signum) {
 	// In case we change 'errno' upon write()
@@ -137,7 +159,6 @@ static void* mgr_thread(void *args) {
 		are freed when the process terminates.) */
 
 	short signum;
-	HashNode* hash_obj;
 	SignalHandlerCallback* callback;
 
 	while (1) {
@@ -150,13 +171,12 @@ static void* mgr_thread(void *args) {
 			return NULL;
 		}
 
-		hash_obj = get_hash_item(SignalHandlers, signum);
+		callback = (SignalHandlerCallback*) get_cmap_item(signal_handlers(), signum);
 
-		if (hash_obj == NULL){
+		if (callback == NULL){
 			log_event(FATAL, " [THDLIB] Error: Unexpected signal: %d", signum);
 		} else {
 			// invoke the signal handler
-			callback = (SignalHandlerCallback*) (hash_obj->value);
 			(*(callback->func))();
 		}
 	}
@@ -280,11 +300,14 @@ static bool th_valid_handle(ThreadHandles th) {
 	return valid;
 }
 
-// intended to be private
-static void show_thread(char * msg, ThreadHandles th) {
+// intended to be private: the thread lock is not even taken when the line is not logged
+static void show_thread(Levels l, char * msg, ThreadHandles th) {
+	if (!log_enabled(l)) {
+		return;
+	}
 	if (th_valid_handle(th) && Threads[th] != NULL) {
 		pthread_mutex_lock(&Threads[th]->lock);
-		log_event(INFO, " %s <Thread>(handle:%d name:%s state:%s pthread:%d)",
+		log_event(l, " %s <Thread>(handle:%d name:%s state:%s pthread:%d)",
 										msg,
 										Threads[th]->handle,
 										Threads[th]->name,
@@ -292,7 +315,7 @@ static void show_thread(char * msg, ThreadHandles th) {
 										Threads[th]->pthread);
 		pthread_mutex_unlock(&Threads[th]->lock);
 	} else {
-		log_event(INFO, " %s (INVALID) <Thread>(handle:%d)", msg, th);
+		log_event(l, " %s (INVALID) <Thread>(handle:%d)", msg, th);
 	}
 }
 
@@ -321,7 +344,7 @@ static void* func_decorator(void *args) {
 	// update the state of the thread
 	thread_info->state = RUNNING;
 
-	show_thread("[THDLIB] Created", thread_info->handle);
+	show_thread(DEBUG, "[THDLIB] Created", thread_info->handle);
 	pthread_mutex_unlock(&StoreLock);
 
 
@@ -424,9 +447,9 @@ int th_wait(ThreadHandles th) {
 			case RUNNING:
 				/* ensure you are not joining while locking the mutex (otherwise other
 				threads won't be able to use sensitive funtions from this lib concurrently) */
-				show_thread("[THDLIB] Waiting on...", th);
+				show_thread(DEBUG, "[THDLIB] Waiting on...", th);
 				pthread_join(pthread, NULL);
-				show_thread("[THDLIB] ...Wait complete!", th);
+				show_thread(DEBUG, "[THDLIB] ...Wait complete!", th);
 
 				break;
 			case CANCELLED:
@@ -440,11 +463,11 @@ int th_wait(ThreadHandles th) {
 				the thread may be cancelled until the thread reaches its cancellation
 				point, ****and cleaned up after the application waits for the thread.**** " */
 				pthread_join(pthread, NULL);
-				show_thread("[THDLIB] Reaped (from cancel)", th);
+				show_thread(INFO, "[THDLIB] Reaped (from cancel)", th);
 				break;
 			case FINISHED:
 				/* there is no need to wait on a thread that has already exited with th_exit() */
-				show_thread("[THDLIB] Reaped (already finished)", th);
+				show_thread(INFO, "[THDLIB] Reaped (already finished)", th);
 				break;
 			default:
 				log_event(WARNING, " [%d] Error: Unexpected thread state! handle:%d state:%d", th, Threads[th]->state);
@@ -494,7 +517,7 @@ int th_kill(ThreadHandles th) {
 			/* This thread is no longer in a running or soon to be running state and
 			therefore cannot be killed. This should result in a THD_ERROR since the
 			this handle is not valid for the state it is in. */
-			show_thread("[THDLIB] Kill failed (already exited)", th);
+			show_thread(INFO, "[THDLIB] Kill failed (already exited)", th);
 			pthread_mutex_unlock(&Threads[th]->lock);
 			return THD_ERROR;
 		}
@@ -506,7 +529,7 @@ int th_kill(ThreadHandles th) {
 		/* REQUIREMENT: ...and updates the status of the thread appropriately. */
 		Threads[th]->state = CANCELLED;
 
-		show_thread("[THDLIB] Killed", th);
+		show_thread(INFO, "[THDLIB] Killed", th);
 
 		pthread_mutex_unlock(&Threads[th]->lock);
 		return THD_OK;
@@ -551,7 +574,7 @@ int th_exit() {
 	pthread_mutex_unlock(&Threads[th]->lock);
 
 	/* REQUIREMENT: ...proper status should be logged to the log file... */
-	show_thread("[THDLIB] Exiting", th);
+	show_thread(DEBUG, "[THDLIB] Exiting", th);
 
 	pthread_exit(NULL);
 
@@ -614,6 +637,13 @@ bool th_install_signal_handler(int signum, void* handler) {
 		return false;
 	}
 
+	/* keep the handler for later invocation (before the generic handler is
+	installed, so that the manager thread can always find it) */
+	SignalHandlerCallback* previous = get_cmap_item(signal_handlers(), signum);
+	SignalHandlerCallback* callback = malloc(sizeof(SignalHandlerCallback));
+	callback->func = handler;
+	insert_cmap_item(signal_handlers(), signum, callback);
+
 	// block all other signals while handling a signal
 	sigfillset(&sa.sa_mask);
 
@@ -624,19 +654,17 @@ bool th_install_signal_handler(int signum, void* handler) {
 
 	if (sigaction(signum, &sa, NULL)) {
 		log_event(FATAL, " [THDLIB] Error: cannot install generic handler for signal (%d)", signum);
-		return false;
-	}
-
-	// keep the handler for later invocation
-	SignalHandlerCallback* callback = malloc(sizeof(SignalHandlerCallback));
-	callback->func = handler;
 
-	if (SignalHandlers == NULL) {
-		SignalHandlers = new_hash(MAX_SIGNAL);
+		/* leave the map as it was, the callback is not freed (as in
+		th_uninstall_signal_handler) since the manager thread may be reading it */
+		if (previous != NULL) {
+			insert_cmap_item(signal_handlers(), signum, previous);
+		} else {
+			delete_cmap_item(signal_handlers(), signum);
+		}
+		return false;
 	}
 
-	insert_hash_item(SignalHandlers, signum, callback, sizeof(void*));
-
 	return true;
 }
 
@@ -664,7 +692,7 @@ bool th_uninstall_signal_handler(int signum) {
 		return false;
 	}
 
-	delete_hash_item(SignalHandlers, signum);
+	delete_cmap_item(SignalHandlers, signum);
 
 	return true;
 }